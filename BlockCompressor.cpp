@@ -0,0 +1,797 @@
+﻿#include "BlockCompressor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define BLOCK_KERNEL_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLOCK_KERNEL_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define BLOCK_KERNEL_NEON
+#endif
+
+namespace {
+	// 4x4 画素を成分ごとに並べたもの（0～255 の float）
+	struct BlockPixels {
+		alignas(32) float channels[4][16];
+	};
+
+	void loadPixels(const uint8_t* rgba, BlockPixels& pixels)
+	{
+		for (int i = 0; i < 16; i++) {
+			for (int c = 0; c < 4; c++) {
+				pixels.channels[c][i] = rgba[i * 4 + c];
+			}
+		}
+	}
+
+	// 16 画素それぞれについて palette の中で最も近い色の番号を indices に書き、誤差（成分ごとに weights をかけた二乗和）の合計を返す
+#if defined(BLOCK_KERNEL_AVX)
+
+	float findNearest(const BlockPixels& pixels, const float (*palette)[4], int paletteSize, const float* weights, uint8_t* indices)
+	{
+		const __m256 w0 = _mm256_set1_ps(weights[0]);
+		const __m256 w1 = _mm256_set1_ps(weights[1]);
+		const __m256 w2 = _mm256_set1_ps(weights[2]);
+		const __m256 w3 = _mm256_set1_ps(weights[3]);
+		__m256 total = _mm256_setzero_ps();
+
+		for (int p = 0; p < 16; p += 8) {
+			__m256 r = _mm256_load_ps(pixels.channels[0] + p);
+			__m256 g = _mm256_load_ps(pixels.channels[1] + p);
+			__m256 b = _mm256_load_ps(pixels.channels[2] + p);
+			__m256 a = _mm256_load_ps(pixels.channels[3] + p);
+
+			__m256 best = _mm256_set1_ps(std::numeric_limits<float>::max());
+			__m256 bestIndex = _mm256_setzero_ps();
+			for (int k = 0; k < paletteSize; k++) {
+				__m256 dr = _mm256_sub_ps(r, _mm256_set1_ps(palette[k][0]));
+				__m256 dg = _mm256_sub_ps(g, _mm256_set1_ps(palette[k][1]));
+				__m256 db = _mm256_sub_ps(b, _mm256_set1_ps(palette[k][2]));
+				__m256 da = _mm256_sub_ps(a, _mm256_set1_ps(palette[k][3]));
+				__m256 d = _mm256_add_ps(
+					_mm256_add_ps(_mm256_mul_ps(w0, _mm256_mul_ps(dr, dr)), _mm256_mul_ps(w1, _mm256_mul_ps(dg, dg))),
+					_mm256_add_ps(_mm256_mul_ps(w2, _mm256_mul_ps(db, db)), _mm256_mul_ps(w3, _mm256_mul_ps(da, da))));
+
+				__m256 closer = _mm256_cmp_ps(d, best, _CMP_LT_OQ);
+				best = _mm256_min_ps(d, best);
+				bestIndex = _mm256_blendv_ps(bestIndex, _mm256_set1_ps(static_cast<float>(k)), closer);
+			}
+
+			alignas(32) int32_t lanes[8];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(lanes), _mm256_cvttps_epi32(bestIndex));
+			for (int i = 0; i < 8; i++) {
+				indices[p + i] = static_cast<uint8_t>(lanes[i]);
+			}
+			total = _mm256_add_ps(total, best);
+		}
+
+		alignas(32) float sums[8];
+		_mm256_store_ps(sums, total);
+		return ((sums[0] + sums[1]) + (sums[2] + sums[3])) + ((sums[4] + sums[5]) + (sums[6] + sums[7]));
+	}
+
+	const char* const KERNEL_NAME = "AVX";
+
+#elif defined(BLOCK_KERNEL_SSE2)
+
+	float findNearest(const BlockPixels& pixels, const float (*palette)[4], int paletteSize, const float* weights, uint8_t* indices)
+	{
+		const __m128 w0 = _mm_set1_ps(weights[0]);
+		const __m128 w1 = _mm_set1_ps(weights[1]);
+		const __m128 w2 = _mm_set1_ps(weights[2]);
+		const __m128 w3 = _mm_set1_ps(weights[3]);
+		__m128 total = _mm_setzero_ps();
+
+		for (int p = 0; p < 16; p += 4) {
+			__m128 r = _mm_load_ps(pixels.channels[0] + p);
+			__m128 g = _mm_load_ps(pixels.channels[1] + p);
+			__m128 b = _mm_load_ps(pixels.channels[2] + p);
+			__m128 a = _mm_load_ps(pixels.channels[3] + p);
+
+			__m128 best = _mm_set1_ps(std::numeric_limits<float>::max());
+			__m128i bestIndex = _mm_setzero_si128();
+			for (int k = 0; k < paletteSize; k++) {
+				__m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[k][0]));
+				__m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[k][1]));
+				__m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[k][2]));
+				__m128 da = _mm_sub_ps(a, _mm_set1_ps(palette[k][3]));
+				__m128 d = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(w0, _mm_mul_ps(dr, dr)), _mm_mul_ps(w1, _mm_mul_ps(dg, dg))),
+					_mm_add_ps(_mm_mul_ps(w2, _mm_mul_ps(db, db)), _mm_mul_ps(w3, _mm_mul_ps(da, da))));
+
+				__m128i closer = _mm_castps_si128(_mm_cmplt_ps(d, best));
+				best = _mm_min_ps(d, best);
+				bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, bestIndex));
+			}
+
+			alignas(16) int32_t lanes[4];
+			_mm_store_si128(reinterpret_cast<__m128i*>(lanes), bestIndex);
+			for (int i = 0; i < 4; i++) {
+				indices[p + i] = static_cast<uint8_t>(lanes[i]);
+			}
+			total = _mm_add_ps(total, best);
+		}
+
+		alignas(16) float sums[4];
+		_mm_store_ps(sums, total);
+		return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+	}
+
+	const char* const KERNEL_NAME = "SSE2";
+
+#elif defined(BLOCK_KERNEL_NEON)
+
+	float findNearest(const BlockPixels& pixels, const float (*palette)[4], int paletteSize, const float* weights, uint8_t* indices)
+	{
+		const float32x4_t w0 = vdupq_n_f32(weights[0]);
+		const float32x4_t w1 = vdupq_n_f32(weights[1]);
+		const float32x4_t w2 = vdupq_n_f32(weights[2]);
+		const float32x4_t w3 = vdupq_n_f32(weights[3]);
+		float32x4_t total = vdupq_n_f32(0.0f);
+
+		for (int p = 0; p < 16; p += 4) {
+			float32x4_t r = vld1q_f32(pixels.channels[0] + p);
+			float32x4_t g = vld1q_f32(pixels.channels[1] + p);
+			float32x4_t b = vld1q_f32(pixels.channels[2] + p);
+			float32x4_t a = vld1q_f32(pixels.channels[3] + p);
+
+			float32x4_t best = vdupq_n_f32(std::numeric_limits<float>::max());
+			uint32x4_t bestIndex = vdupq_n_u32(0);
+			for (int k = 0; k < paletteSize; k++) {
+				float32x4_t dr = vsubq_f32(r, vdupq_n_f32(palette[k][0]));
+				float32x4_t dg = vsubq_f32(g, vdupq_n_f32(palette[k][1]));
+				float32x4_t db = vsubq_f32(b, vdupq_n_f32(palette[k][2]));
+				float32x4_t da = vsubq_f32(a, vdupq_n_f32(palette[k][3]));
+				float32x4_t d = vaddq_f32(
+					vaddq_f32(vmulq_f32(w0, vmulq_f32(dr, dr)), vmulq_f32(w1, vmulq_f32(dg, dg))),
+					vaddq_f32(vmulq_f32(w2, vmulq_f32(db, db)), vmulq_f32(w3, vmulq_f32(da, da))));
+
+				uint32x4_t closer = vcltq_f32(d, best);
+				best = vminq_f32(d, best);
+				bestIndex = vbslq_u32(closer, vdupq_n_u32(static_cast<uint32_t>(k)), bestIndex);
+			}
+
+			uint32_t lanes[4];
+			vst1q_u32(lanes, bestIndex);
+			for (int i = 0; i < 4; i++) {
+				indices[p + i] = static_cast<uint8_t>(lanes[i]);
+			}
+			total = vaddq_f32(total, best);
+		}
+
+		float sums[4];
+		vst1q_f32(sums, total);
+		return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+	}
+
+	const char* const KERNEL_NAME = "NEON";
+
+#else
+
+	float findNearest(const BlockPixels& pixels, const float (*palette)[4], int paletteSize, const float* weights, uint8_t* indices)
+	{
+		float total = 0.0f;
+		for (int p = 0; p < 16; p++) {
+			float best = std::numeric_limits<float>::max();
+			int bestIndex = 0;
+			for (int k = 0; k < paletteSize; k++) {
+				float d = 0.0f;
+				for (int c = 0; c < 4; c++) {
+					float diff = pixels.channels[c][p] - palette[k][c];
+					d += weights[c] * diff * diff;
+				}
+				if (d < best) {
+					best = d;
+					bestIndex = k;
+				}
+			}
+			indices[p] = static_cast<uint8_t>(bestIndex);
+			total += best;
+		}
+		return total;
+	}
+
+	const char* const KERNEL_NAME = "scalar";
+
+#endif
+
+	// 画素の主成分の軸（channelCount 成分。分散がなければ 0 ベクトル）と平均を求める
+	void findPrincipalAxis(const BlockPixels& pixels, int channelCount, float* mean, float* axis)
+	{
+		for (int c = 0; c < channelCount; c++) {
+			float sum = 0.0f;
+			for (int i = 0; i < 16; i++) {
+				sum += pixels.channels[c][i];
+			}
+			mean[c] = sum / 16.0f;
+		}
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; i++) {
+			for (int r = 0; r < channelCount; r++) {
+				float dr = pixels.channels[r][i] - mean[r];
+				for (int c = r; c < channelCount; c++) {
+					covariance[r][c] += dr * (pixels.channels[c][i] - mean[c]);
+				}
+			}
+		}
+		for (int r = 0; r < channelCount; r++) {
+			for (int c = 0; c < r; c++) {
+				covariance[r][c] = covariance[c][r];
+			}
+		}
+
+		// べき乗法。初期値は分散の最も大きい成分の軸にする
+		int largest = 0;
+		for (int c = 1; c < channelCount; c++) {
+			if (covariance[c][c] > covariance[largest][largest]) {
+				largest = c;
+			}
+		}
+		for (int c = 0; c < channelCount; c++) {
+			axis[c] = c == largest ? 1.0f : 0.0f;
+		}
+		if (covariance[largest][largest] <= 0.0f) {
+			std::fill(axis, axis + channelCount, 0.0f);
+			return;
+		}
+
+		for (int iteration = 0; iteration < 8; iteration++) {
+			float next[4] = {};
+			float length = 0.0f;
+			for (int r = 0; r < channelCount; r++) {
+				for (int c = 0; c < channelCount; c++) {
+					next[r] += covariance[r][c] * axis[c];
+				}
+				length += next[r] * next[r];
+			}
+			if (length <= 0.0f) {
+				break;
+			}
+			length = std::sqrt(length);
+			for (int c = 0; c < channelCount; c++) {
+				axis[c] = next[c] / length;
+			}
+		}
+	}
+
+	// 主成分の軸に沿って画素を射影した範囲の両端を端点にする
+	void findEndpoints(const BlockPixels& pixels, int channelCount, float* low, float* high)
+	{
+		float mean[4] = {};
+		float axis[4] = {};
+		findPrincipalAxis(pixels, channelCount, mean, axis);
+
+		float minT = 0.0f;
+		float maxT = 0.0f;
+		for (int i = 0; i < 16; i++) {
+			float t = 0.0f;
+			for (int c = 0; c < channelCount; c++) {
+				t += (pixels.channels[c][i] - mean[c]) * axis[c];
+			}
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+
+		for (int c = 0; c < channelCount; c++) {
+			low[c] = mean[c] + axis[c] * minT;
+			high[c] = mean[c] + axis[c] * maxT;
+		}
+	}
+
+	// indices で選んだ補間の重み（端点 0 にかかる割合）から、誤差が最小になる端点を最小二乗法で求める
+	// 解けない（全画素が同じ重み）ときは false
+	bool fitEndpoints(
+		const BlockPixels& pixels,
+		int channelCount,
+		const uint8_t* indices,
+		const float* indexWeights,
+		float* endpoint0,
+		float* endpoint1)
+	{
+		float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+		float ax[4] = {}, bx[4] = {};
+		for (int i = 0; i < 16; i++) {
+			float a = indexWeights[indices[i]];
+			float b = 1.0f - a;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < channelCount; c++) {
+				ax[c] += a * pixels.channels[c][i];
+				bx[c] += b * pixels.channels[c][i];
+			}
+		}
+
+		float determinant = aa * bb - ab * ab;
+		if (std::fabs(determinant) < 1e-6f) {
+			return false;
+		}
+		for (int c = 0; c < channelCount; c++) {
+			endpoint0[c] = std::min(std::max((ax[c] * bb - bx[c] * ab) / determinant, 0.0f), 255.0f);
+			endpoint1[c] = std::min(std::max((bx[c] * aa - ax[c] * ab) / determinant, 0.0f), 255.0f);
+		}
+		return true;
+	}
+
+	// リトルエンディアンで下位ビットから詰める
+	class BitWriter {
+	public:
+		explicit BitWriter(uint8_t* output) : output(output) { std::memset(output, 0, 16); }
+
+		void write(uint32_t value, int bits)
+		{
+			for (int i = 0; i < bits; i++, position++) {
+				if (value & (1u << i)) {
+					output[position >> 3] |= static_cast<uint8_t>(1u << (position & 7));
+				}
+			}
+		}
+
+	private:
+		uint8_t* output;
+		int position = 0;
+	};
+
+	class BitReader {
+	public:
+		explicit BitReader(const uint8_t* input) : input(input) {}
+
+		uint32_t read(int bits)
+		{
+			uint32_t value = 0;
+			for (int i = 0; i < bits; i++, position++) {
+				value |= static_cast<uint32_t>((input[position >> 3] >> (position & 7)) & 1) << i;
+			}
+			return value;
+		}
+
+	private:
+		const uint8_t* input;
+		int position = 0;
+	};
+
+	// ---- BC1 ----
+
+	const float BC1_INDEX_WEIGHTS[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+	const float RGB_WEIGHTS[4] = { 1.0f, 1.0f, 1.0f, 0.0f };
+
+	uint16_t packRgb565(const float* color)
+	{
+		uint32_t r = static_cast<uint32_t>(std::lround(std::min(std::max(color[0], 0.0f), 255.0f) * 31.0f / 255.0f));
+		uint32_t g = static_cast<uint32_t>(std::lround(std::min(std::max(color[1], 0.0f), 255.0f) * 63.0f / 255.0f));
+		uint32_t b = static_cast<uint32_t>(std::lround(std::min(std::max(color[2], 0.0f), 255.0f) * 31.0f / 255.0f));
+		return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+	}
+
+	void unpackRgb565(uint16_t packed, int* color)
+	{
+		int r = (packed >> 11) & 31;
+		int g = (packed >> 5) & 63;
+		int b = packed & 31;
+		color[0] = (r << 3) | (r >> 2);
+		color[1] = (g << 2) | (g >> 4);
+		color[2] = (b << 3) | (b >> 2);
+	}
+
+	// 4色モードのパレット（color0 > color1 のとき）
+	void buildBc1Palette(uint16_t color0, uint16_t color1, int (*palette)[3])
+	{
+		unpackRgb565(color0, palette[0]);
+		unpackRgb565(color1, palette[1]);
+		for (int c = 0; c < 3; c++) {
+			palette[2][c] = (2 * palette[0][c] + palette[1][c] + 1) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c] + 1) / 3;
+		}
+	}
+
+	struct Bc1Candidate {
+		uint16_t color0 = 0;
+		uint16_t color1 = 0;
+		uint8_t indices[16] = {};
+		float error = std::numeric_limits<float>::max();
+	};
+
+	// 端点を 565 に量子化して番号を選ぶ（大きい方を color0 にして常に4色モードにする）
+	void evaluateBc1(const BlockPixels& pixels, const float* endpoint0, const float* endpoint1, Bc1Candidate& best)
+	{
+		uint16_t packed0 = packRgb565(endpoint0);
+		uint16_t packed1 = packRgb565(endpoint1);
+
+		Bc1Candidate candidate;
+		candidate.color0 = std::max(packed0, packed1);
+		candidate.color1 = std::min(packed0, packed1);
+
+		int palette[4][3];
+		buildBc1Palette(candidate.color0, candidate.color1, palette);
+		float floatPalette[4][4] = {};
+		int paletteSize = candidate.color0 == candidate.color1 ? 1 : 4;
+		for (int k = 0; k < paletteSize; k++) {
+			for (int c = 0; c < 3; c++) {
+				floatPalette[k][c] = static_cast<float>(palette[k][c]);
+			}
+		}
+
+		candidate.error = findNearest(pixels, floatPalette, paletteSize, RGB_WEIGHTS, candidate.indices);
+		if (candidate.error < best.error) {
+			best = candidate;
+		}
+	}
+
+	void encodeColorBlock(const BlockPixels& pixels, uint8_t* output)
+	{
+		float low[4], high[4];
+		findEndpoints(pixels, 3, low, high);
+
+		Bc1Candidate best;
+		evaluateBc1(pixels, high, low, best);
+
+		// 選んだ番号から端点を求め直す（改善しなくなったら打ち切る）
+		for (int iteration = 0; iteration < 2 && best.error > 0.0f; iteration++) {
+			float endpoint0[4], endpoint1[4];
+			if (!fitEndpoints(pixels, 3, best.indices, BC1_INDEX_WEIGHTS, endpoint0, endpoint1)) {
+				break;
+			}
+			float previousError = best.error;
+			evaluateBc1(pixels, endpoint0, endpoint1, best);
+			if (best.error >= previousError) {
+				break;
+			}
+		}
+
+		uint32_t indexBits = 0;
+		for (int i = 0; i < 16; i++) {
+			indexBits |= static_cast<uint32_t>(best.indices[i]) << (i * 2);
+		}
+		std::memcpy(output, &best.color0, 2);
+		std::memcpy(output + 2, &best.color1, 2);
+		std::memcpy(output + 4, &indexBits, 4);
+	}
+
+	void decodeColorBlock(const uint8_t* block, uint8_t* pixels, bool alwaysFourColors)
+	{
+		uint16_t color0, color1;
+		uint32_t indexBits;
+		std::memcpy(&color0, block, 2);
+		std::memcpy(&color1, block + 2, 2);
+		std::memcpy(&indexBits, block + 4, 4);
+
+		int palette[4][4];
+		if (color0 > color1 || alwaysFourColors) {
+			int rgb[4][3];
+			buildBc1Palette(color0, color1, rgb);
+			for (int k = 0; k < 4; k++) {
+				std::copy(rgb[k], rgb[k] + 3, palette[k]);
+				palette[k][3] = 255;
+			}
+		}
+		else {
+			// 3色 + 透明
+			unpackRgb565(color0, palette[0]);
+			unpackRgb565(color1, palette[1]);
+			for (int c = 0; c < 3; c++) {
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+			palette[0][3] = palette[1][3] = palette[2][3] = 255;
+			palette[3][3] = 0;
+		}
+
+		for (int i = 0; i < 16; i++) {
+			const int* color = palette[(indexBits >> (i * 2)) & 3];
+			for (int c = 0; c < 4; c++) {
+				pixels[i * 4 + c] = static_cast<uint8_t>(color[c]);
+			}
+		}
+	}
+
+	// ---- BC4（BC3 のアルファ） ----
+
+	const float ALPHA_WEIGHTS[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+	// 8値モードのパレット（alpha0 > alpha1 のとき）
+	void buildAlphaPalette(int alpha0, int alpha1, int* palette)
+	{
+		palette[0] = alpha0;
+		palette[1] = alpha1;
+		for (int k = 1; k < 7; k++) {
+			palette[k + 1] = ((7 - k) * alpha0 + k * alpha1 + 3) / 7;
+		}
+	}
+
+	void encodeAlphaBlock(const BlockPixels& pixels, uint8_t* output)
+	{
+		float minAlpha = 255.0f;
+		float maxAlpha = 0.0f;
+		for (int i = 0; i < 16; i++) {
+			minAlpha = std::min(minAlpha, pixels.channels[3][i]);
+			maxAlpha = std::max(maxAlpha, pixels.channels[3][i]);
+		}
+
+		int alpha0 = static_cast<int>(maxAlpha);
+		int alpha1 = static_cast<int>(minAlpha);
+		uint8_t indices[16] = {};
+		if (alpha0 > alpha1) {
+			int palette[8];
+			buildAlphaPalette(alpha0, alpha1, palette);
+			float floatPalette[8][4] = {};
+			for (int k = 0; k < 8; k++) {
+				floatPalette[k][3] = static_cast<float>(palette[k]);
+			}
+			findNearest(pixels, floatPalette, 8, ALPHA_WEIGHTS, indices);
+		}
+
+		uint64_t indexBits = 0;
+		for (int i = 0; i < 16; i++) {
+			indexBits |= static_cast<uint64_t>(indices[i]) << (i * 3);
+		}
+		output[0] = static_cast<uint8_t>(alpha0);
+		output[1] = static_cast<uint8_t>(alpha1);
+		for (int i = 0; i < 6; i++) {
+			output[2 + i] = static_cast<uint8_t>(indexBits >> (i * 8));
+		}
+	}
+
+	void decodeAlphaBlock(const uint8_t* block, uint8_t* pixels)
+	{
+		int alpha0 = block[0];
+		int alpha1 = block[1];
+		int palette[8];
+		if (alpha0 > alpha1) {
+			buildAlphaPalette(alpha0, alpha1, palette);
+		}
+		else {
+			// 6値 + 0 と 255
+			palette[0] = alpha0;
+			palette[1] = alpha1;
+			for (int k = 1; k < 5; k++) {
+				palette[k + 1] = ((5 - k) * alpha0 + k * alpha1 + 2) / 5;
+			}
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+
+		uint64_t indexBits = 0;
+		for (int i = 0; i < 6; i++) {
+			indexBits |= static_cast<uint64_t>(block[2 + i]) << (i * 8);
+		}
+		for (int i = 0; i < 16; i++) {
+			pixels[i * 4 + 3] = static_cast<uint8_t>(palette[(indexBits >> (i * 3)) & 7]);
+		}
+	}
+
+	// ---- BC7 モード6 ----
+
+	const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+	const float RGBA_WEIGHTS[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+
+	struct Bc7Candidate {
+		int endpoints[2][4] = {};	// 7bit の値
+		int pbits[2] = {};
+		uint8_t indices[16] = {};
+		float error = std::numeric_limits<float>::max();
+	};
+
+	int interpolateBc7(int value0, int value1, int index)
+	{
+		return ((64 - BC7_WEIGHTS[index]) * value0 + BC7_WEIGHTS[index] * value1 + 32) >> 6;
+	}
+
+	// 端点を pbit の4通りの組み合わせで量子化して番号を選ぶ
+	void evaluateBc7(const BlockPixels& pixels, const float* endpoint0, const float* endpoint1, Bc7Candidate& best)
+	{
+		for (int pbitCombination = 0; pbitCombination < 4; pbitCombination++) {
+			Bc7Candidate candidate;
+			candidate.pbits[0] = pbitCombination & 1;
+			candidate.pbits[1] = pbitCombination >> 1;
+
+			int values[2][4];
+			for (int e = 0; e < 2; e++) {
+				const float* endpoint = e == 0 ? endpoint0 : endpoint1;
+				for (int c = 0; c < 4; c++) {
+					int quantized = static_cast<int>(std::lround((endpoint[c] - candidate.pbits[e]) * 0.5f));
+					candidate.endpoints[e][c] = std::min(std::max(quantized, 0), 127);
+					values[e][c] = (candidate.endpoints[e][c] << 1) | candidate.pbits[e];
+				}
+			}
+
+			float palette[16][4];
+			for (int k = 0; k < 16; k++) {
+				for (int c = 0; c < 4; c++) {
+					palette[k][c] = static_cast<float>(interpolateBc7(values[0][c], values[1][c], k));
+				}
+			}
+
+			candidate.error = findNearest(pixels, palette, 16, RGBA_WEIGHTS, candidate.indices);
+			if (candidate.error < best.error) {
+				best = candidate;
+			}
+		}
+	}
+
+	void encodeBc7Block(const BlockPixels& pixels, uint8_t* output)
+	{
+		float low[4], high[4];
+		findEndpoints(pixels, 4, low, high);
+
+		Bc7Candidate best;
+		evaluateBc7(pixels, low, high, best);
+
+		float indexWeights[16];
+		for (int k = 0; k < 16; k++) {
+			indexWeights[k] = static_cast<float>(64 - BC7_WEIGHTS[k]) / 64.0f;
+		}
+		for (int iteration = 0; iteration < 2 && best.error > 0.0f; iteration++) {
+			float endpoint0[4], endpoint1[4];
+			if (!fitEndpoints(pixels, 4, best.indices, indexWeights, endpoint0, endpoint1)) {
+				break;
+			}
+			float previousError = best.error;
+			evaluateBc7(pixels, endpoint0, endpoint1, best);
+			if (best.error >= previousError) {
+				break;
+			}
+		}
+
+		// 最初の画素の番号の最上位ビットは省略される（0 とみなす）ので、立っていれば端点を入れ替える
+		if (best.indices[0] & 8) {
+			std::swap(best.endpoints[0], best.endpoints[1]);
+			std::swap(best.pbits[0], best.pbits[1]);
+			for (int i = 0; i < 16; i++) {
+				best.indices[i] = static_cast<uint8_t>(15 - best.indices[i]);
+			}
+		}
+
+		BitWriter writer(output);
+		writer.write(1u << 6, 7);
+		for (int c = 0; c < 4; c++) {
+			writer.write(static_cast<uint32_t>(best.endpoints[0][c]), 7);
+			writer.write(static_cast<uint32_t>(best.endpoints[1][c]), 7);
+		}
+		writer.write(static_cast<uint32_t>(best.pbits[0]), 1);
+		writer.write(static_cast<uint32_t>(best.pbits[1]), 1);
+		writer.write(best.indices[0], 3);
+		for (int i = 1; i < 16; i++) {
+			writer.write(best.indices[i], 4);
+		}
+	}
+
+	void decodeBc7Block(const uint8_t* block, uint8_t* pixels)
+	{
+		BitReader reader(block);
+		if (reader.read(7) != (1u << 6)) {
+			// モード6以外は扱わない（マゼンタで埋める）
+			for (int i = 0; i < 16; i++) {
+				pixels[i * 4 + 0] = 255;
+				pixels[i * 4 + 1] = 0;
+				pixels[i * 4 + 2] = 255;
+				pixels[i * 4 + 3] = 255;
+			}
+			return;
+		}
+
+		int values[2][4];
+		for (int c = 0; c < 4; c++) {
+			values[0][c] = static_cast<int>(reader.read(7));
+			values[1][c] = static_cast<int>(reader.read(7));
+		}
+		int pbit0 = static_cast<int>(reader.read(1));
+		int pbit1 = static_cast<int>(reader.read(1));
+		for (int c = 0; c < 4; c++) {
+			values[0][c] = (values[0][c] << 1) | pbit0;
+			values[1][c] = (values[1][c] << 1) | pbit1;
+		}
+
+		for (int i = 0; i < 16; i++) {
+			int index = static_cast<int>(reader.read(i == 0 ? 3 : 4));
+			for (int c = 0; c < 4; c++) {
+				pixels[i * 4 + c] = static_cast<uint8_t>(interpolateBc7(values[0][c], values[1][c], index));
+			}
+		}
+	}
+}
+
+size_t getBlockBytes(BlockFormat format)
+{
+	return format == BlockFormat::Bc1 ? 8 : 16;
+}
+
+size_t getCompressedSize(BlockFormat format, uint32_t width, uint32_t height)
+{
+	size_t blocksX = (static_cast<size_t>(width) + 3) / 4;
+	size_t blocksY = (static_cast<size_t>(height) + 3) / 4;
+	return blocksX * blocksY * getBlockBytes(format);
+}
+
+void compressImage(
+	BlockFormat format,
+	const uint8_t* rgba,
+	uint32_t width,
+	uint32_t height,
+	uint8_t* output,
+	ThreadPool& pool)
+{
+	const uint32_t blocksX = (width + 3) / 4;
+	const uint32_t blocksY = (height + 3) / 4;
+	const size_t blockBytes = getBlockBytes(format);
+
+	pool.parallelFor(blocksY, [&](size_t blockY) {
+		uint8_t pixels[64];
+		for (uint32_t blockX = 0; blockX < blocksX; blockX++) {
+			// 画像の外にはみ出す画素は端の画素で埋める
+			for (uint32_t y = 0; y < 4; y++) {
+				uint32_t sourceY = std::min(static_cast<uint32_t>(blockY) * 4 + y, height - 1);
+				for (uint32_t x = 0; x < 4; x++) {
+					uint32_t sourceX = std::min(blockX * 4 + x, width - 1);
+					std::memcpy(pixels + (y * 4 + x) * 4, rgba + (static_cast<size_t>(sourceY) * width + sourceX) * 4, 4);
+				}
+			}
+
+			uint8_t* block = output + (blockY * blocksX + blockX) * blockBytes;
+			switch (format) {
+			case BlockFormat::Bc1:
+				compressBlockBc1(pixels, block);
+				break;
+			case BlockFormat::Bc3:
+				compressBlockBc3(pixels, block);
+				break;
+			case BlockFormat::Bc7:
+				compressBlockBc7(pixels, block);
+				break;
+			}
+		}
+	});
+}
+
+void compressBlockBc1(const uint8_t* pixels, uint8_t* output)
+{
+	BlockPixels block;
+	loadPixels(pixels, block);
+	encodeColorBlock(block, output);
+}
+
+void compressBlockBc3(const uint8_t* pixels, uint8_t* output)
+{
+	BlockPixels block;
+	loadPixels(pixels, block);
+	encodeAlphaBlock(block, output);
+	encodeColorBlock(block, output + 8);
+}
+
+void compressBlockBc7(const uint8_t* pixels, uint8_t* output)
+{
+	BlockPixels block;
+	loadPixels(pixels, block);
+	encodeBc7Block(block, output);
+}
+
+void decompressBlock(BlockFormat format, const uint8_t* block, uint8_t* pixels)
+{
+	switch (format) {
+	case BlockFormat::Bc1:
+		decodeColorBlock(block, pixels, false);
+		break;
+	case BlockFormat::Bc3:
+		decodeColorBlock(block + 8, pixels, true);
+		decodeAlphaBlock(block, pixels);
+		break;
+	case BlockFormat::Bc7:
+		decodeBc7Block(block, pixels);
+		break;
+	default:
+		throw std::invalid_argument("unknown block format!");
+	}
+}
+
+const char* getBlockCompressorKernelName()
+{
+	return KERNEL_NAME;
+}
@@ -0,0 +1,40 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include "ThreadPool.h"
+
+// ブロック圧縮（BC）の形式。いずれも 4x4 画素を1ブロックにまとめる
+enum class BlockFormat {
+	Bc1,	// RGB 565 の2色と2bit の補間（8 バイト/ブロック。アルファは捨てる）
+	Bc3,	// BC1 の色に BC4 と同じ 8bit アルファを加えたもの（16 バイト/ブロック）
+	Bc7		// モード6（RGBA 各7bit + pbit の2色と 4bit の補間。16 バイト/ブロック）
+};
+
+// 1ブロックのバイト数
+size_t getBlockBytes(BlockFormat format);
+
+// width x height の画像を圧縮したときのバイト数（端の半端な画素もブロック1つ分に数える）
+size_t getCompressedSize(BlockFormat format, uint32_t width, uint32_t height);
+
+// RGBA8 の画像を圧縮して output に書く（ブロックは左上から行ごとに並ぶ）
+// ブロックの行ごとに pool で並列に処理する。4 で割り切れない端のブロックは端の画素を繰り返して埋める
+void compressImage(
+	BlockFormat format,
+	const uint8_t* rgba,
+	uint32_t width,
+	uint32_t height,
+	uint8_t* output,
+	ThreadPool& pool);
+
+// 4x4 画素（RGBA8 を行ごとに並べた 64 バイト）を1ブロック圧縮する
+void compressBlockBc1(const uint8_t* pixels, uint8_t* output);
+void compressBlockBc3(const uint8_t* pixels, uint8_t* output);
+void compressBlockBc7(const uint8_t* pixels, uint8_t* output);
+
+// 圧縮ブロックを 4x4 画素の RGBA8 に戻す（圧縮の検証用。BC7 はこのエンコーダーが書くモード6だけを扱う）
+void decompressBlock(BlockFormat format, const uint8_t* block, uint8_t* pixels);
+
+// 最も近い色を探す処理に使う命令セットの名前
+const char* getBlockCompressorKernelName();
@@ -0,0 +1,317 @@
+﻿#include "Culling.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define CULLING_KERNEL_AVX
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CULLING_KERNEL_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define CULLING_KERNEL_NEON
+#endif
+
+// 位置の配列を囲む球を求める
+BoundingSphere BoundingSphere::fromPositions(const void* data, size_t count, size_t stride)
+{
+	BoundingSphere sphere;
+	if (count == 0) {
+		return sphere;
+	}
+
+	const char* bytes = static_cast<const char*>(data);
+	glm::vec3 minPos(std::numeric_limits<float>::max());
+	glm::vec3 maxPos(-std::numeric_limits<float>::max());
+	for (size_t i = 0; i < count; i++) {
+		glm::vec3 pos;
+		std::memcpy(&pos, bytes + i * stride, sizeof(pos));
+		minPos = glm::min(minPos, pos);
+		maxPos = glm::max(maxPos, pos);
+	}
+
+	sphere.center = (minPos + maxPos) * 0.5f;
+	float radiusSq = 0.0f;
+	for (size_t i = 0; i < count; i++) {
+		glm::vec3 pos;
+		std::memcpy(&pos, bytes + i * stride, sizeof(pos));
+		glm::vec3 d = pos - sphere.center;
+		radiusSq = std::max(radiusSq, glm::dot(d, d));
+	}
+	sphere.radius = std::sqrt(radiusSq);
+	return sphere;
+}
+
+// 行列で変換した球
+BoundingSphere BoundingSphere::transformed(const glm::mat4& matrix) const
+{
+	BoundingSphere result;
+	result.center = glm::vec3(matrix * glm::vec4(center, 1.0f));
+
+	float scaleSq = std::max({
+		glm::dot(glm::vec3(matrix[0]), glm::vec3(matrix[0])),
+		glm::dot(glm::vec3(matrix[1]), glm::vec3(matrix[1])),
+		glm::dot(glm::vec3(matrix[2]), glm::vec3(matrix[2])) });
+	result.radius = radius * std::sqrt(scaleSq);
+	return result;
+}
+
+// proj * view から平面を取り出す
+Frustum Frustum::fromMatrix(const glm::mat4& viewProj)
+{
+	// glm は列優先なので行 i は (m[0][i], m[1][i], m[2][i], m[3][i])
+	auto row = [&](int i) {
+		return glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+	};
+	glm::vec4 r0 = row(0), r1 = row(1), r2 = row(2), r3 = row(3);
+
+	Frustum frustum;
+	frustum.planes[0] = r3 + r0;	// 左
+	frustum.planes[1] = r3 - r0;	// 右
+	frustum.planes[2] = r3 + r1;	// 下
+	frustum.planes[3] = r3 - r1;	// 上
+	frustum.planes[4] = r2;			// 手前（深度 0）
+	frustum.planes[5] = r3 - r2;	// 奥（深度 1）
+
+	for (auto& plane : frustum.planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+	return frustum;
+}
+
+// ローカル空間での錐台
+Frustum Frustum::toLocal(const glm::mat4& model) const
+{
+	// ワールドの点 p = model * q について dot(plane, p) = dot(transpose(model) * plane, q)
+	glm::mat4 transposed = glm::transpose(model);
+
+	Frustum frustum;
+	for (int i = 0; i < 6; i++) {
+		frustum.planes[i] = transposed * planes[i];
+		frustum.planes[i] /= glm::length(glm::vec3(frustum.planes[i]));
+	}
+	return frustum;
+}
+
+// 球が錐台と交わるか
+bool Frustum::intersects(const BoundingSphere& sphere) const
+{
+	for (const auto& plane : planes) {
+		if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// 球の数を変える
+void SphereTable::resize(size_t count)
+{
+	size_t padded = (count + PADDING - 1) / PADDING * PADDING;
+
+	// 半径を -inf にした球は、どの平面についても距離 < +inf で必ず外側になる
+	centerX.resize(padded, 0.0f);
+	centerY.resize(padded, 0.0f);
+	centerZ.resize(padded, 0.0f);
+	radius.resize(padded, -std::numeric_limits<float>::infinity());
+	for (size_t i = count; i < this->count && i < padded; i++) {
+		radius[i] = -std::numeric_limits<float>::infinity();
+	}
+	this->count = count;
+}
+
+void SphereTable::set(size_t index, const BoundingSphere& sphere)
+{
+	centerX[index] = sphere.center.x;
+	centerY[index] = sphere.center.y;
+	centerZ[index] = sphere.center.z;
+	radius[index] = sphere.radius;
+}
+
+// 1つずつ判定する
+// 演算の順序は SIMD 版と揃えてある（x, y, z の順に足してから w を足す）
+uint32_t cullSpheresScalar(const Frustum& frustum, const SphereTable& table, uint32_t* visibleIndices)
+{
+	const float* x = table.getCenterX();
+	const float* y = table.getCenterY();
+	const float* z = table.getCenterZ();
+	const float* r = table.getRadius();
+
+	uint32_t visibleCount = 0;
+	for (size_t i = 0; i < table.size(); i++) {
+		bool visible = true;
+		for (const auto& plane : frustum.planes) {
+			float distance = plane.x * x[i] + plane.y * y[i] + plane.z * z[i] + plane.w;
+			if (distance < -r[i]) {
+				visible = false;
+				break;
+			}
+		}
+		if (visible) {
+			visibleIndices[visibleCount++] = static_cast<uint32_t>(i);
+		}
+	}
+	return visibleCount;
+}
+
+namespace {
+	// lanes 個分の判定結果（ビット i が立っていれば見える）から番号を書き出す
+	// 余りの要素は常に見えないので table.size() を超える番号は出てこない
+	inline uint32_t appendVisible(uint32_t mask, size_t base, uint32_t* visibleIndices, uint32_t visibleCount)
+	{
+		while (mask != 0) {
+			uint32_t bit = 0;
+			while ((mask & (1u << bit)) == 0) {
+				bit++;
+			}
+			visibleIndices[visibleCount++] = static_cast<uint32_t>(base + bit);
+			mask &= mask - 1;
+		}
+		return visibleCount;
+	}
+}
+
+#if defined(CULLING_KERNEL_AVX)
+
+// 8個ずつ判定する
+uint32_t cullSpheres(const Frustum& frustum, const SphereTable& table, uint32_t* visibleIndices)
+{
+	__m256 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = _mm256_set1_ps(frustum.planes[p].x);
+		planeY[p] = _mm256_set1_ps(frustum.planes[p].y);
+		planeZ[p] = _mm256_set1_ps(frustum.planes[p].z);
+		planeW[p] = _mm256_set1_ps(frustum.planes[p].w);
+	}
+	const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+	uint32_t visibleCount = 0;
+	for (size_t i = 0; i < table.paddedSize(); i += 8) {
+		__m256 x = _mm256_loadu_ps(table.getCenterX() + i);
+		__m256 y = _mm256_loadu_ps(table.getCenterY() + i);
+		__m256 z = _mm256_loadu_ps(table.getCenterZ() + i);
+		__m256 negRadius = _mm256_xor_ps(_mm256_loadu_ps(table.getRadius() + i), signMask);
+
+		__m256 culled = _mm256_setzero_ps();
+		for (int p = 0; p < 6; p++) {
+			__m256 distance = _mm256_mul_ps(planeX[p], x);
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(planeY[p], y));
+			distance = _mm256_add_ps(distance, _mm256_mul_ps(planeZ[p], z));
+			distance = _mm256_add_ps(distance, planeW[p]);
+			culled = _mm256_or_ps(culled, _mm256_cmp_ps(distance, negRadius, _CMP_LT_OQ));
+		}
+
+		uint32_t mask = static_cast<uint32_t>(~_mm256_movemask_ps(culled)) & 0xffu;
+		visibleCount = appendVisible(mask, i, visibleIndices, visibleCount);
+	}
+	return visibleCount;
+}
+
+const char* getCullingKernelName()
+{
+	return "AVX";
+}
+
+#elif defined(CULLING_KERNEL_SSE2)
+
+// 4個ずつ判定する
+uint32_t cullSpheres(const Frustum& frustum, const SphereTable& table, uint32_t* visibleIndices)
+{
+	__m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = _mm_set1_ps(frustum.planes[p].x);
+		planeY[p] = _mm_set1_ps(frustum.planes[p].y);
+		planeZ[p] = _mm_set1_ps(frustum.planes[p].z);
+		planeW[p] = _mm_set1_ps(frustum.planes[p].w);
+	}
+	const __m128 signMask = _mm_set1_ps(-0.0f);
+
+	uint32_t visibleCount = 0;
+	for (size_t i = 0; i < table.paddedSize(); i += 4) {
+		__m128 x = _mm_loadu_ps(table.getCenterX() + i);
+		__m128 y = _mm_loadu_ps(table.getCenterY() + i);
+		__m128 z = _mm_loadu_ps(table.getCenterZ() + i);
+		__m128 negRadius = _mm_xor_ps(_mm_loadu_ps(table.getRadius() + i), signMask);
+
+		__m128 culled = _mm_setzero_ps();
+		for (int p = 0; p < 6; p++) {
+			__m128 distance = _mm_mul_ps(planeX[p], x);
+			distance = _mm_add_ps(distance, _mm_mul_ps(planeY[p], y));
+			distance = _mm_add_ps(distance, _mm_mul_ps(planeZ[p], z));
+			distance = _mm_add_ps(distance, planeW[p]);
+			culled = _mm_or_ps(culled, _mm_cmplt_ps(distance, negRadius));
+		}
+
+		uint32_t mask = static_cast<uint32_t>(~_mm_movemask_ps(culled)) & 0xfu;
+		visibleCount = appendVisible(mask, i, visibleIndices, visibleCount);
+	}
+	return visibleCount;
+}
+
+const char* getCullingKernelName()
+{
+	return "SSE2";
+}
+
+#elif defined(CULLING_KERNEL_NEON)
+
+// 4個ずつ判定する
+uint32_t cullSpheres(const Frustum& frustum, const SphereTable& table, uint32_t* visibleIndices)
+{
+	float32x4_t planeX[6], planeY[6], planeZ[6], planeW[6];
+	for (int p = 0; p < 6; p++) {
+		planeX[p] = vdupq_n_f32(frustum.planes[p].x);
+		planeY[p] = vdupq_n_f32(frustum.planes[p].y);
+		planeZ[p] = vdupq_n_f32(frustum.planes[p].z);
+		planeW[p] = vdupq_n_f32(frustum.planes[p].w);
+	}
+	// 各レーンのビット位置（movemask の代わり）
+	const uint32_t laneBitsData[4] = { 1, 2, 4, 8 };
+	const uint32x4_t laneBits = vld1q_u32(laneBitsData);
+
+	uint32_t visibleCount = 0;
+	for (size_t i = 0; i < table.paddedSize(); i += 4) {
+		float32x4_t x = vld1q_f32(table.getCenterX() + i);
+		float32x4_t y = vld1q_f32(table.getCenterY() + i);
+		float32x4_t z = vld1q_f32(table.getCenterZ() + i);
+		float32x4_t negRadius = vnegq_f32(vld1q_f32(table.getRadius() + i));
+
+		uint32x4_t culled = vdupq_n_u32(0);
+		for (int p = 0; p < 6; p++) {
+			float32x4_t distance = vmulq_f32(planeX[p], x);
+			distance = vaddq_f32(distance, vmulq_f32(planeY[p], y));
+			distance = vaddq_f32(distance, vmulq_f32(planeZ[p], z));
+			distance = vaddq_f32(distance, planeW[p]);
+			culled = vorrq_u32(culled, vcltq_f32(distance, negRadius));
+		}
+
+		uint32x4_t visibleBits = vandq_u32(vmvnq_u32(culled), laneBits);
+		uint32x2_t folded = vorr_u32(vget_low_u32(visibleBits), vget_high_u32(visibleBits));
+		uint32_t mask = vget_lane_u32(folded, 0) | vget_lane_u32(folded, 1);
+		visibleCount = appendVisible(mask, i, visibleIndices, visibleCount);
+	}
+	return visibleCount;
+}
+
+const char* getCullingKernelName()
+{
+	return "NEON";
+}
+
+#else
+
+uint32_t cullSpheres(const Frustum& frustum, const SphereTable& table, uint32_t* visibleIndices)
+{
+	return cullSpheresScalar(frustum, table, visibleIndices);
+}
+
+const char* getCullingKernelName()
+{
+	return "scalar";
+}
+
+#endif
@@ -0,0 +1,75 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// 境界球
+struct BoundingSphere {
+	glm::vec3 center = glm::vec3(0.0f);
+	float radius = 0.0f;
+
+	// 位置（float3）が stride バイトおきに並んだ配列を囲む球を求める（AABB の中心を使う）
+	static BoundingSphere fromPositions(const void* data, size_t count, size_t stride);
+
+	// 行列で変換した球（半径は最大の軸スケールで拡大する）
+	BoundingSphere transformed(const glm::mat4& matrix) const;
+};
+
+// ビュー錐台（ワールド空間の6平面。法線は内向きで正規化済み）
+// GPU のカリングシェーダーにもこの並びのまま渡す
+struct Frustum {
+	glm::vec4 planes[6];
+
+	// proj * view から平面を取り出す（深度範囲 0～1 のクリップ空間）
+	static Frustum fromMatrix(const glm::mat4& viewProj);
+
+	// model で変換する前の空間（ローカル空間）での錐台
+	// ローカル空間の球をそのまま判定できるので、model ごとに球を変換し直さずに済む
+	Frustum toLocal(const glm::mat4& model) const;
+
+	// 球が錐台と交わるか（すべての平面の内側にかかっていれば true）
+	bool intersects(const BoundingSphere& sphere) const;
+};
+
+// 境界球を成分ごとの配列（SoA）で持つ表
+// SIMD で複数の球をまとめて判定できるよう、要素数を SIMD 幅の倍数に切り上げ、余りは常に見えない球で埋める
+class SphereTable {
+public:
+	static const size_t PADDING = 8;
+
+	// 球の数を変える（追加した要素は見えない球になる）
+	void resize(size_t count);
+
+	void set(size_t index, const BoundingSphere& sphere);
+
+	size_t size() const { return count; }
+
+	// PADDING の倍数に切り上げた要素数
+	size_t paddedSize() const { return centerX.size(); }
+
+	const float* getCenterX() const { return centerX.data(); }
+	const float* getCenterY() const { return centerY.data(); }
+	const float* getCenterZ() const { return centerZ.data(); }
+	const float* getRadius() const { return radius.data(); }
+
+private:
+	size_t count = 0;
+	std::vector<float> centerX;
+	std::vector<float> centerY;
+	std::vector<float> centerZ;
+	std::vector<float> radius;
+};
+
+// 表の球を錐台と判定し、見える球の番号を昇順に visibleIndices へ詰めて書き出す。見える数を返す
+// visibleIndices には table.size() 個分の領域が必要
+// コンパイル時に使える命令セット（AVX / SSE2 / NEON）のカーネルで判定する
+uint32_t cullSpheres(const Frustum& frustum, const SphereTable& table, uint32_t* visibleIndices);
+
+// cullSpheres と同じ判定を1つずつ行う（SIMD カーネルの検証用）
+uint32_t cullSpheresScalar(const Frustum& frustum, const SphereTable& table, uint32_t* visibleIndices);
+
+// cullSpheres が使う命令セットの名前
+const char* getCullingKernelName();
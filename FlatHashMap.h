@@ -0,0 +1,148 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// 64bit 値の各ビットを全体に拡散させる（MurmurHash3 の fmix64）
+inline uint64_t mixHash(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+// seed に value を混ぜ合わせる
+inline uint64_t hashCombine(uint64_t seed, uint64_t value)
+{
+	return mixHash(seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2)));
+}
+
+// float のビット列を返す（== で等しい -0.0 と 0.0 は同じ値にそろえる）
+inline uint32_t floatHashBits(float value)
+{
+	if (value == 0.0f) {
+		value = 0.0f;
+	}
+	uint32_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+// オープンアドレス法（線形探索）のハッシュマップ
+// キーと値を連続した配列に持ち、要素の追加のみをサポートする（削除はしない）
+// 頂点の重複除去のように、大量の挿入と検索を一度に行う用途向け
+template<typename Key, typename Value, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class FlatHashMap {
+public:
+	FlatHashMap() = default;
+
+	// count 個の要素を再ハッシュなしで格納できるように領域を確保する
+	void reserve(size_t count)
+	{
+		size_t capacity = MIN_CAPACITY;
+		while (capacity * MAX_LOAD_NUM < count * MAX_LOAD_DEN) {
+			capacity *= 2;
+		}
+		if (capacity > slots.size()) {
+			rehash(capacity);
+		}
+	}
+
+	// key がなければ value で追加する
+	// 戻り値は格納されている値へのポインタと、追加したかどうか
+	std::pair<Value*, bool> insert(const Key& key, const Value& value)
+	{
+		if ((count + 1) * MAX_LOAD_DEN > slots.size() * MAX_LOAD_NUM) {
+			rehash(slots.empty() ? MIN_CAPACITY : slots.size() * 2);
+		}
+
+		size_t index = findSlot(key);
+		Slot& slot = slots[index];
+		if (slot.occupied) {
+			return { &slot.value, false };
+		}
+
+		slot.key = key;
+		slot.value = value;
+		slot.occupied = true;
+		count++;
+		return { &slot.value, true };
+	}
+
+	// key に対応する値を返す（なければ nullptr）
+	const Value* find(const Key& key) const
+	{
+		if (slots.empty()) {
+			return nullptr;
+		}
+		const Slot& slot = slots[findSlot(key)];
+		return slot.occupied ? &slot.value : nullptr;
+	}
+
+	size_t size() const { return count; }
+	size_t capacity() const { return slots.size(); }
+
+	void clear()
+	{
+		slots.clear();
+		count = 0;
+		shift = 64;
+	}
+
+private:
+	// 負荷率の上限 7/8
+	static constexpr size_t MAX_LOAD_NUM = 7;
+	static constexpr size_t MAX_LOAD_DEN = 8;
+	static constexpr size_t MIN_CAPACITY = 16;
+
+	struct Slot {
+		Key key;
+		Value value;
+		bool occupied = false;
+	};
+
+	std::vector<Slot> slots;
+	size_t count = 0;
+	unsigned shift = 64;	// 64 - log2(容量)
+
+	// key が格納されているスロット、またはそれを格納すべき空きスロットを返す
+	size_t findSlot(const Key& key) const
+	{
+		// 弱いハッシュでも偏らないように、フィボナッチハッシュで上位ビットを使う
+		uint64_t h = static_cast<uint64_t>(Hash()(key)) * 0x9e3779b97f4a7c15ULL;
+		size_t mask = slots.size() - 1;
+		size_t index = static_cast<size_t>(h >> shift) & mask;
+
+		while (slots[index].occupied && !KeyEqual()(slots[index].key, key)) {
+			index = (index + 1) & mask;
+		}
+		return index;
+	}
+
+	// 容量を newCapacity（2のべき乗）にして全要素を入れ直す
+	void rehash(size_t newCapacity)
+	{
+		std::vector<Slot> old(newCapacity);
+		old.swap(slots);
+
+		shift = 64;
+		for (size_t c = newCapacity; c > 1; c >>= 1) {
+			shift--;
+		}
+
+		for (Slot& slot : old) {
+			if (slot.occupied) {
+				Slot& target = slots[findSlot(slot.key)];
+				target.key = std::move(slot.key);
+				target.value = std::move(slot.value);
+				target.occupied = true;
+			}
+		}
+	}
+};
@@ -24,6 +24,27 @@
 
 #include <chrono>
 
+#include "MemoryAllocator.h"
+#include "UploadQueue.h"
+#include "StagingRing.h"
+#include "FlatHashMap.h"
+#include "ThreadPool.h"
+#include "MappedFile.h"
+#include "MeshCache.h"
+#include "PipelineCache.h"
+#include "InstanceSet.h"
+#include "Culling.h"
+#include "MeshSimplifier.h"
+#include "MeshOptimizer.h"
+#include "VertexFormat.h"
+#include "BlockCompressor.h"
+#include "TextureCache.h"
+#include "Ktx2File.h"
+#include "TextureBaker.h"
+#include "TextureStreamer.h"
+#include "VirtualTexture.h"
+#include "PageCache.h"
+
 
 
 class HelloTriangleApplication {
@@ -32,7 +53,29 @@ public:
 	const int HEIGHT = 600;
 
 	const std::string MODEL_PATH = "models/chalet.obj";
+	const std::string MESH_CACHE_SUFFIX = ".meshcache";	// MODEL_PATH の隣に作るキャッシュファイルの拡張子
 	const std::string TEXTURE_PATH = "textures/chalet.jpg";
+	const std::string TEXTURE_CACHE_SUFFIX = ".texcache";	// TEXTURE_PATH の隣に作る圧縮テクスチャのキャッシュファイルの拡張子
+	const std::string VIRTUAL_TEXTURE_SUFFIX = ".vtpages";	// TEXTURE_PATH の隣に作る仮想テクスチャのページファイルの拡張子
+	const std::string TEXTURE_KTX2_PATH = "textures/chalet.ktx2";	// --bake-textures で TEXTURE_PATH から作るミップチェーン込みのテクスチャ（あれば優先して使う）
+	const std::string PIPELINE_CACHE_PATH = "pipeline.cache";	// 起動をまたいで再利用するパイプラインキャッシュ
+
+	// ステージングリングの容量（これより大きいアップロードは分割して転送する）
+	const VkDeviceSize STAGING_RING_SIZE = 32 * 1024 * 1024;
+
+	// テクスチャをストリーミングするとき、起動時に転送する粗いミップレベルの合計バイト数の上限
+	const VkDeviceSize TEXTURE_STREAM_INITIAL_SIZE = 256 * 1024;
+
+	// 仮想テクスチャのページの画素数と、バイリニアフィルター用にページの周囲に付ける境界の画素数
+	const uint32_t VIRTUAL_TEXTURE_PAGE_SIZE = 128;
+	const uint32_t VIRTUAL_TEXTURE_BORDER = 4;
+
+	// 1つのセカンダリコマンドバッファに記録する最小の描画数（これより少ない描画はスレッドに分けない）
+	const uint32_t MIN_DRAWS_PER_SECONDARY = 128;
+
+	// LOD 生成: 各段のインデックス数の目標（1段前に対する比）と、許す誤差の上限（メッシュの境界球の半径に対する比）
+	const float LOD_INDEX_RATIO = 0.5f;
+	const float LOD_MAX_ERROR_RATIO = 0.1f;
 
 	const std::vector<const char*> validationLayers = {
 		// SDK内にある一般的なvalidation layer
@@ -49,47 +92,97 @@ public:
 	const bool enableValidationLayers = true;
 #endif
 
+	// インスタンスの錐台カリング方法
+	enum class CullingMode {
+		None,	// カリングせず、全インスタンスを直接描画する
+		Cpu,	// CPU で判定して間接描画コマンドを書き込む（GPU 版の検証用フォールバック）
+		Gpu		// コンピュートシェーダーで判定し、間接描画コマンドを GPU 上で生成する
+	};
+
+	// テクスチャのブロック圧縮形式
+	enum class TextureCompression {
+		None,	// RGBA8 のまま転送し、ミップマップは GPU で生成する
+		Bc1,	// 8 倍（アルファなし）
+		Bc3,	// 4 倍（アルファあり）
+		Bc7		// 4 倍（BC1 より高画質）
+	};
+
+	// 起動オプション
+	struct Options {
+		// 同時に処理するフレーム数（CPUが何フレーム先行してよいか）
+		uint32_t maxFramesInFlight = 2;
+
+		// ウィンドウ・スワップチェーンを使わずオフスクリーンイメージに描画する
+		bool headless = false;
+
+		// ヘッドレス時に描画するフレーム数・秒数（どちらも0なら既定のフレーム数）
+		uint32_t benchmarkFrames = 0;
+		double benchmarkSeconds = 0.0;
+
+		// 描画するオブジェクト数（オブジェクトごとに UniformBufferObject を持つ）
+		uint32_t objectCount = 1;
+
+		// 各オブジェクトをインスタンシングで複製する数（1回の描画命令でまとめて描く）
+		uint32_t instanceCount = 1;
+
+		// インスタンスの錐台カリング方法
+		CullingMode culling = CullingMode::None;
+
+		// カリングの結果を毎フレーム検証する（GPU は CPU の結果と、CPU の SIMD カーネルはスカラー版と比較する）
+		bool verifyCulling = false;
+
+		// LOD の誤差を画面に投影したときに許すピクセル数（0 なら常に最も細かい LOD で描く）
+		float lodThreshold = 1.0f;
+
+		// テクスチャの圧縮形式（デバイスが BC 形式に対応していなければ None として扱う）
+		TextureCompression textureCompression = TextureCompression::Bc7;
+
+		// CPU でミップチェーンを作るときの縮小フィルター（圧縮テクスチャ・KTX2 への変換・ブリットできない形式で使う）
+		MipFilter mipFilter = MipFilter::Kaiser;
+
+		// 圧縮しないテクスチャのミップマップも GPU のブリットではなく CPU で作る
+		bool cpuMipmaps = false;
+
+		// テクスチャの粗いミップレベルだけを起動時に転送し、細かいレベルは描画しながら少しずつ転送する
+		bool streamTexture = false;
+
+		// streamTexture のとき1フレームに転送するテクスチャのバイト数の上限（KiB）
+		uint32_t textureStreamBudgetKiB = 4096;
+
+		// テクスチャを仮想テクスチャとして、描画に必要なページだけを物理ページのアトラスに置く（streamTexture とは併用できない）
+		bool virtualTexture = false;
+
+		// 仮想テクスチャのアトラスの1辺のページ数と、1フレームに読み込むページ数の上限
+		uint32_t virtualTextureAtlasPages = 16;
+		uint32_t virtualTextureUploadsPerFrame = 16;
+
+		// 起動せずに textures フォルダの JPEG を textureCompression の形式の KTX2 に変換する
+		bool bakeTextures = false;
+
+		// 起動せずにこの JPEG を並列デコーダーと stb_image でデコードして比べる（空なら行わない）
+		std::string benchmarkJpegPath;
+	};
+
+	explicit HelloTriangleApplication(const Options& options = Options());
+
 	void run() {
-		initWindow();
+		if (!options.headless) {
+			initWindow();
+		}
 		initVulkan();
 		mainLoop();
 		cleanup();
 	}
 
+	// 圧縮形式に対応する Vulkan の形式（どれも _SRGB。None なら VK_FORMAT_R8G8B8A8_SRGB）
+	static VkFormat getCompressedTextureFormat(TextureCompression compression);
+
+	// 読み込み・LOD 生成・最適化で使う頂点（GPU へは GpuVertex に詰め直して送る）
 	struct Vertex {
 		glm::vec3 pos;
 		glm::vec3 color;
 		glm::vec2 texCoord;
 
-		static VkVertexInputBindingDescription getBindingDescription() {
-			VkVertexInputBindingDescription bindingDescription = {};
-			bindingDescription.binding = 0;
-			bindingDescription.stride = sizeof(Vertex);
-			bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-			return bindingDescription;
-		}
-
-		static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
-			std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
-
-			attributeDescriptions[0].binding = 0;
-			attributeDescriptions[0].location = 0;
-			attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[0].offset = offsetof(Vertex, pos);
-			
-			attributeDescriptions[1].binding = 0;
-			attributeDescriptions[1].location = 1;
-			attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-			attributeDescriptions[1].offset = offsetof(Vertex, color);
-
-			attributeDescriptions[2].binding = 0;
-			attributeDescriptions[2].location = 2;
-			attributeDescriptions[2].format = VK_FORMAT_R32G32_SFLOAT;
-			attributeDescriptions[2].offset = offsetof(Vertex, texCoord);
-
-			return attributeDescriptions;
-		}
-
 		bool operator==(const Vertex& other) const {
 			return pos == other.pos && color == other.color && texCoord == other.texCoord;
 		}
@@ -100,47 +193,229 @@ private:
 
 
 
-	std::vector<Vertex> vertices;
+	// GPU に送る頂点の形式（VertexFormat.h）。VERTEX_FORMAT_FLOAT / VERTEX_FORMAT_HALF / VERTEX_FORMAT_COLOR を定義してビルドすると切り替わる
+	// 頂点カラーを持つ形式は shaders/vert_color.spv を、持たない形式は shaders/vert.spv を使う
+#if defined(VERTEX_FORMAT_FLOAT)
+	using GpuVertex = FloatVertex;
+#elif defined(VERTEX_FORMAT_HALF)
+	using GpuVertex = HalfVertex;
+#elif defined(VERTEX_FORMAT_COLOR)
+	using GpuVertex = CompactColorVertex;
+#else
+	using GpuVertex = CompactVertex;
+#endif
+
+	std::vector<Vertex> vertices;	// OBJ から読み込んだ場合のみ。GpuVertex に詰め直したら解放する
+	std::vector<GpuVertex> packedVertices;	// OBJ から読み込んだ場合のみ（キャッシュから読んだ場合は meshCache を参照する）
+	VertexDequantization meshDequantization;	// packedVertices をメッシュ空間に戻す変換
 	std::vector<uint32_t> indices;
+	MeshCache meshCache;	// 頂点・インデックスバッファを作成するまでマップしておく
+	uint32_t vertexCount = 0;
+	uint32_t indexCount = 0;	// 全 LOD の合計
+	VkIndexType indexType = VK_INDEX_TYPE_UINT32;
+	std::vector<MeshCache::Lod> meshLods;	// インデックスバッファ内の各 LOD の範囲（0 が元のメッシュ）
 	VkBuffer vertexBuffer;
-	VkDeviceMemory vertexBufferMemory;
+	MemoryAllocator::Allocation vertexBufferMemory;
 	VkBuffer indexBuffer;
-	VkDeviceMemory indexBufferMemory;
+	MemoryAllocator::Allocation indexBufferMemory;
 
 	struct UniformBufferObject {
 		alignas(16) glm::mat4 model;
 		alignas(16) glm::mat4 view;
 		alignas(16) glm::mat4 proj;
+		alignas(16) glm::vec4 positionScale;	// 量子化した頂点の位置を戻す変換（xyz。meshDequantization と同じ値）
+		alignas(16) glm::vec4 positionOffset;
+		alignas(16) glm::vec4 texCoordTransform;	// 量子化したテクスチャ座標を戻す変換（xy: スケール、zw: オフセット）
 	};
 
 	uint32_t mipLevels;
+	VkFormat textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+	TextureCache textureCache;	// 圧縮テクスチャをイメージへ転送するまでマップしておく
 	VkImage textureImage;
-	VkDeviceMemory textureImageMemory;
+	MemoryAllocator::Allocation textureImageMemory;
 
 	VkSampleCountFlagBits msaaSamples = VK_SAMPLE_COUNT_1_BIT;
 
 	VkImageView textureImageView;
-	VkSampler textureSampler;
+	std::vector<VkSampler> textureSamplers;	// minLod がレベル i のサンプラー（ストリーミングしなければ minLod = 0 の1つだけ）
+
+	// 細かいミップレベルのストリーミング（options.streamTexture）
+	TextureStreamer textureStreamer;
+	uint32_t residentMipLevel = 0;	// 転送が終わっている最も細かいレベル（これより細かいレベルはサンプリングしない）
+	uint32_t streamedTextureLevels = 0;	// 起動後に転送するレベル数（統計用）
+	std::chrono::high_resolution_clock::time_point textureStreamStart;
 
 	VkImage depthImage;
-	VkDeviceMemory depthImageMemory;
+	MemoryAllocator::Allocation depthImageMemory;
 	VkImageView depthImageView;
 
 	VkImage colorImage;
-	VkDeviceMemory colorImageMemory;
+	MemoryAllocator::Allocation colorImageMemory;
 	VkImageView colorImageView;
 
-	std::vector<VkBuffer> uniformBuffers;
-	std::vector<VkDeviceMemory> uniformBuffersMemory;
+	// 全スワップチェーンイメージ・全オブジェクト分の UniformBufferObject を並べた1つのバッファ
+	// (イメージ i, オブジェクト j) の領域は (i * objectCount + j) * uniformStride から始まる
+	VkBuffer uniformBuffer;
+	MemoryAllocator::Allocation uniformBufferMemory;	// 永続的にマップされている
+	VkDeviceSize uniformStride;	// minUniformBufferOffsetAlignment と mat4 の大きさに揃えた1オブジェクト分のサイズ
 	VkDescriptorPool descriptorPool;
-	std::vector<VkDescriptorSet> descriptorSets;
+	std::vector<VkDescriptorSet> descriptorSets;	// textureSamplers ごとのセット。ダイナミックオフセットで領域を切り替えて使う
+
+	// インスタンスごとのモデル行列（全オブジェクトの描画で共有する）
+	// GPU 側はフレームスロットごとに instanceCapacity 個分の領域を持ち、内容が変わったスロットだけ書き直す
+	InstanceSet instances;
+	VkBuffer instanceBuffer = VK_NULL_HANDLE;
+	MemoryAllocator::Allocation instanceBufferMemory;	// 永続的にマップされている
+	uint32_t instanceCapacity = 0;
+	std::vector<uint64_t> instanceBufferVersions;	// スロットごとに書き込んだ instances のバージョン
+
+	// 錐台カリングと間接描画
+	// 見えるインスタンスがある (オブジェクト, LOD) の描画コマンドだけを詰めて並べ、全オブジェクトを1回の間接描画で描く
+	// フレームスロット f の領域は各バッファの f * ～SlotSize から始まり、
+	//   indirectBuffer: IndirectHeader、描画コマンド（最大 maxIndirectDraws 個）、drawCounterOffset から (オブジェクト, LOD) ごとのカウンタ（GPU カリングの作業用）
+	//   drawModelBuffer: 描画コマンドと同じ並びのオブジェクトの model 行列（頂点シェーダーが gl_DrawID で読む）
+	//   visibleInstanceBuffer: 描画コマンドの firstInstance から instanceCount 個ずつ並ぶ見えるインスタンス（最大 visibleInstanceCapacity 個）
+	// どれもデバイスローカルで、CPU カリングの結果と --verify-culling で読み戻す結果は cullingStagingBuffer を経由してコピーする
+	// cullingStagingBuffer のスロットは indirectBuffer・drawModelBuffer・visibleInstanceBuffer のスロットをこの順に並べたもの
+	BoundingSphere meshBounds;	// メッシュ空間の境界球
+	Frustum frustum;	// updateUniformBuffer で求めた今フレームの錐台
+	glm::vec3 cameraPosition = glm::vec3(0.0f);	// updateUniformBuffer で求めた今フレームの視点（LOD の選択用）
+	float lodScale = 0.0f;	// LOD の誤差 x 境界球の半径をこの値倍したものが距離以下なら使える。0 なら LOD 0 だけ（selectLod を参照）
+	std::vector<glm::mat4> objectModels;	// updateUniformBuffer で書き込んだオブジェクトの model 行列（CPU カリング用）
+	SphereTable instanceBounds;	// オブジェクト空間でのインスタンスごとの境界球（CPU カリング用）
+	uint64_t instanceBoundsVersion = UINT64_MAX;	// instanceBounds を求めた instances のバージョン
+	BoundingSphere instanceSetBounds;	// オブジェクト空間で全インスタンスを囲む球（カリングしないときの LOD の選択用）
+	std::vector<uint32_t> objectLods;	// カリングしないときにオブジェクトごとに選んだ LOD
+	std::vector<uint32_t> visibleIndices;	// cullSpheres の出力先
+	std::vector<uint32_t> visibleLods;	// visibleIndices の各インスタンスに選んだ LOD
+	std::vector<uint32_t> referenceIndices;	// cullSpheresScalar の出力先（SIMD カーネルの検証用）
+	uint32_t maxIndirectDraws = 0;	// オブジェクト数 x LOD 数
+	uint32_t visibleInstanceCapacity = 0;	// オブジェクト数 x インスタンス数
+	VkBuffer indirectBuffer = VK_NULL_HANDLE;
+	MemoryAllocator::Allocation indirectBufferMemory;
+	VkDeviceSize indirectSlotSize = 0;
+	VkDeviceSize drawCounterOffset = 0;
+	VkBuffer drawModelBuffer = VK_NULL_HANDLE;
+	MemoryAllocator::Allocation drawModelBufferMemory;
+	VkDeviceSize drawModelSlotSize = 0;
+	VkBuffer visibleInstanceBuffer = VK_NULL_HANDLE;
+	MemoryAllocator::Allocation visibleInstanceBufferMemory;
+	VkDeviceSize visibleInstanceSlotSize = 0;
+	VkBuffer cullingStagingBuffer = VK_NULL_HANDLE;	// --culling cpu か --verify-culling のときだけ作る
+	MemoryAllocator::Allocation cullingStagingBufferMemory;	// 永続的にマップされている
+	VkDeviceSize cullingStagingSlotSize = 0;
+	bool drawIndirectCountEnabled = false;	// VK_KHR_draw_indirect_count で描画数を GPU の書いた値から取れるか（なければ multiDrawIndirect で最大数を描く）
+	PFN_vkCmdDrawIndexedIndirectCountKHR cmdDrawIndexedIndirectCount = nullptr;
+	VkBuffer lodBuffer = VK_NULL_HANDLE;	// GPU カリング用のメッシュの境界球と LOD の表（shaders/cull.comp の Lods と同じ並び）
+	MemoryAllocator::Allocation lodBufferMemory;
+	VkDescriptorSetLayout cullDescriptorSetLayout = VK_NULL_HANDLE;
+	VkDescriptorPool cullDescriptorPool = VK_NULL_HANDLE;
+	std::vector<VkDescriptorSet> cullDescriptorSets;	// フレームスロットごと
+	VkPipelineLayout cullPipelineLayout = VK_NULL_HANDLE;
+	VkPipeline cullPipeline = VK_NULL_HANDLE;
+
+	// indirectBuffer のスロットの先頭（shaders/cull.comp の Commands と同じ並び。続けて描画コマンドが並ぶ）
+	struct IndirectHeader {
+		uint32_t drawCount;	// 描画コマンドの数（vkCmdDrawIndexedIndirectCount の countBuffer）
+		uint32_t visibleCount;	// 見えるインスタンスの数
+		uint32_t reserved[2];
+	};
+
+	// カリングシェーダーのプッシュ定数（shaders/cull.comp の CullParams と同じ並び）
+	struct CullParams {
+		glm::vec4 planes[6];
+		glm::vec4 camera;	// xyz: cameraPosition, w: lodScale（0 なら LOD 0 だけ）
+		uint32_t objectCount;
+		uint32_t instanceCount;
+		uint32_t imageIndex;
+		uint32_t phase;	// CULL_PHASE_*
+	};
+
+	// cull.comp は同じパイプラインを3回ディスパッチする（数える・描画コマンドと領域を割り当てる・書き込む）
+	static const uint32_t CULL_PHASE_COUNT = 0;
+	static const uint32_t CULL_PHASE_ALLOCATE = 1;
+	static const uint32_t CULL_PHASE_WRITE = 2;
+
+	// カリングの結果（GPU カリングも同じ内容を書き込む。描画コマンドと見えるインスタンスの並びは GPU ではアトミック加算の順になる）
+	struct CullingResult {
+		std::vector<VkDrawIndexedIndirectCommand> commands;	// 見えるインスタンスがある (オブジェクト, LOD) だけ
+		std::vector<glm::mat4> drawModels;	// commands と同じ並びのオブジェクトの model 行列
+		std::vector<InstanceData> visibleInstances;	// commands[i].firstInstance から commands[i].instanceCount 個ずつ
+	};
+	CullingResult cullingResult;	// CPU カリングの出力先
 
-	const int MAX_FRAMES_IN_FLIGHT = 2;
+	// GPU カリングの検証（フレームスロットごとに CPU で求めた期待値を保持し、フェンス待ちの後に比較する）
+	struct CullingExpectation {
+		bool pending = false;
+		CullingResult result;
+	};
+	std::vector<CullingExpectation> cullingExpectations;
+	uint64_t cullingVerifiedFrames = 0;
+	uint64_t cullingMismatchedFrames = 0;
+
+	// CPU カリングの統計
+	struct CullingStats {
+		uint64_t frameCount = 0;
+		uint64_t testedCount = 0;	// 判定した境界球の数（オブジェクト数 x インスタンス数）
+		uint64_t visibleCount = 0;
+		uint64_t lodCounts[MeshCache::MAX_LODS] = {};	// LOD ごとの見えるインスタンス数
+		double totalUs = 0.0;
+	};
+	CullingStats cullingStats;
+
+	// 仮想テクスチャ（options.virtualTexture）。textureImage は物理ページのアトラス（1レベル）になる
+	// フラグメントシェーダーは描画に使うページの番号にフレーム番号を書き（フィードバック）、フェンスを待った後に
+	// CPU で集めて pageCache で読み込むページを選ぶ。ページテーブルは常駐していないページに常駐している祖先を入れて渡す
+	// ページテーブルとフィードバックはフレームスロットごとの領域をダイナミックオフセットで選ぶ
+	VirtualTextureFile virtualTextureFile;	// 全ページのタイルをマップしておく
+	PageCache pageCache;
+	VkBuffer pageTableBuffer = VK_NULL_HANDLE;
+	MemoryAllocator::Allocation pageTableBufferMemory;	// 永続的にマップされている
+	VkDeviceSize pageTableSlotSize = 0;
+	std::vector<uint64_t> pageTableVersions;	// スロットごとに書き込んだ pageCache のバージョン
+	VkBuffer feedbackBuffer = VK_NULL_HANDLE;
+	MemoryAllocator::Allocation feedbackBufferMemory;	// 永続的にマップされている
+	VkDeviceSize feedbackSlotSize = 0;
+	std::vector<uint32_t> feedbackFrames;	// スロットで最後に描いたフレームの番号（0 ならまだ描いていない）
+	uint32_t virtualTextureFrame = 0;
+
+	// ページテーブルの先頭（shaders/shader.frag の PageTable と同じ並び。続けてページごとのエントリーが並ぶ）
+	struct PageTableHeader {
+		uint32_t width;
+		uint32_t height;
+		uint32_t levelCount;
+		uint32_t frame;			// フィードバックに書くフレーム番号
+		uint32_t pageSize;
+		uint32_t border;
+		uint32_t tileSize;
+		uint32_t atlasSize;
+		uint32_t levels[VirtualTextureLayout::MAX_LEVELS][4];	// 横のページ数, 縦のページ数, 先頭のページ番号, 0
+	};
+
+	Options options;
+	uint32_t maxFramesInFlight;
 	size_t currentFrame = 0;
 
+	// フレーム統計（CPU/GPUオーバーラップ・ベンチマーク）
+	struct FrameStats {
+		uint64_t frameCount = 0;
+		double fenceWaitMs = 0.0;		// inFlightFences待ちの合計
+		double imageWaitMs = 0.0;		// imagesInFlight待ちの合計
+		std::chrono::high_resolution_clock::time_point lastFrameStart;
+		std::vector<double> intervalSamples;	// drawFrame開始間隔
+		std::vector<double> cpuTimeSamples;		// フェンス待ちを除いたCPU時間
+		std::vector<double> latencySamples;		// サブミットからフェンス完了を確認するまでの時間
+
+		// フレームスロットごとのサブミット時刻と、完了待ちかどうか
+		std::vector<std::chrono::high_resolution_clock::time_point> submitTimes;
+		std::vector<bool> pendingFences;
+	};
+	FrameStats frameStats;
+
 	struct QueueFamilyIndices {
 		std::optional<uint32_t> graphicsFamily;
 		std::optional<uint32_t> presentFamily;
+		std::optional<uint32_t> transferFamily;	// グラフィックスを持たない転送用キューファミリ（任意）
 
 		bool isComplete() {
 			return graphicsFamily.has_value()
@@ -163,7 +438,16 @@ private:
 	void mainLoop();
 	void drawFrame();
 
+	// ヘッドレス時のメインループ（ベンチマーク）
+	void headlessLoop();
+
+	// ヘッドレス時のフレーム描画
+	void drawHeadlessFrame();
+
 	void cleanup();
+
+	// サイズに依存するオブジェクト（アタッチメント・フレームバッファ・イメージビュー）を破棄する
+	// スワップチェーン本体は再作成時に oldSwapchain として渡すため残す
 	void cleanupSwapChain();
 
 	GLFWwindow* window;
@@ -173,10 +457,23 @@ private:
 	VkInstance instance;
 	VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
 	VkDevice device;
+	MemoryAllocator allocator;	// デバイスメモリのサブアロケータ
+	ThreadPool threadPool;	// モデル読み込みなどの並列処理用
 	VkQueue graphicsQueue;
 	VkQueue presentQueue;
-	VkSwapchainKHR swapChain;
+	VkQueue transferQueue;
+	QueueFamilyIndices queueFamilyIndices;	// createLogicalDevice で決定したキューファミリ
+	bool pipelineFeedbackEnabled = false;	// VK_EXT_pipeline_creation_feedback でキャッシュのヒットを判定できるか
+	bool textureCompressionBcEnabled = false;	// textureCompressionBC 機能を有効にしたか
+	PipelineCache pipelineCache;	// すべてのパイプライン作成で共有する
+	UploadQueue graphicsUploads;	// レイアウト遷移・ミップマップ生成など、グラフィックスキューが必要な転送
+	UploadQueue transferUploads;	// バッファ転送（専用の転送キューがあればそちらを使う）
+	VkBuffer stagingRingBuffer;
+	MemoryAllocator::Allocation stagingRingMemory;
+	StagingRing stagingRing;	// アップロード共用のステージング領域
+	VkSwapchainKHR swapChain = VK_NULL_HANDLE;
 	std::vector<VkImage> swapChainImages;
+	std::vector<MemoryAllocator::Allocation> offscreenImagesMemory;	// ヘッドレス時の描画先イメージのメモリ
 	std::vector<VkImageView> swapChainImageViews;
 	VkFormat swapChainImageFormat;
 	VkExtent2D swapChainExtent;
@@ -184,16 +481,27 @@ private:
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkPipelineLayout pipelineLayout;
 	std::vector<VkFramebuffer> swapChainFramebuffers;
-	VkCommandPool commandPool;
-	std::vector<VkCommandBuffer> commandBuffers;
+
+	// フレームスロットごとのコマンド記録用リソース
+	// フェンス待ちの後に vkResetCommandPool でプールごとまとめて再利用する
+	struct FrameCommands {
+		VkCommandPool primaryPool = VK_NULL_HANDLE;
+		VkCommandBuffer primary = VK_NULL_HANDLE;
+		std::vector<VkCommandPool> secondaryPools;	// コマンドプールは外部同期が必要なため記録ジョブごとに持つ
+		std::vector<VkCommandBuffer> secondaries;
+	};
+	std::vector<FrameCommands> frameCommands;
 	std::vector<VkSemaphore> imageAvailableSemaphores;
 	std::vector<VkSemaphore> renderFinishedSemaphores;
 	std::vector<VkFence> inFlightFences;
+	std::vector<VkFence> imagesInFlight;	// スワップチェーンイメージを使用中のフレームのフェンス
 	bool framebufferResized = false;
 
 	void pickPhysicalDevice();
 	bool isDeviceSuitable(VkPhysicalDevice device);
 	bool checkDeviceExtensionSupport(VkPhysicalDevice device);
+	std::vector<const char*> getRequiredDeviceExtensions();
+	bool isDeviceExtensionAvailable(VkPhysicalDevice device, const char* extensionName);
 	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
 
 	void createLogicalDevice();
@@ -211,9 +519,12 @@ private:
 	// スワップチェーン作成
 	void createSwapChain();
 
-	// スワップチェーン再生成
+	// スワップチェーン再生成（サイズに依存するオブジェクトだけを作り直す）
 	void recreateSwapChain();
 
+	// オフスクリーン描画先作成（ヘッドレス時にスワップチェーンの代わりに使用する）
+	void createOffscreenImages();
+
 	// イメージビュー作成
 	void createImageViews();
 
@@ -224,22 +535,19 @@ private:
 	void createGraphicsPipeline();
 
 	// シェーダーモジュール作成
-	VkShaderModule createShaderModule(const std::vector<char>& code);
+	VkShaderModule createShaderModule(const FileView& code);
 
 	// フレームバッファ作成
 	void createFramebuffers();
 
-	// コマンドプール作成
+	// コマンドプール作成（フレームスロットごと）
 	void createCommandPool();
 
-	// コマンドバッファ作成
+	// コマンドバッファ作成（フレームスロットごとのプライマリと記録ジョブごとのセカンダリ）
 	void createCommandBuffers();
 
-	// コマンドバッファの作成とレコード開始を行う
-	VkCommandBuffer beginSingleTimeCommands();
-
-	// コマンドバッファのレコード完了・サブミット・解放
-	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+	// フレームのコマンドを記録する（描画はスレッドプールでセカンダリコマンドバッファに分けて記録する）
+	void recordCommandBuffer(size_t frameIndex, uint32_t imageIndex);
 
 	// バッファ作成
 	void createBuffer(
@@ -247,26 +555,105 @@ private:
 		VkBufferUsageFlags usage,
 		VkMemoryPropertyFlags properties,
 		VkBuffer& buffer,
-		VkDeviceMemory& bufferMemory);
+		MemoryAllocator::Allocation& bufferMemory);
 
-	// モデルロード
+	// モデルロード（キャッシュがあればそちらを使い、なければ OBJ から読み込んでキャッシュを作る）
 	void loadModel();
 
+	// メッシュキャッシュに保存する頂点レイアウト
+	static MeshCache::Layout getMeshCacheLayout();
+
+	// 頂点バッファを共有する粗い LOD を作り、インデックスを indices の後ろに追加する
+	void buildLods();
+
+	// 各 LOD の三角形を頂点キャッシュと重ね描きに合わせて並べ替え、頂点を参照順に並べ替える
+	void optimizeMesh();
+
+	// vertices を GpuVertex に詰め直して packedVertices に入れる
+	void packVertices();
+
+	// GpuVertex の配列の位置を戻して meshBounds を求める
+	void computeMeshBounds(const GpuVertex* packed, size_t count);
+
+	// ワールド空間の境界球で囲まれたものを描く LOD を選ぶ
+	uint32_t selectLod(const glm::vec3& center, float radius) const;
+
 	// 頂点バッファ作成
 	void createVertexBuffer();
 
 	// インデックスバッファ作成
 	void createIndexBuffer();
 
-	// バッファコピー
-	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+	// ステージングリング作成
+	void createStagingRing();
 
-	// メモリタイプを見つける
-	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+	// データをステージングリング経由でバッファへ転送する（transferUploads に記録する）
+	void uploadToBuffer(VkBuffer dstBuffer, const void* data, VkDeviceSize size);
+
+	// ピクセルをステージングリング経由でイメージのミップ mipLevel へ転送する（graphicsUploads に記録する）
+	// pixels は blockExtent x blockExtent 画素のブロック（1つ blockBytes バイト）を行ごとに並べたもの
+	// 圧縮していないイメージは blockExtent = 1、blockBytes = 1画素のバイト数
+	void uploadToImage(
+		VkImage image,
+		const void* pixels,
+		uint32_t width,
+		uint32_t height,
+		uint32_t mipLevel,
+		uint32_t blockBytes,
+		uint32_t blockExtent);
+
+	// uploadToImage のうち、ブロック行 [firstBlockRow, firstBlockRow + blockRowCount) だけを転送する
+	// pixels はレベル全体の先頭を指す
+	void uploadImageRows(
+		VkImage image,
+		const void* pixels,
+		uint32_t width,
+		uint32_t height,
+		uint32_t mipLevel,
+		uint32_t blockBytes,
+		uint32_t blockExtent,
+		uint32_t firstBlockRow,
+		uint32_t blockRowCount);
+
+	// バッファコピー（transferUploads に記録する）
+	void copyBuffer(
+		VkBuffer srcBuffer,
+		VkDeviceSize srcOffset,
+		VkBuffer dstBuffer,
+		VkDeviceSize dstOffset,
+		VkDeviceSize size);
 
 	// テクスチャイメージ作成
 	void createTextureImage();
 
+	// ブロック圧縮したミップチェーンをキャッシュから読み込み（なければ作って保存し）、テクスチャイメージを作る
+	void createCompressedTextureImage(TextureCompression compression);
+
+	// KTX2 の全レベルを1回のコピーで転送してテクスチャイメージを作る
+	void createKtx2TextureImage(const Ktx2File& file);
+
+	// 粗いミップレベルだけを転送してテクスチャイメージを作り、残りのレベルのストリーミングを始める
+	// （KTX2・圧縮テクスチャのキャッシュがあればマップして、なければバックグラウンドでデコード・圧縮して転送する）
+	void createStreamedTextureImage();
+
+	// 1フレームの予算内でストリーミング中のミップレベルを転送し、転送し終えたレベルまでサンプリングを許す
+	void streamTextureLevels();
+
+	// 仮想テクスチャのページファイルを開き（なければ作り）、アトラス・ページテーブル・フィードバックのバッファを作る
+	void createVirtualTexture();
+
+	// フレームスロットのフィードバックで要求されたページを読み込み、スロットのページテーブルを書き直す
+	void updateVirtualTexture(size_t frameIndex);
+
+	// ページのタイルをステージングリング経由でアトラスのスロットへ転送する（graphicsUploads に記録する。レイアウトは TRANSFER_DST）
+	void uploadVirtualTexturePages(const std::vector<PageCache::Load>& loads);
+
+	// テクスチャに使う形式をデバイスでサンプリング（線形補間）できるか
+	bool canSampleTextureFormat(VkFormat format);
+
+	// テクスチャに使う形式をリニアフィルターでブリットできるか（できなければミップマップを CPU で作る）
+	bool canBlitTextureFormat(VkFormat format);
+
 	// イメージ作成
 	void createImage(
 		uint32_t width,
@@ -278,7 +665,7 @@ private:
 		VkImageUsageFlags usage,
 		VkMemoryPropertyFlags properties,
 		VkImage& image,
-		VkDeviceMemory& imageMemory);
+		MemoryAllocator::Allocation& imageMemory);
 
 	// イメージビュー作成
 	VkImageView createImageView(
@@ -287,28 +674,33 @@ private:
 		VkImageAspectFlags aspectFlags, 
 		uint32_t mipLevels);
 
-	// イメージレイアウト遷移
+	// イメージレイアウト遷移（graphicsUploads に記録する）
+	// ミップレベル [baseMipLevel, baseMipLevel + mipLevels) を遷移する
 	void transitionImageLayout(
 		VkImage image,
 		VkFormat format,
 		VkImageLayout oldLayout,
 		VkImageLayout newLayout,
-		uint32_t mipLevels);
+		uint32_t mipLevels,
+		uint32_t baseMipLevel = 0);
 
-	// バッファをイメージにコピーする
+	// バッファをイメージにコピーする（graphicsUploads に記録する）
 	void copyBufferToImage(
 		VkBuffer buffer,
+		VkDeviceSize bufferOffset,
 		VkImage image,
+		uint32_t mipLevel,
 		uint32_t width,
+		uint32_t offsetY,
 		uint32_t height);
 
 	// テクスチャのイメージビュー作成
 	void createTextureImageView();
 
-	// イメージサンプラを作成する
+	// イメージサンプラを作成する（ストリーミングするときはレベルごとに minLod を変えて作る）
 	void createTextureSampler();
 
-	// ミップマップを生成する
+	// ミップマップを生成する（graphicsUploads に記録する）
 	void generateMipmaps(
 		VkImage image,
 		VkFormat imageFormat,
@@ -326,6 +718,9 @@ private:
 	// カラーリソースを作成する
 	void createColorResources();
 
+	// フォーマットが tiling で features をすべて使えるか
+	bool isFormatSupported(VkFormat format, VkImageTiling tiling, VkFormatFeatureFlags features);
+
 	// フォーマットを検索する
 	VkFormat findSupportedFormat(
 		const std::vector<VkFormat>& candidates,
@@ -341,21 +736,72 @@ private:
 	// 同期オブジェクト作成
 	void createSyncObjects();
 
+	// フレーム統計を出力する
+	void printFrameStats();
+
+	// 完了したフレームのフェンスを確認し、サブミットからの遅延を記録する
+	void collectFenceLatencies();
+
 	// ディスクリプタセットレイアウト作成
 	void createDescriptorSetLayout();
 
 	// ユニフォームバッファ作成
 	void createUniformBuffers();
 
+	// 起動オプションに従ってインスタンスを格子状に並べる
+	void createInstances();
+
+	// インスタンスバッファ作成（容量は instances の要素数以上）
+	void createInstanceBuffer();
+
+	// フレームスロットのインスタンスバッファを instances の内容に合わせる（容量が足りなければ作り直す）
+	void updateInstanceBuffer(size_t frameIndex);
+
+	// カリング用のバッファ・ディスクリプタ・コンピュートパイプラインを作成する
+	void createCullingResources();
+
+	// 間接描画コマンド・描画ごとの model 行列・見えるインスタンスのバッファを作成する（オブジェクト数 x インスタンス数に合わせる）
+	void createCullingBuffers();
+
+	// カリング用のバッファを破棄する
+	void destroyCullingBuffers();
+
+	// カリング用ディスクリプタセットにバッファを書き込む
+	void writeCullDescriptorSets();
+
+	// CPU でカリングし、見えるインスタンスがある (オブジェクト, LOD) の描画を result に詰めて書き出す
+	void cullInstancesOnCpu(CullingResult& result);
+
+	// instances が変わっていれば instanceBounds を求め直す
+	void updateInstanceBounds();
+
+	// フレームスロットのカリング結果を用意する（CPU ならここでステージングへ書き込み、GPU なら検証用の期待値を求める）
+	void prepareCulling(size_t frameIndex);
+
+	// CPU カリングの結果をステージングからデバイスローカルのバッファへコピーするコマンドを記録する（レンダーパス開始前に呼ぶ）
+	void recordCullingUpload(VkCommandBuffer commandBuffer, size_t frameIndex);
+
+	// GPU カリングのコマンドを記録する（レンダーパス開始前に呼ぶ）
+	void recordCulling(VkCommandBuffer commandBuffer, size_t frameIndex, uint32_t imageIndex);
+
+	// 完了したフレームスロットの GPU カリング結果を期待値と比較する
+	void verifyCullingResults(size_t frameIndex);
+
 	// ユニフォームバッファ更新
 	void updateUniformBuffer(uint32_t currentImage);
 
+	// (イメージ, オブジェクト) に対応するユニフォームバッファ内のオフセット
+	uint32_t uniformOffset(size_t imageIndex, uint32_t objectIndex) const;
+
 	// ディスクリプタプール作成
 	void createDescriptorPool();
 
 	// ディスクリプタセット作成
 	void createDescriptorSets();
 
+	// 全ディスクリプタセットにユニフォームバッファとテクスチャを書き込む
+	void writeDescriptorSets();
+
 	VkDebugUtilsMessengerEXT debugMessenger;
 
 	bool checkValidationLayerSupport();
@@ -384,19 +830,24 @@ private:
 		const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData,
 		void* pUserData);
 
-	static std::vector<char> readFile(const std::string& filename);
+	// ファイル内容を読み取り専用ビューで返す（マップできなければストリームで読み込む）
+	static FileView readFile(const std::string& filename);
 	VkPipeline graphicsPipeline;
 
 	static void framebufferResizeCallback(GLFWwindow* window, int width, int height);
 };
 
 namespace std {
+	// 全成分のビット列を混ぜ合わせる（-0.0 と 0.0 は operator== に合わせて同じハッシュにする）
 	template<> struct hash<HelloTriangleApplication::Vertex>
 	{
 		size_t operator()(HelloTriangleApplication::Vertex const& vertex) const {
-			return ((hash<glm::vec3>()(vertex.pos) ^
-				(hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^
-				(hash<glm::vec2>()(vertex.texCoord) << 1);
+			uint64_t h = 0;
+			h = hashCombine(h, (uint64_t(floatHashBits(vertex.pos.x)) << 32) | floatHashBits(vertex.pos.y));
+			h = hashCombine(h, (uint64_t(floatHashBits(vertex.pos.z)) << 32) | floatHashBits(vertex.color.x));
+			h = hashCombine(h, (uint64_t(floatHashBits(vertex.color.y)) << 32) | floatHashBits(vertex.color.z));
+			h = hashCombine(h, (uint64_t(floatHashBits(vertex.texCoord.x)) << 32) | floatHashBits(vertex.texCoord.y));
+			return static_cast<size_t>(h);
 		}
 	};
 }
\ No newline at end of file
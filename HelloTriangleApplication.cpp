@@ -3,9 +3,48 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+// tiny_obj_loader.h の実装部はインクルードガードの外にあるため、宣言だけを先に読み込んでおく
+#include "ParallelObjLoader.h"
+
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
+// 2つの時刻の差をミリ秒で返す
+static double elapsedMs(
+	std::chrono::high_resolution_clock::time_point begin,
+	std::chrono::high_resolution_clock::time_point end)
+{
+	return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+// サンプルの百分位数を求める（最近傍順位法）
+static double percentile(std::vector<double> samples, double p)
+{
+	if (samples.empty()) {
+		return 0.0;
+	}
+
+	size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * samples.size()));
+	rank = std::clamp<size_t>(rank, 1, samples.size()) - 1;
+	std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+	return samples[rank];
+}
+
+HelloTriangleApplication::HelloTriangleApplication(const Options& options)
+	: options(options),
+	maxFramesInFlight(options.maxFramesInFlight)
+{
+	if (maxFramesInFlight == 0) {
+		throw std::invalid_argument("maxFramesInFlight must be at least 1!");
+	}
+	if (options.objectCount == 0) {
+		throw std::invalid_argument("objectCount must be at least 1!");
+	}
+	if (options.virtualTexture && options.streamTexture) {
+		throw std::invalid_argument("virtualTexture and streamTexture cannot be used together!");
+	}
+}
+
 void HelloTriangleApplication::initWindow()
 {
 	glfwInit();
@@ -30,20 +69,41 @@ void HelloTriangleApplication::initVulkan()
 	createDescriptorSetLayout();
 	createGraphicsPipeline();
 	createCommandPool();
+	createStagingRing();
 	createColorResources();
 	createDepthResource();
 	createFramebuffers();
 	createTextureImage();
+
+	// テクスチャの転送とミップマップ生成をGPUで進めている間にモデルを読み込む
+	UploadQueue::Ticket textureUpload = graphicsUploads.submit();
+
 	createTextureImageView();
 	createTextureSampler();
 	loadModel();
 	createVertexBuffer();
 	createIndexBuffer();
+
+	// キャッシュの内容はステージングリングへコピー済み
+	meshCache.close();
+	UploadQueue::Ticket meshUpload = transferUploads.submit();
+
 	createUniformBuffers();
+	createInstances();
+	createInstanceBuffer();
+	createCullingResources();
 	createDescriptorPool();
 	createDescriptorSets();
 	createCommandBuffers();
 	createSyncObjects();
+
+	// 最初のフレームを描画する前にアップロードの完了を待つ
+	graphicsUploads.wait(textureUpload);
+	transferUploads.wait(meshUpload);
+
+	allocator.printStats(std::cout);
+	std::cout << "staging ring: " << (STAGING_RING_SIZE >> 20) << " MiB, "
+		<< stagingRing.getStallCount() << " stalls" << std::endl;
 }
 
 void HelloTriangleApplication::createInstance()
@@ -111,6 +171,9 @@ void HelloTriangleApplication::createInstance()
 
 void HelloTriangleApplication::createSurface()
 {
+	// ヘッドレス時は表示先を持たない
+	if (options.headless) { return; }
+
 	if (glfwCreateWindowSurface(instance, window, nullptr, &surface) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create window surface!");
 	}
@@ -164,7 +227,11 @@ bool HelloTriangleApplication::isDeviceSuitable(VkPhysicalDevice device)
 	bool extensionSupported = checkDeviceExtensionSupport(device);
 
 	bool swapChainAdequate = false;
-	if (extensionSupported) {
+	if (options.headless) {
+		// ヘッドレス時はスワップチェーンを使用しない
+		swapChainAdequate = true;
+	}
+	else if (extensionSupported) {
 		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
 		swapChainAdequate = !swapChainSupport.formats.empty()
 			&& !swapChainSupport.presentModes.empty();
@@ -185,7 +252,8 @@ bool HelloTriangleApplication::checkDeviceExtensionSupport(VkPhysicalDevice devi
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
 	// setにして拡張リストの重複をなくす
-	std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+	std::vector<const char*> extensions = getRequiredDeviceExtensions();
+	std::set<std::string> requiredExtensions(extensions.begin(), extensions.end());
 
 	// 有効化したい拡張と、使用可能な拡張を突き合わせる
 	for (const auto& extension : availableExtensions) {
@@ -195,6 +263,32 @@ bool HelloTriangleApplication::checkDeviceExtensionSupport(VkPhysicalDevice devi
 	return requiredExtensions.empty();
 }
 
+// 有効化するデバイス拡張
+std::vector<const char*> HelloTriangleApplication::getRequiredDeviceExtensions()
+{
+	// ヘッドレス時はスワップチェーン拡張が不要（ソフトウェア実装では提供されないことがある）
+	if (options.headless) {
+		return {};
+	}
+	return deviceExtensions;
+}
+
+// 任意で有効化するデバイス拡張が使えるか
+bool HelloTriangleApplication::isDeviceExtensionAvailable(VkPhysicalDevice device, const char* extensionName)
+{
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+	for (const auto& extension : availableExtensions) {
+		if (std::strcmp(extension.extensionName, extensionName) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
 HelloTriangleApplication::QueueFamilyIndices HelloTriangleApplication::findQueueFamilies(VkPhysicalDevice device)
 {
 	QueueFamilyIndices indices;
@@ -206,19 +300,34 @@ HelloTriangleApplication::QueueFamilyIndices HelloTriangleApplication::findQueue
 
 	int i = 0;
 	for (const auto& queueFamily : queueFamilies) {
-		if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-			indices.graphicsFamily = i;
+		// グラフィックスを持たず転送が可能なキューファミリ（DMAエンジン）を転送用に使う
+		// 計算キューも持たない純粋な転送キューを優先する
+		if (queueFamily.queueCount > 0
+			&& !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+			&& (queueFamily.queueFlags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT))
+			&& (!indices.transferFamily.has_value() || !(queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT))) {
+			indices.transferFamily = i;
 		}
 
-		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-		if (queueFamily.queueCount > 0 && presentSupport) {
-			indices.presentFamily = i;
-		}
+		// グラフィックス・プレゼンテーションは両方見つかった時点で確定する
+		if (!indices.isComplete()) {
+			if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+				indices.graphicsFamily = i;
+			}
 
-		if (indices.isComplete()) {
-			break;
+			VkBool32 presentSupport = false;
+			if (options.headless) {
+				// ヘッドレス時は表示しないため、グラフィックスキューを代わりに割り当てる
+				presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+			}
+			else {
+				vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+			}
+			if (queueFamily.queueCount > 0 && presentSupport) {
+				indices.presentFamily = i;
+			}
 		}
+
 		i++;
 	}
 
@@ -233,6 +342,9 @@ void HelloTriangleApplication::createLogicalDevice()
 	std::set<uint32_t> uniqueQueueFamilies = { 
 		indices.graphicsFamily.value(),
 		indices.presentFamily.value() };
+	if (indices.transferFamily.has_value()) {
+		uniqueQueueFamilies.insert(indices.transferFamily.value());
+	}
 
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -262,14 +374,60 @@ void HelloTriangleApplication::createLogicalDevice()
 	// SampleShading有効化
 	deviceFeatures.sampleRateShading = VK_TRUE;
 
+	// ブロック圧縮テクスチャ（対応していれば有効にし、使えるかは形式ごとに createTextureImage で確かめる）
+	VkPhysicalDeviceFeatures supportedFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+	textureCompressionBcEnabled = supportedFeatures.textureCompressionBC == VK_TRUE;
+	deviceFeatures.textureCompressionBC = supportedFeatures.textureCompressionBC;
+
+	// 仮想テクスチャはフラグメントシェーダーからフィードバックのストレージバッファへ書き込む
+	if (options.virtualTexture) {
+		if (supportedFeatures.fragmentStoresAndAtomics != VK_TRUE) {
+			throw std::runtime_error("virtual texturing requires fragmentStoresAndAtomics!");
+		}
+		deviceFeatures.fragmentStoresAndAtomics = VK_TRUE;
+	}
+
+	// カリングした描画は1回の間接描画にまとめ、描画コマンドの firstInstance で見えるインスタンスの領域を、
+	// gl_DrawID でオブジェクトの model 行列を選ぶ
+	if (options.culling != CullingMode::None) {
+		if (supportedFeatures.drawIndirectFirstInstance != VK_TRUE) {
+			throw std::runtime_error("culling requires drawIndirectFirstInstance!");
+		}
+		if (!isDeviceExtensionAvailable(physicalDevice, VK_KHR_SHADER_DRAW_PARAMETERS_EXTENSION_NAME)) {
+			throw std::runtime_error("culling requires VK_KHR_shader_draw_parameters!");
+		}
+		deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+		deviceFeatures.multiDrawIndirect = supportedFeatures.multiDrawIndirect;
+	}
+
 	// 論理デバイス作成情報
 	VkDeviceCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	createInfo.pEnabledFeatures = &deviceFeatures;
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	std::vector<const char*> extensions = getRequiredDeviceExtensions();
+
+	// パイプラインキャッシュのヒット率を計測するために作成フィードバックを使う
+	pipelineFeedbackEnabled = isDeviceExtensionAvailable(physicalDevice, VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+	if (pipelineFeedbackEnabled) {
+		extensions.push_back(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME);
+	}
+
+	// 描画数は GPU の書いた値から取れればそれを使い、取れなければ multiDrawIndirect で最大数のコマンドを描く（空のコマンドは何も描かない）
+	if (options.culling != CullingMode::None) {
+		extensions.push_back(VK_KHR_SHADER_DRAW_PARAMETERS_EXTENSION_NAME);
+		drawIndirectCountEnabled = isDeviceExtensionAvailable(physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		if (drawIndirectCountEnabled) {
+			extensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		}
+		else if (supportedFeatures.multiDrawIndirect != VK_TRUE) {
+			throw std::runtime_error("culling requires VK_KHR_draw_indirect_count or multiDrawIndirect!");
+		}
+	}
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+	createInfo.ppEnabledExtensionNames = extensions.data();
 
 	if (enableValidationLayers) {
 		createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -287,6 +445,16 @@ void HelloTriangleApplication::createLogicalDevice()
 	// キュー取得
 	vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
 	vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+	vkGetDeviceQueue(device, indices.transferFamily.value_or(indices.graphicsFamily.value()), 0, &transferQueue);
+	queueFamilyIndices = indices;
+
+	if (drawIndirectCountEnabled) {
+		cmdDrawIndexedIndirectCount = reinterpret_cast<PFN_vkCmdDrawIndexedIndirectCountKHR>(
+			vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR"));
+	}
+
+	allocator.init(physicalDevice, device);
+	pipelineCache.init(physicalDevice, device, PIPELINE_CACHE_PATH);
 }
 
 // スワップチェーン作成に必要な情報を集める
@@ -334,7 +502,7 @@ VkSurfaceFormatKHR HelloTriangleApplication::chooseSwapSurfaceFormat(const std::
 {
 	for (const auto& availableFormat : availableFormats)
 	{
-		if (availableFormat.format == VK_FORMAT_B8G8R8A8_UNORM	// BGRA 8bit unsignd int
+		if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB	// BGRA 8bit（書き込み時に sRGB へ符号化する）
 			&& availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR	// SRGB
 			) {
 			return availableFormat;
@@ -380,6 +548,11 @@ VkExtent2D HelloTriangleApplication::chooseSwapExtent(const VkSurfaceCapabilitie
 // スワップチェーンの作成
 void HelloTriangleApplication::createSwapChain()
 {
+	if (options.headless) {
+		createOffscreenImages();
+		return;
+	}
+
 	// スワップチェーン作成に必要な情報を集める
 	SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
@@ -433,12 +606,18 @@ void HelloTriangleApplication::createSwapChain()
 	createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
 	createInfo.presentMode = presentMode;
 	createInfo.clipped = VK_TRUE;	// ウィンドウが隠れたときなどはクリッピングする
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+
+	// 再作成時は古いスワップチェーンを渡し、表示中のイメージをドライバーに引き継がせる
+	VkSwapchainKHR oldSwapChain = swapChain;
+	createInfo.oldSwapchain = oldSwapChain;
 
 	// スワップチェーン作成
 	if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create swap chain!");
 	}
+	if (oldSwapChain != VK_NULL_HANDLE) {
+		vkDestroySwapchainKHR(device, oldSwapChain, nullptr);
+	}
 
 	vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
 	swapChainImages.resize(imageCount);
@@ -458,19 +637,70 @@ void HelloTriangleApplication::recreateSwapChain()
 
 	vkDeviceWaitIdle(device);
 
+	const VkFormat oldImageFormat = swapChainImageFormat;
+	const size_t oldImageCount = swapChainImages.size();
+
 	cleanupSwapChain();
 
 	createSwapChain();
 	createImageViews();
-	createRenderPass();
-	createGraphicsPipeline();
+
+	// ビューポートとシザーは記録時に設定するため、パイプラインはサイズに依存しない
+	// フォーマットが変わった場合のみレンダーパスとパイプラインを作り直す
+	if (swapChainImageFormat != oldImageFormat) {
+		vkDestroyPipeline(device, graphicsPipeline, nullptr);
+		vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+		vkDestroyRenderPass(device, renderPass, nullptr);
+		createRenderPass();
+		createGraphicsPipeline();
+	}
+
 	createColorResources();
 	createDepthResource();
 	createFramebuffers();
-	createUniformBuffers();
-	createDescriptorPool();
-	createDescriptorSets();
-	createCommandBuffers();
+
+	// ユニフォームはイメージごとに持つため、イメージ数が変わった場合のみ作り直してセットを書き換える
+	if (swapChainImages.size() != oldImageCount) {
+		vkDestroyBuffer(device, uniformBuffer, nullptr);
+		allocator.free(uniformBufferMemory);
+		createUniformBuffers();
+		writeDescriptorSets();
+		if (options.culling == CullingMode::Gpu) {
+			writeCullDescriptorSets();
+		}
+	}
+
+	// アタッチメントのレイアウト遷移をサブミットする
+	// 同じグラフィックスキューで後続のフレームより先に実行されるため完了は待たない
+	graphicsUploads.submit();
+
+	// イメージ数が変わる可能性があるため使用中フェンスの対応をリセットする
+	imagesInFlight.assign(swapChainImages.size(), VK_NULL_HANDLE);
+}
+
+// オフスクリーン描画先作成
+void HelloTriangleApplication::createOffscreenImages()
+{
+	swapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+	swapChainExtent = { static_cast<uint32_t>(WIDTH), static_cast<uint32_t>(HEIGHT) };
+
+	// フレームスロットごとに1枚ずつ用意する
+	swapChainImages.resize(maxFramesInFlight);
+	offscreenImagesMemory.resize(maxFramesInFlight);
+
+	for (size_t i = 0; i < swapChainImages.size(); i++) {
+		createImage(
+			swapChainExtent.width,
+			swapChainExtent.height,
+			1,
+			VK_SAMPLE_COUNT_1_BIT,
+			swapChainImageFormat,
+			VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+			swapChainImages[i],
+			offscreenImagesMemory[i]);
+	}
 }
 
 void HelloTriangleApplication::createImageViews()
@@ -502,7 +732,10 @@ void HelloTriangleApplication::createRenderPass()
 	colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// ヘッドレス時は表示せず、読み出し可能なレイアウトで終える
+	colorAttachmentResolve.finalLayout = options.headless
+		? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+		: VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentDescription depthAttachment = {};
 	depthAttachment.format = findDepthFormat();
@@ -561,8 +794,12 @@ void HelloTriangleApplication::createRenderPass()
 // グラフィックスパイプライン作成
 void HelloTriangleApplication::createGraphicsPipeline()
 {
-	auto vertShaderCode = readFile("shaders/vert.spv");
-	auto fragShaderCode = readFile("shaders/frag.spv");
+	// カリングするときはオブジェクトの model 行列を描画コマンドごとの表から読む版を使う
+	const bool indirectDraw = options.culling != CullingMode::None;
+	auto vertShaderCode = readFile(GpuVertex::HAS_COLOR
+		? (indirectDraw ? "shaders/vert_color_indirect.spv" : "shaders/vert_color.spv")
+		: (indirectDraw ? "shaders/vert_indirect.spv" : "shaders/vert.spv"));
+	auto fragShaderCode = readFile(options.virtualTexture ? "shaders/frag_virtual.spv" : "shaders/frag.spv");
 
 	// シェーダーモジュール用意
 	VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
@@ -588,13 +825,20 @@ void HelloTriangleApplication::createGraphicsPipeline()
 	};
 
 	// Vertex input
-	auto bindingDescription = Vertex::getBindingDescription();
-	auto attributeDescriptions = Vertex::getAttributeDescriptions();
+	// バインディング0は頂点単位、バインディング1はインスタンス単位で読む
+	std::array<VkVertexInputBindingDescription, 2> bindingDescriptions = {
+		GpuVertex::getBindingDescription(),
+		InstanceData::getBindingDescription()
+	};
+	std::vector<VkVertexInputAttributeDescription> attributeDescriptions = GpuVertex::getAttributeDescriptions();
+	for (const auto& attribute : InstanceData::getAttributeDescriptions()) {
+		attributeDescriptions.push_back(attribute);
+	}
 
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
 	vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	vertexInputInfo.vertexBindingDescriptionCount = 1;
-	vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+	vertexInputInfo.vertexBindingDescriptionCount = static_cast<uint32_t>(bindingDescriptions.size());
+	vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
 	vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
 	vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
@@ -604,27 +848,14 @@ void HelloTriangleApplication::createGraphicsPipeline()
 	inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
 	inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-	// Viewport
-	VkViewport viewport = {};
-	viewport.x = 0.0f;
-	viewport.y = 0.0f;
-	viewport.width = (float)swapChainExtent.width;
-	viewport.height = (float)swapChainExtent.height;
-	viewport.minDepth = 0.0f;
-	viewport.maxDepth = 1.0f;
-
-	// Scissor
-	VkRect2D scissor = {};
-	scissor.offset = { 0, 0 };
-	scissor.extent = swapChainExtent;
-
 	// Pipeline ViewportState
+	// ビューポートとシザーはダイナミックステートにして、コマンドバッファ記録時に設定する
 	VkPipelineViewportStateCreateInfo viewportState = {};
 	viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
 	viewportState.viewportCount = 1;
-	viewportState.pViewports = &viewport;
+	viewportState.pViewports = nullptr;
 	viewportState.scissorCount = 1;
-	viewportState.pScissors = &scissor;
+	viewportState.pScissors = nullptr;
 
 	// DepthStencilState
 	VkPipelineDepthStencilStateCreateInfo depthStencil = {};
@@ -689,7 +920,7 @@ void HelloTriangleApplication::createGraphicsPipeline()
 	// Dinamic state
 	VkDynamicState dynamicStates[] = {
 		VK_DYNAMIC_STATE_VIEWPORT,
-		VK_DYNAMIC_STATE_LINE_WIDTH
+		VK_DYNAMIC_STATE_SCISSOR
 	};
 	VkPipelineDynamicStateCreateInfo dynamicState = {};
 	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
@@ -720,22 +951,38 @@ void HelloTriangleApplication::createGraphicsPipeline()
 	pipelineInfo.pMultisampleState = &multisampling;
 	pipelineInfo.pDepthStencilState = &depthStencil;
 	pipelineInfo.pColorBlendState = &colorBlending;
-	pipelineInfo.pDynamicState = nullptr;				// Optional
+	pipelineInfo.pDynamicState = &dynamicState;
 	pipelineInfo.layout = pipelineLayout;
 	pipelineInfo.renderPass = renderPass;
 	pipelineInfo.subpass = 0;
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 	pipelineInfo.basePipelineIndex = -1;
 
+	// キャッシュから作成できたかをドライバーに報告してもらう
+	VkPipelineCreationFeedbackEXT pipelineFeedback = {};
+	std::array<VkPipelineCreationFeedbackEXT, 2> stageFeedbacks = {};
+	VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo = {};
+	feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+	feedbackInfo.pPipelineCreationFeedback = &pipelineFeedback;
+	feedbackInfo.pipelineStageCreationFeedbackCount = pipelineInfo.stageCount;
+	feedbackInfo.pPipelineStageCreationFeedbacks = stageFeedbacks.data();
+	if (pipelineFeedbackEnabled) {
+		pipelineInfo.pNext = &feedbackInfo;
+	}
+
+	auto createStart = std::chrono::high_resolution_clock::now();
 	if (vkCreateGraphicsPipelines(
 		device,
-		VK_NULL_HANDLE,
+		pipelineCache.get(),
 		1,
 		&pipelineInfo,
 		nullptr,
 		&graphicsPipeline) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create graphics pipeline!");
 	}
+	pipelineCache.recordCreation(
+		pipelineFeedbackEnabled ? &pipelineFeedback : nullptr,
+		elapsedMs(createStart, std::chrono::high_resolution_clock::now()));
 
 	// グラフィックスパイプライン作成後はShaderModuleを破棄する
 	vkDestroyShaderModule(device, fragShaderModule, nullptr);
@@ -743,10 +990,11 @@ void HelloTriangleApplication::createGraphicsPipeline()
 }
 
 // シェーダーモジュール作成
-VkShaderModule HelloTriangleApplication::createShaderModule(const std::vector<char>& code)
+VkShaderModule HelloTriangleApplication::createShaderModule(const FileView& code)
 {
 	VkShaderModuleCreateInfo createInfo = {};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+	// マップ先頭やヒープ確保の先頭は4バイト境界に揃っている
 	createInfo.codeSize = code.size();
 	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());
 
@@ -791,119 +1039,243 @@ void HelloTriangleApplication::createCommandPool()
 {
 	QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
 
+	// 毎フレーム記録し直すため TRANSIENT にし、コマンドバッファ単位ではなくプール単位でリセットする
 	VkCommandPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
 	poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-	poolInfo.flags = 0;	// Optional
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
 
-	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create command pool!");
+	frameCommands.resize(maxFramesInFlight);
+	for (auto& frame : frameCommands) {
+		frame.secondaryPools.resize(threadPool.size());
+		if (vkCreateCommandPool(device, &poolInfo, nullptr, &frame.primaryPool) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create command pool!");
+		}
+		for (auto& pool : frame.secondaryPools) {
+			if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+				throw std::runtime_error("failed to create command pool!");
+			}
+		}
 	}
+
+	graphicsUploads.init(device, graphicsQueue, queueFamilyIndices.graphicsFamily.value());
+	transferUploads.init(
+		device,
+		transferQueue,
+		queueFamilyIndices.transferFamily.value_or(queueFamilyIndices.graphicsFamily.value()));
 }
 
 // コマンドバッファ作成
 void HelloTriangleApplication::createCommandBuffers()
 {
-	commandBuffers.resize(swapChainImages.size());
+	for (auto& frame : frameCommands) {
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.commandPool = frame.primaryPool;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandBufferCount = 1;
+
+		if (vkAllocateCommandBuffers(device, &allocInfo, &frame.primary) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate command buffers!");
+		}
 
-	VkCommandBufferAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.commandPool = commandPool;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandBufferCount = (uint32_t)commandBuffers.size();
+		frame.secondaries.resize(frame.secondaryPools.size());
+		for (size_t i = 0; i < frame.secondaryPools.size(); i++) {
+			allocInfo.commandPool = frame.secondaryPools[i];
+			allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
 
-	if (vkAllocateCommandBuffers(device, &allocInfo, commandBuffers.data()) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate command buffers!");
+			if (vkAllocateCommandBuffers(device, &allocInfo, &frame.secondaries[i]) != VK_SUCCESS) {
+				throw std::runtime_error("failed to allocate command buffers!");
+			}
+		}
 	}
+}
 
-	for (size_t i = 0; i < commandBuffers.size(); i++) {
-		VkCommandBufferBeginInfo beginInfo = {};
-		beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-		beginInfo.flags = 0;	// Optional
-		beginInfo.pInheritanceInfo = nullptr; // Optional
+// フレームのコマンドを記録する
+void HelloTriangleApplication::recordCommandBuffer(size_t frameIndex, uint32_t imageIndex)
+{
+	FrameCommands& frame = frameCommands[frameIndex];
 
-		if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS) {
-			throw std::runtime_error("failed to begin recording command buffer!");
-		}
+	// このフレームスロットの前回のコマンドはフェンス待ちで完了しているので、プールごとリセットする
+	vkResetCommandPool(device, frame.primaryPool, 0);
+	for (VkCommandPool pool : frame.secondaryPools) {
+		vkResetCommandPool(device, pool, 0);
+	}
 
-		VkRenderPassBeginInfo renderPassInfo = {};
-		renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass = renderPass;
-		renderPassInfo.framebuffer = swapChainFramebuffers[i];
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+	beginInfo.pInheritanceInfo = nullptr; // Optional
 
-		// レンダーエリア定義
-		renderPassInfo.renderArea.offset = { 0,0 };
-		renderPassInfo.renderArea.extent = swapChainExtent;
+	if (vkBeginCommandBuffer(frame.primary, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("failed to begin recording command buffer!");
+	}
 
-		// クリアカラー定義
-		std::array<VkClearValue, 2> clearValues = {};
-		clearValues[0] = { 0.0f, 0.0f, 0.0f, 1.0f };
-		clearValues[1] = { 1.0f, 0 };
-		renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
-		renderPassInfo.pClearValues = clearValues.data();
+	VkRenderPassBeginInfo renderPassInfo = {};
+	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass = renderPass;
+	renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+
+	// レンダーエリア定義
+	renderPassInfo.renderArea.offset = { 0,0 };
+	renderPassInfo.renderArea.extent = swapChainExtent;
+
+	// クリアカラー定義
+	std::array<VkClearValue, 2> clearValues = {};
+	clearValues[0] = { 0.0f, 0.0f, 0.0f, 1.0f };
+	clearValues[1] = { 1.0f, 0 };
+	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
+	renderPassInfo.pClearValues = clearValues.data();
+
+	// 見えるインスタンスと間接描画コマンドをコンピュートで生成するか、CPU で求めたものを転送する
+	if (options.culling == CullingMode::Gpu) {
+		recordCulling(frame.primary, frameIndex, imageIndex);
+	}
+	else if (options.culling == CullingMode::Cpu) {
+		recordCullingUpload(frame.primary, frameIndex);
+	}
 
-		// レンダーパス開始
-		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+	// レンダーパス開始（描画はセカンダリコマンドバッファから実行する）
+	vkCmdBeginRenderPass(frame.primary, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+
+	// 描画を連続した範囲に分け、範囲ごとに別のプール・セカンダリコマンドバッファへ並列に記録する
+	// カリングするときは全オブジェクトを1回の間接描画で描く
+	const uint32_t drawCount = options.culling == CullingMode::None ? options.objectCount : 1;
+	const size_t jobCount = std::max<size_t>(1, std::min<size_t>(
+		frame.secondaries.size(),
+		(drawCount + MIN_DRAWS_PER_SECONDARY - 1) / MIN_DRAWS_PER_SECONDARY));
+
+	// テクスチャをストリーミング中なら、転送し終えたレベルまでしか読まないセットを使う
+	const VkDescriptorSet descriptorSet = descriptorSets[residentMipLevel];
+
+	// 間接描画の model 行列の表と、仮想テクスチャのページテーブル・フィードバックはフレームスロットの領域を使う
+	// ダイナミックオフセットはバインディング番号の順に並べる
+	std::array<uint32_t, 4> frameOffsets = {};
+	uint32_t dynamicOffsetCount = 1;
+	if (options.culling != CullingMode::None) {
+		frameOffsets[dynamicOffsetCount++] = static_cast<uint32_t>(drawModelSlotSize * frameIndex);
+	}
+	if (options.virtualTexture) {
+		frameOffsets[dynamicOffsetCount++] = static_cast<uint32_t>(pageTableSlotSize * frameIndex);
+		frameOffsets[dynamicOffsetCount++] = static_cast<uint32_t>(feedbackSlotSize * frameIndex);
+	}
 
-		// グラフィックスパイプラインバインド
-		vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+	threadPool.parallelFor(jobCount, [&](size_t job) {
+		VkCommandBuffer commandBuffer = frame.secondaries[job];
+		const uint32_t firstDraw = static_cast<uint32_t>(drawCount * job / jobCount);
+		const uint32_t endDraw = static_cast<uint32_t>(drawCount * (job + 1) / jobCount);
 
-		VkBuffer vertexBuffers[] = { vertexBuffer };
-		VkDeviceSize offsets[] = { 0 };
-		vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-		vkCmdBindIndexBuffer(commandBuffers[i], indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+		// レンダーパス内で実行するため、レンダーパスとフレームバッファを継承する
+		VkCommandBufferInheritanceInfo inheritanceInfo = {};
+		inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+		inheritanceInfo.renderPass = renderPass;
+		inheritanceInfo.subpass = 0;
+		inheritanceInfo.framebuffer = swapChainFramebuffers[imageIndex];
 
-		// ディスクリプタセットバインド
-		vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSets[i], 0, nullptr);
+		VkCommandBufferBeginInfo secondaryBeginInfo = {};
+		secondaryBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		secondaryBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+		secondaryBeginInfo.pInheritanceInfo = &inheritanceInfo;
 
-		// 描画命令
-		vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+		if (vkBeginCommandBuffer(commandBuffer, &secondaryBeginInfo) != VK_SUCCESS) {
+			throw std::runtime_error("failed to begin recording command buffer!");
+		}
 
-		// レンダーパス記録完了
-		vkCmdEndRenderPass(commandBuffers[i]);
+		// グラフィックスパイプラインバインド
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+		// ビューポート・シザー（ダイナミックステートはセカンダリコマンドバッファごとに設定する）
+		VkViewport viewport = {};
+		viewport.x = 0.0f;
+		viewport.y = 0.0f;
+		viewport.width = (float)swapChainExtent.width;
+		viewport.height = (float)swapChainExtent.height;
+		viewport.minDepth = 0.0f;
+		viewport.maxDepth = 1.0f;
+		vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+		VkRect2D scissor = {};
+		scissor.offset = { 0, 0 };
+		scissor.extent = swapChainExtent;
+		vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+		// インスタンスデータはこのフレームスロットの領域を使う（カリングするときは見えるインスタンスだけを読む）
+		VkBuffer vertexBuffers[] = { vertexBuffer, instanceBuffer };
+		VkDeviceSize offsets[] = { 0, sizeof(InstanceData) * instanceCapacity * frameIndex };
+		if (options.culling != CullingMode::None) {
+			vertexBuffers[1] = visibleInstanceBuffer;
+			offsets[1] = visibleInstanceSlotSize * frameIndex;
+		}
+		vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, offsets);
+		vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, indexType);
+
+		// 先頭のダイナミックオフセットで描画ごとにオブジェクトのユニフォームを選ぶ
+		std::array<uint32_t, 4> dynamicOffsets = frameOffsets;
+
+		if (options.culling != CullingMode::None) {
+			// view・proj などは全オブジェクトで同じなので、オブジェクト 0 のユニフォームを使う
+			dynamicOffsets[0] = uniformOffset(imageIndex, 0);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, dynamicOffsetCount, dynamicOffsets.data());
+
+			// カリングで詰めた描画コマンドを1回で描く
+			const VkDeviceSize commandOffset = indirectSlotSize * frameIndex + sizeof(IndirectHeader);
+			if (drawIndirectCountEnabled) {
+				cmdDrawIndexedIndirectCount(
+					commandBuffer,
+					indirectBuffer,
+					commandOffset,
+					indirectBuffer,
+					indirectSlotSize * frameIndex + offsetof(IndirectHeader, drawCount),
+					maxIndirectDraws,
+					sizeof(VkDrawIndexedIndirectCommand));
+			}
+			else {
+				// 使わなかったコマンドは 0 で埋めてあり、何も描かない
+				vkCmdDrawIndexedIndirect(commandBuffer, indirectBuffer, commandOffset, maxIndirectDraws, sizeof(VkDrawIndexedIndirectCommand));
+			}
+		}
+		else {
+			for (uint32_t object = firstDraw; object < endDraw; object++) {
+				// ディスクリプタセットバインド（ダイナミックオフセットでオブジェクトのユニフォームを選ぶ）
+				dynamicOffsets[0] = uniformOffset(imageIndex, object);
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &descriptorSet, dynamicOffsetCount, dynamicOffsets.data());
+
+				// 描画命令（全インスタンスをオブジェクトごとに選んだ LOD で1回で描く）
+				const MeshCache::Lod& lod = meshLods[objectLods[object]];
+				vkCmdDrawIndexed(commandBuffer, lod.indexCount, instances.size(), lod.firstIndex, 0, 0);
+			}
+		}
 
-		// コマンドバッファ記録完了
-		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
+		if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
 			throw std::runtime_error("failed to record command buffer!");
 		}
-	}
-}
-
-// コマンドバッファの作成とレコード開始を行う
-VkCommandBuffer HelloTriangleApplication::beginSingleTimeCommands()
-{
-	VkCommandBufferAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-	allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-	allocInfo.commandPool = commandPool;
-	allocInfo.commandBufferCount = 1;
-
-	VkCommandBuffer commandBuffer;
-	vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-	VkCommandBufferBeginInfo beginInfo = {};
-	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-	vkBeginCommandBuffer(commandBuffer, &beginInfo);
+	});
 
-	return commandBuffer;
-}
-
-// コマンドバッファのレコード完了・サブミット・解放
-void HelloTriangleApplication::endSingleTimeCommands(VkCommandBuffer commandBuffer)
-{
-	vkEndCommandBuffer(commandBuffer);
+	vkCmdExecuteCommands(frame.primary, static_cast<uint32_t>(jobCount), frame.secondaries.data());
 
-	VkSubmitInfo submitInfo = {};
-	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffer;
+	// レンダーパス記録完了
+	vkCmdEndRenderPass(frame.primary);
 
-	vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(graphicsQueue);
+	// 仮想テクスチャのフィードバックをフェンスを待った後に CPU で読めるようにする
+	if (options.virtualTexture) {
+		VkMemoryBarrier feedbackBarrier = {};
+		feedbackBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+		feedbackBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		feedbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+		vkCmdPipelineBarrier(
+			frame.primary,
+			VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+			VK_PIPELINE_STAGE_HOST_BIT,
+			0,
+			1, &feedbackBarrier,
+			0, nullptr,
+			0, nullptr);
+	}
 
-	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+	// コマンドバッファ記録完了
+	if (vkEndCommandBuffer(frame.primary) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record command buffer!");
+	}
 }
 
 // バッファ作成
@@ -912,7 +1284,7 @@ void HelloTriangleApplication::createBuffer(
 	VkBufferUsageFlags usage,
 	VkMemoryPropertyFlags properties,
 	VkBuffer& buffer,
-	VkDeviceMemory& bufferMemory)
+	MemoryAllocator::Allocation& bufferMemory)
 {
 	VkBufferCreateInfo bufferInfo = {};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -920,6 +1292,17 @@ void HelloTriangleApplication::createBuffer(
 	bufferInfo.usage = usage;
 	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+	// 専用の転送キューで読み書きするバッファは、所有権の移動を省くためグラフィックスキューと共有する
+	uint32_t sharedQueueFamilies[2];
+	if ((usage & (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT))
+		&& queueFamilyIndices.transferFamily.has_value()) {
+		sharedQueueFamilies[0] = queueFamilyIndices.graphicsFamily.value();
+		sharedQueueFamilies[1] = queueFamilyIndices.transferFamily.value();
+		bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+		bufferInfo.queueFamilyIndexCount = 2;
+		bufferInfo.pQueueFamilyIndices = sharedQueueFamilies;
+	}
+
 	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create buffer!");
 	}
@@ -927,30 +1310,61 @@ void HelloTriangleApplication::createBuffer(
 	VkMemoryRequirements memRequirements;
 	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate buffer memory!");
-	}
+	// 個別に vkAllocateMemory せず、サブアロケータのブロックから切り出す
+	bufferMemory = allocator.allocate(memRequirements, properties, MemoryAllocator::ResourceKind::Linear);
 
-	vkBindBufferMemory(device, buffer, bufferMemory, 0);
+	vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
 }
 
 // モデルロード
 void HelloTriangleApplication::loadModel() {
+	auto loadStart = std::chrono::high_resolution_clock::now();
+
+	// 元ファイルの内容が変わっていなければキャッシュを使う
+	const std::string cachePath = MODEL_PATH + MESH_CACHE_SUFFIX;
+	const MeshCache::Layout layout = getMeshCacheLayout();
+	FileView sourceFile = readFile(MODEL_PATH);
+	const MeshCache::SourceInfo source = MeshCache::hashSource(sourceFile, threadPool);
+
+	if (meshCache.open(cachePath, source, layout)) {
+		vertexCount = static_cast<uint32_t>(meshCache.getVertexCount());
+		indexCount = static_cast<uint32_t>(meshCache.getIndexCount());
+		indexType = meshCache.getIndexSize() == 2 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+		meshLods = meshCache.getLods();
+		meshDequantization = meshCache.getDequantization();
+		computeMeshBounds(static_cast<const GpuVertex*>(meshCache.getVertexData()), vertexCount);
+
+		std::cout << "model: " << vertexCount << " vertices, " << indexCount << " indices (" << meshLods.size()
+			<< " LODs) from " << cachePath << ", "
+			<< elapsedMs(loadStart, std::chrono::high_resolution_clock::now()) << " ms" << std::endl;
+		return;
+	}
+
 	tinyobj::attrib_t attrib;
 	std::vector<tinyobj::shape_t> shapes;
 	std::vector<tinyobj::material_t> materials;
 	std::string warn, err;
 
-	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str())) {
-		throw std::runtime_error(warn + err);
+	// ファイルをチャンクに分けて並列に解析する
+	// マテリアルや多角形など並列ローダーが扱わない要素を含む場合は tinyobj で読み直す
+	ParallelObjLoader objLoader(threadPool);
+	if (!objLoader.load(sourceFile, &attrib, &shapes, &warn)) {
+		warn.clear();
+		if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, MODEL_PATH.c_str())) {
+			throw std::runtime_error(warn + err);
+		}
+	}
+	sourceFile.reset();
+
+	// インデックス数が一意な頂点数の上限なので、先に確保して再ハッシュを避ける
+	size_t totalIndices = 0;
+	for (const auto& shape : shapes) {
+		totalIndices += shape.mesh.indices.size();
 	}
 
-	std::unordered_map<Vertex, uint32_t> uniqueVertices = {};
+	FlatHashMap<Vertex, uint32_t> uniqueVertices;
+	uniqueVertices.reserve(totalIndices);
+	indices.reserve(totalIndices);
 
 	for (const auto& shape : shapes) {
 		for (const auto& index : shape.mesh.indices) {
@@ -968,36 +1382,200 @@ void HelloTriangleApplication::loadModel() {
 			};
 
 			vertex.color = { 1.0f, 1.0f, 1.0f };
-			vertices.push_back(vertex);
 
-			if (uniqueVertices.count(vertex) == 0) {
-				uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
+			// 初めて現れた頂点だけを追加し、そのインデックスを参照する
+			auto result = uniqueVertices.insert(vertex, static_cast<uint32_t>(vertices.size()));
+			if (result.second) {
 				vertices.push_back(vertex);
 			}
 
-			indices.push_back(uniqueVertices[vertex]);
+			indices.push_back(*result.first);
 		}
 	}
+
+	std::cout << "model: " << totalIndices << " vertices in, " << vertices.size() << " vertices out, "
+		<< elapsedMs(loadStart, std::chrono::high_resolution_clock::now()) << " ms" << std::endl;
+
+	meshBounds = BoundingSphere::fromPositions(
+		reinterpret_cast<const char*>(vertices.data()) + offsetof(Vertex, pos), vertices.size(), sizeof(Vertex));
+	buildLods();
+	optimizeMesh();
+	packVertices();
+
+	vertexCount = static_cast<uint32_t>(packedVertices.size());
+	indexCount = static_cast<uint32_t>(indices.size());
+	indexType = VK_INDEX_TYPE_UINT32;
+
+	// 次回の起動用に LOD ごとキャッシュを書き出す（65536 頂点以下なら 16bit インデックスで保存する）
+	uint32_t cacheIndexSize = packedVertices.size() <= 0x10000 ? 2 : 4;
+	if (!MeshCache::write(
+		cachePath,
+		source,
+		layout,
+		packedVertices.data(),
+		packedVertices.size(),
+		meshDequantization,
+		indices.data(),
+		indices.size(),
+		cacheIndexSize,
+		meshLods)) {
+		std::cerr << "failed to write mesh cache: " << cachePath << std::endl;
+	}
 }
 
-void HelloTriangleApplication::createVertexBuffer()
+// 粗い LOD を作る
+void HelloTriangleApplication::buildLods()
 {
-	VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+	auto buildStart = std::chrono::high_resolution_clock::now();
+
+	MeshCache::Lod baseLod;
+	baseLod.indexCount = static_cast<uint32_t>(indices.size());
+	meshLods.assign(1, baseLod);
+
+	// 1段前の LOD をさらに簡略化する（誤差は各段の誤差を足して見積もる）
+	MeshSimplifier simplifier(
+		reinterpret_cast<const char*>(vertices.data()) + offsetof(Vertex, pos), vertices.size(), sizeof(Vertex));
+	const float maxError = meshBounds.radius * LOD_MAX_ERROR_RATIO;
+	std::vector<uint32_t> previous = indices;
+	float previousError = 0.0f;
+
+	while (meshLods.size() < MeshCache::MAX_LODS && previousError < maxError) {
+		size_t targetIndexCount = static_cast<size_t>(previous.size() / 3 * LOD_INDEX_RATIO) * 3;
+		float error = 0.0f;
+		std::vector<uint32_t> simplified = simplifier.simplify(
+			previous.data(), previous.size(), targetIndexCount, maxError - previousError, &error);
+
+		// 1割も減らなければ、それ以上は誤差の上限か境界・継ぎ目に阻まれているので打ち切る
+		if (simplified.empty() || simplified.size() * 10 > previous.size() * 9) {
+			break;
+		}
 
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(
-		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer,
-		stagingBufferMemory);
+		MeshCache::Lod lod;
+		lod.firstIndex = static_cast<uint32_t>(indices.size());
+		lod.indexCount = static_cast<uint32_t>(simplified.size());
+		lod.error = previousError + error;
+		indices.insert(indices.end(), simplified.begin(), simplified.end());
+		meshLods.push_back(lod);
+
+		previousError = lod.error;
+		previous = std::move(simplified);
+	}
+
+	std::cout << "model LODs:";
+	for (const auto& lod : meshLods) {
+		std::cout << " " << lod.indexCount / 3 << " triangles (error " << lod.error << ")";
+	}
+	std::cout << ", " << elapsedMs(buildStart, std::chrono::high_resolution_clock::now()) << " ms" << std::endl;
+}
+
+// 描画順・頂点順の最適化
+// 並べ替えた結果はメッシュキャッシュに保存されるので、次回からの起動と描画には手間がかからない
+void HelloTriangleApplication::optimizeMesh()
+{
+	auto optimizeStart = std::chrono::high_resolution_clock::now();
+
+	std::vector<VertexCacheStats> statsBefore;
+	std::vector<VertexCacheStats> statsAfter;
+	for (const auto& lod : meshLods) {
+		uint32_t* lodIndices = indices.data() + lod.firstIndex;
+		statsBefore.push_back(analyzeVertexCache(lodIndices, lod.indexCount, vertices.size()));
+
+		optimizeVertexCache(lodIndices, lod.indexCount, vertices.size());
+		optimizeOverdraw(
+			lodIndices,
+			lod.indexCount,
+			reinterpret_cast<const char*>(vertices.data()) + offsetof(Vertex, pos),
+			vertices.size(),
+			sizeof(Vertex));
+
+		statsAfter.push_back(analyzeVertexCache(lodIndices, lod.indexCount, vertices.size()));
+	}
+
+	// 頂点は LOD 0 で初めて参照される順に並ぶ（粗い LOD は LOD 0 の頂点の一部を使う）
+	optimizeVertexFetch(vertices.data(), vertices.size(), sizeof(Vertex), indices.data(), indices.size());
+
+	std::cout << "model vertex cache (ACMR / ATVR, " << VERTEX_CACHE_SIZE << " entries):";
+	for (size_t i = 0; i < meshLods.size(); i++) {
+		std::cout << " LOD " << i << " " << statsBefore[i].acmr << " / " << statsBefore[i].atvr
+			<< " -> " << statsAfter[i].acmr << " / " << statsAfter[i].atvr;
+	}
+	std::cout << ", " << elapsedMs(optimizeStart, std::chrono::high_resolution_clock::now()) << " ms" << std::endl;
+}
+
+// LOD を選ぶ
+// LOD の誤差はメッシュ空間の距離なので、境界球の半径の比（radius / meshBounds.radius）でワールドの大きさに直し、
+// 距離 distance から画面上のピクセル数に投影したものが lodThreshold 以下になる最も粗い LOD を使う
+// 比較は lodScale にまとめた係数で行い、shaders/cull.comp も同じ式で選ぶ
+// lodScale が 0 なら（--lod-threshold 0）、誤差が 0 の LOD も含めて元のメッシュ以外は使わない
+uint32_t HelloTriangleApplication::selectLod(const glm::vec3& center, float radius) const
+{
+	if (lodScale <= 0.0f) {
+		return 0;
+	}
+
+	float distance = std::max(glm::length(center - cameraPosition) - radius, 0.0f);
+
+	uint32_t lod = 0;
+	for (uint32_t i = 1; i < meshLods.size(); i++) {
+		if (meshLods[i].error * radius * lodScale <= distance) {
+			lod = i;
+		}
+	}
+	return lod;
+}
+
+// 頂点を GPU に送る形式に詰め直す
+// 位置とテクスチャ座標の範囲から量子化の変換を決め、頂点シェーダーで元に戻す
+void HelloTriangleApplication::packVertices()
+{
+	glm::vec3 positionMin(std::numeric_limits<float>::max());
+	glm::vec3 positionMax(-std::numeric_limits<float>::max());
+	glm::vec2 texCoordMin(std::numeric_limits<float>::max());
+	glm::vec2 texCoordMax(-std::numeric_limits<float>::max());
+	for (const auto& vertex : vertices) {
+		positionMin = glm::min(positionMin, vertex.pos);
+		positionMax = glm::max(positionMax, vertex.pos);
+		texCoordMin = glm::min(texCoordMin, vertex.texCoord);
+		texCoordMax = glm::max(texCoordMax, vertex.texCoord);
+	}
+	meshDequantization = GpuVertex::getDequantization(positionMin, positionMax, texCoordMin, texCoordMax);
+
+	packedVertices.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); i++) {
+		packedVertices[i] = GpuVertex::encode(vertices[i].pos, vertices[i].color, vertices[i].texCoord, meshDequantization);
+	}
+	std::vector<Vertex>().swap(vertices);
+
+	// 境界球は量子化した位置から求め直し、キャッシュから読んだ場合と一致させる
+	computeMeshBounds(packedVertices.data(), packedVertices.size());
+
+	std::cout << "model vertex format: " << sizeof(GpuVertex) << " bytes per vertex (" << sizeof(Vertex) << " unpacked), "
+		<< sizeof(GpuVertex) * packedVertices.size() / 1024 << " KiB" << std::endl;
+}
+
+// 量子化した位置を戻して境界球を求める
+void HelloTriangleApplication::computeMeshBounds(const GpuVertex* packed, size_t count)
+{
+	std::vector<glm::vec3> positions(count);
+	for (size_t i = 0; i < count; i++) {
+		positions[i] = packed[i].decodePosition(meshDequantization);
+	}
+	meshBounds = BoundingSphere::fromPositions(positions.data(), positions.size(), sizeof(glm::vec3));
+}
+
+// メッシュキャッシュに保存する頂点レイアウト
+MeshCache::Layout HelloTriangleApplication::getMeshCacheLayout()
+{
+	MeshCache::Layout layout;
+	layout.stride = sizeof(GpuVertex);
+	layout.attributes = GpuVertex::getAttributeDescriptions();
+	return layout;
+}
 
-	// メモリへデータをマップする
-	void* data;
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, vertices.data(), (size_t)bufferSize);
-	vkUnmapMemory(device, stagingBufferMemory);
+void HelloTriangleApplication::createVertexBuffer()
+{
+	VkDeviceSize bufferSize = sizeof(GpuVertex) * vertexCount;
+	const void* data = meshCache.isOpen() ? meshCache.getVertexData() : packedVertices.data();
 
 	createBuffer(
 		bufferSize,
@@ -1006,30 +1584,14 @@ void HelloTriangleApplication::createVertexBuffer()
 		vertexBuffer,
 		vertexBufferMemory);
 
-	copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
-
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+	uploadToBuffer(vertexBuffer, data, bufferSize);
 }
 
 // インデックスバッファ作成
 void HelloTriangleApplication::createIndexBuffer()
 {
-	VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
-
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-	createBuffer(
-		bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer,
-		stagingBufferMemory);
-
-	void* data;
-	vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices.data(), (size_t)bufferSize);
-	vkUnmapMemory(device, stagingBufferMemory);
+	VkDeviceSize bufferSize = (indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t)) * indexCount;
+	const void* data = meshCache.isOpen() ? meshCache.getIndexData() : indices.data();
 
 	createBuffer(
 		bufferSize,
@@ -1038,70 +1600,168 @@ void HelloTriangleApplication::createIndexBuffer()
 		indexBuffer,
 		indexBufferMemory);
 
-	copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+	uploadToBuffer(indexBuffer, data, bufferSize);
+}
+
+// ステージングリング作成
+void HelloTriangleApplication::createStagingRing()
+{
+	createBuffer(
+		STAGING_RING_SIZE,
+		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		stagingRingBuffer,
+		stagingRingMemory);
 
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+	stagingRing.init(stagingRingBuffer, stagingRingMemory.mapped, STAGING_RING_SIZE);
 }
 
-// バッファコピー
-void HelloTriangleApplication::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+// データをステージングリング経由でバッファへ転送する
+void HelloTriangleApplication::uploadToBuffer(VkBuffer dstBuffer, const void* data, VkDeviceSize size)
 {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+	// リングの半分ずつ転送し、前のチャンクの転送中に次のチャンクを書き込めるようにする
+	const VkDeviceSize chunkSize = stagingRing.getCapacity() / 2;
+	const char* src = static_cast<const char*>(data);
 
-	VkBufferCopy copyRegion = {};
-	copyRegion.size = size;
-	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+	for (VkDeviceSize offset = 0; offset < size; offset += chunkSize) {
+		VkDeviceSize copySize = std::min(chunkSize, size - offset);
+
+		StagingRing::Region region = stagingRing.allocate(copySize, 16, transferUploads);
+		memcpy(region.data, src + offset, static_cast<size_t>(copySize));
 
-	endSingleTimeCommands(commandBuffer);
+		copyBuffer(region.buffer, region.offset, dstBuffer, offset, copySize);
+	}
 }
 
-uint32_t HelloTriangleApplication::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+// ピクセルをステージングリング経由でイメージのミップ mipLevel へ転送する
+void HelloTriangleApplication::uploadToImage(
+	VkImage image,
+	const void* pixels,
+	uint32_t width,
+	uint32_t height,
+	uint32_t mipLevel,
+	uint32_t blockBytes,
+	uint32_t blockExtent)
 {
-	VkPhysicalDeviceMemoryProperties memProperties;
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+	const uint32_t blockRows = (height + blockExtent - 1) / blockExtent;
+	uploadImageRows(image, pixels, width, height, mipLevel, blockBytes, blockExtent, 0, blockRows);
+}
 
-	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
-		if (typeFilter & (1 << i)
-			&& (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
-			return i;
-		}
+// ピクセルのブロック行 [firstBlockRow, firstBlockRow + blockRowCount) をイメージのミップ mipLevel へ転送する
+void HelloTriangleApplication::uploadImageRows(
+	VkImage image,
+	const void* pixels,
+	uint32_t width,
+	uint32_t height,
+	uint32_t mipLevel,
+	uint32_t blockBytes,
+	uint32_t blockExtent,
+	uint32_t firstBlockRow,
+	uint32_t blockRowCount)
+{
+	// リングに収まらない範囲はブロックの行単位で分割して転送する
+	const uint32_t endRow = firstBlockRow + blockRowCount;
+	const VkDeviceSize rowPitch = static_cast<VkDeviceSize>((width + blockExtent - 1) / blockExtent) * blockBytes;
+	const VkDeviceSize chunkSize = stagingRing.getCapacity() / 2;
+	if (rowPitch > chunkSize) {
+		throw std::runtime_error("texture row does not fit in the staging ring!");
+	}
+
+	const uint32_t rowsPerChunk = static_cast<uint32_t>(chunkSize / rowPitch);
+	const char* src = static_cast<const char*>(pixels);
+
+	for (uint32_t row = firstBlockRow; row < endRow; row += rowsPerChunk) {
+		uint32_t rows = std::min(rowsPerChunk, endRow - row);
+		VkDeviceSize copySize = rowPitch * rows;
+
+		// bufferOffset はブロック（テクセル）サイズと4の倍数である必要がある
+		StagingRing::Region region = stagingRing.allocate(copySize, 16, graphicsUploads);
+		memcpy(region.data, src + rowPitch * row, static_cast<size_t>(copySize));
+
+		// 最後のブロックの行はイメージの下端で切る
+		uint32_t y = row * blockExtent;
+		copyBufferToImage(region.buffer, region.offset, image, mipLevel, width, y, std::min(rows * blockExtent, height - y));
 	}
+}
+
+// バッファコピー
+void HelloTriangleApplication::copyBuffer(
+	VkBuffer srcBuffer,
+	VkDeviceSize srcOffset,
+	VkBuffer dstBuffer,
+	VkDeviceSize dstOffset,
+	VkDeviceSize size)
+{
+	VkCommandBuffer commandBuffer = transferUploads.getCommandBuffer();
 
-	throw std::runtime_error("failed to find suitable memory type!");
+	VkBufferCopy copyRegion = {};
+	copyRegion.srcOffset = srcOffset;
+	copyRegion.dstOffset = dstOffset;
+	copyRegion.size = size;
+	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 }
 
 // テクスチャイメージ作成
 void HelloTriangleApplication::createTextureImage()
 {
-	// イメージファイル読み込み
-	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load(TEXTURE_PATH.c_str(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-	VkDeviceSize imageSize = texWidth * texHeight * 4;
-	mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
-
-	if (!pixels) {
-		throw std::runtime_error("failed to load texture image!");
+	// --virtual-texture なら描画に必要なページだけをアトラスに読み込む
+	if (options.virtualTexture) {
+		createVirtualTexture();
+		return;
 	}
 
-	// イメージ一時的にを格納するバッファを用意
-	VkBuffer stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+	// --stream-texture なら粗いレベルだけを転送して、残りは描画しながら転送する
+	if (options.streamTexture) {
+		createStreamedTextureImage();
+		return;
+	}
 
-	createBuffer(imageSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer,
-		stagingBufferMemory);
+	// --bake-textures で変換済みの KTX2 があれば、デコードもミップマップ生成もせずに全レベルを転送する
+	{
+		Ktx2File ktx2File;
+		if (ktx2File.open(TEXTURE_KTX2_PATH)) {
+			// 色のテクスチャなので、サンプラーが線形に戻す _SRGB の形式のものだけを使う
+			if (!isSrgbFormat(ktx2File.getFormat())) {
+				std::cout << "texture: " << TEXTURE_KTX2_PATH << " is not in an sRGB format, ignoring it (run --bake-textures again)" << std::endl;
+			}
+			else if (canSampleTextureFormat(ktx2File.getFormat())) {
+				createKtx2TextureImage(ktx2File);
+				return;
+			}
+			else {
+				std::cout << "texture: " << TEXTURE_KTX2_PATH << " uses a format the device cannot sample, ignoring it" << std::endl;
+			}
+		}
+	}
+
+	// ブロック圧縮を使えるなら、圧縮したミップチェーンをそのまま転送する
+	if (options.textureCompression != TextureCompression::None) {
+		if (canSampleTextureFormat(getCompressedTextureFormat(options.textureCompression))) {
+			createCompressedTextureImage(options.textureCompression);
+			return;
+		}
+		std::cout << "texture: block compression is not supported by the device, uploading uncompressed" << std::endl;
+	}
+	textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+	// イメージファイル読み込み
+	// マップしたファイルから直接デコードし、デコード後はすぐにマップを解除する
+	// ベースライン JPEG はスレッドプールで並列にデコードする
+	auto decodeStart = std::chrono::high_resolution_clock::now();
+	DecodedImage image;
+	{
+		FileView textureFile = readFile(TEXTURE_PATH);
+		image = decodeImage(textureFile.data(), textureFile.size(), threadPool);
+	}
+	std::cout << "texture: decoded " << image.width << "x" << image.height << " (" << image.decoder << ") in "
+		<< elapsedMs(decodeStart, std::chrono::high_resolution_clock::now()) << " ms" << std::endl;
 
-	// イメージをコピー
-	void* data;
-	vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-	memcpy(data, pixels, static_cast<size_t>(imageSize));
-	vkUnmapMemory(device, stagingBufferMemory);
+	const int texWidth = static_cast<int>(image.width);
+	const int texHeight = static_cast<int>(image.height);
+	mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
 
-	// イメージファイルを解放
-	stbi_image_free(pixels);
+	// リニアフィルターでブリットできない形式か --cpu-mipmaps なら、CPU で全レベルを作ってから転送する
+	const bool cpuMipmaps = options.cpuMipmaps || !canBlitTextureFormat(textureFormat);
 
 	// イメージを作成
 	createImage(
@@ -1109,7 +1769,7 @@ void HelloTriangleApplication::createTextureImage()
 		texHeight,
 		mipLevels,
 		VK_SAMPLE_COUNT_1_BIT,
-		VK_FORMAT_R8G8B8A8_UNORM,
+		textureFormat,
 		VK_IMAGE_TILING_OPTIMAL,
 		VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
@@ -1118,44 +1778,758 @@ void HelloTriangleApplication::createTextureImage()
 
 	transitionImageLayout(
 		textureImage,
-		VK_FORMAT_R8G8B8A8_UNORM,
+		textureFormat,
 		VK_IMAGE_LAYOUT_UNDEFINED,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 		mipLevels
 	);
 
-	copyBufferToImage(
-		stagingBuffer,
+	if (cpuMipmaps) {
+		auto mipStart = std::chrono::high_resolution_clock::now();
+		std::vector<MipLevel> mipChain = generateMipChain(
+			std::move(image.rgba), image.width, image.height, mipLevels, options.mipFilter,
+			isSrgbFormat(textureFormat), threadPool);
+		std::cout << "texture: " << mipChain.size() << " levels built on the CPU with the " << getMipFilterName(options.mipFilter)
+			<< " filter (" << getMipGeneratorKernelName() << ") in "
+			<< elapsedMs(mipStart, std::chrono::high_resolution_clock::now()) << " ms" << std::endl;
+
+		// 全レベルをステージングリングへコピーして転送を記録する
+		for (uint32_t level = 0; level < mipLevels; level++) {
+			uploadToImage(
+				textureImage,
+				mipChain[level].rgba.data(),
+				mipChain[level].width,
+				mipChain[level].height,
+				level,
+				4,
+				1);
+		}
+
+		transitionImageLayout(
+			textureImage,
+			textureFormat,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			mipLevels);
+		return;
+	}
+
+	// ステージングリングへコピーして転送を記録する
+	uploadToImage(
 		textureImage,
-		static_cast<uint32_t>(texWidth),
-		static_cast<uint32_t>(texHeight)
-	);
+		image.rgba.data(),
+		image.width,
+		image.height,
+		0,
+		4,
+		1);
 
-	transitionImageLayout(
+	// デコードした画素を解放
+	image = DecodedImage();
+
+	/*transitionImageLayout(
 		textureImage,
 		VK_FORMAT_R8G8B8A8_UNORM,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		mipLevels
+	);*/
+
+	generateMipmaps(textureImage, textureFormat, texWidth, texHeight, mipLevels);
+}
+
+// 圧縮テクスチャのイメージ作成
+// キャッシュがなければ画像をデコードし、CPU でミップチェーンを作ってから各レベルを圧縮して保存する
+// 圧縮形式はリニアでブリットできないことが多いので、GPU でのミップマップ生成は使わない
+void HelloTriangleApplication::createCompressedTextureImage(TextureCompression compression)
+{
+	auto loadStart = std::chrono::high_resolution_clock::now();
+
+	const BlockFormat blockFormat =
+		compression == TextureCompression::Bc1 ? BlockFormat::Bc1 :
+		compression == TextureCompression::Bc3 ? BlockFormat::Bc3 : BlockFormat::Bc7;
+	textureFormat = getCompressedTextureFormat(compression);
+
+	const std::string cachePath = TEXTURE_PATH + TEXTURE_CACHE_SUFFIX;
+	FileView sourceFile = readFile(TEXTURE_PATH);
+	const MeshCache::SourceInfo source = MeshCache::hashSource(sourceFile, threadPool);
+
+	std::vector<BakedLevel> baked;
+	std::vector<TextureCache::Level> levels;
+	const bool cached = textureCache.open(cachePath, source, textureFormat, options.mipFilter);
+
+	if (cached) {
+		levels = textureCache.getLevels();
+	}
+	else {
+		baked = bakeTexture(sourceFile.data(), sourceFile.size(), textureFormat, TextureCache::MAX_LEVELS, options.mipFilter, threadPool);
+		for (const BakedLevel& bakedLevel : baked) {
+			TextureCache::Level entry;
+			entry.width = bakedLevel.width;
+			entry.height = bakedLevel.height;
+			entry.data = bakedLevel.data.data();
+			entry.size = bakedLevel.data.size();
+			levels.push_back(entry);
+		}
+
+		if (!TextureCache::write(cachePath, source, textureFormat, options.mipFilter, levels)) {
+			std::cerr << "failed to write texture cache: " << cachePath << std::endl;
+		}
+	}
+	sourceFile.reset();
+
+	mipLevels = static_cast<uint32_t>(levels.size());
+	createImage(
+		levels[0].width,
+		levels[0].height,
+		mipLevels,
+		VK_SAMPLE_COUNT_1_BIT,
+		textureFormat,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		textureImage,
+		textureImageMemory);
+
+	transitionImageLayout(
+		textureImage,
+		textureFormat,
 		VK_IMAGE_LAYOUT_UNDEFINED,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 		mipLevels);
 
-	copyBufferToImage(
-		stagingBuffer,
+	// 全レベルをステージングリングへコピーして転送を記録する
+	uint64_t compressedSize = 0;
+	uint64_t uncompressedSize = 0;
+	for (uint32_t level = 0; level < mipLevels; level++) {
+		uploadToImage(
+			textureImage,
+			levels[level].data,
+			levels[level].width,
+			levels[level].height,
+			level,
+			static_cast<uint32_t>(getBlockBytes(blockFormat)),
+			4);
+		compressedSize += levels[level].size;
+		uncompressedSize += static_cast<uint64_t>(levels[level].width) * levels[level].height * 4;
+	}
+
+	transitionImageLayout(
 		textureImage,
-		static_cast<uint32_t>(texWidth),
-		static_cast<uint32_t>(texHeight));
+		textureFormat,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		mipLevels);
 
-	/*transitionImageLayout(
+	// キャッシュの内容はステージングリングへコピー済み
+	textureCache.close();
+
+	const char* formatNames[] = { "RGBA8", "BC1", "BC3", "BC7" };
+	std::cout << "texture: " << formatNames[static_cast<int>(compression)] << " " << levels[0].width << "x" << levels[0].height
+		<< ", " << mipLevels << " levels, " << (compressedSize >> 10) << " KiB (" << (uncompressedSize >> 10) << " KiB as RGBA8) "
+		<< (cached ? "from " + cachePath
+			: std::string(getMipFilterName(options.mipFilter)) + " mips (" + getMipGeneratorKernelName() + "), encoded with " + getBlockCompressorKernelName()) << ", "
+		<< elapsedMs(loadStart, std::chrono::high_resolution_clock::now()) << " ms" << std::endl;
+}
+
+// KTX2 のテクスチャイメージ作成
+// 全レベルのデータはファイル内で連続しているので、1回のコピーでステージングへ移し、
+// レベルごとの領域を1回の vkCmdCopyBufferToImage で転送する
+void HelloTriangleApplication::createKtx2TextureImage(const Ktx2File& file)
+{
+	auto loadStart = std::chrono::high_resolution_clock::now();
+
+	const std::vector<Ktx2File::Level>& levels = file.getLevels();
+	textureFormat = file.getFormat();
+	mipLevels = static_cast<uint32_t>(levels.size());
+
+	createImage(
+		levels[0].width,
+		levels[0].height,
+		mipLevels,
+		VK_SAMPLE_COUNT_1_BIT,
+		textureFormat,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		textureImage,
-		VK_FORMAT_R8G8B8A8_UNORM,
+		textureImageMemory);
+
+	transitionImageLayout(
+		textureImage,
+		textureFormat,
+		VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		mipLevels);
+
+	// リングに収まればリングへ、収まらなければ専用のステージングバッファへコピーする
+	// 専用のバッファは転送が完了したら解放する
+	const VkDeviceSize dataSize = file.getLevelDataSize();
+	VkBuffer srcBuffer;
+	VkDeviceSize srcOffset;
+	if (dataSize <= stagingRing.getCapacity() / 2) {
+		StagingRing::Region region = stagingRing.allocate(dataSize, 16, graphicsUploads);
+		memcpy(region.data, file.getLevelData(), static_cast<size_t>(dataSize));
+		srcBuffer = region.buffer;
+		srcOffset = region.offset;
+	}
+	else {
+		VkBuffer stagingBuffer;
+		MemoryAllocator::Allocation stagingBufferMemory;
+		createBuffer(
+			dataSize,
+			VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			stagingBuffer,
+			stagingBufferMemory);
+		memcpy(stagingBufferMemory.mapped, file.getLevelData(), static_cast<size_t>(dataSize));
+
+		graphicsUploads.onComplete([this, stagingBuffer, stagingBufferMemory]() mutable {
+			vkDestroyBuffer(device, stagingBuffer, nullptr);
+			allocator.free(stagingBufferMemory);
+		});
+		srcBuffer = stagingBuffer;
+		srcOffset = 0;
+	}
+
+	std::vector<VkBufferImageCopy> regions(mipLevels);
+	for (uint32_t level = 0; level < mipLevels; level++) {
+		regions[level].bufferOffset = srcOffset
+			+ static_cast<VkDeviceSize>(static_cast<const char*>(levels[level].data) - static_cast<const char*>(file.getLevelData()));
+		regions[level].bufferRowLength = 0;
+		regions[level].bufferImageHeight = 0;
+		regions[level].imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		regions[level].imageSubresource.mipLevel = level;
+		regions[level].imageSubresource.baseArrayLayer = 0;
+		regions[level].imageSubresource.layerCount = 1;
+		regions[level].imageOffset = { 0, 0, 0 };
+		regions[level].imageExtent = { levels[level].width, levels[level].height, 1 };
+	}
+
+	vkCmdCopyBufferToImage(
+		graphicsUploads.getCommandBuffer(),
+		srcBuffer,
+		textureImage,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		static_cast<uint32_t>(regions.size()),
+		regions.data());
+
+	transitionImageLayout(
+		textureImage,
+		textureFormat,
 		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-		mipLevels
-	);*/
+		mipLevels);
+
+	std::cout << "texture: " << TEXTURE_KTX2_PATH << " " << levels[0].width << "x" << levels[0].height
+		<< ", " << mipLevels << " levels, " << (dataSize >> 10) << " KiB in one copy, "
+		<< elapsedMs(loadStart, std::chrono::high_resolution_clock::now()) << " ms" << std::endl;
+}
+
+// ストリーミングするテクスチャのイメージ作成
+// 最初のフレームまでに転送するのは TEXTURE_STREAM_INITIAL_SIZE に収まる粗いレベルだけにして、
+// テクスチャの大きさによらず起動時間が変わらないようにする
+void HelloTriangleApplication::createStreamedTextureImage()
+{
+	auto loadStart = std::chrono::high_resolution_clock::now();
+
+	TextureStreamer::Layout layout;
+	TextureStreamer::Source source;	// すぐに読めたデータ（マップした KTX2 かキャッシュ）
+	TextureStreamer::Loader loader;	// source がなければバックグラウンドでデータを作る
+	std::string sourceName;
+
+	// 変換済みの KTX2 か圧縮テクスチャのキャッシュがあれば、マップしたまま少しずつ転送する
+	auto ktx2File = std::make_shared<Ktx2File>();
+	if (ktx2File->open(TEXTURE_KTX2_PATH) && isSrgbFormat(ktx2File->getFormat()) && canSampleTextureFormat(ktx2File->getFormat())) {
+		textureFormat = ktx2File->getFormat();
+		for (const Ktx2File::Level& level : ktx2File->getLevels()) {
+			source.levels.push_back({ level.width, level.height, static_cast<const uint8_t*>(level.data), level.size });
+		}
+		source.owner = ktx2File;
+		sourceName = TEXTURE_KTX2_PATH;
+	}
+	else {
+		textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+		if (options.textureCompression != TextureCompression::None
+			&& canSampleTextureFormat(getCompressedTextureFormat(options.textureCompression))) {
+			textureFormat = getCompressedTextureFormat(options.textureCompression);
+		}
+
+		FileView sourceFile = readFile(TEXTURE_PATH);
+		const std::string cachePath = TEXTURE_PATH + TEXTURE_CACHE_SUFFIX;
+		MeshCache::SourceInfo sourceInfo = {};
+		if (textureFormat != VK_FORMAT_R8G8B8A8_SRGB) {
+			sourceInfo = MeshCache::hashSource(sourceFile, threadPool);
+			auto cache = std::make_shared<TextureCache>();
+			if (cache->open(cachePath, sourceInfo, textureFormat, options.mipFilter)) {
+				for (const TextureCache::Level& level : cache->getLevels()) {
+					source.levels.push_back({ level.width, level.height, static_cast<const uint8_t*>(level.data), level.size });
+				}
+				source.owner = cache;
+				sourceName = cachePath;
+			}
+		}
+
+		// なければ大きさだけを読んでイメージを作り、デコード・ミップチェーン生成・圧縮はバックグラウンドで行う
+		if (source.levels.empty()) {
+			if (!readImageInfo(sourceFile.data(), sourceFile.size(), layout.width, layout.height)) {
+				throw std::runtime_error("failed to load texture image!");
+			}
+			layout.levelCount = static_cast<uint32_t>(std::floor(std::log2(std::max(layout.width, layout.height)))) + 1;
+
+			const VkFormat format = textureFormat;
+			const MipFilter mipFilter = options.mipFilter;
+			const uint32_t levelCount = layout.levelCount;
+			loader = [sourceFile, format, mipFilter, levelCount, cachePath, sourceInfo](ThreadPool& pool) {
+				auto baked = std::make_shared<std::vector<BakedLevel>>(
+					bakeTexture(sourceFile.data(), sourceFile.size(), format, levelCount, mipFilter, pool));
+
+				TextureStreamer::Source bakedSource;
+				std::vector<TextureCache::Level> cacheLevels;
+				for (const BakedLevel& level : *baked) {
+					bakedSource.levels.push_back({ level.width, level.height, level.data.data(), level.data.size() });
+					cacheLevels.push_back({ level.width, level.height, level.data.data(), level.data.size() });
+				}
+				bakedSource.owner = baked;
+
+				// 圧縮したものは次回の起動のためにキャッシュへ保存する
+				if (format != VK_FORMAT_R8G8B8A8_SRGB && !TextureCache::write(cachePath, sourceInfo, format, mipFilter, cacheLevels)) {
+					std::cerr << "failed to write texture cache: " << cachePath << std::endl;
+				}
+				return bakedSource;
+			};
+			sourceName = TEXTURE_PATH;
+		}
+	}
+
+	if (!source.levels.empty()) {
+		layout.width = source.levels[0].width;
+		layout.height = source.levels[0].height;
+		layout.levelCount = static_cast<uint32_t>(source.levels.size());
+	}
+	Ktx2File::getBlockInfo(textureFormat, layout.blockBytes, layout.blockExtent);
+	mipLevels = layout.levelCount;
+
+	createImage(
+		layout.width,
+		layout.height,
+		mipLevels,
+		VK_SAMPLE_COUNT_1_BIT,
+		textureFormat,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		textureImage,
+		textureImageMemory);
+
+	transitionImageLayout(
+		textureImage,
+		textureFormat,
+		VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		mipLevels);
+
+	// 最も粗いレベルから TEXTURE_STREAM_INITIAL_SIZE に収まるまでをすぐに転送する（1x1 のレベルは必ず転送する）
+	uint32_t residentLevel = mipLevels - 1;
+	VkDeviceSize initialSize = 0;
+	if (!source.levels.empty()) {
+		initialSize = source.levels[residentLevel].size;
+		while (residentLevel > 0 && initialSize + source.levels[residentLevel - 1].size <= TEXTURE_STREAM_INITIAL_SIZE) {
+			residentLevel--;
+			initialSize += source.levels[residentLevel].size;
+		}
+		for (uint32_t level = residentLevel; level < mipLevels; level++) {
+			uploadToImage(
+				textureImage,
+				source.levels[level].data,
+				source.levels[level].width,
+				source.levels[level].height,
+				level,
+				layout.blockBytes,
+				layout.blockExtent);
+		}
+	}
+	else {
+		// データができるまでは灰色の 1x1 のレベルで描画する
+		uint8_t pixels[4 * 4 * 4];
+		std::fill(std::begin(pixels), std::end(pixels), static_cast<uint8_t>(128));
+		uint8_t block[16] = {};
+		const uint8_t* placeholder = pixels;
+		if (textureFormat != VK_FORMAT_R8G8B8A8_SRGB) {
+			if (textureFormat == VK_FORMAT_BC1_RGB_SRGB_BLOCK) {
+				compressBlockBc1(pixels, block);
+			}
+			else if (textureFormat == VK_FORMAT_BC3_SRGB_BLOCK) {
+				compressBlockBc3(pixels, block);
+			}
+			else {
+				compressBlockBc7(pixels, block);
+			}
+			placeholder = block;
+		}
+		uploadToImage(textureImage, placeholder, 1, 1, residentLevel, layout.blockBytes, layout.blockExtent);
+		initialSize = layout.blockBytes;
+	}
+
+	// まだ転送していないレベルもサンプリングできるレイアウトにしておき、minLod で読まないようにする
+	transitionImageLayout(
+		textureImage,
+		textureFormat,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		mipLevels);
+
+	// 灰色で埋めた最も粗いレベルも本物ではないので、プレースホルダーのときは全レベルを転送する
+	const bool loaded = !source.levels.empty();
+	const uint32_t pendingLevels = loaded ? residentLevel : mipLevels;
+	residentMipLevel = residentLevel;
+	streamedTextureLevels = pendingLevels;
+	textureStreamStart = std::chrono::high_resolution_clock::now();
+	if (loaded) {
+		textureStreamer.start(layout, pendingLevels, std::move(source));
+	}
+	else {
+		textureStreamer.start(layout, pendingLevels, std::move(loader));
+	}
+
+	std::cout << "texture: streaming " << sourceName << " " << layout.width << "x" << layout.height << ", " << mipLevels << " levels, "
+		<< (mipLevels - residentLevel) << " levels (" << (initialSize >> 10) << " KiB) uploaded at startup"
+		<< (loaded ? "" : " as a placeholder while decoding in the background") << ", "
+		<< elapsedMs(loadStart, std::chrono::high_resolution_clock::now()) << " ms" << std::endl;
+}
+
+// ストリーミング中のテクスチャの転送
+// 以前のフレームがサンプリングしているレベルもあるので、レベルごとに読み取りの完了を待ってから書き込み、
+// 書き終えたレベルはこのフレームから minLod を下げたセットで読む
+void HelloTriangleApplication::streamTextureLevels()
+{
+	if (!textureStreamer.isActive()) {
+		return;
+	}
+
+	// 転送の終わったステージング領域を再利用できるようにする（ヘッドレスのループでは他に回収しない）
+	graphicsUploads.collectCompleted();
+
+	VkDeviceSize budget = std::min<VkDeviceSize>(
+		static_cast<VkDeviceSize>(options.textureStreamBudgetKiB) * 1024, stagingRing.getCapacity() / 2);
+	uint32_t blockBytes, blockExtent;
+	Ktx2File::getBlockInfo(textureFormat, blockBytes, blockExtent);
+
+	bool recorded = false;
+	TextureStreamer::Band band;
+	while (budget > 0 && textureStreamer.nextBand(budget, band)) {
+		transitionImageLayout(
+			textureImage,
+			textureFormat,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1,
+			band.level);
+
+		uploadImageRows(
+			textureImage,
+			band.data,
+			band.width,
+			band.height,
+			band.level,
+			blockBytes,
+			blockExtent,
+			band.firstRow,
+			band.rowCount);
+
+		transitionImageLayout(
+			textureImage,
+			textureFormat,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			1,
+			band.level);
+
+		// 同じキューで描画より先に実行されるので、このフレームから読んでよい
+		if (band.completesLevel) {
+			residentMipLevel = band.level;
+		}
+		budget -= std::min(budget, band.size);
+		recorded = true;
+	}
+
+	if (recorded) {
+		graphicsUploads.submit();
+	}
+
+	if (!textureStreamer.isActive()) {
+		std::cout << "texture: streamed " << streamedTextureLevels << " levels (" << (textureStreamer.getStreamedBytes() >> 10)
+			<< " KiB) in " << elapsedMs(textureStreamStart, std::chrono::high_resolution_clock::now()) << " ms" << std::endl;
+		textureStreamer.finish();
+	}
+}
+
+// 仮想テクスチャの作成
+// 全ページのタイルを .vtpages にまとめておき（なければ作る）、アトラスには最も粗いレベルのページだけを読み込んで始める
+// 残りのページはフラグメントシェーダーのフィードバックで要求されたものを updateVirtualTexture で読み込む
+void HelloTriangleApplication::createVirtualTexture()
+{
+	auto loadStart = std::chrono::high_resolution_clock::now();
+
+	textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+	if (options.textureCompression != TextureCompression::None
+		&& canSampleTextureFormat(getCompressedTextureFormat(options.textureCompression))) {
+		textureFormat = getCompressedTextureFormat(options.textureCompression);
+	}
+
+	const std::string pagesPath = TEXTURE_PATH + VIRTUAL_TEXTURE_SUFFIX;
+	bool baked = false;
+	{
+		FileView sourceFile = readFile(TEXTURE_PATH);
+		const MeshCache::SourceInfo source = MeshCache::hashSource(sourceFile, threadPool);
+		if (!virtualTextureFile.open(pagesPath, source, textureFormat, VIRTUAL_TEXTURE_PAGE_SIZE, VIRTUAL_TEXTURE_BORDER, options.mipFilter)) {
+			VirtualTextureLayout layout;
+			std::vector<uint8_t> tiles = bakeVirtualTexture(
+				sourceFile.data(),
+				sourceFile.size(),
+				textureFormat,
+				VIRTUAL_TEXTURE_PAGE_SIZE,
+				VIRTUAL_TEXTURE_BORDER,
+				options.mipFilter,
+				threadPool,
+				layout);
+			// 書き出したファイルをマップし直して、読み込み時と同じ経路でページを転送する
+			if (!VirtualTextureFile::write(pagesPath, source, textureFormat, options.mipFilter, layout, tiles)
+				|| !virtualTextureFile.open(pagesPath, source, textureFormat, VIRTUAL_TEXTURE_PAGE_SIZE, VIRTUAL_TEXTURE_BORDER, options.mipFilter)) {
+				throw std::runtime_error("failed to write virtual texture pages: " + pagesPath + "!");
+			}
+			baked = true;
+		}
+	}
+
+	const VirtualTextureLayout& layout = virtualTextureFile.getLayout();
+
+	// 物理ページのアトラス（タイルを virtualTextureAtlasPages 枚ずつ縦横に並べる）
+	const uint32_t tileSize = layout.getTileSize();
+	const uint32_t atlasSize = options.virtualTextureAtlasPages * tileSize;
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	if (atlasSize > properties.limits.maxImageDimension2D) {
+		throw std::runtime_error("virtual texture atlas is larger than the device supports!");
+	}
+
+	// ミップマップはページのレベルとしてシェーダーが選ぶので、アトラス自体は1レベル
+	mipLevels = 1;
+	createImage(
+		atlasSize,
+		atlasSize,
+		mipLevels,
+		VK_SAMPLE_COUNT_1_BIT,
+		textureFormat,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		textureImage,
+		textureImageMemory);
+
+	const std::vector<PageCache::Load> loads = pageCache.init(layout, options.virtualTextureAtlasPages);
+
+	transitionImageLayout(
+		textureImage,
+		textureFormat,
+		VK_IMAGE_LAYOUT_UNDEFINED,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		mipLevels);
+
+	uploadVirtualTexturePages(loads);
+
+	transitionImageLayout(
+		textureImage,
+		textureFormat,
+		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+		mipLevels);
+
+	// ページテーブルとフィードバック（フレームスロットごと。ダイナミックオフセットの位置はカリングのバッファと同じく 256 バイトに揃える）
+	const VkDeviceSize slotAlignment = 256;
+	pageTableSlotSize = (sizeof(PageTableHeader) + sizeof(uint32_t) * layout.pageCount + slotAlignment - 1) / slotAlignment * slotAlignment;
+	feedbackSlotSize = (sizeof(uint32_t) * layout.pageCount + slotAlignment - 1) / slotAlignment * slotAlignment;
+
+	createBuffer(
+		pageTableSlotSize * maxFramesInFlight,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		pageTableBuffer,
+		pageTableBufferMemory);
+
+	createBuffer(
+		feedbackSlotSize * maxFramesInFlight,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		feedbackBuffer,
+		feedbackBufferMemory);
+	std::memset(feedbackBufferMemory.mapped, 0, static_cast<size_t>(feedbackSlotSize * maxFramesInFlight));
+
+	PageTableHeader header = {};
+	header.width = layout.width;
+	header.height = layout.height;
+	header.levelCount = layout.getLevelCount();
+	header.pageSize = layout.pageSize;
+	header.border = layout.border;
+	header.tileSize = tileSize;
+	header.atlasSize = atlasSize;
+	for (uint32_t level = 0; level < layout.getLevelCount(); level++) {
+		header.levels[level][0] = layout.levels[level].pagesX;
+		header.levels[level][1] = layout.levels[level].pagesY;
+		header.levels[level][2] = layout.levels[level].firstPage;
+	}
+	for (uint32_t i = 0; i < maxFramesInFlight; i++) {
+		std::memcpy(static_cast<char*>(pageTableBufferMemory.mapped) + pageTableSlotSize * i, &header, sizeof(header));
+	}
+
+	// エントリーは updateVirtualTexture で書く
+	pageTableVersions.assign(maxFramesInFlight, UINT64_MAX);
+	feedbackFrames.assign(maxFramesInFlight, 0);
+	virtualTextureFrame = 0;
+
+	std::cout << "texture: virtual " << pagesPath << " " << layout.width << "x" << layout.height << ", "
+		<< layout.getLevelCount() << " levels, " << layout.pageCount << " pages of " << layout.pageSize << "+" << layout.border * 2
+		<< " px, atlas " << atlasSize << "x" << atlasSize << " (" << pageCache.getSlotCount() << " pages), "
+		<< loads.size() << " pages uploaded at startup" << (baked ? " after baking" : "") << ", "
+		<< elapsedMs(loadStart, std::chrono::high_resolution_clock::now()) << " ms" << std::endl;
+}
+
+// 仮想テクスチャの更新
+// このスロットの前回のフレームはフェンスを待ち終えているので、そのフィードバックから要求されたページを集め、
+// 読み込むページを選んでアトラスへ転送し、このフレームのページテーブルを書き直す
+void HelloTriangleApplication::updateVirtualTexture(size_t frameIndex)
+{
+	if (!options.virtualTexture) {
+		return;
+	}
+	virtualTextureFrame++;
+
+	const VirtualTextureLayout& layout = virtualTextureFile.getLayout();
+	uint32_t* requests = reinterpret_cast<uint32_t*>(static_cast<char*>(feedbackBufferMemory.mapped) + feedbackSlotSize * frameIndex);
+	const uint32_t stamp = feedbackFrames[frameIndex];
+	if (stamp != 0) {
+		// シェーダーはそのフレームの番号を書くので、古い番号のページはこのフレームでは使われていない
+		for (uint32_t page = 0; page < layout.pageCount; page++) {
+			if (requests[page] == stamp) {
+				pageCache.request(page, virtualTextureFrame);
+			}
+		}
+	}
+	feedbackFrames[frameIndex] = virtualTextureFrame;
+
+	const std::vector<PageCache::Load> loads = pageCache.schedule(options.virtualTextureUploadsPerFrame, virtualTextureFrame);
+	if (!loads.empty()) {
+		// 転送の終わったステージング領域を再利用できるようにする（ヘッドレスのループでは他に回収しない）
+		graphicsUploads.collectCompleted();
+
+		// 追い出したページを読んでいた以前のフレームは、同じキューで先に実行されるレイアウト遷移が読み取りの完了を待つ
+		transitionImageLayout(
+			textureImage,
+			textureFormat,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1);
+
+		uploadVirtualTexturePages(loads);
+
+		transitionImageLayout(
+			textureImage,
+			textureFormat,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+			1);
+
+		graphicsUploads.submit();
+	}
+
+	// 描画中の他のスロットのページテーブルは書き換えない（追い出したスロットを指していても、そのフレームの転送より前に実行される）
+	char* pageTable = static_cast<char*>(pageTableBufferMemory.mapped) + pageTableSlotSize * frameIndex;
+	reinterpret_cast<PageTableHeader*>(pageTable)->frame = virtualTextureFrame;
+	if (pageTableVersions[frameIndex] != pageCache.getVersion()) {
+		pageCache.writePageTable(reinterpret_cast<uint32_t*>(pageTable + sizeof(PageTableHeader)));
+		pageTableVersions[frameIndex] = pageCache.getVersion();
+	}
+}
+
+// pageCache が選んだページのタイルをマップしたファイルからステージングへコピーし、アトラスのスロットへ転送する
+// アトラスは TRANSFER_DST_OPTIMAL にしておくこと
+void HelloTriangleApplication::uploadVirtualTexturePages(const std::vector<PageCache::Load>& loads)
+{
+	const uint32_t tileSize = virtualTextureFile.getLayout().getTileSize();
+	const uint32_t slotsPerSide = pageCache.getSlotsPerSide();
+	const VkDeviceSize tileBytes = virtualTextureFile.getTileBytes();
+
+	for (const PageCache::Load& load : loads) {
+		StagingRing::Region staging = stagingRing.allocate(tileBytes, 16, graphicsUploads);
+		std::memcpy(staging.data, virtualTextureFile.getTile(load.page), static_cast<size_t>(tileBytes));
+
+		VkBufferImageCopy region = {};
+		region.bufferOffset = staging.offset;
+		region.bufferRowLength = 0;
+		region.bufferImageHeight = 0;
+		region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel = 0;
+		region.imageSubresource.baseArrayLayer = 0;
+		region.imageSubresource.layerCount = 1;
+		region.imageOffset = {
+			static_cast<int32_t>(load.slot % slotsPerSide * tileSize),
+			static_cast<int32_t>(load.slot / slotsPerSide * tileSize),
+			0
+		};
+		region.imageExtent = { tileSize, tileSize, 1 };
+
+		// リングに空きがないと allocate が記録中のバッチをサブミットするので、コピーはページごとにすぐ記録する
+		vkCmdCopyBufferToImage(
+			graphicsUploads.getCommandBuffer(),
+			staging.buffer,
+			textureImage,
+			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1,
+			&region);
+	}
+}
+
+// テクスチャに使う形式をデバイスでサンプリング（線形補間）できるか
+bool HelloTriangleApplication::canSampleTextureFormat(VkFormat format)
+{
+	uint32_t blockBytes, blockExtent;
+	if (!Ktx2File::getBlockInfo(format, blockBytes, blockExtent)) {
+		return false;
+	}
+
+	// BC 形式は textureCompressionBC 機能を有効にしていなければ使えない
+	if (blockExtent > 1 && !textureCompressionBcEnabled) {
+		return false;
+	}
+
+	return isFormatSupported(
+		format,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+}
 
-	generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels);
+// format のイメージ同士でリニアフィルターのブリットができるか（GPU でミップマップを作れるか）
+bool HelloTriangleApplication::canBlitTextureFormat(VkFormat format)
+{
+	return isFormatSupported(
+		format,
+		VK_IMAGE_TILING_OPTIMAL,
+		VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT);
+}
 
-	vkDestroyBuffer(device, stagingBuffer, nullptr);
-	vkFreeMemory(device, stagingBufferMemory, nullptr);
+// 圧縮形式に対応する Vulkan の形式
+VkFormat HelloTriangleApplication::getCompressedTextureFormat(TextureCompression compression)
+{
+	switch (compression) {
+	case TextureCompression::Bc1:
+		return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+	case TextureCompression::Bc3:
+		return VK_FORMAT_BC3_SRGB_BLOCK;
+	case TextureCompression::Bc7:
+		return VK_FORMAT_BC7_SRGB_BLOCK;
+	default:
+		return VK_FORMAT_R8G8B8A8_SRGB;
+	}
 }
 
 // イメージ作成
@@ -1169,7 +2543,7 @@ void HelloTriangleApplication::createImage(
 	VkImageUsageFlags usage,
 	VkMemoryPropertyFlags properties,
 	VkImage& image,
-	VkDeviceMemory& imageMemory)
+	MemoryAllocator::Allocation& imageMemory)
 {
 	// イメージ情報設定
 	VkImageCreateInfo imageInfo = {};
@@ -1195,16 +2569,12 @@ void HelloTriangleApplication::createImage(
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo = {};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-		throw std::runtime_error("failed to allocate image memory!");
-	}
+	imageMemory = allocator.allocate(
+		memRequirements,
+		properties,
+		tiling == VK_IMAGE_TILING_OPTIMAL ? MemoryAllocator::ResourceKind::Optimal : MemoryAllocator::ResourceKind::Linear);
 
-	vkBindImageMemory(device, image, imageMemory, 0);
+	vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
 }
 
 // イメージビュー作成
@@ -1239,9 +2609,10 @@ void HelloTriangleApplication::transitionImageLayout(
 	VkFormat format,
 	VkImageLayout oldLayout,
 	VkImageLayout newLayout,
-	uint32_t mipLevels)
+	uint32_t mipLevels,
+	uint32_t baseMipLevel)
 {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+	VkCommandBuffer commandBuffer = graphicsUploads.getCommandBuffer();
 
 	VkImageMemoryBarrier barrier = {};
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1251,7 +2622,7 @@ void HelloTriangleApplication::transitionImageLayout(
 	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
 	barrier.image = image;
 	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseMipLevel = 0;
+	barrier.subresourceRange.baseMipLevel = baseMipLevel;
 	barrier.subresourceRange.levelCount = mipLevels;
 	barrier.subresourceRange.baseArrayLayer = 0;
 	barrier.subresourceRange.layerCount = 1;
@@ -1286,6 +2657,14 @@ void HelloTriangleApplication::transitionImageLayout(
 		sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
 		destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
 	}
+	else if (oldLayout == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL && newLayout == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL) {
+		// ストリーミング中のレベルへ書き込む前に、以前のフレームのサンプリングを待つ
+		barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+		barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+		sourceStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+		destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+	}
 	else if (oldLayout == VK_IMAGE_LAYOUT_UNDEFINED && newLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
 		barrier.srcAccessMask = 0;
 		barrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
@@ -1312,28 +2691,30 @@ void HelloTriangleApplication::transitionImageLayout(
 		0, nullptr,
 		1, &barrier
 	);
-	endSingleTimeCommands(commandBuffer);
 }
 
 // バッファをイメージにコピーする
 void HelloTriangleApplication::copyBufferToImage(
 	VkBuffer buffer,
+	VkDeviceSize bufferOffset,
 	VkImage image,
+	uint32_t mipLevel,
 	uint32_t width,
+	uint32_t offsetY,
 	uint32_t height)
 {
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+	VkCommandBuffer commandBuffer = graphicsUploads.getCommandBuffer();
 
 	VkBufferImageCopy region = {};
-	region.bufferOffset = 0;
+	region.bufferOffset = bufferOffset;
 	region.bufferRowLength = 0;
 	region.bufferImageHeight = 0;
 	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.mipLevel = mipLevel;
 	region.imageSubresource.baseArrayLayer = 0;
 	region.imageSubresource.layerCount = 1;
 
-	region.imageOffset = { 0,0,0 };
+	region.imageOffset = { 0, static_cast<int32_t>(offsetY), 0 };
 	region.imageExtent = {
 		width,
 		height,
@@ -1348,16 +2729,19 @@ void HelloTriangleApplication::copyBufferToImage(
 		1,
 		&region
 	);
-	endSingleTimeCommands(commandBuffer);
 }
 
 // テクスチャのイメージビュー作成
 void HelloTriangleApplication::createTextureImageView() {
-	textureImageView = createImageView(textureImage, VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+	textureImageView = createImageView(textureImage, textureFormat, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
 }
 
 // イメージサンプラを作成する
 void HelloTriangleApplication::createTextureSampler() {
+	// ストリーミングするときは、転送し終えたレベルより細かいレベルを読まないよう minLod で止めたサンプラーをレベルごとに作る
+	// （描画中のフレームが使うディスクリプタセットは書き換えられないので、residentMipLevel に応じてセットを選び替える）
+	textureSamplers.resize(options.streamTexture ? mipLevels : 1);
+
 	VkSamplerCreateInfo samplerInfo = {};
 	samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
 	samplerInfo.magFilter = VK_FILTER_LINEAR;
@@ -1373,12 +2757,14 @@ void HelloTriangleApplication::createTextureSampler() {
 	samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
 	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
 	samplerInfo.mipLodBias = 0.0f;
-	samplerInfo.minLod = 0;
 	samplerInfo.maxLod = static_cast<float>(mipLevels);
 	samplerInfo.mipLodBias = 0;
 
-	if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS) {
-		throw std::runtime_error("failed to create texture sampler!");
+	for (size_t level = 0; level < textureSamplers.size(); level++) {
+		samplerInfo.minLod = static_cast<float>(level);
+		if (vkCreateSampler(device, &samplerInfo, nullptr, &textureSamplers[level]) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create texture sampler!");
+		}
 	}
 }
 
@@ -1390,15 +2776,12 @@ void HelloTriangleApplication::generateMipmaps(
 	uint32_t texHeight,
 	uint32_t mipLevels)
 {
-	// Check if image format supports linear blitting
-	VkFormatProperties formatProperties;
-	vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
-
-	if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+	// 呼び出し側が canBlitTextureFormat で確かめ、できなければ generateMipChain を使う
+	if (!canBlitTextureFormat(imageFormat)) {
 		throw std::runtime_error("texture image format does not support linear blitting");
 	}
 
-	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+	VkCommandBuffer commandBuffer = graphicsUploads.getCommandBuffer();
 
 	VkImageMemoryBarrier barrier = {};
 	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1479,8 +2862,6 @@ void HelloTriangleApplication::generateMipmaps(
 		0, nullptr,
 		0, nullptr,
 		1, &barrier);
-
-	endSingleTimeCommands(commandBuffer);
 }
 
 // MSAAサンプリング数を取得する
@@ -1560,14 +2941,7 @@ VkFormat HelloTriangleApplication::findSupportedFormat(
 	VkFormatFeatureFlags features)
 {
 	for (VkFormat format : candidates) {
-		VkFormatProperties props;
-		vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
-
-		if (tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features)
-		{
-			return format;
-		}
-		else if (tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features) {
+		if (isFormatSupported(format, tiling, features)) {
 			return format;
 		}
 	}
@@ -1575,6 +2949,18 @@ VkFormat HelloTriangleApplication::findSupportedFormat(
 	throw std::runtime_error("failed to find supported format!");
 }
 
+// フォーマットが tiling で features をすべて使えるか
+bool HelloTriangleApplication::isFormatSupported(VkFormat format, VkImageTiling tiling, VkFormatFeatureFlags features)
+{
+	VkFormatProperties props;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+
+	if (tiling == VK_IMAGE_TILING_LINEAR) {
+		return (props.linearTilingFeatures & features) == features;
+	}
+	return (props.optimalTilingFeatures & features) == features;
+}
+
 // デプスフォーマットを検索する
 VkFormat HelloTriangleApplication::findDepthFormat() {
 	return findSupportedFormat(
@@ -1592,9 +2978,9 @@ bool HelloTriangleApplication::hasStencilComponent(VkFormat format)
 
 void HelloTriangleApplication::createSyncObjects()
 {
-	imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-	inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+	imageAvailableSemaphores.resize(maxFramesInFlight);
+	renderFinishedSemaphores.resize(maxFramesInFlight);
+	inFlightFences.resize(maxFramesInFlight);
 
 	VkSemaphoreCreateInfo semaphoreInfo = {};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -1603,7 +2989,7 @@ void HelloTriangleApplication::createSyncObjects()
 	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
 	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
-	for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+	for (size_t i = 0; i < maxFramesInFlight; i++) {
 		if (vkCreateSemaphore(
 				device,
 				&semaphoreInfo,
@@ -1623,13 +3009,17 @@ void HelloTriangleApplication::createSyncObjects()
 			throw std::runtime_error("failed to create semaphores for a frame!");
 		}
 	}
+	imagesInFlight.resize(swapChainImages.size(), VK_NULL_HANDLE);
+
+	frameStats.submitTimes.resize(maxFramesInFlight);
+	frameStats.pendingFences.resize(maxFramesInFlight, false);
 }
 
 void HelloTriangleApplication::createDescriptorSetLayout()
 {
 	VkDescriptorSetLayoutBinding uboLayoutBinding = {};
 	uboLayoutBinding.binding = 0;
-	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	uboLayoutBinding.descriptorCount = 1;
 	uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 	uboLayoutBinding.pImmutableSamplers = nullptr;	//Optional
@@ -1641,7 +3031,32 @@ void HelloTriangleApplication::createDescriptorSetLayout()
 	samplerLayoutBinding.pImmutableSamplers = nullptr;
 	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	std::array<VkDescriptorSetLayoutBinding, 2>bindings = { uboLayoutBinding, samplerLayoutBinding };
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, samplerLayoutBinding };
+
+	// カリングして間接描画するときの描画コマンドごとのオブジェクトの model 行列（binding 2）
+	if (options.culling != CullingMode::None) {
+		VkDescriptorSetLayoutBinding drawModelLayoutBinding = {};
+		drawModelLayoutBinding.binding = 2;
+		drawModelLayoutBinding.descriptorCount = 1;
+		drawModelLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		drawModelLayoutBinding.pImmutableSamplers = nullptr;
+		drawModelLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+		bindings.push_back(drawModelLayoutBinding);
+	}
+
+	// 仮想テクスチャのページテーブル（binding 3）とフィードバック（binding 4）
+	if (options.virtualTexture) {
+		for (uint32_t binding = 3; binding <= 4; binding++) {
+			VkDescriptorSetLayoutBinding storageLayoutBinding = {};
+			storageLayoutBinding.binding = binding;
+			storageLayoutBinding.descriptorCount = 1;
+			storageLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+			storageLayoutBinding.pImmutableSamplers = nullptr;
+			storageLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+			bindings.push_back(storageLayoutBinding);
+		}
+	}
+
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
@@ -1655,19 +3070,31 @@ void HelloTriangleApplication::createDescriptorSetLayout()
 // ユニフォームバッファ作成
 void HelloTriangleApplication::createUniformBuffers()
 {
-	VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+	// ダイナミックオフセットは minUniformBufferOffsetAlignment の倍数でなければならない
+	// GPU カリングは mat4 の配列として model 行列を読むので、mat4 の大きさの倍数にもする（どちらも2のべき乗）
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	VkDeviceSize alignment = std::max<VkDeviceSize>(properties.limits.minUniformBufferOffsetAlignment, sizeof(glm::mat4));
+	uniformStride = (sizeof(UniformBufferObject) + alignment - 1) / alignment * alignment;
+
+	VkDeviceSize bufferSize = uniformStride * options.objectCount * swapChainImages.size();
+	if (bufferSize > std::numeric_limits<uint32_t>::max()) {
+		throw std::runtime_error("too many objects for a dynamic uniform buffer!");
+	}
 
-	uniformBuffers.resize(swapChainImages.size());
-	uniformBuffersMemory.resize(swapChainImages.size());
+	// GPU カリングではコンピュートシェーダーからオブジェクトの model 行列を読む
+	createBuffer(
+		bufferSize,
+		VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		uniformBuffer,
+		uniformBufferMemory);
+}
 
-	for (size_t i = 0; i < swapChainImages.size(); i++) {
-		createBuffer(
-			bufferSize,
-			VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-			uniformBuffers[i],
-			uniformBuffersMemory[i]);
-	}
+// (イメージ, オブジェクト) に対応するユニフォームバッファ内のオフセット
+uint32_t HelloTriangleApplication::uniformOffset(size_t imageIndex, uint32_t objectIndex) const
+{
+	return static_cast<uint32_t>((imageIndex * options.objectCount + objectIndex) * uniformStride);
 }
 
 // ユニフォームバッファ更新
@@ -1678,32 +3105,152 @@ void HelloTriangleApplication::updateUniformBuffer(uint32_t currentImage)
 	auto currentTime = std::chrono::high_resolution_clock::now();
 	float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
-	UniformBufferObject ubo = {};
-	ubo.model = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	ubo.view = glm::lookAt(glm::vec3(2.0f, 2.0f, 2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
-	ubo.proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f);
-	ubo.proj[1][1] *= -1;
+	// オブジェクトは XY 平面上に格子状に並べ、全体が収まるようにカメラを引く
+	// 各オブジェクトのインスタンスも格子状に並び、オブジェクトと一緒に回るので、回しても重ならないよう対角線より長めに間隔を取る
+	const uint32_t instanceGridSize = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(options.instanceCount))));
+	const uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(options.objectCount))));
+	const float spacing = instanceGridSize > 1 ? 1.2f * 1.5f * instanceGridSize : 1.2f;
+	const float distance = std::max(1.0f, gridSize * spacing * 0.5f);
+
+	glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	cameraPosition = glm::vec3(2.0f, 2.0f, 2.0f) * distance;
+	glm::mat4 view = glm::lookAt(cameraPosition, glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f));
+	glm::mat4 proj = glm::perspective(glm::radians(45.0f), swapChainExtent.width / (float)swapChainExtent.height, 0.1f, 10.0f * distance);
+	proj[1][1] *= -1;
+	frustum = Frustum::fromMatrix(proj * view);
+
+	// 距離 1 でのワールドの長さ 1 のピクセル数は proj[1][1] * 高さ / 2
+	// selectLod の比較をかけ算だけで済ませるため、ピクセル数の上限とメッシュの半径で割っておく
+	// 0 は元のメッシュだけを使う印（大きな値にしても誤差が 0 の LOD は選ばれてしまう）
+	if (options.lodThreshold > 0.0f && meshBounds.radius > 0.0f) {
+		float pixelsPerUnit = std::abs(proj[1][1]) * swapChainExtent.height * 0.5f;
+		lodScale = pixelsPerUnit / (options.lodThreshold * meshBounds.radius);
+	}
+	else {
+		lodScale = 0.0f;
+	}
 
-	void* data;
-	vkMapMemory(device, uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);
-	memcpy(data, &ubo, sizeof(ubo));
-	vkUnmapMemory(device, uniformBuffersMemory[currentImage]);
+	// 永続的にマップされたメモリへ直接書き込む（coherent なのでフラッシュは不要）
+	// CPU カリングで読み返さないよう、model 行列は objectModels にも残す
+	char* base = static_cast<char*>(uniformBufferMemory.mapped);
+	objectModels.resize(options.objectCount);
+	for (uint32_t object = 0; object < options.objectCount; object++) {
+		float x = (static_cast<float>(object % gridSize) - (gridSize - 1) * 0.5f) * spacing;
+		float y = (static_cast<float>(object / gridSize) - (gridSize - 1) * 0.5f) * spacing;
+
+		objectModels[object] = glm::translate(glm::mat4(1.0f), glm::vec3(x, y, 0.0f)) * rotation;
+
+		UniformBufferObject* ubo = reinterpret_cast<UniformBufferObject*>(base + uniformOffset(currentImage, object));
+		ubo->model = objectModels[object];
+		ubo->view = view;
+		ubo->proj = proj;
+		ubo->positionScale = glm::vec4(meshDequantization.positionScale, 0.0f);
+		ubo->positionOffset = glm::vec4(meshDequantization.positionOffset, 0.0f);
+		ubo->texCoordTransform = glm::vec4(meshDequantization.texCoordScale, meshDequantization.texCoordOffset);
+	}
+}
+
+// 起動オプションに従ってインスタンスを格子状に並べる
+void HelloTriangleApplication::createInstances()
+{
+	// インスタンスの model 行列はオブジェクト空間での配置で、その後にオブジェクトのユニフォームの model 行列をかける
+	const uint32_t gridSize = static_cast<uint32_t>(std::ceil(std::sqrt(static_cast<float>(options.instanceCount))));
+	const float spacing = 1.2f;
+
+	instances.clear();
+	for (uint32_t instance = 0; instance < options.instanceCount; instance++) {
+		float x = (static_cast<float>(instance % gridSize) - (gridSize - 1) * 0.5f) * spacing;
+		float y = (static_cast<float>(instance / gridSize) - (gridSize - 1) * 0.5f) * spacing;
+
+		InstanceData data = {};
+		data.model = glm::translate(glm::mat4(1.0f), glm::vec3(x, y, 0.0f));
+		instances.add(data);
+	}
+}
+
+// インスタンスバッファ作成
+void HelloTriangleApplication::createInstanceBuffer()
+{
+	// 追加のたびに作り直さないよう、必要数の2倍まで確保する
+	// スロットの先頭をストレージバッファのオフセットアライメント（最大256バイト）に揃えるため4の倍数にする
+	instanceCapacity = (std::max<uint32_t>(1, instances.size() * 2) + 3) / 4 * 4;
+
+	createBuffer(
+		sizeof(InstanceData) * instanceCapacity * maxFramesInFlight,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		instanceBuffer,
+		instanceBufferMemory);
+
+	// どのスロットもまだ書き込んでいない
+	instanceBufferVersions.assign(maxFramesInFlight, UINT64_MAX);
+}
+
+// フレームスロットのインスタンスバッファを instances の内容に合わせる
+void HelloTriangleApplication::updateInstanceBuffer(size_t frameIndex)
+{
+	// 容量を超えたら作り直す（他のフレームスロットが使用中の可能性があるので完了を待つ）
+	const bool instancesGrown = instances.size() > instanceCapacity;
+	const bool visibleGrown = options.culling != CullingMode::None
+		&& static_cast<uint64_t>(options.objectCount) * instances.size() > visibleInstanceCapacity;
+	if (instancesGrown || visibleGrown) {
+		vkDeviceWaitIdle(device);
+		for (size_t frame = 0; frame < frameCommands.size(); frame++) {
+			verifyCullingResults(frame);
+		}
+		if (instancesGrown) {
+			vkDestroyBuffer(device, instanceBuffer, nullptr);
+			allocator.free(instanceBufferMemory);
+			createInstanceBuffer();
+		}
+
+		// 見えるインスタンスの出力先も容量に合わせて作り直す
+		// 描画ごとの model 行列はグラフィックスのディスクリプタからも参照している
+		if (visibleGrown) {
+			destroyCullingBuffers();
+			createCullingBuffers();
+			writeDescriptorSets();
+		}
+		if (options.culling == CullingMode::Gpu) {
+			writeCullDescriptorSets();
+		}
+	}
+
+	if (instanceBufferVersions[frameIndex] == instances.getVersion()) {
+		return;
+	}
+
+	// 永続的にマップされたメモリへ直接書き込む（coherent なのでフラッシュは不要）
+	char* base = static_cast<char*>(instanceBufferMemory.mapped);
+	std::memcpy(
+		base + sizeof(InstanceData) * instanceCapacity * frameIndex,
+		instances.data(),
+		sizeof(InstanceData) * instances.size());
+	instanceBufferVersions[frameIndex] = instances.getVersion();
 }
 
 // ディスクリプタプール作成
 void HelloTriangleApplication::createDescriptorPool()
 {
-	std::array<VkDescriptorPoolSize, 2> poolSizes = {};
-	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
+	// 間接描画の model 行列の表と、仮想テクスチャのページテーブル・フィードバックがストレージバッファ
+	const uint32_t storageCount = (options.culling != CullingMode::None ? 1 : 0) + (options.virtualTexture ? 2 : 0);
+	std::vector<VkDescriptorPoolSize> poolSizes(storageCount > 0 ? 3 : 2);
+	// テクスチャのサンプラーごとに1セット
+	const uint32_t setCount = static_cast<uint32_t>(textureSamplers.size());
+	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+	poolSizes[0].descriptorCount = setCount;
 	poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	poolSizes[1].descriptorCount = static_cast<uint32_t>(swapChainImages.size());
+	poolSizes[1].descriptorCount = setCount;
+	if (storageCount > 0) {
+		poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		poolSizes[2].descriptorCount = setCount * storageCount;
+	}
 
 	VkDescriptorPoolCreateInfo poolInfo = {};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = static_cast<uint32_t>(swapChainImages.size());
+	poolInfo.maxSets = setCount;
 
 	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
 		throw std::runtime_error("failed to create descriptor pool!");
@@ -1713,36 +3260,60 @@ void HelloTriangleApplication::createDescriptorPool()
 // ディスクリプタセット作成
 void HelloTriangleApplication::createDescriptorSets()
 {
-	std::vector<VkDescriptorSetLayout> layouts(swapChainImages.size(), descriptorSetLayout);
+	// 全イメージ・全オブジェクトで1つのセットを共有し、描画ごとにダイナミックオフセットを渡す
+	// ストリーミングするときはサンプラー（minLod）ごとに1つずつ作る
+	descriptorSets.resize(textureSamplers.size());
+	std::vector<VkDescriptorSetLayout> layouts(descriptorSets.size(), descriptorSetLayout);
+
 	VkDescriptorSetAllocateInfo allocInfo = {};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(swapChainImages.size());
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(layouts.size());
 	allocInfo.pSetLayouts = layouts.data();
 
-	descriptorSets.resize(swapChainImages.size());
 	if (vkAllocateDescriptorSets(device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
 		throw std::runtime_error("failed to allocate descriptor sets!");
 	}
 
-	for (size_t i = 0; i < swapChainImages.size(); i++) {
-		VkDescriptorBufferInfo bufferInfo = {};
-		bufferInfo.buffer = uniformBuffers[i];
-		bufferInfo.offset = 0;
-		bufferInfo.range = sizeof(UniformBufferObject);
+	writeDescriptorSets();
+}
 
+// 全ディスクリプタセットにユニフォームバッファとテクスチャを書き込む
+void HelloTriangleApplication::writeDescriptorSets()
+{
+	VkDescriptorBufferInfo bufferInfo = {};
+	bufferInfo.buffer = uniformBuffer;
+	bufferInfo.offset = 0;
+	bufferInfo.range = sizeof(UniformBufferObject);
+
+	VkDescriptorBufferInfo drawModelInfo = {};
+	drawModelInfo.buffer = drawModelBuffer;
+	drawModelInfo.offset = 0;
+	drawModelInfo.range = drawModelSlotSize;
+
+	VkDescriptorBufferInfo pageTableInfo = {};
+	pageTableInfo.buffer = pageTableBuffer;
+	pageTableInfo.offset = 0;
+	pageTableInfo.range = pageTableSlotSize;
+
+	VkDescriptorBufferInfo feedbackInfo = {};
+	feedbackInfo.buffer = feedbackBuffer;
+	feedbackInfo.offset = 0;
+	feedbackInfo.range = feedbackSlotSize;
+
+	for (size_t i = 0; i < descriptorSets.size(); i++) {
 		VkDescriptorImageInfo imageInfo = {};
 		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
 		imageInfo.imageView = textureImageView;
-		imageInfo.sampler = textureSampler;
+		imageInfo.sampler = textureSamplers[i];
 
-		std::array<VkWriteDescriptorSet, 2> descriptorWrites = {};
+		std::array<VkWriteDescriptorSet, 5> descriptorWrites = {};
 
 		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 		descriptorWrites[0].dstSet = descriptorSets[i];
 		descriptorWrites[0].dstBinding = 0;
 		descriptorWrites[0].dstArrayElement = 0;
-		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 		descriptorWrites[0].descriptorCount = 1;
 		descriptorWrites[0].pBufferInfo = &bufferInfo;
 
@@ -1754,29 +3325,786 @@ void HelloTriangleApplication::createDescriptorSets()
 		descriptorWrites[1].descriptorCount = 1;
 		descriptorWrites[1].pImageInfo = &imageInfo;	// Optional
 
+		descriptorWrites[2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[2].dstSet = descriptorSets[i];
+		descriptorWrites[2].dstBinding = 2;
+		descriptorWrites[2].dstArrayElement = 0;
+		descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		descriptorWrites[2].descriptorCount = 1;
+		descriptorWrites[2].pBufferInfo = &drawModelInfo;
+
+		descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[3].dstSet = descriptorSets[i];
+		descriptorWrites[3].dstBinding = 3;
+		descriptorWrites[3].dstArrayElement = 0;
+		descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		descriptorWrites[3].descriptorCount = 1;
+		descriptorWrites[3].pBufferInfo = &pageTableInfo;
+
+		descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[4].dstSet = descriptorSets[i];
+		descriptorWrites[4].dstBinding = 4;
+		descriptorWrites[4].dstArrayElement = 0;
+		descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC;
+		descriptorWrites[4].descriptorCount = 1;
+		descriptorWrites[4].pBufferInfo = &feedbackInfo;
+
+		// カリングしなければ binding 2 はなく、仮想テクスチャを使わなければ binding 3, 4 はない
+		uint32_t writeCount = options.culling != CullingMode::None ? 3 : 2;
+		if (options.virtualTexture) {
+			descriptorWrites[writeCount] = descriptorWrites[3];
+			descriptorWrites[writeCount + 1] = descriptorWrites[4];
+			writeCount += 2;
+		}
+		vkUpdateDescriptorSets(
+			device,
+			writeCount,
+			descriptorWrites.data(),
+			0,
+			nullptr);
+	}
+}
+
+
+// カリング用のバッファ・ディスクリプタ・コンピュートパイプラインを作成する
+void HelloTriangleApplication::createCullingResources()
+{
+	if (options.culling == CullingMode::None) {
+		return;
+	}
+
+	// 描画コマンドは (オブジェクト, LOD) ごとに最大1つで、1回の間接描画で全部を描く
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	const uint64_t drawLimit = static_cast<uint64_t>(options.objectCount) * meshLods.size();
+	if (drawLimit > properties.limits.maxDrawIndirectCount) {
+		throw std::runtime_error("too many objects and LODs for one indirect draw!");
+	}
+	maxIndirectDraws = static_cast<uint32_t>(drawLimit);
+
+	createCullingBuffers();
+	cullingExpectations.assign(maxFramesInFlight, CullingExpectation());
+
+	if (options.culling != CullingMode::Gpu) {
+		return;
+	}
+
+	// コンピュートはグラフィックスキューに記録する
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+	if (!(families[queueFamilyIndices.graphicsFamily.value()].queueFlags & VK_QUEUE_COMPUTE_BIT)) {
+		throw std::runtime_error("graphics queue does not support compute for GPU culling!");
+	}
+
+	// メッシュの境界球と LOD の表は実行中に変わらないので、一度だけ書き込む
+	struct LodEntry {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float error;
+		uint32_t reserved;
+	};
+	const VkDeviceSize lodBufferSize = sizeof(glm::vec4) + sizeof(LodEntry) * meshLods.size();
+	createBuffer(
+		lodBufferSize,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+		lodBuffer,
+		lodBufferMemory);
+
+	char* lodData = static_cast<char*>(lodBufferMemory.mapped);
+	glm::vec4 sphere(meshBounds.center, meshBounds.radius);
+	std::memcpy(lodData, &sphere, sizeof(sphere));
+	for (size_t i = 0; i < meshLods.size(); i++) {
+		LodEntry entry = { meshLods[i].firstIndex, meshLods[i].indexCount, meshLods[i].error, 0 };
+		std::memcpy(lodData + sizeof(glm::vec4) + sizeof(LodEntry) * i, &entry, sizeof(entry));
+	}
+
+	// binding 0: オブジェクト（ユニフォームバッファ）, 1: インスタンス, 2: 見えるインスタンス, 3: 間接描画コマンド, 4: LOD の表,
+	// 5: 描画ごとの model 行列, 6: (オブジェクト, LOD) ごとのカウンタ
+	std::array<VkDescriptorSetLayoutBinding, 7> bindings = {};
+	for (uint32_t i = 0; i < bindings.size(); i++) {
+		bindings[i].binding = i;
+		bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[i].descriptorCount = 1;
+		bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings = bindings.data();
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &cullDescriptorSetLayout) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create descriptor set layout!");
+	}
+
+	VkDescriptorPoolSize poolSize = {};
+	poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSize.descriptorCount = static_cast<uint32_t>(bindings.size()) * maxFramesInFlight;
+
+	VkDescriptorPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount = 1;
+	poolInfo.pPoolSizes = &poolSize;
+	poolInfo.maxSets = maxFramesInFlight;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &cullDescriptorPool) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create descriptor pool!");
+	}
+
+	std::vector<VkDescriptorSetLayout> layouts(maxFramesInFlight, cullDescriptorSetLayout);
+	VkDescriptorSetAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool = cullDescriptorPool;
+	allocInfo.descriptorSetCount = maxFramesInFlight;
+	allocInfo.pSetLayouts = layouts.data();
+
+	cullDescriptorSets.resize(maxFramesInFlight);
+	if (vkAllocateDescriptorSets(device, &allocInfo, cullDescriptorSets.data()) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate descriptor sets!");
+	}
+	writeCullDescriptorSets();
+
+	VkPushConstantRange pushConstantRange = {};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(CullParams);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = 1;
+	pipelineLayoutInfo.pSetLayouts = &cullDescriptorSetLayout;
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &cullPipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create pipeline layout!");
+	}
+
+	if (uniformStride % sizeof(glm::mat4) != 0) {
+		throw std::runtime_error("uniform stride is not a multiple of mat4!");
+	}
+
+	auto cullShaderCode = readFile("shaders/cull.spv");
+	VkShaderModule cullShaderModule = createShaderModule(cullShaderCode);
+
+	// オブジェクトの間隔と LOD の数は実行中に変わらないので特殊化定数で渡す
+	struct SpecializationData {
+		uint32_t objectStride;
+		uint32_t lodCount;
+	} specializationData = {
+		static_cast<uint32_t>(uniformStride / sizeof(glm::mat4)),
+		static_cast<uint32_t>(meshLods.size())
+	};
+	std::array<VkSpecializationMapEntry, 2> specializationEntries = {};
+	specializationEntries[0].constantID = 0;
+	specializationEntries[0].offset = offsetof(SpecializationData, objectStride);
+	specializationEntries[0].size = sizeof(uint32_t);
+	specializationEntries[1].constantID = 1;
+	specializationEntries[1].offset = offsetof(SpecializationData, lodCount);
+	specializationEntries[1].size = sizeof(uint32_t);
+
+	VkSpecializationInfo specializationInfo = {};
+	specializationInfo.mapEntryCount = static_cast<uint32_t>(specializationEntries.size());
+	specializationInfo.pMapEntries = specializationEntries.data();
+	specializationInfo.dataSize = sizeof(specializationData);
+	specializationInfo.pData = &specializationData;
+
+	VkComputePipelineCreateInfo pipelineInfo = {};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module = cullShaderModule;
+	pipelineInfo.stage.pName = "main";
+	pipelineInfo.stage.pSpecializationInfo = &specializationInfo;
+	pipelineInfo.layout = cullPipelineLayout;
+
+	VkPipelineCreationFeedbackEXT pipelineFeedback = {};
+	VkPipelineCreationFeedbackEXT stageFeedback = {};
+	VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo = {};
+	feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+	feedbackInfo.pPipelineCreationFeedback = &pipelineFeedback;
+	feedbackInfo.pipelineStageCreationFeedbackCount = 1;
+	feedbackInfo.pPipelineStageCreationFeedbacks = &stageFeedback;
+	if (pipelineFeedbackEnabled) {
+		pipelineInfo.pNext = &feedbackInfo;
+	}
+
+	auto createStart = std::chrono::high_resolution_clock::now();
+	if (vkCreateComputePipelines(device, pipelineCache.get(), 1, &pipelineInfo, nullptr, &cullPipeline) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create compute pipeline!");
+	}
+	pipelineCache.recordCreation(
+		pipelineFeedbackEnabled ? &pipelineFeedback : nullptr,
+		elapsedMs(createStart, std::chrono::high_resolution_clock::now()));
+
+	vkDestroyShaderModule(device, cullShaderModule, nullptr);
+}
+
+// 間接描画コマンド・描画ごとの model 行列・見えるインスタンスのバッファを作成する
+void HelloTriangleApplication::createCullingBuffers()
+{
+	// スロットの先頭をストレージバッファのオフセットアライメント（最大256バイト）に揃える
+	const VkDeviceSize slotAlignment = 256;
+	drawCounterOffset = alignUp(sizeof(IndirectHeader) + sizeof(VkDrawIndexedIndirectCommand) * maxIndirectDraws, slotAlignment);
+	indirectSlotSize = alignUp(drawCounterOffset + sizeof(uint32_t) * maxIndirectDraws, slotAlignment);
+	drawModelSlotSize = alignUp(sizeof(glm::mat4) * maxIndirectDraws, slotAlignment);
+
+	// 見えるインスタンスは全オブジェクトで1つの領域に詰めるので、オブジェクト数 x インスタンス数あれば足りる
+	visibleInstanceCapacity = static_cast<uint32_t>(std::max<uint64_t>(1, static_cast<uint64_t>(options.objectCount) * instances.size()));
+	visibleInstanceSlotSize = alignUp(sizeof(InstanceData) * visibleInstanceCapacity, slotAlignment);
+
+	// 描画と GPU カリングで毎フレーム読み書きするのでデバイスローカルに置く
+	// GPU カリングでは vkCmdFillBuffer でスロットを 0 にしてからコンピュートで書き込み、CPU カリングではステージングからコピーする
+	const VkBufferUsageFlags transferUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	createBuffer(
+		indirectSlotSize * maxFramesInFlight,
+		VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | transferUsage,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		indirectBuffer,
+		indirectBufferMemory);
+
+	createBuffer(
+		drawModelSlotSize * maxFramesInFlight,
+		VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | transferUsage,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		drawModelBuffer,
+		drawModelBufferMemory);
+
+	createBuffer(
+		visibleInstanceSlotSize * maxFramesInFlight,
+		VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | transferUsage,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		visibleInstanceBuffer,
+		visibleInstanceBufferMemory);
+
+	// CPU カリングのアップロードと GPU カリングの検証の読み戻しに使う
+	cullingStagingSlotSize = indirectSlotSize + drawModelSlotSize + visibleInstanceSlotSize;
+	if (options.culling == CullingMode::Cpu || options.verifyCulling) {
+		createBuffer(
+			cullingStagingSlotSize * maxFramesInFlight,
+			transferUsage,
+			VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			cullingStagingBuffer,
+			cullingStagingBufferMemory);
+	}
+}
+
+// カリング用のバッファを破棄する
+void HelloTriangleApplication::destroyCullingBuffers()
+{
+	vkDestroyBuffer(device, indirectBuffer, nullptr);
+	allocator.free(indirectBufferMemory);
+	vkDestroyBuffer(device, drawModelBuffer, nullptr);
+	allocator.free(drawModelBufferMemory);
+	vkDestroyBuffer(device, visibleInstanceBuffer, nullptr);
+	allocator.free(visibleInstanceBufferMemory);
+	vkDestroyBuffer(device, cullingStagingBuffer, nullptr);
+	allocator.free(cullingStagingBufferMemory);
+	indirectBuffer = VK_NULL_HANDLE;
+	drawModelBuffer = VK_NULL_HANDLE;
+	visibleInstanceBuffer = VK_NULL_HANDLE;
+	cullingStagingBuffer = VK_NULL_HANDLE;
+}
+
+// カリング用ディスクリプタセットにバッファを書き込む
+void HelloTriangleApplication::writeCullDescriptorSets()
+{
+	for (size_t frame = 0; frame < cullDescriptorSets.size(); frame++) {
+		std::array<VkDescriptorBufferInfo, 7> bufferInfos = {};
+		bufferInfos[0].buffer = uniformBuffer;
+		bufferInfos[0].offset = 0;
+		bufferInfos[0].range = VK_WHOLE_SIZE;
+		bufferInfos[1].buffer = instanceBuffer;
+		bufferInfos[1].offset = sizeof(InstanceData) * instanceCapacity * frame;
+		bufferInfos[1].range = sizeof(InstanceData) * instanceCapacity;
+		bufferInfos[2].buffer = visibleInstanceBuffer;
+		bufferInfos[2].offset = visibleInstanceSlotSize * frame;
+		bufferInfos[2].range = visibleInstanceSlotSize;
+		bufferInfos[3].buffer = indirectBuffer;
+		bufferInfos[3].offset = indirectSlotSize * frame;
+		bufferInfos[3].range = drawCounterOffset;
+		bufferInfos[4].buffer = lodBuffer;
+		bufferInfos[4].offset = 0;
+		bufferInfos[4].range = VK_WHOLE_SIZE;
+		bufferInfos[5].buffer = drawModelBuffer;
+		bufferInfos[5].offset = drawModelSlotSize * frame;
+		bufferInfos[5].range = drawModelSlotSize;
+		bufferInfos[6].buffer = indirectBuffer;
+		bufferInfos[6].offset = indirectSlotSize * frame + drawCounterOffset;
+		bufferInfos[6].range = indirectSlotSize - drawCounterOffset;
+
+		std::array<VkWriteDescriptorSet, 7> descriptorWrites = {};
+		for (uint32_t i = 0; i < descriptorWrites.size(); i++) {
+			descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[i].dstSet = cullDescriptorSets[frame];
+			descriptorWrites[i].dstBinding = i;
+			descriptorWrites[i].dstArrayElement = 0;
+			descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[i].descriptorCount = 1;
+			descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+		}
+
 		vkUpdateDescriptorSets(
 			device,
-			static_cast<uint32_t>(descriptorWrites.size()), 
+			static_cast<uint32_t>(descriptorWrites.size()),
 			descriptorWrites.data(),
 			0,
 			nullptr);
 	}
 }
 
+// instances が変わっていれば instanceBounds を求め直す
+void HelloTriangleApplication::updateInstanceBounds()
+{
+	if (instanceBoundsVersion == instances.getVersion()) {
+		return;
+	}
+
+	const InstanceData* source = instances.data();
+	instanceBounds.resize(instances.size());
+	glm::vec3 minCenter(std::numeric_limits<float>::max());
+	glm::vec3 maxCenter(-std::numeric_limits<float>::max());
+	for (uint32_t instance = 0; instance < instances.size(); instance++) {
+		BoundingSphere sphere = meshBounds.transformed(source[instance].model);
+		instanceBounds.set(instance, sphere);
+		minCenter = glm::min(minCenter, sphere.center);
+		maxCenter = glm::max(maxCenter, sphere.center);
+	}
+
+	// 全インスタンスを囲む球（中心は各球の中心の AABB の中心）
+	instanceSetBounds = BoundingSphere();
+	if (!instances.empty()) {
+		instanceSetBounds.center = (minCenter + maxCenter) * 0.5f;
+		for (uint32_t instance = 0; instance < instances.size(); instance++) {
+			glm::vec3 center(instanceBounds.getCenterX()[instance], instanceBounds.getCenterY()[instance], instanceBounds.getCenterZ()[instance]);
+			instanceSetBounds.radius = std::max(
+				instanceSetBounds.radius,
+				glm::length(center - instanceSetBounds.center) + instanceBounds.getRadius()[instance]);
+		}
+	}
+	visibleIndices.resize(instances.size());
+	visibleLods.resize(instances.size());
+	referenceIndices.resize(instances.size());
+	instanceBoundsVersion = instances.getVersion();
+}
+
+// CPU でカリングし、見えるインスタンスがある (オブジェクト, LOD) ごとに描画コマンドを1つ作って詰めて書き出す
+// インスタンスの境界球はオブジェクト空間で持っておき、錐台のほうをオブジェクトごとにオブジェクト空間へ移して判定する
+// 判定と LOD の選択は shaders/cull.comp と同じ式・同じ順序で行う（描画コマンドとインスタンスの並びは GPU ではアトミック加算の順になる）
+void HelloTriangleApplication::cullInstancesOnCpu(CullingResult& result)
+{
+	updateInstanceBounds();
+
+	// CPU カリングの検証では、SIMD カーネルの結果をスカラー版と比べる（時間には含めない）
+	if (options.culling == CullingMode::Cpu && options.verifyCulling) {
+		bool match = true;
+		for (uint32_t object = 0; object < options.objectCount && match; object++) {
+			Frustum localFrustum = frustum.toLocal(objectModels[object]);
+			uint32_t visible = cullSpheres(localFrustum, instanceBounds, visibleIndices.data());
+			uint32_t expected = cullSpheresScalar(localFrustum, instanceBounds, referenceIndices.data());
+			match = visible == expected && std::equal(visibleIndices.begin(), visibleIndices.begin() + visible, referenceIndices.begin());
+		}
+
+		cullingVerifiedFrames++;
+		if (!match) {
+			cullingMismatchedFrames++;
+		}
+	}
+
+	auto cullStart = std::chrono::high_resolution_clock::now();
+	const InstanceData* source = instances.data();
+	const uint32_t lodCount = static_cast<uint32_t>(meshLods.size());
+	const float* centerX = instanceBounds.getCenterX();
+	const float* centerY = instanceBounds.getCenterY();
+	const float* centerZ = instanceBounds.getCenterZ();
+	const float* radius = instanceBounds.getRadius();
+
+	result.commands.clear();
+	result.drawModels.clear();
+	result.visibleInstances.clear();
+
+	std::vector<uint32_t> counts(lodCount);
+	for (uint32_t object = 0; object < options.objectCount; object++) {
+		Frustum localFrustum = frustum.toLocal(objectModels[object]);
+		uint32_t visible = cullSpheres(localFrustum, instanceBounds, visibleIndices.data());
+
+		std::fill(counts.begin(), counts.end(), 0u);
+		for (uint32_t i = 0; i < visible; i++) {
+			uint32_t instance = visibleIndices[i];
+			BoundingSphere localSphere;
+			localSphere.center = glm::vec3(centerX[instance], centerY[instance], centerZ[instance]);
+			localSphere.radius = radius[instance];
+			BoundingSphere worldSphere = localSphere.transformed(objectModels[object]);
+			visibleLods[i] = selectLod(worldSphere.center, worldSphere.radius);
+			counts[visibleLods[i]]++;
+		}
+
+		// 空の (オブジェクト, LOD) にはコマンドを作らない
+		for (uint32_t lod = 0; lod < lodCount; lod++) {
+			if (counts[lod] == 0) {
+				continue;
+			}
+			VkDrawIndexedIndirectCommand command = {};
+			command.indexCount = meshLods[lod].indexCount;
+			command.instanceCount = counts[lod];
+			command.firstIndex = meshLods[lod].firstIndex;
+			command.firstInstance = static_cast<uint32_t>(result.visibleInstances.size());
+			result.commands.push_back(command);
+			result.drawModels.push_back(objectModels[object]);
+
+			for (uint32_t i = 0; i < visible; i++) {
+				if (visibleLods[i] == lod) {
+					result.visibleInstances.push_back(source[visibleIndices[i]]);
+				}
+			}
+			cullingStats.lodCounts[lod] += counts[lod];
+		}
+	}
+
+	cullingStats.frameCount++;
+	cullingStats.testedCount += static_cast<uint64_t>(options.objectCount) * instances.size();
+	cullingStats.visibleCount += result.visibleInstances.size();
+	cullingStats.totalUs += 1000.0 * elapsedMs(cullStart, std::chrono::high_resolution_clock::now());
+}
+
+// フレームスロットのカリング結果を用意する
+void HelloTriangleApplication::prepareCulling(size_t frameIndex)
+{
+	if (options.culling == CullingMode::None) {
+		// インスタンスごとには選べないので、全インスタンスを囲む球でオブジェクトごとに選ぶ
+		updateInstanceBounds();
+		objectLods.resize(options.objectCount);
+		for (uint32_t object = 0; object < options.objectCount; object++) {
+			BoundingSphere worldSphere = instanceSetBounds.transformed(objectModels[object]);
+			objectLods[object] = selectLod(worldSphere.center, worldSphere.radius);
+		}
+	}
+	else if (options.culling == CullingMode::Cpu) {
+		cullInstancesOnCpu(cullingResult);
+
+		// ステージングのスロットへ書き込み、recordCullingUpload でデバイスローカルのバッファへコピーする
+		// multiDrawIndirect で最大数を描くときのため、使わないコマンドは空にしておく
+		char* stagingSlot = static_cast<char*>(cullingStagingBufferMemory.mapped) + cullingStagingSlotSize * frameIndex;
+		char* indirectSlot = stagingSlot;
+		IndirectHeader header = {};
+		header.drawCount = static_cast<uint32_t>(cullingResult.commands.size());
+		header.visibleCount = static_cast<uint32_t>(cullingResult.visibleInstances.size());
+		std::memcpy(indirectSlot, &header, sizeof(header));
+
+		char* commands = indirectSlot + sizeof(IndirectHeader);
+		const size_t commandBytes = sizeof(VkDrawIndexedIndirectCommand) * cullingResult.commands.size();
+		std::memcpy(commands, cullingResult.commands.data(), commandBytes);
+		std::memset(commands + commandBytes, 0, sizeof(VkDrawIndexedIndirectCommand) * maxIndirectDraws - commandBytes);
+
+		std::memcpy(
+			stagingSlot + indirectSlotSize,
+			cullingResult.drawModels.data(),
+			sizeof(glm::mat4) * cullingResult.drawModels.size());
+		std::memcpy(
+			stagingSlot + indirectSlotSize + drawModelSlotSize,
+			cullingResult.visibleInstances.data(),
+			sizeof(InstanceData) * cullingResult.visibleInstances.size());
+	}
+	else if (options.culling == CullingMode::Gpu && options.verifyCulling) {
+		// GPU の結果と比べるため、同じ入力で CPU の結果を求めておく
+		CullingExpectation& expected = cullingExpectations[frameIndex];
+		cullInstancesOnCpu(expected.result);
+		expected.pending = true;
+	}
+}
+
+// CPU カリングの結果をステージングからデバイスローカルのバッファへコピーするコマンドを記録する
+void HelloTriangleApplication::recordCullingUpload(VkCommandBuffer commandBuffer, size_t frameIndex)
+{
+	const VkDeviceSize stagingOffset = cullingStagingSlotSize * frameIndex;
+
+	// 描画コマンドは使わないもの（空のコマンド）も含めて全部、model 行列と見えるインスタンスは使う分だけコピーする
+	VkBufferCopy indirectRegion = {};
+	indirectRegion.srcOffset = stagingOffset;
+	indirectRegion.dstOffset = indirectSlotSize * frameIndex;
+	indirectRegion.size = sizeof(IndirectHeader) + sizeof(VkDrawIndexedIndirectCommand) * maxIndirectDraws;
+	vkCmdCopyBuffer(commandBuffer, cullingStagingBuffer, indirectBuffer, 1, &indirectRegion);
+
+	if (!cullingResult.commands.empty()) {
+		VkBufferCopy drawModelRegion = {};
+		drawModelRegion.srcOffset = stagingOffset + indirectSlotSize;
+		drawModelRegion.dstOffset = drawModelSlotSize * frameIndex;
+		drawModelRegion.size = sizeof(glm::mat4) * cullingResult.drawModels.size();
+		vkCmdCopyBuffer(commandBuffer, cullingStagingBuffer, drawModelBuffer, 1, &drawModelRegion);
+
+		VkBufferCopy visibleRegion = {};
+		visibleRegion.srcOffset = stagingOffset + indirectSlotSize + drawModelSlotSize;
+		visibleRegion.dstOffset = visibleInstanceSlotSize * frameIndex;
+		visibleRegion.size = sizeof(InstanceData) * cullingResult.visibleInstances.size();
+		vkCmdCopyBuffer(commandBuffer, cullingStagingBuffer, visibleInstanceBuffer, 1, &visibleRegion);
+	}
+
+	// 間接描画コマンド・インスタンス属性・描画ごとの model 行列として読めるようにする
+	VkMemoryBarrier uploadBarrier = {};
+	uploadBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	uploadBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	uploadBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+		0,
+		1, &uploadBarrier,
+		0, nullptr,
+		0, nullptr);
+}
+
+// GPU カリングのコマンドを記録する
+void HelloTriangleApplication::recordCulling(VkCommandBuffer commandBuffer, size_t frameIndex, uint32_t imageIndex)
+{
+	// 描画数・カウンタを 0 にしてからシェーダーでアトミックに数える
+	// 使わなかったコマンドも 0（instanceCount が 0 の空のコマンド）になる
+	vkCmdFillBuffer(commandBuffer, indirectBuffer, indirectSlotSize * frameIndex, indirectSlotSize, 0);
+
+	VkMemoryBarrier fillBarrier = {};
+	fillBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	fillBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	fillBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		0,
+		1, &fillBarrier,
+		0, nullptr,
+		0, nullptr);
+
+	CullParams params = {};
+	for (int i = 0; i < 6; i++) {
+		params.planes[i] = frustum.planes[i];
+	}
+	params.camera = glm::vec4(cameraPosition, lodScale);
+	params.objectCount = options.objectCount;
+	params.instanceCount = instances.size();
+	params.imageIndex = imageIndex;
+
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipelineLayout, 0, 1, &cullDescriptorSets[frameIndex], 0, nullptr);
+
+	// 前のフェーズの書き込みを次のフェーズで読めるようにする
+	VkMemoryBarrier phaseBarrier = {};
+	phaseBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	phaseBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	phaseBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+	// x: インスタンス（64個ずつ）, y: オブジェクト
+	const uint32_t groupSize = 64;
+	const uint32_t instanceGroups = (instances.size() + groupSize - 1) / groupSize;
+	const uint32_t phases[] = { CULL_PHASE_COUNT, CULL_PHASE_ALLOCATE, CULL_PHASE_WRITE };
+	for (uint32_t phase : phases) {
+		if (phase != CULL_PHASE_COUNT) {
+			vkCmdPipelineBarrier(
+				commandBuffer,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+				0,
+				1, &phaseBarrier,
+				0, nullptr,
+				0, nullptr);
+		}
+
+		params.phase = phase;
+		vkCmdPushConstants(commandBuffer, cullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(params), &params);
+		if (phase == CULL_PHASE_ALLOCATE) {
+			// x: (オブジェクト, LOD)
+			vkCmdDispatch(commandBuffer, (maxIndirectDraws + groupSize - 1) / groupSize, 1, 1);
+		}
+		else if (instanceGroups > 0) {
+			vkCmdDispatch(commandBuffer, instanceGroups, options.objectCount, 1);
+		}
+	}
+
+	// 間接描画コマンド・インスタンス属性・描画ごとの model 行列として読めるようにする
+	// --verify-culling ではステージングへコピーして読み戻すので、転送からも読めるようにする
+	VkMemoryBarrier cullBarrier = {};
+	cullBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	cullBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+	cullBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	VkPipelineStageFlags cullDstStages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT;
+	if (options.verifyCulling) {
+		cullBarrier.dstAccessMask |= VK_ACCESS_TRANSFER_READ_BIT;
+		cullDstStages |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+	}
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+		cullDstStages,
+		0,
+		1, &cullBarrier,
+		0, nullptr,
+		0, nullptr);
+
+	if (!options.verifyCulling) {
+		return;
+	}
+
+	// 書き込まれた数は CPU からは分からないので、スロット全体を読み戻す（検証のときだけ）
+	const VkDeviceSize stagingOffset = cullingStagingSlotSize * frameIndex;
+	VkBufferCopy indirectRegion = {};
+	indirectRegion.srcOffset = indirectSlotSize * frameIndex;
+	indirectRegion.dstOffset = stagingOffset;
+	indirectRegion.size = sizeof(IndirectHeader) + sizeof(VkDrawIndexedIndirectCommand) * maxIndirectDraws;
+	vkCmdCopyBuffer(commandBuffer, indirectBuffer, cullingStagingBuffer, 1, &indirectRegion);
+
+	VkBufferCopy drawModelRegion = {};
+	drawModelRegion.srcOffset = drawModelSlotSize * frameIndex;
+	drawModelRegion.dstOffset = stagingOffset + indirectSlotSize;
+	drawModelRegion.size = drawModelSlotSize;
+	vkCmdCopyBuffer(commandBuffer, drawModelBuffer, cullingStagingBuffer, 1, &drawModelRegion);
+
+	VkBufferCopy visibleRegion = {};
+	visibleRegion.srcOffset = visibleInstanceSlotSize * frameIndex;
+	visibleRegion.dstOffset = stagingOffset + indirectSlotSize + drawModelSlotSize;
+	visibleRegion.size = visibleInstanceSlotSize;
+	vkCmdCopyBuffer(commandBuffer, visibleInstanceBuffer, cullingStagingBuffer, 1, &visibleRegion);
+
+	// フェンスを待った後に CPU で読む
+	VkMemoryBarrier readbackBarrier = {};
+	readbackBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	readbackBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	readbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(
+		commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_HOST_BIT,
+		0,
+		1, &readbackBarrier,
+		0, nullptr,
+		0, nullptr);
+}
+
+// 完了したフレームスロットの GPU カリング結果を期待値と比較する
+void HelloTriangleApplication::verifyCullingResults(size_t frameIndex)
+{
+	if (options.culling != CullingMode::Gpu || !options.verifyCulling || !cullingExpectations[frameIndex].pending) {
+		return;
+	}
+	CullingExpectation& expected = cullingExpectations[frameIndex];
+	expected.pending = false;
+
+	// recordCulling でステージングへ読み戻したものを読む
+	const char* stagingSlot = static_cast<const char*>(cullingStagingBufferMemory.mapped) + cullingStagingSlotSize * frameIndex;
+	IndirectHeader header;
+	std::memcpy(&header, stagingSlot, sizeof(header));
+	const VkDrawIndexedIndirectCommand* commands = reinterpret_cast<const VkDrawIndexedIndirectCommand*>(stagingSlot + sizeof(IndirectHeader));
+	const glm::mat4* drawModels = reinterpret_cast<const glm::mat4*>(stagingSlot + indirectSlotSize);
+	const InstanceData* visibleInstances = reinterpret_cast<const InstanceData*>(stagingSlot + indirectSlotSize + drawModelSlotSize);
+
+	// GPU は描画コマンドもインスタンスもアトミック加算の順に書き込むので、
+	// 描画ごとに (model 行列, LOD, インスタンスの並びを揃えたもの) にまとめ、それも並べ替えてから比較する
+	struct Draw {
+		glm::mat4 model;
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		std::vector<InstanceData> instances;
+	};
+	auto instanceLess = [](const InstanceData& a, const InstanceData& b) {
+		return std::memcmp(&a, &b, sizeof(InstanceData)) < 0;
+	};
+	auto drawKeyCompare = [](const Draw& a, const Draw& b) {
+		int order = std::memcmp(&a.model, &b.model, sizeof(glm::mat4));
+		if (order != 0) {
+			return order;
+		}
+		if (a.firstIndex != b.firstIndex) {
+			return a.firstIndex < b.firstIndex ? -1 : 1;
+		}
+		if (a.indexCount != b.indexCount) {
+			return a.indexCount < b.indexCount ? -1 : 1;
+		}
+		return 0;
+	};
+	auto collect = [&](uint32_t drawCount, const VkDrawIndexedIndirectCommand* drawCommands, const glm::mat4* models, const InstanceData* instanceData) {
+		std::vector<Draw> draws(drawCount);
+		for (uint32_t i = 0; i < drawCount; i++) {
+			draws[i].model = models[i];
+			draws[i].firstIndex = drawCommands[i].firstIndex;
+			draws[i].indexCount = drawCommands[i].indexCount;
+			const InstanceData* begin = instanceData + drawCommands[i].firstInstance;
+			draws[i].instances.assign(begin, begin + drawCommands[i].instanceCount);
+			std::sort(draws[i].instances.begin(), draws[i].instances.end(), instanceLess);
+		}
+		std::sort(draws.begin(), draws.end(), [&](const Draw& a, const Draw& b) {
+			return drawKeyCompare(a, b) < 0;
+		});
+		return draws;
+	};
+
+	const CullingResult& result = expected.result;
+	bool match = header.drawCount == result.commands.size() && header.visibleCount == result.visibleInstances.size();
+
+	// 範囲外を読まないよう、コマンドの指すインスタンスが書き込まれた数に収まるかを先に確かめる
+	for (uint32_t i = 0; i < header.drawCount && match; i++) {
+		match = commands[i].vertexOffset == 0
+			&& static_cast<uint64_t>(commands[i].firstInstance) + commands[i].instanceCount <= header.visibleCount;
+	}
+
+	if (match) {
+		std::vector<Draw> actual = collect(header.drawCount, commands, drawModels, visibleInstances);
+		std::vector<Draw> expectedDraws = collect(
+			static_cast<uint32_t>(result.commands.size()),
+			result.commands.data(),
+			result.drawModels.data(),
+			result.visibleInstances.data());
+		match = std::equal(actual.begin(), actual.end(), expectedDraws.begin(), [&](const Draw& a, const Draw& b) {
+			return drawKeyCompare(a, b) == 0
+				&& a.instances.size() == b.instances.size()
+				&& std::equal(a.instances.begin(), a.instances.end(), b.instances.begin(), [](const InstanceData& x, const InstanceData& y) {
+					return std::memcmp(&x, &y, sizeof(InstanceData)) == 0;
+				});
+		});
+	}
+
+	cullingVerifiedFrames++;
+	if (!match) {
+		cullingMismatchedFrames++;
+	}
+}
 
 void HelloTriangleApplication::mainLoop()
 {
+	if (options.headless) {
+		headlessLoop();
+		return;
+	}
+
 	while (!glfwWindowShouldClose(window)) {
 		glfwPollEvents();
+		graphicsUploads.collectCompleted();
 		drawFrame();
 	}
 
 	vkDeviceWaitIdle(device);
+	for (size_t frame = 0; frame < frameCommands.size(); frame++) {
+		verifyCullingResults(frame);
+	}
+
+	printFrameStats();
 }
 
 void HelloTriangleApplication::drawFrame()
 {
+	auto frameStart = std::chrono::high_resolution_clock::now();
+	if (frameStats.frameCount > 0) {
+		frameStats.intervalSamples.push_back(elapsedMs(frameStats.lastFrameStart, frameStart));
+	}
+	frameStats.lastFrameStart = frameStart;
+	collectFenceLatencies();
+
+	// maxFramesInFlight フレーム前の描画が終わるまで待つ
 	vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+	double waitMs = elapsedMs(frameStart, std::chrono::high_resolution_clock::now());
+	frameStats.fenceWaitMs += waitMs;
+	collectFenceLatencies();
+	verifyCullingResults(currentFrame);
 
 	uint32_t imageIndex;
 	VkResult result = vkAcquireNextImageKHR(
@@ -1795,7 +4123,24 @@ void HelloTriangleApplication::drawFrame()
 		throw std::runtime_error("failed to acuire swap chain image!");
 	}
 
+	// 取得したイメージを以前のフレームがまだ使用中であれば待つ
+	// （スワップチェーンイメージ数と maxFramesInFlight が一致しない場合や、順不同で返された場合）
+	if (imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+		auto imageWaitStart = std::chrono::high_resolution_clock::now();
+		vkWaitForFences(device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+		double imageWaitMs = elapsedMs(imageWaitStart, std::chrono::high_resolution_clock::now());
+		frameStats.imageWaitMs += imageWaitMs;
+		waitMs += imageWaitMs;
+	}
+	imagesInFlight[imageIndex] = inFlightFences[currentFrame];
+
 	updateUniformBuffer(imageIndex);
+	updateInstanceBuffer(currentFrame);
+	prepareCulling(currentFrame);
+	streamTextureLevels();
+	updateVirtualTexture(currentFrame);
+	recordCommandBuffer(currentFrame, imageIndex);
+
 	VkSubmitInfo submitInfo = {};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
@@ -1806,7 +4151,7 @@ void HelloTriangleApplication::drawFrame()
 	submitInfo.pWaitDstStageMask = waitStages;
 
 	submitInfo.commandBufferCount = 1;
-	submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
+	submitInfo.pCommandBuffers = &frameCommands[currentFrame].primary;
 
 	VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[currentFrame] };
 	submitInfo.signalSemaphoreCount = 1;
@@ -1816,6 +4161,8 @@ void HelloTriangleApplication::drawFrame()
 	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
 		throw std::runtime_error("failed to submit draw command buffer!");
 	}
+	frameStats.submitTimes[currentFrame] = std::chrono::high_resolution_clock::now();
+	frameStats.pendingFences[currentFrame] = true;
 
 	VkPresentInfoKHR presentInfo = {};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1839,85 +4186,291 @@ void HelloTriangleApplication::drawFrame()
 		throw std::runtime_error("failed to present swap chain image!");
 	}
 
-	currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+	frameStats.cpuTimeSamples.push_back(elapsedMs(frameStart, std::chrono::high_resolution_clock::now()) - waitMs);
+	currentFrame = (currentFrame + 1) % maxFramesInFlight;
+	frameStats.frameCount++;
+}
+
+// ヘッドレス時のメインループ（ベンチマーク）
+void HelloTriangleApplication::headlessLoop()
+{
+	// 長さの指定がなければ既定のフレーム数だけ描画する
+	const uint32_t defaultBenchmarkFrames = 500;
+	uint32_t frameLimit = options.benchmarkFrames;
+	if (frameLimit == 0 && options.benchmarkSeconds <= 0.0) {
+		frameLimit = defaultBenchmarkFrames;
+	}
 
-	vkQueueWaitIdle(presentQueue);
+	auto startTime = std::chrono::high_resolution_clock::now();
+	for (uint32_t frame = 0; ; frame++) {
+		if (frameLimit > 0 && frame >= frameLimit) {
+			break;
+		}
+		if (options.benchmarkSeconds > 0.0
+			&& elapsedMs(startTime, std::chrono::high_resolution_clock::now()) >= options.benchmarkSeconds * 1000.0) {
+			break;
+		}
+
+		drawHeadlessFrame();
+	}
+
+	vkDeviceWaitIdle(device);
+	collectFenceLatencies();
+	for (size_t frame = 0; frame < frameCommands.size(); frame++) {
+		verifyCullingResults(frame);
+	}
+
+	printFrameStats();
+}
+
+// ヘッドレス時のフレーム描画
+void HelloTriangleApplication::drawHeadlessFrame()
+{
+	auto frameStart = std::chrono::high_resolution_clock::now();
+	if (frameStats.frameCount > 0) {
+		frameStats.intervalSamples.push_back(elapsedMs(frameStats.lastFrameStart, frameStart));
+	}
+	frameStats.lastFrameStart = frameStart;
+	collectFenceLatencies();
+
+	vkWaitForFences(device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
+	double waitMs = elapsedMs(frameStart, std::chrono::high_resolution_clock::now());
+	frameStats.fenceWaitMs += waitMs;
+	collectFenceLatencies();
+	verifyCullingResults(currentFrame);
+
+	// オフスクリーンイメージはフレームスロットと1対1に対応するため、フェンス待ちだけで再利用できる
+	uint32_t imageIndex = static_cast<uint32_t>(currentFrame);
+	updateUniformBuffer(imageIndex);
+	updateInstanceBuffer(currentFrame);
+	prepareCulling(currentFrame);
+	streamTextureLevels();
+	updateVirtualTexture(currentFrame);
+	recordCommandBuffer(currentFrame, imageIndex);
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &frameCommands[currentFrame].primary;
+
+	vkResetFences(device, 1, &inFlightFences[currentFrame]);
+
+	if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS) {
+		throw std::runtime_error("failed to submit draw command buffer!");
+	}
+	frameStats.submitTimes[currentFrame] = std::chrono::high_resolution_clock::now();
+	frameStats.pendingFences[currentFrame] = true;
+
+	frameStats.cpuTimeSamples.push_back(elapsedMs(frameStart, std::chrono::high_resolution_clock::now()) - waitMs);
+	currentFrame = (currentFrame + 1) % maxFramesInFlight;
+	frameStats.frameCount++;
+}
+
+// 完了したフレームのフェンスを確認し、サブミットからの遅延を記録する
+// フレーム開始時とフェンス待ちの直後にのみ確認するため、値は実際の完了時刻に対する上限となる
+void HelloTriangleApplication::collectFenceLatencies()
+{
+	auto now = std::chrono::high_resolution_clock::now();
+
+	for (size_t i = 0; i < frameStats.pendingFences.size(); i++) {
+		if (frameStats.pendingFences[i] && vkGetFenceStatus(device, inFlightFences[i]) == VK_SUCCESS) {
+			frameStats.latencySamples.push_back(elapsedMs(frameStats.submitTimes[i], now));
+			frameStats.pendingFences[i] = false;
+		}
+	}
+}
+
+// フレーム統計を出力する
+void HelloTriangleApplication::printFrameStats()
+{
+	if (frameStats.intervalSamples.empty()) {
+		return;
+	}
+
+	double totalInterval = 0.0;
+	for (double interval : frameStats.intervalSamples) {
+		totalInterval += interval;
+	}
+	double totalCpu = 0.0;
+	for (double cpuTime : frameStats.cpuTimeSamples) {
+		totalCpu += cpuTime;
+	}
+
+	double avgInterval = totalInterval / frameStats.intervalSamples.size();
+	double avgCpu = totalCpu / frameStats.cpuTimeSamples.size();
+	double avgWait = (frameStats.fenceWaitMs + frameStats.imageWaitMs) / frameStats.frameCount;
+
+	std::cout << (options.headless ? "headless" : "windowed")
+		<< ", frames in flight: " << maxFramesInFlight
+		<< ", frames: " << frameStats.frameCount << std::endl;
+	std::cout << "  avg frame interval: " << avgInterval << " ms ("
+		<< (avgInterval > 0.0 ? 1000.0 / avgInterval : 0.0) << " fps)" << std::endl;
+	std::cout << "  avg CPU work: " << avgCpu << " ms, avg GPU wait: " << avgWait << " ms"
+		<< " (frame fence " << frameStats.fenceWaitMs / frameStats.frameCount
+		<< " ms, image fence " << frameStats.imageWaitMs / frameStats.frameCount << " ms)" << std::endl;
+	// フレーム間隔のうちCPUがGPUを待たずに次フレームを準備できた割合
+	std::cout << "  CPU/GPU overlap: "
+		<< (avgInterval > 0.0 ? 100.0 * std::max(1.0 - avgWait / avgInterval, 0.0) : 0.0) << " %" << std::endl;
+
+	const auto& intervals = frameStats.intervalSamples;
+	std::cout << "  frame time [ms]: p50 " << percentile(intervals, 50.0)
+		<< ", p90 " << percentile(intervals, 90.0)
+		<< ", p99 " << percentile(intervals, 99.0)
+		<< ", max " << percentile(intervals, 100.0) << std::endl;
+	// FPSの下位パーセンタイルはフレーム時間の上位パーセンタイルに対応する
+	std::cout << "  fps: p50 " << 1000.0 / percentile(intervals, 50.0)
+		<< ", p10 " << 1000.0 / percentile(intervals, 90.0)
+		<< ", p1 " << 1000.0 / percentile(intervals, 99.0) << std::endl;
+	std::cout << "  CPU time [ms]: p50 " << percentile(frameStats.cpuTimeSamples, 50.0)
+		<< ", p90 " << percentile(frameStats.cpuTimeSamples, 90.0)
+		<< ", p99 " << percentile(frameStats.cpuTimeSamples, 99.0) << std::endl;
+	std::cout << "  submit-to-fence [ms]: p50 " << percentile(frameStats.latencySamples, 50.0)
+		<< ", p90 " << percentile(frameStats.latencySamples, 90.0)
+		<< ", p99 " << percentile(frameStats.latencySamples, 99.0) << std::endl;
+
+	if (cullingStats.frameCount > 0) {
+		uint64_t tested = cullingStats.testedCount / cullingStats.frameCount;
+		uint64_t visible = cullingStats.visibleCount / cullingStats.frameCount;
+		std::cout << "  CPU culling (" << getCullingKernelName() << "): avg " << visible << " visible, "
+			<< tested - visible << " culled of " << tested << " per frame, "
+			<< cullingStats.totalUs / cullingStats.frameCount << " us per frame" << std::endl;
+		std::cout << "  visible instances per LOD:";
+		for (size_t lod = 0; lod < meshLods.size(); lod++) {
+			std::cout << " " << cullingStats.lodCounts[lod] / cullingStats.frameCount;
+		}
+		std::cout << std::endl;
+	}
+	if (options.virtualTexture) {
+		const PageCache::Stats& vtStats = pageCache.getStats();
+		std::cout << "  virtual texture: " << pageCache.getResidentCount() << " of " << pageCache.getSlotCount() << " atlas pages resident, "
+			<< vtStats.loads << " loads, " << vtStats.evictions << " evictions, " << vtStats.deferred << " deferred, hit rate "
+			<< (vtStats.requests > 0 ? 100.0 * vtStats.hits / vtStats.requests : 100.0) << " %" << std::endl;
+	}
+	if (options.culling != CullingMode::None && options.verifyCulling) {
+		std::cout << "  culling verification: " << cullingVerifiedFrames << " frames, "
+			<< cullingMismatchedFrames << " mismatches against "
+			<< (options.culling == CullingMode::Gpu ? "CPU culling" : "scalar culling") << std::endl;
+	}
 }
 
 void HelloTriangleApplication::cleanupSwapChain()
 {
 	vkDestroyImageView(device, colorImageView, nullptr);
 	vkDestroyImage(device, colorImage, nullptr);
-	vkFreeMemory(device, colorImageMemory, nullptr);
+	allocator.free(colorImageMemory);
 
 	vkDestroyImageView(device, depthImageView, nullptr);
 	vkDestroyImage(device, depthImage, nullptr);
-	vkFreeMemory(device, depthImageMemory, nullptr);
+	allocator.free(depthImageMemory);
 
 	for (size_t i = 0; i < swapChainFramebuffers.size(); i++) {
 		vkDestroyFramebuffer(device, swapChainFramebuffers[i], nullptr);
 	}
 
-	vkFreeCommandBuffers(
-		device,
-		commandPool,
-		static_cast<uint32_t>(commandBuffers.size()),
-		commandBuffers.data());
-
-	vkDestroyPipeline(device, graphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
-	vkDestroyRenderPass(device, renderPass, nullptr);
-
 	for (size_t i = 0; i < swapChainImageViews.size(); i++) {
 		vkDestroyImageView(device, swapChainImageViews[i], nullptr);
 	}
 
-	vkDestroySwapchainKHR(device, swapChain, nullptr);
-
-	for (size_t i = 0; i < swapChainImages.size(); i++) {
-		vkDestroyBuffer(device, uniformBuffers[i], nullptr);
-		vkFreeMemory(device, uniformBuffersMemory[i], nullptr);
+	if (options.headless) {
+		for (size_t i = 0; i < swapChainImages.size(); i++) {
+			vkDestroyImage(device, swapChainImages[i], nullptr);
+			allocator.free(offscreenImagesMemory[i]);
+		}
 	}
-
-	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
 }
 
 void HelloTriangleApplication::cleanup()
 {
 	cleanupSwapChain();
 
-	vkDestroySampler(device, textureSampler, nullptr);
+	if (!options.headless) {
+		vkDestroySwapchainKHR(device, swapChain, nullptr);
+	}
+
+	vkDestroyPipeline(device, graphicsPipeline, nullptr);
+	vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+	vkDestroyRenderPass(device, renderPass, nullptr);
+
+	vkDestroyBuffer(device, uniformBuffer, nullptr);
+	allocator.free(uniformBufferMemory);
+	vkDestroyBuffer(device, instanceBuffer, nullptr);
+	allocator.free(instanceBufferMemory);
+
+	destroyCullingBuffers();
+	vkDestroyBuffer(device, lodBuffer, nullptr);
+	allocator.free(lodBufferMemory);
+	vkDestroyPipeline(device, cullPipeline, nullptr);
+	vkDestroyPipelineLayout(device, cullPipelineLayout, nullptr);
+	vkDestroyDescriptorPool(device, cullDescriptorPool, nullptr);
+	vkDestroyDescriptorSetLayout(device, cullDescriptorSetLayout, nullptr);
+
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+
+	vkDestroyBuffer(device, pageTableBuffer, nullptr);
+	allocator.free(pageTableBufferMemory);
+	vkDestroyBuffer(device, feedbackBuffer, nullptr);
+	allocator.free(feedbackBufferMemory);
+	virtualTextureFile.close();
+
+	// バックグラウンドで読み込み中のテクスチャがあれば終わるまで待つ
+	textureStreamer.finish();
+
+	for (VkSampler sampler : textureSamplers) {
+		vkDestroySampler(device, sampler, nullptr);
+	}
 	vkDestroyImageView(device, textureImageView, nullptr);
 
 	vkDestroyImage(device, textureImage, nullptr);
-	vkFreeMemory(device, textureImageMemory, nullptr);
+	allocator.free(textureImageMemory);
 
 	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 	vkDestroyBuffer(device, vertexBuffer, nullptr);
-	vkFreeMemory(device, vertexBufferMemory, nullptr);
+	allocator.free(vertexBufferMemory);
 	vkDestroyBuffer(device, indexBuffer, nullptr);
-	vkFreeMemory(device, indexBufferMemory, nullptr);
+	allocator.free(indexBufferMemory);
 
-	for (rsize_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+	for (size_t i = 0; i < maxFramesInFlight; i++) {
 		vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
 		vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
 		vkDestroyFence(device, inFlightFences[i], nullptr);
 	}
 
-	vkDestroyCommandPool(device, commandPool, nullptr);
+	graphicsUploads.destroy();
+	transferUploads.destroy();
+	vkDestroyBuffer(device, stagingRingBuffer, nullptr);
+	allocator.free(stagingRingMemory);
+	// プールを破棄すると割り当てたコマンドバッファも解放される
+	for (auto& frame : frameCommands) {
+		vkDestroyCommandPool(device, frame.primaryPool, nullptr);
+		for (VkCommandPool pool : frame.secondaryPools) {
+			vkDestroyCommandPool(device, pool, nullptr);
+		}
+	}
+
+	// 次回の起動で再利用できるようにキャッシュを書き戻す
+	if (!pipelineCache.save()) {
+		std::cerr << "failed to save pipeline cache: " << PIPELINE_CACHE_PATH << std::endl;
+	}
+	pipelineCache.printStats(std::cout);
+	pipelineCache.destroy();
 
+	allocator.destroy();
 	vkDestroyDevice(device, nullptr);
 
 	if (enableValidationLayers) {
 		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
 	}
 
-	vkDestroySurfaceKHR(instance, surface, nullptr);
+	if (!options.headless) {
+		vkDestroySurfaceKHR(instance, surface, nullptr);
+	}
 	vkDestroyInstance(instance, nullptr);
 
-	glfwDestroyWindow(window);
+	if (!options.headless) {
+		glfwDestroyWindow(window);
 
-	glfwTerminate();
+		glfwTerminate();
+	}
 }
 
 
@@ -1955,13 +4508,18 @@ bool HelloTriangleApplication::checkValidationLayerSupport()
 
 std::vector<const char*> HelloTriangleApplication::getRequiredExtensions()
 {
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions;
+	std::vector<const char*> extensions;
 
-	// GLFWが必要とするVulkanインスタンス拡張名前の配列を取得します
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	// ヘッドレス時はサーフェイス関連の拡張が不要
+	if (!options.headless) {
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions;
 
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+		// GLFWが必要とするVulkanインスタンス拡張名前の配列を取得します
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
 
 	if (enableValidationLayers) {
 		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
@@ -2036,27 +4594,10 @@ VKAPI_ATTR VkBool32 VKAPI_CALL HelloTriangleApplication::debugCallback(
 	return VK_FALSE;
 }
 
-std::vector<char> HelloTriangleApplication::readFile(const std::string& filename)
+FileView HelloTriangleApplication::readFile(const std::string& filename)
 {
-	// std::ios::ate -> ファイルの最後から読み込む
-	// std::ios::binary -> バイナリ形式で読み込む
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);
-
-	if (!file.is_open()) {
-		throw std::runtime_error("failed to open file!");
-	}
-
-	// ファイルサイズから用意すべき配列サイズを決定する
-	// file.tellg() -> 現在の読み込み位置
-	size_t fileSize = (size_t)file.tellg();
-	std::vector<char> buffer(fileSize);
-	
-	// 終わりから開始にむかって読み込む
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-
-	file.close();
-	return buffer;
+	// コピーせずにマップした内容を返す。返したビューが生きている間はマップも有効
+	return FileView::open(filename);
 }
 
 void HelloTriangleApplication::framebufferResizeCallback(GLFWwindow* window, int width, int height)
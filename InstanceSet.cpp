@@ -0,0 +1,71 @@
+﻿#include "InstanceSet.h"
+
+#include <stdexcept>
+
+// インスタンスを追加する
+InstanceSet::Handle InstanceSet::add(const InstanceData& instance)
+{
+	Handle handle;
+	if (!freeHandles.empty()) {
+		handle = freeHandles.back();
+		freeHandles.pop_back();
+	}
+	else {
+		handle = static_cast<Handle>(indices.size());
+		indices.push_back(INVALID_HANDLE);
+	}
+
+	indices[handle] = static_cast<uint32_t>(instances.size());
+	instances.push_back(instance);
+	handles.push_back(handle);
+	version++;
+	return handle;
+}
+
+// インスタンスを削除する
+void InstanceSet::remove(Handle handle)
+{
+	if (!contains(handle)) {
+		throw std::invalid_argument("invalid instance handle!");
+	}
+
+	uint32_t index = indices[handle];
+	uint32_t last = static_cast<uint32_t>(instances.size() - 1);
+	if (index != last) {
+		instances[index] = instances[last];
+		handles[index] = handles[last];
+		indices[handles[index]] = index;
+	}
+	instances.pop_back();
+	handles.pop_back();
+
+	indices[handle] = INVALID_HANDLE;
+	freeHandles.push_back(handle);
+	version++;
+}
+
+// インスタンスの内容を書き換える
+void InstanceSet::update(Handle handle, const InstanceData& instance)
+{
+	if (!contains(handle)) {
+		throw std::invalid_argument("invalid instance handle!");
+	}
+
+	instances[indices[handle]] = instance;
+	version++;
+}
+
+bool InstanceSet::contains(Handle handle) const
+{
+	return handle < indices.size() && indices[handle] != INVALID_HANDLE;
+}
+
+// すべて削除する
+void InstanceSet::clear()
+{
+	instances.clear();
+	handles.clear();
+	indices.clear();
+	freeHandles.clear();
+	version++;
+}
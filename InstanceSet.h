@@ -0,0 +1,75 @@
+﻿#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// インスタンス1つ分のデータ（頂点バッファのバインディング1からインスタンス単位で読む）
+struct InstanceData {
+	glm::mat4 model;
+
+	static const uint32_t BINDING = 1;
+	static const uint32_t FIRST_LOCATION = 3;	// mat4 は vec4 4つ分のロケーションを使う
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = BINDING;
+		bindingDescription.stride = sizeof(InstanceData);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+		return bindingDescription;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions = {};
+
+		for (uint32_t column = 0; column < 4; column++) {
+			attributeDescriptions[column].binding = BINDING;
+			attributeDescriptions[column].location = FIRST_LOCATION + column;
+			attributeDescriptions[column].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+			attributeDescriptions[column].offset = static_cast<uint32_t>(sizeof(glm::vec4) * column);
+		}
+
+		return attributeDescriptions;
+	}
+};
+
+// インスタンスの集合
+// 要素は隙間なく並べて保持し、そのまま GPU のインスタンスバッファへコピーできる
+// 追加時に返すハンドルは削除で並びが変わっても同じインスタンスを指す
+class InstanceSet {
+public:
+	typedef uint32_t Handle;
+	static constexpr Handle INVALID_HANDLE = UINT32_MAX;
+
+	// インスタンスを追加する
+	Handle add(const InstanceData& instance);
+
+	// インスタンスを削除する（末尾の要素を空いた位置へ移して詰める）
+	void remove(Handle handle);
+
+	// インスタンスの内容を書き換える
+	void update(Handle handle, const InstanceData& instance);
+
+	bool contains(Handle handle) const;
+
+	// すべて削除する
+	void clear();
+
+	uint32_t size() const { return static_cast<uint32_t>(instances.size()); }
+	bool empty() const { return instances.empty(); }
+	const InstanceData* data() const { return instances.data(); }
+
+	// 内容が変わるたびに増える（GPU 側のコピーが最新かどうかの判定に使う）
+	uint64_t getVersion() const { return version; }
+
+private:
+	std::vector<InstanceData> instances;
+	std::vector<Handle> handles;			// 並び順 -> ハンドル
+	std::vector<uint32_t> indices;			// ハンドル -> 並び順（削除済みなら INVALID_HANDLE）
+	std::vector<Handle> freeHandles;		// 再利用できるハンドル
+	uint64_t version = 0;
+};
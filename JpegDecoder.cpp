@@ -0,0 +1,1503 @@
+﻿#include "JpegDecoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define JPEG_KERNEL_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JPEG_KERNEL_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define JPEG_KERNEL_NEON
+#endif
+
+namespace {
+	// ジグザグ順の番号から 8x8 ブロック内の位置への変換（壊れたデータで 63 を越えても書き込めるよう余分に持つ）
+	const uint8_t ZIGZAG_TO_NATURAL[64 + 16] = {
+		0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+		12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+		35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+		58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63,
+		63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63, 63
+	};
+
+	// 先頭の何ビットで表引きするか
+	const int FAST_BITS = 9;
+
+	// 標準的なハフマン符号の表
+	struct HuffmanTable {
+		uint16_t fast[1 << FAST_BITS];	// 先頭 FAST_BITS ビットで決まる符号の (符号長 << 8 | 記号)。決まらなければ 0
+		int16_t fastAc[1 << FAST_BITS];	// AC 用: 符号と値が FAST_BITS ビットに収まれば (値 << 8 | ラン << 4 | 全体のビット数)。収まらなければ 0
+		uint8_t symbols[256];
+		int32_t maxCode[18];			// 長さ l の符号の最大値 + 1
+		int32_t valueOffset[17];		// 長さ l の符号から symbols の位置を求めるための差
+		bool defined = false;
+	};
+
+	// DHT の符号長ごとの個数と記号から表を作る（符号が長さに収まらなければ false）
+	bool buildHuffmanTable(const uint8_t* counts, const uint8_t* symbols, HuffmanTable& table)
+	{
+		std::memset(table.fast, 0, sizeof(table.fast));
+		int32_t code = 0;
+		int32_t index = 0;
+		for (int length = 1; length <= 16; length++) {
+			table.valueOffset[length] = index - code;
+			for (int i = 0; i < counts[length - 1]; i++) {
+				if (index >= 256) {
+					return false;
+				}
+				table.symbols[index] = symbols[index];
+				if (length <= FAST_BITS) {
+					int32_t first = code << (FAST_BITS - length);
+					int32_t count = 1 << (FAST_BITS - length);
+					for (int32_t j = 0; j < count; j++) {
+						table.fast[first + j] = static_cast<uint16_t>((length << 8) | symbols[index]);
+					}
+				}
+				code++;
+				index++;
+			}
+			if (code > (1 << length)) {
+				return false;
+			}
+			table.maxCode[length] = code;
+			code <<= 1;
+		}
+		table.maxCode[17] = 0x7FFFFFFF;
+
+		// 短い AC 係数は符号と値をまとめて1回で読めるようにする
+		std::memset(table.fastAc, 0, sizeof(table.fastAc));
+		for (int32_t i = 0; i < (1 << FAST_BITS); i++) {
+			uint32_t fast = table.fast[i];
+			if (fast == 0) {
+				continue;
+			}
+			int run = (fast >> 4) & 15;
+			int size = fast & 15;
+			int length = static_cast<int>(fast >> 8);
+			if (size == 0 || length + size > FAST_BITS) {
+				continue;
+			}
+			int value = (i >> (FAST_BITS - length - size)) & ((1 << size) - 1);
+			if (value < (1 << (size - 1))) {
+				value += 1 - (1 << size);
+			}
+			if (value >= -128 && value <= 127) {
+				table.fastAc[i] = static_cast<int16_t>(value * 256 + run * 16 + length + size);
+			}
+		}
+		table.defined = true;
+		return true;
+	}
+
+	// エントロピー符号化データをビット単位で読む
+	// マーカーに達したら読み進めずに 0 を補う
+	class BitReader {
+	public:
+		BitReader(const uint8_t* begin, const uint8_t* end) : pos(begin), end(end) {}
+
+		// 記号を1つ復号する
+		int decode(const HuffmanTable& table)
+		{
+			if (count < 16) {
+				refill();
+			}
+			uint32_t peek = static_cast<uint32_t>(bits >> 48);
+			uint32_t fast = table.fast[peek >> (16 - FAST_BITS)];
+			if (fast != 0) {
+				consume(static_cast<int>(fast >> 8));
+				return static_cast<int>(fast & 0xFF);
+			}
+			for (int length = FAST_BITS + 1; length <= 16; length++) {
+				int32_t code = static_cast<int32_t>(peek >> (16 - length));
+				if (code < table.maxCode[length]) {
+					consume(length);
+					return table.symbols[code + table.valueOffset[length]];
+				}
+			}
+			throw std::runtime_error("failed to decode JPEG: bad huffman code!");
+		}
+
+		// 先頭 FAST_BITS ビットを覗く（読み進めない）
+		uint32_t peekFast()
+		{
+			if (count < 16) {
+				refill();
+			}
+			return static_cast<uint32_t>(bits >> (64 - FAST_BITS));
+		}
+
+		void skip(int length)
+		{
+			consume(length);
+		}
+
+		// length ビット（1～16）の値を読み、符号付きの値に戻す
+		int receiveExtend(int length)
+		{
+			if (count < length) {
+				refill();
+			}
+			int value = static_cast<int>(bits >> (64 - length));
+			consume(length);
+			return value < (1 << (length - 1)) ? value - (1 << length) + 1 : value;
+		}
+
+		// リスタートマーカーを読み飛ばし、ビットの読み取りを最初からやり直す
+		void restart()
+		{
+			bits = 0;
+			count = 0;
+			markerReached = false;
+			while (pos < end && *pos == 0xFF && pos + 1 < end && pos[1] == 0xFF) {
+				pos++;
+			}
+			if (pos + 1 >= end || pos[0] != 0xFF || (pos[1] & 0xF8) != 0xD0) {
+				throw std::runtime_error("failed to decode JPEG: missing restart marker!");
+			}
+			pos += 2;
+		}
+
+	private:
+		const uint8_t* pos;
+		const uint8_t* end;
+		uint64_t bits = 0;	// 上位ビットから詰める
+		int count = 0;
+		bool markerReached = false;
+
+		void refill()
+		{
+			while (count <= 56) {
+				uint32_t byte = 0;
+				if (!markerReached && pos < end) {
+					byte = *pos;
+					if (byte != 0xFF) {
+						pos++;
+					}
+					else if (pos + 1 < end && pos[1] == 0x00) {
+						pos += 2;
+					}
+					else {
+						markerReached = true;
+						byte = 0;
+					}
+				}
+				bits |= static_cast<uint64_t>(byte) << (56 - count);
+				count += 8;
+			}
+		}
+
+		void consume(int length)
+		{
+			bits <<= length;
+			count -= length;
+		}
+	};
+
+	// 色成分
+	struct Component {
+		uint8_t id = 0;
+		uint32_t h = 1;				// サンプリング係数
+		uint32_t v = 1;
+		uint32_t quantTable = 0;
+		uint32_t dcTable = 0;
+		uint32_t acTable = 0;
+		uint32_t width = 0;			// 実際の画素数
+		uint32_t height = 0;
+		uint32_t planeWidth = 0;	// MCU 単位に切り上げた画素数
+		uint32_t planeHeight = 0;
+		std::vector<uint8_t> plane;
+	};
+
+	// SOS までに読み取ったフレームの情報
+	struct Frame {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		std::vector<Component> components;
+		uint32_t hMax = 1;
+		uint32_t vMax = 1;
+		uint32_t mcusX = 0;
+		uint32_t mcusY = 0;
+		uint32_t blocksPerMcu = 0;
+		uint32_t restartInterval = 0;
+		HuffmanTable dcTables[4];
+		HuffmanTable acTables[4];
+		uint16_t quantTables[4][64] = {};	// ジグザグ順
+		bool quantDefined[4] = {};
+		const uint8_t* scanBegin = nullptr;
+		const uint8_t* end = nullptr;
+	};
+
+	uint32_t readU16(const uint8_t* p)
+	{
+		return (static_cast<uint32_t>(p[0]) << 8) | p[1];
+	}
+
+	// SOI から最初の SOS までを読み取る（扱えない形式や壊れたヘッダーなら false）
+	bool parseHeaders(const uint8_t* data, size_t size, Frame& frame)
+	{
+		const uint8_t* end = data + size;
+		if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+			return false;
+		}
+
+		bool adobeRgb = false;
+		const uint8_t* p = data + 2;
+		for (;;) {
+			// 詰め物の 0xFF を飛ばしてマーカーを読む
+			if (p >= end || *p != 0xFF) {
+				return false;
+			}
+			while (p < end && *p == 0xFF) {
+				p++;
+			}
+			if (p >= end) {
+				return false;
+			}
+			const uint8_t marker = *p++;
+			if (marker == 0xD8 || (marker >= 0xD0 && marker <= 0xD7) || marker == 0x01) {
+				continue;
+			}
+			if (marker == 0xD9 || p + 2 > end) {
+				return false;
+			}
+
+			const uint32_t length = readU16(p);
+			if (length < 2 || p + length > end) {
+				return false;
+			}
+			const uint8_t* segment = p + 2;
+			const uint8_t* segmentEnd = p + length;
+			p = segmentEnd;
+
+			switch (marker) {
+			case 0xC0:	// ベースライン
+			case 0xC1:	// 拡張シーケンシャル（ハフマン符号）
+			{
+				if (segmentEnd - segment < 6 || segment[0] != 8) {
+					return false;
+				}
+				frame.height = readU16(segment + 1);
+				frame.width = readU16(segment + 3);
+				const uint32_t count = segment[5];
+				if (frame.width == 0 || frame.height == 0 || (count != 1 && count != 3)
+					|| static_cast<size_t>(segmentEnd - segment) < 6 + 3 * count) {
+					return false;
+				}
+				frame.components.resize(count);
+				for (uint32_t i = 0; i < count; i++) {
+					Component& component = frame.components[i];
+					component.id = segment[6 + 3 * i];
+					component.h = segment[7 + 3 * i] >> 4;
+					component.v = segment[7 + 3 * i] & 15;
+					component.quantTable = segment[8 + 3 * i];
+					if (component.quantTable > 3) {
+						return false;
+					}
+				}
+				break;
+			}
+			case 0xC4:	// DHT
+				while (segment < segmentEnd) {
+					if (segmentEnd - segment < 17) {
+						return false;
+					}
+					const uint32_t tableClass = segment[0] >> 4;
+					const uint32_t tableId = segment[0] & 15;
+					uint32_t symbolCount = 0;
+					for (int i = 0; i < 16; i++) {
+						symbolCount += segment[1 + i];
+					}
+					if (tableClass > 1 || tableId > 3 || symbolCount > 256
+						|| static_cast<size_t>(segmentEnd - segment) < 17 + symbolCount) {
+						return false;
+					}
+					HuffmanTable& table = tableClass == 0 ? frame.dcTables[tableId] : frame.acTables[tableId];
+					if (!buildHuffmanTable(segment + 1, segment + 17, table)) {
+						return false;
+					}
+					segment += 17 + symbolCount;
+				}
+				break;
+			case 0xDB:	// DQT
+				while (segment < segmentEnd) {
+					const uint32_t precision = segment[0] >> 4;
+					const uint32_t tableId = segment[0] & 15;
+					const size_t tableSize = precision == 0 ? 64 : 128;
+					if (precision > 1 || tableId > 3 || static_cast<size_t>(segmentEnd - segment) < 1 + tableSize) {
+						return false;
+					}
+					for (int i = 0; i < 64; i++) {
+						frame.quantTables[tableId][i] = static_cast<uint16_t>(
+							precision == 0 ? segment[1 + i] : readU16(segment + 1 + 2 * i));
+					}
+					frame.quantDefined[tableId] = true;
+					segment += 1 + tableSize;
+				}
+				break;
+			case 0xDD:	// DRI
+				if (segmentEnd - segment < 2) {
+					return false;
+				}
+				frame.restartInterval = readU16(segment);
+				break;
+			case 0xEE:	// APP14（Adobe）。色変換なしなら RGB か CMYK
+				if (segmentEnd - segment >= 12 && std::memcmp(segment, "Adobe", 5) == 0 && segment[11] == 0) {
+					adobeRgb = true;
+				}
+				break;
+			case 0xDA:	// SOS
+			{
+				if (frame.components.empty() || adobeRgb || segmentEnd - segment < 1) {
+					return false;
+				}
+
+				// すべての成分を1つのスキャンにまとめたものだけを扱う
+				const uint32_t count = segment[0];
+				if (count != frame.components.size() || static_cast<size_t>(segmentEnd - segment) < 4 + 2 * count) {
+					return false;
+				}
+				for (uint32_t i = 0; i < count; i++) {
+					Component& component = frame.components[i];
+					if (segment[1 + 2 * i] != component.id) {
+						return false;
+					}
+					component.dcTable = segment[2 + 2 * i] >> 4;
+					component.acTable = segment[2 + 2 * i] & 15;
+					if (component.dcTable > 3 || component.acTable > 3
+						|| !frame.dcTables[component.dcTable].defined || !frame.acTables[component.acTable].defined
+						|| !frame.quantDefined[component.quantTable]) {
+						return false;
+					}
+				}
+				const uint8_t* spectral = segment + 1 + 2 * count;
+				if (spectral[0] != 0 || spectral[1] != 63 || spectral[2] != 0) {
+					return false;
+				}
+
+				frame.scanBegin = segmentEnd;
+				frame.end = end;
+				return true;
+			}
+			default:
+				// プログレッシブ・可逆・算術符号と DNL は扱わない
+				if ((marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) || marker == 0xDC) {
+					return false;
+				}
+				break;
+			}
+		}
+	}
+
+	// サンプリング係数を確かめ、MCU と成分ごとの面の大きさを決める
+	bool setupFrame(Frame& frame)
+	{
+		if (frame.components.size() == 1) {
+			// 1成分のスキャンはサンプリング係数によらず1ブロックが1 MCU
+			frame.components[0].h = 1;
+			frame.components[0].v = 1;
+		}
+		else {
+			// 輝度だけが 1～2、色差は 1 のもの（4:4:4 / 4:2:2 / 4:4:0 / 4:2:0）だけを扱う
+			const Component& luma = frame.components[0];
+			if (luma.h < 1 || luma.h > 2 || luma.v < 1 || luma.v > 2) {
+				return false;
+			}
+			for (size_t i = 1; i < frame.components.size(); i++) {
+				if (frame.components[i].h != 1 || frame.components[i].v != 1) {
+					return false;
+				}
+			}
+			// Adobe の RGB（成分 ID が 'R' 'G' 'B'）は YCbCr ではない
+			if (frame.components[0].id == 'R' && frame.components[1].id == 'G' && frame.components[2].id == 'B') {
+				return false;
+			}
+		}
+
+		frame.hMax = frame.components[0].h;
+		frame.vMax = frame.components[0].v;
+		frame.mcusX = (frame.width + 8 * frame.hMax - 1) / (8 * frame.hMax);
+		frame.mcusY = (frame.height + 8 * frame.vMax - 1) / (8 * frame.vMax);
+		frame.blocksPerMcu = 0;
+		for (Component& component : frame.components) {
+			component.width = (frame.width * component.h + frame.hMax - 1) / frame.hMax;
+			component.height = (frame.height * component.v + frame.vMax - 1) / frame.vMax;
+			component.planeWidth = frame.mcusX * component.h * 8;
+			component.planeHeight = frame.mcusY * component.v * 8;
+			frame.blocksPerMcu += component.h * component.v;
+		}
+		return true;
+	}
+
+	// 8x8 ブロック1つをエントロピー復号し、逆量子化して自然順に並べる
+	void decodeBlock(
+		BitReader& reader,
+		const HuffmanTable& dcTable,
+		const HuffmanTable& acTable,
+		const uint16_t* quant,
+		int& dcPredictor,
+		int16_t* block)
+	{
+		std::memset(block, 0, sizeof(int16_t) * 64);
+
+		int size = reader.decode(dcTable);
+		if (size > 16) {
+			throw std::runtime_error("failed to decode JPEG: bad DC coefficient!");
+		}
+		dcPredictor += size != 0 ? reader.receiveExtend(size) : 0;
+		block[0] = static_cast<int16_t>(dcPredictor * quant[0]);
+
+		for (int k = 1; k < 64;) {
+			int fastAc = acTable.fastAc[reader.peekFast()];
+			if (fastAc != 0) {
+				reader.skip(fastAc & 15);
+				k += (fastAc >> 4) & 15;
+				if (k > 63) {
+					throw std::runtime_error("failed to decode JPEG: bad AC coefficient!");
+				}
+				block[ZIGZAG_TO_NATURAL[k]] = static_cast<int16_t>((fastAc >> 8) * quant[k]);
+				k++;
+				continue;
+			}
+			int symbol = reader.decode(acTable);
+			int run = symbol >> 4;
+			size = symbol & 15;
+			if (size == 0) {
+				if (run != 15) {
+					break;	// EOB
+				}
+				k += 16;
+				continue;
+			}
+			k += run;
+			if (k > 63) {
+				throw std::runtime_error("failed to decode JPEG: bad AC coefficient!");
+			}
+			block[ZIGZAG_TO_NATURAL[k]] = static_cast<int16_t>(reader.receiveExtend(size) * quant[k]);
+			k++;
+		}
+	}
+
+	// スキャン内の現在位置（リスタート区間の先頭から読み始められる）
+	struct ScanState {
+		BitReader reader;
+		uint32_t nextMcu;		// 次に復号する MCU の番号
+		uint32_t startMcu;		// reader が読み始めた MCU の番号（リスタート区間の先頭）
+		int dcPredictors[3] = {};
+
+		ScanState(const uint8_t* begin, const uint8_t* end, uint32_t startMcu)
+			: reader(begin, end), nextMcu(startMcu), startMcu(startMcu) {}
+	};
+
+	// MCU を count 個復号して blocks に書く（MCU ごとに成分順・成分内はラスター順のブロック）
+	// リスタート区間の境目ではマーカーを読み飛ばし、DC の予測値を戻す
+	void decodeMcus(const Frame& frame, ScanState& state, uint32_t count, int16_t* blocks)
+	{
+		for (uint32_t i = 0; i < count; i++, state.nextMcu++) {
+			if (frame.restartInterval != 0 && state.nextMcu != state.startMcu && state.nextMcu % frame.restartInterval == 0) {
+				state.reader.restart();
+				std::fill(std::begin(state.dcPredictors), std::end(state.dcPredictors), 0);
+			}
+			for (size_t c = 0; c < frame.components.size(); c++) {
+				const Component& component = frame.components[c];
+				for (uint32_t b = 0; b < component.h * component.v; b++) {
+					decodeBlock(
+						state.reader,
+						frame.dcTables[component.dcTable],
+						frame.acTables[component.acTable],
+						frame.quantTables[component.quantTable],
+						state.dcPredictors[c],
+						blocks);
+					blocks += 64;
+				}
+			}
+		}
+	}
+
+	// 整数の逆 DCT（libjpeg の jidctint と同じ分解。stb_image と同じ結果になる）
+	// 係数は 4096 倍した固定小数点
+	inline int fixed(float x)
+	{
+		return static_cast<int>(x * 4096.0f + 0.5f);
+	}
+
+	struct Idct1D {
+		int t0, t1, t2, t3, x0, x1, x2, x3;
+
+		Idct1D(int s0, int s1, int s2, int s3, int s4, int s5, int s6, int s7)
+		{
+			// 偶数部
+			int p1 = (s2 + s6) * fixed(0.5411961f);
+			t2 = p1 + s6 * fixed(-1.847759065f);
+			t3 = p1 + s2 * fixed(0.765366865f);
+			t0 = (s0 + s4) * 4096;
+			t1 = (s0 - s4) * 4096;
+			x0 = t0 + t3;
+			x3 = t0 - t3;
+			x1 = t1 + t2;
+			x2 = t1 - t2;
+
+			// 奇数部
+			t0 = s7;
+			t1 = s5;
+			t2 = s3;
+			t3 = s1;
+			int p3 = t0 + t2;
+			int p4 = t1 + t3;
+			p1 = t0 + t3;
+			int p2 = t1 + t2;
+			int p5 = (p3 + p4) * fixed(1.175875602f);
+			t0 = t0 * fixed(0.298631336f);
+			t1 = t1 * fixed(2.053119869f);
+			t2 = t2 * fixed(3.072711026f);
+			t3 = t3 * fixed(1.501321110f);
+			p1 = p5 + p1 * fixed(-0.899976223f);
+			p2 = p5 + p2 * fixed(-2.562915447f);
+			p3 = p3 * fixed(-1.961570560f);
+			p4 = p4 * fixed(-0.390180644f);
+			t3 += p1 + p4;
+			t2 += p2 + p3;
+			t1 += p2 + p4;
+			t0 += p1 + p3;
+		}
+	};
+
+	inline uint8_t clampByte(int x)
+	{
+		return static_cast<uint8_t>(x < 0 ? 0 : (x > 255 ? 255 : x));
+	}
+
+#if defined(JPEG_KERNEL_AVX2) || defined(JPEG_KERNEL_SSE2)
+	// SSE2 の逆 DCT（8 列を 16bit のレーンに並べて1度に変換する）
+	// 積は madd で 32bit に広げて足すので、整数版と同じ結果になる
+	struct Wide {
+		__m128i lo, hi;
+	};
+
+	inline Wide add(Wide a, Wide b)
+	{
+		return { _mm_add_epi32(a.lo, b.lo), _mm_add_epi32(a.hi, b.hi) };
+	}
+
+	inline Wide sub(Wide a, Wide b)
+	{
+		return { _mm_sub_epi32(a.lo, b.lo), _mm_sub_epi32(a.hi, b.hi) };
+	}
+
+	// 16bit の x を 4096 倍して 32bit に広げる
+	inline Wide widen(__m128i x)
+	{
+		return {
+			_mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), x), 4),
+			_mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), x), 4)
+		};
+	}
+
+	// 偶数レーンに x の係数、奇数レーンに y の係数を並べた定数
+	inline __m128i coefficientPair(int x, int y)
+	{
+		return _mm_setr_epi16(
+			static_cast<int16_t>(x), static_cast<int16_t>(y), static_cast<int16_t>(x), static_cast<int16_t>(y),
+			static_cast<int16_t>(x), static_cast<int16_t>(y), static_cast<int16_t>(x), static_cast<int16_t>(y));
+	}
+
+	// x * c[偶数] + y * c[奇数] を 32bit で求める
+	inline Wide rotate(__m128i x, __m128i y, __m128i c)
+	{
+		return {
+			_mm_madd_epi16(_mm_unpacklo_epi16(x, y), c),
+			_mm_madd_epi16(_mm_unpackhi_epi16(x, y), c)
+		};
+	}
+
+	// a ± b を丸めて SHIFT ビット戻し、16bit に詰める
+	template <int SHIFT>
+	inline void butterfly(Wide a, Wide b, __m128i bias, __m128i& sum, __m128i& difference)
+	{
+		a.lo = _mm_add_epi32(a.lo, bias);
+		a.hi = _mm_add_epi32(a.hi, bias);
+		Wide s = add(a, b);
+		Wide d = sub(a, b);
+		sum = _mm_packs_epi32(_mm_srai_epi32(s.lo, SHIFT), _mm_srai_epi32(s.hi, SHIFT));
+		difference = _mm_packs_epi32(_mm_srai_epi32(d.lo, SHIFT), _mm_srai_epi32(d.hi, SHIFT));
+	}
+
+	template <int SHIFT>
+	void inverseDctPass(__m128i* rows, __m128i bias)
+	{
+		static const __m128i ROTATE_EVEN_0 = coefficientPair(fixed(0.5411961f), fixed(0.5411961f) + fixed(-1.847759065f));
+		static const __m128i ROTATE_EVEN_1 = coefficientPair(fixed(0.5411961f) + fixed(0.765366865f), fixed(0.5411961f));
+		static const __m128i ROTATE_ODD_0 = coefficientPair(fixed(1.175875602f) + fixed(-0.899976223f), fixed(1.175875602f));
+		static const __m128i ROTATE_ODD_1 = coefficientPair(fixed(1.175875602f), fixed(1.175875602f) + fixed(-2.562915447f));
+		static const __m128i ROTATE_73_0 = coefficientPair(fixed(-1.961570560f) + fixed(0.298631336f), fixed(-1.961570560f));
+		static const __m128i ROTATE_73_1 = coefficientPair(fixed(-1.961570560f), fixed(-1.961570560f) + fixed(3.072711026f));
+		static const __m128i ROTATE_51_0 = coefficientPair(fixed(-0.390180644f) + fixed(2.053119869f), fixed(-0.390180644f));
+		static const __m128i ROTATE_51_1 = coefficientPair(fixed(-0.390180644f), fixed(-0.390180644f) + fixed(1.501321110f));
+
+		// 偶数部
+		Wide t2 = rotate(rows[2], rows[6], ROTATE_EVEN_0);
+		Wide t3 = rotate(rows[2], rows[6], ROTATE_EVEN_1);
+		Wide t0 = widen(_mm_add_epi16(rows[0], rows[4]));
+		Wide t1 = widen(_mm_sub_epi16(rows[0], rows[4]));
+		Wide x0 = add(t0, t3);
+		Wide x3 = sub(t0, t3);
+		Wide x1 = add(t1, t2);
+		Wide x2 = sub(t1, t2);
+
+		// 奇数部
+		Wide y0 = rotate(rows[7], rows[3], ROTATE_73_0);
+		Wide y2 = rotate(rows[7], rows[3], ROTATE_73_1);
+		Wide y1 = rotate(rows[5], rows[1], ROTATE_51_0);
+		Wide y3 = rotate(rows[5], rows[1], ROTATE_51_1);
+		__m128i sum17 = _mm_add_epi16(rows[1], rows[7]);
+		__m128i sum35 = _mm_add_epi16(rows[3], rows[5]);
+		Wide y4 = rotate(sum17, sum35, ROTATE_ODD_0);
+		Wide y5 = rotate(sum17, sum35, ROTATE_ODD_1);
+		Wide x4 = add(y0, y4);
+		Wide x5 = add(y1, y5);
+		Wide x6 = add(y2, y5);
+		Wide x7 = add(y3, y4);
+
+		butterfly<SHIFT>(x0, x7, bias, rows[0], rows[7]);
+		butterfly<SHIFT>(x1, x6, bias, rows[1], rows[6]);
+		butterfly<SHIFT>(x2, x5, bias, rows[2], rows[5]);
+		butterfly<SHIFT>(x3, x4, bias, rows[3], rows[4]);
+	}
+
+	inline void interleave16(__m128i& a, __m128i& b)
+	{
+		__m128i low = _mm_unpacklo_epi16(a, b);
+		b = _mm_unpackhi_epi16(a, b);
+		a = low;
+	}
+
+	inline void interleave8(__m128i& a, __m128i& b)
+	{
+		__m128i low = _mm_unpacklo_epi8(a, b);
+		b = _mm_unpackhi_epi8(a, b);
+		a = low;
+	}
+
+	void inverseDct(const int16_t* block, uint8_t* out, uint32_t stride)
+	{
+		__m128i rows[8];
+		for (int i = 0; i < 8; i++) {
+			rows[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i * 8));
+		}
+
+		// 列ごとに変換してから転置する
+		inverseDctPass<10>(rows, _mm_set1_epi32(512));
+		for (int step = 4; step >= 1; step >>= 1) {
+			for (int i = 0; i < 4; i++) {
+				int a = (i / step) * step * 2 + i % step;
+				interleave16(rows[a], rows[a + step]);
+			}
+		}
+
+		// 行ごとに変換する
+		inverseDctPass<17>(rows, _mm_set1_epi32(65536 + (128 << 17)));
+
+		// 8bit に詰めて転置し直す
+		__m128i p0 = _mm_packus_epi16(rows[0], rows[1]);
+		__m128i p1 = _mm_packus_epi16(rows[2], rows[3]);
+		__m128i p2 = _mm_packus_epi16(rows[4], rows[5]);
+		__m128i p3 = _mm_packus_epi16(rows[6], rows[7]);
+		interleave8(p0, p2);
+		interleave8(p1, p3);
+		interleave8(p0, p1);
+		interleave8(p2, p3);
+		interleave8(p0, p2);
+		interleave8(p1, p3);
+
+		const __m128i lines[4] = { p0, p2, p1, p3 };
+		for (int i = 0; i < 4; i++, out += stride * 2) {
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out), lines[i]);
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + stride), _mm_shuffle_epi32(lines[i], 0x4E));
+		}
+	}
+#else
+	// 8x8 ブロックを逆変換して out（stride バイトごとの行）に書く
+	void inverseDct(const int16_t* block, uint8_t* out, uint32_t stride)
+	{
+		int columns[64];
+
+		// 列ごとに変換する（AC がなければ DC を並べるだけ）
+		for (int i = 0; i < 8; i++) {
+			const int16_t* d = block + i;
+			int* v = columns + i;
+			if (d[8] == 0 && d[16] == 0 && d[24] == 0 && d[32] == 0 && d[40] == 0 && d[48] == 0 && d[56] == 0) {
+				int dc = d[0] * 4;
+				v[0] = v[8] = v[16] = v[24] = v[32] = v[40] = v[48] = v[56] = dc;
+				continue;
+			}
+
+			// 固定小数点の 4096 倍を戻し、精度のために 2bit 残す
+			Idct1D idct(d[0], d[8], d[16], d[24], d[32], d[40], d[48], d[56]);
+			int x0 = idct.x0 + 512, x1 = idct.x1 + 512, x2 = idct.x2 + 512, x3 = idct.x3 + 512;
+			v[0] = (x0 + idct.t3) >> 10;
+			v[56] = (x0 - idct.t3) >> 10;
+			v[8] = (x1 + idct.t2) >> 10;
+			v[48] = (x1 - idct.t2) >> 10;
+			v[16] = (x2 + idct.t1) >> 10;
+			v[40] = (x2 - idct.t1) >> 10;
+			v[24] = (x3 + idct.t0) >> 10;
+			v[32] = (x3 - idct.t0) >> 10;
+		}
+
+		// 行ごとに変換する
+		// 4096 倍・列の 4 倍・縦横の sqrt(8) 倍ずつの合計 1 << 17 を丸めて戻し、128 を足して 0～255 にする
+		for (int i = 0; i < 8; i++, out += stride) {
+			const int* v = columns + i * 8;
+			Idct1D idct(v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7]);
+			const int bias = 65536 + (128 << 17);
+			int x0 = idct.x0 + bias, x1 = idct.x1 + bias, x2 = idct.x2 + bias, x3 = idct.x3 + bias;
+			out[0] = clampByte((x0 + idct.t3) >> 17);
+			out[7] = clampByte((x0 - idct.t3) >> 17);
+			out[1] = clampByte((x1 + idct.t2) >> 17);
+			out[6] = clampByte((x1 - idct.t2) >> 17);
+			out[2] = clampByte((x2 + idct.t1) >> 17);
+			out[5] = clampByte((x2 - idct.t1) >> 17);
+			out[3] = clampByte((x3 + idct.t0) >> 17);
+			out[4] = clampByte((x3 - idct.t0) >> 17);
+		}
+	}
+#endif
+
+	// YCbCr -> RGB の係数（14bit の固定小数点）
+	const int32_t Y_SCALE = 1 << 14;
+	const int32_t ROUNDING = 1 << 13;
+	const int32_t CR_TO_R = 22970;		// 1.402
+	const int32_t CB_TO_G = -5638;		// -0.344136
+	const int32_t CR_TO_G = -11700;		// -0.714136
+	const int32_t CB_TO_B = 29032;		// 1.772
+
+	// madd 用に low, high の 16bit を組にした 32bit 値
+	inline int32_t pairCoefficients(int32_t low, int32_t high)
+	{
+		return static_cast<int32_t>((static_cast<uint32_t>(high) << 16) | (static_cast<uint32_t>(low) & 0xFFFF));
+	}
+
+	// ---- 行単位の処理（SIMD 版は端や余りをこれらで処理する） ----
+
+	// out[2i-1], out[2i] (first <= i < w) を縦横 2 倍の三角フィルターで求める
+	void upsampleH2V2Scalar(const uint8_t* nearRow, const uint8_t* farRow, uint32_t first, uint32_t w, uint8_t* out)
+	{
+		int t1 = 3 * nearRow[first - 1] + farRow[first - 1];
+		for (uint32_t i = first; i < w; i++) {
+			int t0 = t1;
+			t1 = 3 * nearRow[i] + farRow[i];
+			out[i * 2 - 1] = static_cast<uint8_t>((3 * t0 + t1 + 8) >> 4);
+			out[i * 2] = static_cast<uint8_t>((3 * t1 + t0 + 8) >> 4);
+		}
+	}
+
+	// out[2i], out[2i+1] (first <= i < last) を横 2 倍の三角フィルターで求める
+	void upsampleH2V1Scalar(const uint8_t* in, uint32_t first, uint32_t last, uint8_t* out)
+	{
+		for (uint32_t i = first; i < last; i++) {
+			int n = 3 * in[i] + 2;
+			out[i * 2] = static_cast<uint8_t>((n + in[i - 1]) >> 2);
+			out[i * 2 + 1] = static_cast<uint8_t>((n + in[i + 1]) >> 2);
+		}
+	}
+
+	// out[i] (first <= i < w) を縦 2 倍の三角フィルターで求める
+	void upsampleH1V2Scalar(const uint8_t* nearRow, const uint8_t* farRow, uint32_t first, uint32_t w, uint8_t* out)
+	{
+		for (uint32_t i = first; i < w; i++) {
+			out[i] = static_cast<uint8_t>((3 * nearRow[i] + farRow[i] + 2) >> 2);
+		}
+	}
+
+	// 画素 first ～ count - 1 を YCbCr から RGBA に変換する
+	void convertYCbCrScalar(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint32_t first, uint32_t count, uint8_t* rgba)
+	{
+		for (uint32_t i = first; i < count; i++) {
+			int32_t luma = y[i] * Y_SCALE + ROUNDING;
+			int32_t blue = cb[i] - 128;
+			int32_t red = cr[i] - 128;
+			rgba[i * 4 + 0] = clampByte((luma + CR_TO_R * red) >> 14);
+			rgba[i * 4 + 1] = clampByte((luma + CB_TO_G * blue + CR_TO_G * red) >> 14);
+			rgba[i * 4 + 2] = clampByte((luma + CB_TO_B * blue) >> 14);
+			rgba[i * 4 + 3] = 255;
+		}
+	}
+
+	// 各関数は SIMD で処理できる範囲を処理し、処理し終えた位置を返す
+#if defined(JPEG_KERNEL_AVX2)
+
+	// 16 個の uint8 を uint16 に広げて読む
+	inline __m256i load16(const uint8_t* p)
+	{
+		return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+	}
+
+	// 16 個ずつの even, odd を交互に並べて 32 バイト書く
+	inline void storeInterleaved(uint8_t* out, __m256i even, __m256i odd)
+	{
+		__m256i lo = _mm256_unpacklo_epi16(even, odd);
+		__m256i hi = _mm256_unpackhi_epi16(even, odd);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_packus_epi16(lo, hi));
+	}
+
+	uint32_t upsampleH2V2Simd(const uint8_t* nearRow, const uint8_t* farRow, uint32_t w, uint8_t* out)
+	{
+		const __m256i three = _mm256_set1_epi16(3);
+		const __m256i eight = _mm256_set1_epi16(8);
+		uint32_t i = 1;
+		for (; i + 16 <= w; i += 16) {
+			__m256i prev = _mm256_add_epi16(_mm256_mullo_epi16(load16(nearRow + i - 1), three), load16(farRow + i - 1));
+			__m256i curr = _mm256_add_epi16(_mm256_mullo_epi16(load16(nearRow + i), three), load16(farRow + i));
+			__m256i odd = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(prev, three), curr), eight), 4);
+			__m256i even = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(curr, three), prev), eight), 4);
+			storeInterleaved(out + i * 2 - 1, odd, even);
+		}
+		return i;
+	}
+
+	uint32_t upsampleH2V1Simd(const uint8_t* in, uint32_t w, uint8_t* out)
+	{
+		const __m256i three = _mm256_set1_epi16(3);
+		const __m256i two = _mm256_set1_epi16(2);
+		uint32_t i = 1;
+		for (; i + 16 <= w - 1; i += 16) {
+			__m256i n = _mm256_add_epi16(_mm256_mullo_epi16(load16(in + i), three), two);
+			__m256i even = _mm256_srli_epi16(_mm256_add_epi16(n, load16(in + i - 1)), 2);
+			__m256i odd = _mm256_srli_epi16(_mm256_add_epi16(n, load16(in + i + 1)), 2);
+			storeInterleaved(out + i * 2, even, odd);
+		}
+		return i;
+	}
+
+	uint32_t upsampleH1V2Simd(const uint8_t* nearRow, const uint8_t* farRow, uint32_t w, uint8_t* out)
+	{
+		const __m256i three = _mm256_set1_epi16(3);
+		const __m256i two = _mm256_set1_epi16(2);
+		uint32_t i = 0;
+		for (; i + 32 <= w; i += 32) {
+			__m256i lo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(load16(nearRow + i), three), load16(farRow + i)), two), 2);
+			__m256i hi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(load16(nearRow + i + 16), three), load16(farRow + i + 16)), two), 2);
+			// packus はレーンごとに詰めるので、レーンの順序を戻す
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(lo, hi), 0xD8));
+		}
+		return i;
+	}
+
+	uint32_t convertYCbCrSimd(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint32_t count, uint8_t* rgba)
+	{
+		const __m256i offset = _mm256_set1_epi16(128);
+		const __m256i one = _mm256_set1_epi16(1);
+		// madd は隣り合う 16bit の組を掛けて足すので、係数も組にする
+		const __m256i lumaCoefficients = _mm256_set1_epi32(pairCoefficients(Y_SCALE, ROUNDING));
+		const __m256i redCoefficients = _mm256_set1_epi32(pairCoefficients(0, CR_TO_R));
+		const __m256i greenCoefficients = _mm256_set1_epi32(pairCoefficients(CB_TO_G, CR_TO_G));
+		const __m256i blueCoefficients = _mm256_set1_epi32(pairCoefficients(CB_TO_B, 0));
+		const __m256i alpha = _mm256_set1_epi16(255);
+		const __m256i pairShuffle = _mm256_setr_epi8(
+			0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15,
+			0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15);
+
+		uint32_t i = 0;
+		for (; i + 16 <= count; i += 16) {
+			__m256i luma = load16(y + i);
+			__m256i blue = _mm256_sub_epi16(load16(cb + i), offset);
+			__m256i red = _mm256_sub_epi16(load16(cr + i), offset);
+
+			// unpacklo はレーンごとに画素 0-3 / 8-11、unpackhi は 4-7 / 12-15 を 32bit に並べる
+			__m256i lumaLo = _mm256_madd_epi16(_mm256_unpacklo_epi16(luma, one), lumaCoefficients);
+			__m256i lumaHi = _mm256_madd_epi16(_mm256_unpackhi_epi16(luma, one), lumaCoefficients);
+			__m256i chromaLo = _mm256_unpacklo_epi16(blue, red);
+			__m256i chromaHi = _mm256_unpackhi_epi16(blue, red);
+
+			// packs_epi32 で画素順の 16bit に戻る
+			__m256i r = _mm256_packs_epi32(
+				_mm256_srai_epi32(_mm256_add_epi32(lumaLo, _mm256_madd_epi16(chromaLo, redCoefficients)), 14),
+				_mm256_srai_epi32(_mm256_add_epi32(lumaHi, _mm256_madd_epi16(chromaHi, redCoefficients)), 14));
+			__m256i g = _mm256_packs_epi32(
+				_mm256_srai_epi32(_mm256_add_epi32(lumaLo, _mm256_madd_epi16(chromaLo, greenCoefficients)), 14),
+				_mm256_srai_epi32(_mm256_add_epi32(lumaHi, _mm256_madd_epi16(chromaHi, greenCoefficients)), 14));
+			__m256i b = _mm256_packs_epi32(
+				_mm256_srai_epi32(_mm256_add_epi32(lumaLo, _mm256_madd_epi16(chromaLo, blueCoefficients)), 14),
+				_mm256_srai_epi32(_mm256_add_epi32(lumaHi, _mm256_madd_epi16(chromaHi, blueCoefficients)), 14));
+
+			// レーンごとに R0-7 G0-7 / B0-7 A0-7 を詰めて RG / BA の組に並べ替え、16bit 単位で交互に並べる
+			__m256i rg = _mm256_shuffle_epi8(_mm256_packus_epi16(r, g), pairShuffle);
+			__m256i ba = _mm256_shuffle_epi8(_mm256_packus_epi16(b, alpha), pairShuffle);
+			__m256i lo = _mm256_unpacklo_epi16(rg, ba);
+			__m256i hi = _mm256_unpackhi_epi16(rg, ba);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + i * 4), _mm256_permute2x128_si256(lo, hi, 0x20));
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(rgba + i * 4 + 32), _mm256_permute2x128_si256(lo, hi, 0x31));
+		}
+		return i;
+	}
+
+	const char* const KERNEL_NAME = "AVX2";
+
+#elif defined(JPEG_KERNEL_SSE2)
+
+	// 8 個の uint8 を uint16 に広げて読む
+	inline __m128i load8(const uint8_t* p)
+	{
+		return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128());
+	}
+
+	// 8 個ずつの even, odd を交互に並べて 16 バイト書く
+	inline void storeInterleaved(uint8_t* out, __m128i even, __m128i odd)
+	{
+		__m128i lo = _mm_unpacklo_epi16(even, odd);
+		__m128i hi = _mm_unpackhi_epi16(even, odd);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(lo, hi));
+	}
+
+	// x * 3
+	inline __m128i times3(__m128i x)
+	{
+		return _mm_add_epi16(_mm_slli_epi16(x, 1), x);
+	}
+
+	uint32_t upsampleH2V2Simd(const uint8_t* nearRow, const uint8_t* farRow, uint32_t w, uint8_t* out)
+	{
+		const __m128i eight = _mm_set1_epi16(8);
+		uint32_t i = 1;
+		for (; i + 8 <= w; i += 8) {
+			__m128i prev = _mm_add_epi16(times3(load8(nearRow + i - 1)), load8(farRow + i - 1));
+			__m128i curr = _mm_add_epi16(times3(load8(nearRow + i)), load8(farRow + i));
+			__m128i odd = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(times3(prev), curr), eight), 4);
+			__m128i even = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(times3(curr), prev), eight), 4);
+			storeInterleaved(out + i * 2 - 1, odd, even);
+		}
+		return i;
+	}
+
+	uint32_t upsampleH2V1Simd(const uint8_t* in, uint32_t w, uint8_t* out)
+	{
+		const __m128i two = _mm_set1_epi16(2);
+		uint32_t i = 1;
+		for (; i + 8 <= w - 1; i += 8) {
+			__m128i n = _mm_add_epi16(times3(load8(in + i)), two);
+			__m128i even = _mm_srli_epi16(_mm_add_epi16(n, load8(in + i - 1)), 2);
+			__m128i odd = _mm_srli_epi16(_mm_add_epi16(n, load8(in + i + 1)), 2);
+			storeInterleaved(out + i * 2, even, odd);
+		}
+		return i;
+	}
+
+	uint32_t upsampleH1V2Simd(const uint8_t* nearRow, const uint8_t* farRow, uint32_t w, uint8_t* out)
+	{
+		const __m128i two = _mm_set1_epi16(2);
+		uint32_t i = 0;
+		for (; i + 16 <= w; i += 16) {
+			__m128i lo = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(times3(load8(nearRow + i)), load8(farRow + i)), two), 2);
+			__m128i hi = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(times3(load8(nearRow + i + 8)), load8(farRow + i + 8)), two), 2);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(lo, hi));
+		}
+		return i;
+	}
+
+	uint32_t convertYCbCrSimd(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint32_t count, uint8_t* rgba)
+	{
+		const __m128i offset = _mm_set1_epi16(128);
+		const __m128i one = _mm_set1_epi16(1);
+		// madd は隣り合う 16bit の組を掛けて足すので、係数も組にする
+		const __m128i lumaCoefficients = _mm_set1_epi32(pairCoefficients(Y_SCALE, ROUNDING));
+		const __m128i redCoefficients = _mm_set1_epi32(pairCoefficients(0, CR_TO_R));
+		const __m128i greenCoefficients = _mm_set1_epi32(pairCoefficients(CB_TO_G, CR_TO_G));
+		const __m128i blueCoefficients = _mm_set1_epi32(pairCoefficients(CB_TO_B, 0));
+		const __m128i alpha = _mm_set1_epi16(255);
+
+		uint32_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m128i luma = load8(y + i);
+			__m128i blue = _mm_sub_epi16(load8(cb + i), offset);
+			__m128i red = _mm_sub_epi16(load8(cr + i), offset);
+
+			__m128i lumaLo = _mm_madd_epi16(_mm_unpacklo_epi16(luma, one), lumaCoefficients);
+			__m128i lumaHi = _mm_madd_epi16(_mm_unpackhi_epi16(luma, one), lumaCoefficients);
+			__m128i chromaLo = _mm_unpacklo_epi16(blue, red);
+			__m128i chromaHi = _mm_unpackhi_epi16(blue, red);
+
+			__m128i r = _mm_packs_epi32(
+				_mm_srai_epi32(_mm_add_epi32(lumaLo, _mm_madd_epi16(chromaLo, redCoefficients)), 14),
+				_mm_srai_epi32(_mm_add_epi32(lumaHi, _mm_madd_epi16(chromaHi, redCoefficients)), 14));
+			__m128i g = _mm_packs_epi32(
+				_mm_srai_epi32(_mm_add_epi32(lumaLo, _mm_madd_epi16(chromaLo, greenCoefficients)), 14),
+				_mm_srai_epi32(_mm_add_epi32(lumaHi, _mm_madd_epi16(chromaHi, greenCoefficients)), 14));
+			__m128i b = _mm_packs_epi32(
+				_mm_srai_epi32(_mm_add_epi32(lumaLo, _mm_madd_epi16(chromaLo, blueCoefficients)), 14),
+				_mm_srai_epi32(_mm_add_epi32(lumaHi, _mm_madd_epi16(chromaHi, blueCoefficients)), 14));
+
+			// R0-7 G0-7 / B0-7 A0-7 を RG / BA の組にし、16bit 単位で交互に並べる
+			__m128i rg = _mm_packus_epi16(r, g);
+			__m128i ba = _mm_packus_epi16(b, alpha);
+			rg = _mm_unpacklo_epi8(rg, _mm_srli_si128(rg, 8));
+			ba = _mm_unpacklo_epi8(ba, _mm_srli_si128(ba, 8));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i * 4), _mm_unpacklo_epi16(rg, ba));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(rgba + i * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+		}
+		return i;
+	}
+
+	const char* const KERNEL_NAME = "SSE2";
+
+#elif defined(JPEG_KERNEL_NEON)
+
+	// 8 個の uint8 を int16 に広げて読む
+	inline int16x8_t load8(const uint8_t* p)
+	{
+		return vreinterpretq_s16_u16(vmovl_u8(vld1_u8(p)));
+	}
+
+	uint32_t upsampleH2V2Simd(const uint8_t* nearRow, const uint8_t* farRow, uint32_t w, uint8_t* out)
+	{
+		uint32_t i = 1;
+		for (; i + 8 <= w; i += 8) {
+			int16x8_t prev = vmlaq_n_s16(load8(farRow + i - 1), load8(nearRow + i - 1), 3);
+			int16x8_t curr = vmlaq_n_s16(load8(farRow + i), load8(nearRow + i), 3);
+			uint8x8x2_t pair;
+			pair.val[0] = vqrshrun_n_s16(vmlaq_n_s16(curr, prev, 3), 4);
+			pair.val[1] = vqrshrun_n_s16(vmlaq_n_s16(prev, curr, 3), 4);
+			vst2_u8(out + i * 2 - 1, pair);
+		}
+		return i;
+	}
+
+	uint32_t upsampleH2V1Simd(const uint8_t* in, uint32_t w, uint8_t* out)
+	{
+		uint32_t i = 1;
+		for (; i + 8 <= w - 1; i += 8) {
+			int16x8_t n = vmulq_n_s16(load8(in + i), 3);
+			uint8x8x2_t pair;
+			pair.val[0] = vqrshrun_n_s16(vaddq_s16(n, load8(in + i - 1)), 2);
+			pair.val[1] = vqrshrun_n_s16(vaddq_s16(n, load8(in + i + 1)), 2);
+			vst2_u8(out + i * 2, pair);
+		}
+		return i;
+	}
+
+	uint32_t upsampleH1V2Simd(const uint8_t* nearRow, const uint8_t* farRow, uint32_t w, uint8_t* out)
+	{
+		uint32_t i = 0;
+		for (; i + 8 <= w; i += 8) {
+			vst1_u8(out + i, vqrshrun_n_s16(vmlaq_n_s16(load8(farRow + i), load8(nearRow + i), 3), 2));
+		}
+		return i;
+	}
+
+	uint32_t convertYCbCrSimd(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint32_t count, uint8_t* rgba)
+	{
+		const int16x8_t offset = vdupq_n_s16(128);
+		const int32x4_t rounding = vdupq_n_s32(ROUNDING);
+
+		uint32_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			int16x8_t luma = load8(y + i);
+			int16x8_t blue = vsubq_s16(load8(cb + i), offset);
+			int16x8_t red = vsubq_s16(load8(cr + i), offset);
+
+			int32x4_t lumaLo = vaddq_s32(vshll_n_s16(vget_low_s16(luma), 14), rounding);
+			int32x4_t lumaHi = vaddq_s32(vshll_n_s16(vget_high_s16(luma), 14), rounding);
+
+			int32x4_t rLo = vmlal_n_s16(lumaLo, vget_low_s16(red), CR_TO_R);
+			int32x4_t rHi = vmlal_n_s16(lumaHi, vget_high_s16(red), CR_TO_R);
+			int32x4_t gLo = vmlal_n_s16(vmlal_n_s16(lumaLo, vget_low_s16(blue), CB_TO_G), vget_low_s16(red), CR_TO_G);
+			int32x4_t gHi = vmlal_n_s16(vmlal_n_s16(lumaHi, vget_high_s16(blue), CB_TO_G), vget_high_s16(red), CR_TO_G);
+			int32x4_t bLo = vmlal_n_s16(lumaLo, vget_low_s16(blue), CB_TO_B);
+			int32x4_t bHi = vmlal_n_s16(lumaHi, vget_high_s16(blue), CB_TO_B);
+
+			uint8x8x4_t pixels;
+			pixels.val[0] = vqmovun_s16(vcombine_s16(vshrn_n_s32(rLo, 14), vshrn_n_s32(rHi, 14)));
+			pixels.val[1] = vqmovun_s16(vcombine_s16(vshrn_n_s32(gLo, 14), vshrn_n_s32(gHi, 14)));
+			pixels.val[2] = vqmovun_s16(vcombine_s16(vshrn_n_s32(bLo, 14), vshrn_n_s32(bHi, 14)));
+			pixels.val[3] = vdup_n_u8(255);
+			vst4_u8(rgba + i * 4, pixels);
+		}
+		return i;
+	}
+
+	const char* const KERNEL_NAME = "NEON";
+
+#else
+
+	uint32_t upsampleH2V2Simd(const uint8_t*, const uint8_t*, uint32_t, uint8_t*)
+	{
+		return 1;
+	}
+
+	uint32_t upsampleH2V1Simd(const uint8_t*, uint32_t, uint8_t*)
+	{
+		return 1;
+	}
+
+	uint32_t upsampleH1V2Simd(const uint8_t*, const uint8_t*, uint32_t, uint8_t*)
+	{
+		return 0;
+	}
+
+	uint32_t convertYCbCrSimd(const uint8_t*, const uint8_t*, const uint8_t*, uint32_t, uint8_t*)
+	{
+		return 0;
+	}
+
+	const char* const KERNEL_NAME = "scalar";
+
+#endif
+
+	// 横 2 倍・縦 2 倍（in は w 画素、out は 2w 画素）
+	void upsampleH2V2(const uint8_t* nearRow, const uint8_t* farRow, uint32_t w, uint8_t* out)
+	{
+		out[0] = static_cast<uint8_t>((3 * nearRow[0] + farRow[0] + 2) >> 2);
+		if (w == 1) {
+			out[1] = out[0];
+			return;
+		}
+		uint32_t i = upsampleH2V2Simd(nearRow, farRow, w, out);
+		upsampleH2V2Scalar(nearRow, farRow, i, w, out);
+		out[w * 2 - 1] = static_cast<uint8_t>((3 * nearRow[w - 1] + farRow[w - 1] + 2) >> 2);
+	}
+
+	// 横 2 倍（in は w 画素、out は 2w 画素）
+	void upsampleH2V1(const uint8_t* in, uint32_t w, uint8_t* out)
+	{
+		if (w == 1) {
+			out[0] = out[1] = in[0];
+			return;
+		}
+		out[0] = in[0];
+		out[1] = static_cast<uint8_t>((3 * in[0] + in[1] + 2) >> 2);
+		uint32_t i = upsampleH2V1Simd(in, w, out);
+		upsampleH2V1Scalar(in, i, w - 1, out);
+		out[w * 2 - 2] = static_cast<uint8_t>((in[w - 2] + 3 * in[w - 1] + 2) >> 2);
+		out[w * 2 - 1] = in[w - 1];
+	}
+
+	// 縦 2 倍
+	void upsampleH1V2(const uint8_t* nearRow, const uint8_t* farRow, uint32_t w, uint8_t* out)
+	{
+		uint32_t i = upsampleH1V2Simd(nearRow, farRow, w, out);
+		upsampleH1V2Scalar(nearRow, farRow, i, w, out);
+	}
+
+	void convertYCbCr(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint32_t count, uint8_t* rgba)
+	{
+		uint32_t i = convertYCbCrSimd(y, cb, cr, count, rgba);
+		convertYCbCrScalar(y, cb, cr, i, count, rgba);
+	}
+
+	// MCU 行ごとの IDCT と色変換
+	// 色差を縦に補間するときは上下の MCU 行の色差も使うので、両隣の IDCT が終わった行から色変換する
+	class RowProcessor {
+	public:
+		RowProcessor(Frame& frame, uint8_t* rgba)
+			: frame(frame),
+			rgba(rgba),
+			transformed(new std::atomic<bool>[frame.mcusY]),
+			converted(new std::atomic<bool>[frame.mcusY]),
+			verticalNeighbors(frame.components.size() == 3 && frame.vMax == 2)
+		{
+			for (uint32_t i = 0; i < frame.mcusY; i++) {
+				transformed[i].store(false);
+				converted[i].store(false);
+			}
+		}
+
+		// 1 MCU 行分の係数を逆変換して各成分の面に書き、色変換できるようになった行を変換する
+		void transformRow(uint32_t row, const int16_t* blocks)
+		{
+			for (uint32_t mcuX = 0; mcuX < frame.mcusX; mcuX++) {
+				for (Component& component : frame.components) {
+					for (uint32_t by = 0; by < component.v; by++) {
+						for (uint32_t bx = 0; bx < component.h; bx++) {
+							uint8_t* out = component.plane.data()
+								+ static_cast<size_t>((row * component.v + by) * 8) * component.planeWidth
+								+ (mcuX * component.h + bx) * 8;
+							inverseDct(blocks, out, component.planeWidth);
+							blocks += 64;
+						}
+					}
+				}
+			}
+
+			transformed[row].store(true);
+			if (row > 0) {
+				tryConvert(row - 1);
+			}
+			tryConvert(row);
+			if (row + 1 < frame.mcusY) {
+				tryConvert(row + 1);
+			}
+		}
+
+		bool isTransformed(uint32_t row) const
+		{
+			return transformed[row].load();
+		}
+
+	private:
+		Frame& frame;
+		uint8_t* rgba;
+		std::unique_ptr<std::atomic<bool>[]> transformed;	// IDCT が終わった MCU 行
+		std::unique_ptr<std::atomic<bool>[]> converted;		// 色変換を始めた MCU 行
+		bool verticalNeighbors;
+
+		// 必要な行の IDCT が終わっていて、まだ誰も変換していなければ変換する
+		void tryConvert(uint32_t row)
+		{
+			if (!transformed[row].load()
+				|| (verticalNeighbors && row > 0 && !transformed[row - 1].load())
+				|| (verticalNeighbors && row + 1 < frame.mcusY && !transformed[row + 1].load())) {
+				return;
+			}
+			if (converted[row].exchange(true)) {
+				return;
+			}
+			convertRow(row);
+		}
+
+		// MCU 行に含まれる画素の行を RGBA に変換する
+		void convertRow(uint32_t row)
+		{
+			const uint32_t firstY = row * 8 * frame.vMax;
+			const uint32_t lastY = std::min(firstY + 8 * frame.vMax, frame.height);
+			const size_t outputStride = static_cast<size_t>(frame.width) * 4;
+
+			if (frame.components.size() == 1) {
+				const Component& gray = frame.components[0];
+				for (uint32_t y = firstY; y < lastY; y++) {
+					const uint8_t* in = gray.plane.data() + static_cast<size_t>(y) * gray.planeWidth;
+					uint8_t* out = rgba + y * outputStride;
+					for (uint32_t x = 0; x < frame.width; x++) {
+						out[x * 4 + 0] = out[x * 4 + 1] = out[x * 4 + 2] = in[x];
+						out[x * 4 + 3] = 255;
+					}
+				}
+				return;
+			}
+
+			// 色差のサンプリング係数は 1 なので、輝度の係数がそのまま拡大率になる
+			const Component& luma = frame.components[0];
+			const uint32_t scaleX = frame.hMax;
+			const uint32_t scaleY = frame.vMax;
+			std::vector<uint8_t> upsampled[2];
+			for (int k = 0; k < 2; k++) {
+				if (scaleX > 1 || scaleY > 1) {
+					upsampled[k].resize(static_cast<size_t>(frame.components[1 + k].width) * scaleX);
+				}
+			}
+
+			for (uint32_t y = firstY; y < lastY; y++) {
+				const uint8_t* chromaRows[2];
+				for (int k = 0; k < 2; k++) {
+					const Component& chroma = frame.components[1 + k];
+					const uint32_t nearY = y / scaleY;
+					const uint8_t* nearRow = chroma.plane.data() + static_cast<size_t>(nearY) * chroma.planeWidth;
+					if (scaleY == 1) {
+						if (scaleX == 1) {
+							chromaRows[k] = nearRow;
+							continue;
+						}
+						upsampleH2V1(nearRow, chroma.width, upsampled[k].data());
+					}
+					else {
+						// 偶数行は上の行、奇数行は下の行と補間する（画像の端では同じ行）
+						const uint32_t farY = (y & 1) != 0 ? std::min(nearY + 1, chroma.height - 1) : (nearY > 0 ? nearY - 1 : 0);
+						const uint8_t* farRow = chroma.plane.data() + static_cast<size_t>(farY) * chroma.planeWidth;
+						if (scaleX == 2) {
+							upsampleH2V2(nearRow, farRow, chroma.width, upsampled[k].data());
+						}
+						else {
+							upsampleH1V2(nearRow, farRow, chroma.width, upsampled[k].data());
+						}
+					}
+					chromaRows[k] = upsampled[k].data();
+				}
+
+				convertYCbCr(
+					luma.plane.data() + static_cast<size_t>(y) * luma.planeWidth,
+					chromaRows[0],
+					chromaRows[1],
+					frame.width,
+					rgba + y * outputStride);
+			}
+		}
+	};
+
+	// スキャン内のリスタート区間の先頭を探す
+	std::vector<const uint8_t*> findRestartSegments(const Frame& frame)
+	{
+		std::vector<const uint8_t*> segments{ frame.scanBegin };
+		const uint8_t* p = frame.scanBegin;
+		while (p < frame.end) {
+			p = static_cast<const uint8_t*>(std::memchr(p, 0xFF, static_cast<size_t>(frame.end - p)));
+			if (p == nullptr || p + 1 >= frame.end) {
+				break;
+			}
+			const uint8_t marker = p[1];
+			if (marker == 0x00 || marker == 0xFF) {
+				p += marker == 0x00 ? 2 : 1;
+			}
+			else if (marker >= 0xD0 && marker <= 0xD7) {
+				p += 2;
+				segments.push_back(p);
+			}
+			else {
+				break;	// スキャンの終わり
+			}
+		}
+		return segments;
+	}
+
+	// MCU 行の帯ごとに並列に復号する
+	// 各帯は自分の最初の MCU を含むリスタート区間の先頭から読み始め、帯より前の MCU は復号して捨てる
+	void decodeBands(const Frame& frame, const std::vector<const uint8_t*>& segments, uint32_t bandRows, RowProcessor& rows, ThreadPool& pool)
+	{
+		const uint32_t bandCount = (frame.mcusY + bandRows - 1) / bandRows;
+		const size_t rowBlocks = static_cast<size_t>(frame.mcusX) * frame.blocksPerMcu * 64;
+
+		pool.parallelFor(bandCount, [&](size_t band) {
+			const uint32_t firstRow = static_cast<uint32_t>(band) * bandRows;
+			const uint32_t lastRow = std::min(firstRow + bandRows, frame.mcusY);
+			const uint32_t firstMcu = firstRow * frame.mcusX;
+			const uint32_t segment = firstMcu / frame.restartInterval;
+
+			ScanState state(segments[segment], frame.end, segment * frame.restartInterval);
+			std::vector<int16_t> blocks(rowBlocks);
+			while (state.nextMcu < firstMcu) {
+				decodeMcus(frame, state, std::min(firstMcu - state.nextMcu, frame.mcusX), blocks.data());
+			}
+			for (uint32_t row = firstRow; row < lastRow; row++) {
+				decodeMcus(frame, state, frame.mcusX, blocks.data());
+				rows.transformRow(row, blocks.data());
+			}
+		});
+	}
+
+	// 1スレッドがエントロピー復号した MCU 行をリングに置き、残りのスレッドが取り出して変換する
+	// 復号するスレッドは、リングの同じ位置を使う古い行がまだ取り出されていなければ自分で変換するので、
+	// ほかのスレッドが動いていなくても止まらない
+	void decodePipelined(const Frame& frame, RowProcessor& rows, ThreadPool& pool)
+	{
+		const size_t rowBlocks = static_cast<size_t>(frame.mcusX) * frame.blocksPerMcu * 64;
+		const uint32_t ringRows = static_cast<uint32_t>(std::max<size_t>(4, pool.size() * 2));
+		std::vector<int16_t> ring(ringRows * rowBlocks);
+
+		std::atomic<uint32_t> decodedRows{ 0 };
+		std::atomic<uint32_t> nextRow{ 0 };
+		std::atomic<bool> failed{ false };
+		std::mutex mutex;
+		std::condition_variable decodedCondition;
+
+		auto transform = [&](uint32_t row) {
+			rows.transformRow(row, ring.data() + (row % ringRows) * rowBlocks);
+		};
+
+		// 行を順に取り出し、復号が終わるのを待って変換する
+		auto consume = [&]() {
+			for (;;) {
+				uint32_t row = nextRow.fetch_add(1);
+				if (row >= frame.mcusY) {
+					return;
+				}
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					decodedCondition.wait(lock, [&]() { return decodedRows.load() > row || failed.load(); });
+				}
+				if (failed.load()) {
+					return;
+				}
+				transform(row);
+			}
+		};
+
+		pool.parallelFor(pool.size(), [&](size_t index) {
+			if (index != 0) {
+				consume();
+				return;
+			}
+
+			try {
+				ScanState state(frame.scanBegin, frame.end, 0);
+				for (uint32_t row = 0; row < frame.mcusY; row++) {
+					if (row >= ringRows) {
+						const uint32_t oldest = row - ringRows;
+						while (!rows.isTransformed(oldest)) {
+							uint32_t next = nextRow.load();
+							if (next <= oldest && nextRow.compare_exchange_weak(next, next + 1)) {
+								transform(next);
+							}
+							else {
+								std::this_thread::yield();
+							}
+						}
+					}
+
+					decodeMcus(frame, state, frame.mcusX, ring.data() + (row % ringRows) * rowBlocks);
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						decodedRows.store(row + 1);
+					}
+					decodedCondition.notify_all();
+				}
+			}
+			catch (...) {
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					failed.store(true);
+				}
+				decodedCondition.notify_all();
+				throw;
+			}
+
+			// 復号し終えたら変換を手伝う
+			consume();
+		});
+	}
+}
+
+// JPEG をデコードする
+bool decodeJpeg(const void* data, size_t size, ThreadPool& pool, JpegImage& image)
+{
+	Frame frame;
+	if (!parseHeaders(static_cast<const uint8_t*>(data), size, frame) || !setupFrame(frame)) {
+		return false;
+	}
+
+	for (Component& component : frame.components) {
+		component.plane.resize(static_cast<size_t>(component.planeWidth) * component.planeHeight);
+	}
+	image.width = frame.width;
+	image.height = frame.height;
+	image.rgba.resize(static_cast<size_t>(frame.width) * frame.height * 4);
+	image.restartSegments = 0;
+
+	RowProcessor rows(frame, image.rgba.data());
+
+	// 区間が帯より長いと捨てる MCU が多くなるので、パイプラインで復号する
+	const uint32_t bandRows = std::max<uint32_t>(1, static_cast<uint32_t>((frame.mcusY + pool.size() * 4 - 1) / (pool.size() * 4)));
+	if (frame.restartInterval != 0 && frame.restartInterval <= bandRows * frame.mcusX) {
+		std::vector<const uint8_t*> segments = findRestartSegments(frame);
+		const uint32_t totalMcus = frame.mcusX * frame.mcusY;
+		if (segments.size() == (totalMcus + frame.restartInterval - 1) / frame.restartInterval) {
+			decodeBands(frame, segments, bandRows, rows, pool);
+			image.restartSegments = static_cast<uint32_t>(segments.size());
+			return true;
+		}
+	}
+
+	decodePipelined(frame, rows, pool);
+	return true;
+}
+
+// アップサンプリング・色変換に使う命令セットの名前
+const char* getJpegDecoderKernelName()
+{
+	return KERNEL_NAME;
+}
@@ -0,0 +1,28 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// ベースライン JPEG（8bit・ハフマン符号・1 または 3 成分、輝度のサンプリング係数 1～2）を並列にデコードする
+// リスタートマーカーがあれば区間の境目から MCU 行の帯ごとに独立して復号し、
+// なければ1スレッドがエントロピー復号した MCU 行を、他のスレッドが IDCT・アップサンプリング・色変換する
+// アップサンプリングは stb_image と同じ三角フィルターで、色変換とともに AVX2 / SSE2 / NEON で行う
+
+// デコードした画像
+struct JpegImage {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> rgba;		// RGBA8（アルファは常に 255）
+	uint32_t restartSegments = 0;	// リスタート区間で分けて復号した区間の数（0 ならパイプラインで復号した）
+};
+
+// data を RGBA8 にデコードする
+// 扱えない JPEG（プログレッシブ・12bit・CMYK・RGB など）や JPEG でないデータなら false（stb_image にまかせる）
+// エントロピー符号化データが壊れていれば std::runtime_error
+bool decodeJpeg(const void* data, size_t size, ThreadPool& pool, JpegImage& image);
+
+// アップサンプリング・色変換に使う命令セットの名前
+const char* getJpegDecoderKernelName();
@@ -0,0 +1,281 @@
+﻿#include "Ktx2File.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// «KTX 20»\r\n\x1A\n
+static const uint8_t KTX2_IDENTIFIER[12] = { 0xAB, 0x4B, 0x54, 0x58, 0x20, 0x32, 0x30, 0xBB, 0x0D, 0x0A, 0x1A, 0x0A };
+
+// KTX2 が書き手の名前として推奨するキー
+static const char KTX_WRITER_KEY[] = "KTXwriter";
+static const char KTX_WRITER_VALUE[] = "VulkanTutorial";
+
+// レベルデータの先頭に必要な揃え（ブロックのバイト数と4の最小公倍数。扱う形式ではどちらか大きい方）
+static uint64_t getLevelAlignment(uint32_t blockBytes)
+{
+	return std::max<uint64_t>(blockBytes, 4);
+}
+
+// width x height の画像のバイト数
+static uint64_t getLevelSize(uint32_t width, uint32_t height, uint32_t blockBytes, uint32_t blockExtent)
+{
+	uint64_t blocksX = (width + blockExtent - 1) / blockExtent;
+	uint64_t blocksY = (height + blockExtent - 1) / blockExtent;
+	return blocksX * blocksY * blockBytes;
+}
+
+// 形式を表す基本データ形式記述子（Khronos Data Format の basic descriptor block）を作る
+// 先頭の1語は記述子全体のバイト数
+static std::vector<uint32_t> buildDataFormatDescriptor(VkFormat format)
+{
+	// 色モデル・サンプルの種類（Khronos Data Format の値）
+	const uint32_t MODEL_RGBSDA = 1;
+	const uint32_t MODEL_BC1A = 128;
+	const uint32_t MODEL_BC3 = 130;
+	const uint32_t MODEL_BC7 = 134;
+	const uint32_t PRIMARIES_BT709 = 1;
+	const uint32_t TRANSFER_LINEAR = 1;
+	const uint32_t TRANSFER_SRGB = 2;
+	const uint32_t CHANNEL_ALPHA = 15;
+	const uint32_t QUALIFIER_LINEAR = 1 << 4;	// sRGB の形式でもアルファは線形
+
+	// サンプル1つ分（ビット位置・ビット数・チャンネル・値の範囲）
+	struct Sample {
+		uint32_t bitOffset;
+		uint32_t bitLength;
+		uint32_t channel;
+		uint32_t upper;
+	};
+
+	uint32_t model;
+	uint32_t blockExtent;
+	uint32_t bytesPlane0;
+	std::vector<Sample> samples;
+	const bool srgb = format == VK_FORMAT_R8G8B8A8_SRGB
+		|| format == VK_FORMAT_BC1_RGB_SRGB_BLOCK
+		|| format == VK_FORMAT_BC3_SRGB_BLOCK
+		|| format == VK_FORMAT_BC7_SRGB_BLOCK;
+	const uint32_t alpha = CHANNEL_ALPHA | (srgb ? QUALIFIER_LINEAR : 0);
+	switch (format) {
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		model = MODEL_RGBSDA;
+		blockExtent = 1;
+		bytesPlane0 = 4;
+		samples = { { 0, 8, 0, 255 }, { 8, 8, 1, 255 }, { 16, 8, 2, 255 }, { 24, 8, alpha, 255 } };
+		break;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		model = MODEL_BC1A;
+		blockExtent = 4;
+		bytesPlane0 = 8;
+		samples = { { 0, 64, 0, 0xFFFFFFFF } };
+		break;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+		model = MODEL_BC3;
+		blockExtent = 4;
+		bytesPlane0 = 16;
+		samples = { { 0, 64, alpha, 0xFFFFFFFF }, { 64, 64, 0, 0xFFFFFFFF } };
+		break;
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		model = MODEL_BC7;
+		blockExtent = 4;
+		bytesPlane0 = 16;
+		samples = { { 0, 128, 0, 0xFFFFFFFF } };
+		break;
+	default:
+		throw std::invalid_argument("unsupported KTX2 format!");
+	}
+
+	const uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+	std::vector<uint32_t> words;
+	words.push_back(4 + blockSize);
+	words.push_back(0);	// vendorId = Khronos, descriptorType = basic
+	words.push_back(2 | (blockSize << 16));	// versionNumber = 2
+	words.push_back(model | (PRIMARIES_BT709 << 8) | ((srgb ? TRANSFER_SRGB : TRANSFER_LINEAR) << 16));
+	words.push_back((blockExtent - 1) | ((blockExtent - 1) << 8));
+	words.push_back(bytesPlane0);
+	words.push_back(0);
+	for (const Sample& sample : samples) {
+		words.push_back(sample.bitOffset | ((sample.bitLength - 1) << 16) | (sample.channel << 24));
+		words.push_back(0);	// samplePosition
+		words.push_back(0);	// sampleLower
+		words.push_back(sample.upper);
+	}
+	return words;
+}
+
+// ファイルを開く
+bool Ktx2File::open(const std::string& path)
+{
+	close();
+
+	FileView mapped;
+	try {
+		mapped = FileView::open(path);
+	}
+	catch (const std::runtime_error&) {
+		return false;
+	}
+
+	// ヘッダーを検証する（超圧縮・3D・配列・キューブマップは扱わない）
+	Header header;
+	if (mapped.size() < sizeof(header)) {
+		return false;
+	}
+	std::memcpy(&header, mapped.data(), sizeof(header));
+
+	uint32_t blockBytes, blockExtent;
+	if (std::memcmp(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER)) != 0
+		|| !getBlockInfo(static_cast<VkFormat>(header.vkFormat), blockBytes, blockExtent)
+		|| header.pixelWidth == 0 || header.pixelHeight == 0 || header.pixelDepth != 0
+		|| header.layerCount > 1 || header.faceCount != 1
+		|| header.supercompressionScheme != 0 || header.levelCount > MAX_LEVELS) {
+		return false;
+	}
+
+	// levelCount = 0 は「レベル0 だけを格納し、ミップマップは読み込み側で作る」という意味
+	const uint32_t levelCount = std::max(header.levelCount, 1u);
+	const uint64_t indexEnd = sizeof(Header) + sizeof(LevelIndex) * static_cast<uint64_t>(levelCount);
+	if (mapped.size() < indexEnd) {
+		return false;
+	}
+
+	// 各レベルの領域がファイルに収まり、転送に必要な揃えを満たしているか
+	const uint64_t alignment = getLevelAlignment(blockBytes);
+	uint64_t dataBegin = mapped.size();
+	uint64_t dataEnd = 0;
+	std::vector<Level> loadedLevels(levelCount);
+	for (uint32_t i = 0; i < levelCount; i++) {
+		LevelIndex entry;
+		std::memcpy(&entry, mapped.data() + sizeof(Header) + sizeof(LevelIndex) * i, sizeof(entry));
+
+		uint32_t width = std::max(header.pixelWidth >> i, 1u);
+		uint32_t height = std::max(header.pixelHeight >> i, 1u);
+		if (entry.byteOffset < indexEnd || entry.byteOffset % alignment != 0
+			|| entry.byteLength != getLevelSize(width, height, blockBytes, blockExtent)
+			|| entry.byteOffset > mapped.size() || entry.byteLength > mapped.size() - entry.byteOffset) {
+			return false;
+		}
+		loadedLevels[i].width = width;
+		loadedLevels[i].height = height;
+		loadedLevels[i].data = mapped.data() + entry.byteOffset;
+		loadedLevels[i].size = entry.byteLength;
+
+		dataBegin = std::min(dataBegin, entry.byteOffset);
+		dataEnd = std::max(dataEnd, entry.byteOffset + entry.byteLength);
+	}
+
+	file = std::move(mapped);
+	format = static_cast<VkFormat>(header.vkFormat);
+	levels = std::move(loadedLevels);
+	levelDataOffset = dataBegin;
+	levelDataSize = dataEnd - dataBegin;
+	return true;
+}
+
+// マップを解除する
+void Ktx2File::close()
+{
+	file.reset();
+	format = VK_FORMAT_UNDEFINED;
+	levels.clear();
+	levelDataOffset = 0;
+	levelDataSize = 0;
+}
+
+// KTX2 を書き出す
+bool Ktx2File::write(const std::string& path, VkFormat format, const std::vector<Level>& levels)
+{
+	uint32_t blockBytes, blockExtent;
+	if (!getBlockInfo(format, blockBytes, blockExtent)) {
+		throw std::invalid_argument("unsupported KTX2 format!");
+	}
+	if (levels.empty() || levels.size() > MAX_LEVELS) {
+		throw std::invalid_argument("KTX2 level count must be 1 to MAX_LEVELS!");
+	}
+	for (size_t i = 0; i < levels.size(); i++) {
+		if (levels[i].width != std::max(levels[0].width >> i, 1u)
+			|| levels[i].height != std::max(levels[0].height >> i, 1u)
+			|| levels[i].size != getLevelSize(levels[i].width, levels[i].height, blockBytes, blockExtent)) {
+			throw std::invalid_argument("KTX2 levels must form a mip chain!");
+		}
+	}
+
+	const std::vector<uint32_t> dfd = buildDataFormatDescriptor(format);
+
+	// キーと値: 長さ（4バイト） | キー\0値\0 | 4バイト境界までの詰め物
+	std::vector<char> kvd(4);
+	const uint32_t keyAndValueLength = static_cast<uint32_t>(sizeof(KTX_WRITER_KEY) + sizeof(KTX_WRITER_VALUE));
+	std::memcpy(kvd.data(), &keyAndValueLength, 4);
+	kvd.insert(kvd.end(), KTX_WRITER_KEY, KTX_WRITER_KEY + sizeof(KTX_WRITER_KEY));
+	kvd.insert(kvd.end(), KTX_WRITER_VALUE, KTX_WRITER_VALUE + sizeof(KTX_WRITER_VALUE));
+	kvd.resize(static_cast<size_t>(alignUp(kvd.size(), 4)));
+
+	Header header = {};
+	std::memcpy(header.identifier, KTX2_IDENTIFIER, sizeof(KTX2_IDENTIFIER));
+	header.vkFormat = static_cast<uint32_t>(format);
+	header.typeSize = 1;
+	header.pixelWidth = levels[0].width;
+	header.pixelHeight = levels[0].height;
+	header.faceCount = 1;
+	header.levelCount = static_cast<uint32_t>(levels.size());
+	header.dfdByteOffset = static_cast<uint32_t>(sizeof(Header) + sizeof(LevelIndex) * levels.size());
+	header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+	header.kvdByteOffset = header.dfdByteOffset + header.dfdByteLength;
+	header.kvdByteLength = static_cast<uint32_t>(kvd.size());
+
+	// 小さいレベルから順に置く（先頭から読むだけで粗いレベルがそろう）
+	const uint64_t alignment = getLevelAlignment(blockBytes);
+	std::vector<LevelIndex> index(levels.size());
+	uint64_t offset = header.kvdByteOffset + header.kvdByteLength;
+	for (size_t i = levels.size(); i-- > 0;) {
+		offset = alignUp(offset, alignment);
+		index[i].byteOffset = offset;
+		index[i].byteLength = levels[i].size;
+		index[i].uncompressedByteLength = levels[i].size;
+		offset += levels[i].size;
+	}
+
+	return writeFileAtomically(path, [&](std::ostream& out) {
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(sizeof(LevelIndex) * index.size()));
+		out.write(reinterpret_cast<const char*>(dfd.data()), static_cast<std::streamsize>(header.dfdByteLength));
+		out.write(kvd.data(), static_cast<std::streamsize>(kvd.size()));
+
+		static const char padding[16] = {};
+		for (size_t i = levels.size(); i-- > 0;) {
+			out.write(padding, static_cast<std::streamsize>(index[i].byteOffset - static_cast<uint64_t>(out.tellp())));
+			out.write(static_cast<const char*>(levels[i].data), static_cast<std::streamsize>(levels[i].size));
+		}
+	});
+}
+
+// 1ブロックのバイト数と辺の画素数
+bool Ktx2File::getBlockInfo(VkFormat format, uint32_t& blockBytes, uint32_t& blockExtent)
+{
+	switch (format) {
+	case VK_FORMAT_R8G8B8A8_UNORM:
+	case VK_FORMAT_R8G8B8A8_SRGB:
+		blockBytes = 4;
+		blockExtent = 1;
+		return true;
+	case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+		blockBytes = 8;
+		blockExtent = 4;
+		return true;
+	case VK_FORMAT_BC3_UNORM_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC7_UNORM_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		blockBytes = 16;
+		blockExtent = 4;
+		return true;
+	default:
+		return false;
+	}
+}
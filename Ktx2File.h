@@ -0,0 +1,87 @@
+﻿#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+
+// KTX2 コンテナの読み書き（2D・1レイヤー・超圧縮なしのものだけを扱う）
+// 読み込み時はファイルをマップし、全レベルのデータ（小さいレベルから順に連続して並ぶ）を
+// 1回のコピーでステージングへ移して、レベルごとの領域を1回の vkCmdCopyBufferToImage で転送できる
+//
+// ファイル構成: Header | LevelIndex * levelCount | データ形式記述子（DFD） | キーと値 | 最小レベルのデータ | ... | レベル0 のデータ
+class Ktx2File {
+public:
+	static const uint32_t MAX_LEVELS = 16;
+
+	// ミップレベル1つ分
+	struct Level {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		const void* data = nullptr;
+		uint64_t size = 0;
+	};
+
+	// ファイルを開き、扱える KTX2 なら true
+	bool open(const std::string& path);
+
+	// マップを解除する
+	void close();
+
+	bool isOpen() const { return !file.empty(); }
+
+	VkFormat getFormat() const { return format; }
+
+	// レベル0 から順に並ぶ（data はマップしたファイルを指す）
+	const std::vector<Level>& getLevels() const { return levels; }
+
+	// 全レベルのデータを含むファイル内の連続した領域
+	// 各レベルの data からこの先頭を引いたオフセットはブロックのバイト数と4の倍数になっている
+	const void* getLevelData() const { return file.data() + levelDataOffset; }
+	uint64_t getLevelDataSize() const { return levelDataSize; }
+
+	// KTX2 を書き出す（一時ファイルに書いてから置き換える）
+	// levels はレベル0 から順に 1 ～ MAX_LEVELS 個で、data は書き出し中だけ参照する
+	// 書き出せなければ false
+	static bool write(const std::string& path, VkFormat format, const std::vector<Level>& levels);
+
+	// format の1ブロックのバイト数と辺の画素数（扱えない形式なら false）
+	static bool getBlockInfo(VkFormat format, uint32_t& blockBytes, uint32_t& blockExtent);
+
+private:
+	// ファイル先頭の識別子とヘッダー、索引
+	struct Header {
+		uint8_t identifier[12];
+		uint32_t vkFormat;
+		uint32_t typeSize;
+		uint32_t pixelWidth;
+		uint32_t pixelHeight;
+		uint32_t pixelDepth;
+		uint32_t layerCount;
+		uint32_t faceCount;
+		uint32_t levelCount;
+		uint32_t supercompressionScheme;
+		uint32_t dfdByteOffset;
+		uint32_t dfdByteLength;
+		uint32_t kvdByteOffset;
+		uint32_t kvdByteLength;
+		uint64_t sgdByteOffset;
+		uint64_t sgdByteLength;
+	};
+
+	// レベル1つ分の索引
+	struct LevelIndex {
+		uint64_t byteOffset;
+		uint64_t byteLength;
+		uint64_t uncompressedByteLength;
+	};
+
+	FileView file;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	std::vector<Level> levels;
+	uint64_t levelDataOffset = 0;
+	uint64_t levelDataSize = 0;
+};
@@ -0,0 +1,252 @@
+﻿#include "MappedFile.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// filename を開いてマップする
+MappedFile::MappedFile(const std::string& filename)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(
+		filename.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		nullptr,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+		nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		throw std::runtime_error("failed to open file: " + filename);
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		throw std::runtime_error("failed to get file size: " + filename);
+	}
+	fileHandle = file;
+
+	// ディスク上のファイル以外はマップできない
+	if (GetFileType(file) != FILE_TYPE_DISK) {
+		close();
+		throw std::runtime_error("failed to map file: " + filename);
+	}
+	length = static_cast<size_t>(fileSize.QuadPart);
+
+	// 空のファイルはマップできない
+	if (length == 0) {
+		return;
+	}
+
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mapping == nullptr) {
+		close();
+		throw std::runtime_error("failed to map file: " + filename);
+	}
+	mappingHandle = mapping;
+
+	address = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (address == nullptr) {
+		close();
+		throw std::runtime_error("failed to map file: " + filename);
+	}
+#else
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd < 0) {
+		throw std::runtime_error("failed to open file: " + filename);
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		::close(fd);
+		throw std::runtime_error("failed to get file size: " + filename);
+	}
+
+	// パイプやデバイスはサイズが分からずマップもできない
+	if (!S_ISREG(st.st_mode)) {
+		::close(fd);
+		throw std::runtime_error("failed to map file: " + filename);
+	}
+	length = static_cast<size_t>(st.st_size);
+
+	if (length > 0) {
+		void* mapped = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped == MAP_FAILED) {
+			::close(fd);
+			length = 0;
+			throw std::runtime_error("failed to map file: " + filename);
+		}
+		address = mapped;
+
+		// 先頭から順に読むことを伝えて先読みを促す
+		madvise(address, length, MADV_SEQUENTIAL);
+	}
+
+	// マップはファイルディスクリプタを閉じても有効
+	::close(fd);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+{
+	*this = std::move(other);
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other) {
+		close();
+		std::swap(address, other.address);
+		std::swap(length, other.length);
+#ifdef _WIN32
+		std::swap(fileHandle, other.fileHandle);
+		std::swap(mappingHandle, other.mappingHandle);
+#endif
+	}
+	return *this;
+}
+
+// マップを解除する
+void MappedFile::close()
+{
+#ifdef _WIN32
+	if (address != nullptr) {
+		UnmapViewOfFile(address);
+	}
+	if (mappingHandle != nullptr) {
+		CloseHandle(mappingHandle);
+	}
+	if (fileHandle != nullptr) {
+		CloseHandle(fileHandle);
+	}
+	mappingHandle = nullptr;
+	fileHandle = nullptr;
+#else
+	if (address != nullptr) {
+		munmap(address, length);
+	}
+#endif
+	address = nullptr;
+	length = 0;
+}
+
+// filename をマップして開く
+FileView FileView::open(const std::string& filename)
+{
+	std::shared_ptr<MappedFile> file;
+	try {
+		file = std::make_shared<MappedFile>(filename);
+	}
+	catch (const std::runtime_error&) {
+		// 存在しないファイルもここに来るが、その場合は read() が開けずに例外を投げる
+		return read(filename);
+	}
+
+	FileView view;
+	view.begin = file->data();
+	view.length = file->size();
+	view.mapped = true;
+	view.owner = std::move(file);
+	return view;
+}
+
+// filename をストリームで読み込む
+FileView FileView::read(const std::string& filename)
+{
+	std::ifstream file(filename, std::ios::binary);
+	if (!file.is_open()) {
+		throw std::runtime_error("failed to open file: " + filename);
+	}
+
+	// サイズが分からないこともあるので、末尾まで塊ごとに読み足す
+	const size_t blockSize = 64 * 1024;
+	auto buffer = std::make_shared<std::vector<char>>();
+	size_t used = 0;
+	while (file) {
+		buffer->resize(used + blockSize);
+		file.read(buffer->data() + used, blockSize);
+		used += static_cast<size_t>(file.gcount());
+	}
+	if (file.bad()) {
+		throw std::runtime_error("failed to read file: " + filename);
+	}
+	buffer->resize(used);
+	buffer->shrink_to_fit();
+
+	FileView view;
+	view.begin = buffer->empty() ? nullptr : buffer->data();
+	view.length = buffer->size();
+	view.owner = std::move(buffer);
+	return view;
+}
+
+// offset から count バイトを切り出す
+FileView FileView::subview(size_t offset, size_t count) const
+{
+	if (offset > length || count > length - offset) {
+		throw std::out_of_range("file view range out of bounds");
+	}
+
+	FileView view = *this;
+	view.begin = begin + offset;
+	view.length = count;
+	return view;
+}
+
+// バッファへの参照を手放す
+void FileView::reset()
+{
+	owner.reset();
+	begin = nullptr;
+	length = 0;
+	mapped = false;
+}
+
+// 一時ファイルに書いてから path を置き換える
+bool writeFileAtomically(const std::string& path, const std::function<void(std::ostream&)>& writer)
+{
+	std::string tempPath = path + ".tmp";
+	{
+		std::ofstream out(tempPath, std::ios::binary | std::ios::trunc);
+		if (!out) {
+			return false;
+		}
+
+		writer(out);
+
+		if (!out) {
+			out.close();
+			std::remove(tempPath.c_str());
+			return false;
+		}
+	}
+
+	// 置き換えは不可分なので、古いファイルが消えたまま残ることはない
+	std::error_code error;
+	std::filesystem::rename(tempPath, path, error);
+	if (error) {
+		std::remove(tempPath.c_str());
+		return false;
+	}
+	return true;
+}
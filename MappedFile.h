@@ -0,0 +1,85 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+
+// ファイル全体を読み取り専用でメモリにマップする
+// 空のファイルはマップせず、data() が nullptr、size() が 0 になる
+class MappedFile {
+public:
+	MappedFile() = default;
+
+	// filename を開いてマップする（開けなければ std::runtime_error）
+	explicit MappedFile(const std::string& filename);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	const char* data() const { return static_cast<const char*>(address); }
+	size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+
+	// マップを解除する
+	void close();
+
+private:
+	void* address = nullptr;
+	size_t length = 0;
+
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+};
+
+// ファイル内容への読み取り専用ビュー
+// コピーしたビューや subview() で切り出したビューは同じバッファを共有し、
+// 最後のビューが破棄された時点でマップ解除（またはメモリ解放）される
+class FileView {
+public:
+	FileView() = default;
+
+	// filename をマップして開く
+	// パイプなどマップできないファイルはストリームで読み込む。開けなければ std::runtime_error
+	static FileView open(const std::string& filename);
+
+	// filename をマップせずにストリームで全体を読み込む
+	static FileView read(const std::string& filename);
+
+	const char* data() const { return begin; }
+	size_t size() const { return length; }
+	bool empty() const { return length == 0; }
+
+	// ファイルをマップしているか（false ならヒープに読み込んだ内容）
+	bool isMapped() const { return mapped; }
+
+	// offset から count バイトを切り出す（範囲外なら std::out_of_range）
+	FileView subview(size_t offset, size_t count) const;
+
+	// バッファへの参照を手放す
+	void reset();
+
+private:
+	std::shared_ptr<const void> owner;
+	const char* begin = nullptr;
+	size_t length = 0;
+	bool mapped = false;
+};
+
+// value を alignment の倍数に切り上げる
+inline uint64_t alignUp(uint64_t value, uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+// writer が書き込んだ内容で path を置き換える
+// 一時ファイルに書いてから差し替えるので、書きかけのファイルが path に見えることはない
+// 書き込みか置き換えに失敗したら false（path は元のまま）
+bool writeFileAtomically(const std::string& path, const std::function<void(std::ostream&)>& writer);
@@ -0,0 +1,357 @@
+﻿#include "MemoryAllocator.h"
+
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+// 初期化
+void MemoryAllocator::init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize preferredBlockSize)
+{
+	this->device = device;
+	this->preferredBlockSize = preferredBlockSize;
+
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+	bufferImageGranularity = std::max<VkDeviceSize>(properties.limits.bufferImageGranularity, 1);
+	maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+}
+
+// すべてのブロックを解放する
+void MemoryAllocator::destroy()
+{
+	for (auto& block : blocks) {
+		if (block) {
+			vkFreeMemory(device, block->memory, nullptr);
+		}
+	}
+	blocks.clear();
+	liveDeviceAllocations = 0;
+}
+
+// メモリ要件に合う範囲を割り当てる
+MemoryAllocator::Allocation MemoryAllocator::allocate(
+	const VkMemoryRequirements& requirements,
+	VkMemoryPropertyFlags properties,
+	ResourceKind kind)
+{
+	Allocation allocation;
+	allocation.memoryTypeIndex = findMemoryType(requirements.memoryTypeBits, properties);
+	allocation.size = requirements.size;
+
+	VkDeviceSize blockSize = blockSizeFor(allocation.memoryTypeIndex);
+
+	// ブロックの半分を超える大きなリソースは専用の割り当てにする
+	if (requirements.size > blockSize / 2) {
+		void* mapped = nullptr;
+		allocation.memory = allocateDeviceMemory(requirements.size, allocation.memoryTypeIndex, &mapped);
+		allocation.offset = 0;
+		allocation.mapped = mapped;
+		allocation.rangeOffset = 0;
+		allocation.rangeSize = requirements.size;
+		dedicatedCount++;
+		dedicatedBytes += requirements.size;
+		return allocation;
+	}
+
+	// bufferImageGranularity が1より大きい場合、リニアと最適タイリングのリソースを
+	// 同じブロックに置かないことで、隣接によるエイリアシングを避ける
+	bool separateKinds = bufferImageGranularity > 1;
+
+	for (uint32_t i = 0; i < blocks.size(); i++) {
+		Block* block = blocks[i].get();
+		if (block == nullptr
+			|| block->memoryTypeIndex != allocation.memoryTypeIndex
+			|| (separateKinds && block->kind != kind)) {
+			continue;
+		}
+
+		if (allocateFromBlock(*block, i, requirements, allocation)) {
+			return allocation;
+		}
+	}
+
+	// 既存ブロックに空きがなければ新しいブロックを確保する
+	auto block = std::make_unique<Block>();
+	block->memoryTypeIndex = allocation.memoryTypeIndex;
+	block->kind = kind;
+
+	// 確保に失敗した場合はブロックを小さくして再試行する
+	void* mapped = nullptr;
+	for (;;) {
+		try {
+			block->memory = allocateDeviceMemory(blockSize, allocation.memoryTypeIndex, &mapped);
+			break;
+		}
+		catch (const std::runtime_error&) {
+			if (blockSize / 2 < requirements.size + requirements.alignment) {
+				throw;
+			}
+			blockSize /= 2;
+		}
+	}
+	block->size = blockSize;
+	block->mapped = static_cast<char*>(mapped);
+	block->freeRanges[0] = blockSize;
+
+	// 空いているスロットを再利用する
+	uint32_t blockIndex = static_cast<uint32_t>(blocks.size());
+	for (uint32_t i = 0; i < blocks.size(); i++) {
+		if (!blocks[i]) {
+			blockIndex = i;
+			break;
+		}
+	}
+	if (blockIndex == blocks.size()) {
+		blocks.push_back(nullptr);
+	}
+	blocks[blockIndex] = std::move(block);
+
+	if (!allocateFromBlock(*blocks[blockIndex], blockIndex, requirements, allocation)) {
+		throw std::runtime_error("failed to sub-allocate device memory!");
+	}
+	return allocation;
+}
+
+// 割り当てを解放する
+void MemoryAllocator::free(Allocation& allocation)
+{
+	if (allocation.memory == VK_NULL_HANDLE) {
+		return;
+	}
+
+	if (allocation.blockIndex == UINT32_MAX) {
+		// 専用割り当て
+		vkFreeMemory(device, allocation.memory, nullptr);
+		liveDeviceAllocations--;
+		dedicatedCount--;
+		dedicatedBytes -= allocation.rangeSize;
+	}
+	else {
+		Block& block = *blocks[allocation.blockIndex];
+		auto& ranges = block.freeRanges;
+
+		VkDeviceSize offset = allocation.rangeOffset;
+		VkDeviceSize size = allocation.rangeSize;
+
+		// 後ろの空き範囲と結合する
+		auto next = ranges.find(offset + size);
+		if (next != ranges.end()) {
+			size += next->second;
+			ranges.erase(next);
+		}
+
+		// 前の空き範囲と結合する
+		auto it = ranges.lower_bound(offset);
+		if (it != ranges.begin()) {
+			auto prev = std::prev(it);
+			if (prev->first + prev->second == offset) {
+				prev->second += size;
+				block.allocationCount--;
+				allocation = Allocation();
+				return;
+			}
+		}
+
+		ranges[offset] = size;
+		block.allocationCount--;
+	}
+
+	allocation = Allocation();
+}
+
+// 空になったブロックを解放する
+// 生存中の割り当ての移動は所有者によるリソースの作り直しが必要なため行わない
+VkDeviceSize MemoryAllocator::defragment()
+{
+	VkDeviceSize released = 0;
+
+	for (auto& block : blocks) {
+		if (block && block->allocationCount == 0) {
+			released += block->size;
+			vkFreeMemory(device, block->memory, nullptr);
+			liveDeviceAllocations--;
+			block.reset();
+		}
+	}
+
+	// 末尾の空きスロットを詰める
+	while (!blocks.empty() && !blocks.back()) {
+		blocks.pop_back();
+	}
+
+	return released;
+}
+
+// 統計を取得する（全メモリタイプ）
+MemoryAllocator::Stats MemoryAllocator::getStats() const
+{
+	Stats stats;
+	accumulateStats(stats, 0, true);
+	stats.dedicatedCount = dedicatedCount;
+	stats.allocationCount += dedicatedCount;
+	stats.reservedBytes += dedicatedBytes;
+	stats.usedBytes += dedicatedBytes;
+	return stats;
+}
+
+// 統計を取得する（メモリタイプ別、専用割り当ては含まない）
+MemoryAllocator::Stats MemoryAllocator::getStats(uint32_t memoryTypeIndex) const
+{
+	Stats stats;
+	accumulateStats(stats, memoryTypeIndex, false);
+	return stats;
+}
+
+// 統計を出力する
+void MemoryAllocator::printStats(std::ostream& out) const
+{
+	Stats total = getStats();
+	const double mib = 1024.0 * 1024.0;
+
+	out << "device memory: " << total.blockCount << " blocks + " << total.dedicatedCount << " dedicated, "
+		<< total.allocationCount << " allocations, "
+		<< total.usedBytes / mib << " / " << total.reservedBytes / mib << " MiB used, "
+		<< "vkAllocateMemory calls: " << total.deviceAllocationCalls
+		<< " (limit " << maxAllocationCount << ")" << std::endl;
+
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+		Stats stats = getStats(i);
+		if (stats.blockCount == 0) {
+			continue;
+		}
+
+		// 空き容量に対する最大空き範囲の割合が小さいほど断片化している
+		VkDeviceSize freeBytes = stats.reservedBytes - stats.usedBytes;
+		double fragmentation = freeBytes > 0
+			? 1.0 - static_cast<double>(stats.largestFreeRange) / static_cast<double>(freeBytes)
+			: 0.0;
+
+		out << "  type " << i << ": " << stats.blockCount << " blocks, "
+			<< stats.allocationCount << " allocations, "
+			<< stats.usedBytes / mib << " / " << stats.reservedBytes / mib << " MiB used, "
+			<< stats.freeRangeCount << " free ranges, fragmentation " << fragmentation * 100.0 << " %" << std::endl;
+	}
+}
+
+// メモリタイプを見つける
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+		if (typeFilter & (1 << i)
+			&& (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+			return i;
+		}
+	}
+
+	throw std::runtime_error("failed to find suitable memory type!");
+}
+
+// ブロックのサイズを決める
+VkDeviceSize MemoryAllocator::blockSizeFor(uint32_t memoryTypeIndex) const
+{
+	VkDeviceSize heapSize = memProperties.memoryHeaps[memProperties.memoryTypes[memoryTypeIndex].heapIndex].size;
+
+	// ヒープの1/8を上限とする（ホスト可視の小さなヒープなどを使い切らないため）
+	return std::min(preferredBlockSize, std::max<VkDeviceSize>(heapSize / 8, 1024 * 1024));
+}
+
+// vkAllocateMemory を呼び、ホスト可視なら永続的にマップする
+VkDeviceMemory MemoryAllocator::allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void** mapped)
+{
+	if (maxAllocationCount != 0 && liveDeviceAllocations >= maxAllocationCount) {
+		throw std::runtime_error("exceeded maxMemoryAllocationCount!");
+	}
+
+	VkMemoryAllocateInfo allocInfo = {};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = size;
+	allocInfo.memoryTypeIndex = memoryTypeIndex;
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+		throw std::runtime_error("failed to allocate device memory!");
+	}
+	deviceAllocationCalls++;
+	liveDeviceAllocations++;
+
+	*mapped = nullptr;
+	if (memProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+		if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped) != VK_SUCCESS) {
+			vkFreeMemory(device, memory, nullptr);
+			liveDeviceAllocations--;
+			throw std::runtime_error("failed to map device memory!");
+		}
+	}
+
+	return memory;
+}
+
+// ブロックから範囲を切り出す（最良適合）
+bool MemoryAllocator::allocateFromBlock(
+	Block& block,
+	uint32_t blockIndex,
+	const VkMemoryRequirements& requirements,
+	Allocation& allocation)
+{
+	VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+
+	auto best = block.freeRanges.end();
+	for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+		VkDeviceSize padding = alignUp(it->first, alignment) - it->first;
+		if (padding + requirements.size <= it->second
+			&& (best == block.freeRanges.end() || it->second < best->second)) {
+			best = it;
+		}
+	}
+
+	if (best == block.freeRanges.end()) {
+		return false;
+	}
+
+	VkDeviceSize rangeOffset = best->first;
+	VkDeviceSize rangeEnd = best->first + best->second;
+	VkDeviceSize alignedOffset = alignUp(rangeOffset, alignment);
+	VkDeviceSize allocationEnd = alignedOffset + requirements.size;
+
+	// 先頭のパディングは割り当て範囲に含め、後ろの余りを空き範囲として残す
+	block.freeRanges.erase(best);
+	if (allocationEnd < rangeEnd) {
+		block.freeRanges[allocationEnd] = rangeEnd - allocationEnd;
+	}
+	block.allocationCount++;
+
+	allocation.memory = block.memory;
+	allocation.offset = alignedOffset;
+	allocation.mapped = block.mapped ? block.mapped + alignedOffset : nullptr;
+	allocation.blockIndex = blockIndex;
+	allocation.rangeOffset = rangeOffset;
+	allocation.rangeSize = allocationEnd - rangeOffset;
+	return true;
+}
+
+void MemoryAllocator::accumulateStats(Stats& stats, uint32_t memoryTypeIndex, bool allTypes) const
+{
+	stats.deviceAllocationCalls = deviceAllocationCalls;
+
+	for (const auto& block : blocks) {
+		if (!block || (!allTypes && block->memoryTypeIndex != memoryTypeIndex)) {
+			continue;
+		}
+
+		VkDeviceSize freeBytes = 0;
+		for (const auto& range : block->freeRanges) {
+			freeBytes += range.second;
+			stats.largestFreeRange = std::max(stats.largestFreeRange, range.second);
+		}
+
+		stats.blockCount++;
+		stats.allocationCount += block->allocationCount;
+		stats.freeRangeCount += static_cast<uint32_t>(block->freeRanges.size());
+		stats.reservedBytes += block->size;
+		stats.usedBytes += block->size - freeBytes;
+	}
+}
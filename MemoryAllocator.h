@@ -0,0 +1,110 @@
+﻿#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <map>
+#include <memory>
+#include <ostream>
+
+// デバイスメモリのサブアロケータ
+// メモリタイプごとに大きなブロックを vkAllocateMemory で確保し、そこから切り出して割り当てる
+class MemoryAllocator {
+public:
+	// リソースの種類（bufferImageGranularity の判定に使用する）
+	enum class ResourceKind {
+		Linear,		// バッファ・リニアタイリングのイメージ
+		Optimal		// 最適タイリングのイメージ
+	};
+
+	// 割り当て結果
+	struct Allocation {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;		// memory 内のオフセット（アライメント済み）
+		VkDeviceSize size = 0;			// 要求サイズ
+		void* mapped = nullptr;			// ホスト可視メモリの場合は offset の位置を指す
+		uint32_t memoryTypeIndex = 0;
+
+		// 解放時に使用する内部情報
+		uint32_t blockIndex = UINT32_MAX;	// UINT32_MAX なら専用割り当て
+		VkDeviceSize rangeOffset = 0;		// パディングを含む確保範囲
+		VkDeviceSize rangeSize = 0;
+	};
+
+	// 使用状況の統計
+	struct Stats {
+		uint32_t blockCount = 0;			// 確保済みブロック数
+		uint32_t dedicatedCount = 0;		// 専用割り当て数
+		uint32_t allocationCount = 0;		// 生存中の割り当て数
+		uint32_t freeRangeCount = 0;		// ブロック内の空き範囲数
+		VkDeviceSize reservedBytes = 0;		// vkAllocateMemory で確保したバイト数
+		VkDeviceSize usedBytes = 0;			// 割り当て済みのバイト数（パディング含む）
+		VkDeviceSize largestFreeRange = 0;	// 最大の空き範囲
+		uint64_t deviceAllocationCalls = 0;	// これまでの vkAllocateMemory 呼び出し回数
+	};
+
+	// 初期化（論理デバイス作成後に呼ぶ）
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, VkDeviceSize preferredBlockSize = 64 * 1024 * 1024);
+
+	// すべてのブロックを解放する（論理デバイス破棄前に呼ぶ）
+	void destroy();
+
+	// メモリ要件に合う範囲を割り当てる
+	Allocation allocate(
+		const VkMemoryRequirements& requirements,
+		VkMemoryPropertyFlags properties,
+		ResourceKind kind);
+
+	// 割り当てを解放する
+	void free(Allocation& allocation);
+
+	// 空になったブロックを解放し、解放したバイト数を返す
+	VkDeviceSize defragment();
+
+	// 統計を取得する
+	Stats getStats() const;
+	Stats getStats(uint32_t memoryTypeIndex) const;
+
+	// 統計を出力する
+	void printStats(std::ostream& out) const;
+
+	// メモリタイプを見つける
+	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+private:
+	// vkAllocateMemory で確保した1つのブロック
+	struct Block {
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		VkDeviceSize size = 0;
+		uint32_t memoryTypeIndex = 0;
+		ResourceKind kind = ResourceKind::Linear;
+		char* mapped = nullptr;
+		uint32_t allocationCount = 0;
+
+		// 空き範囲（オフセット -> サイズ）。隣接する範囲は常に結合しておく
+		std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties memProperties = {};
+	VkDeviceSize bufferImageGranularity = 1;
+	uint32_t maxAllocationCount = 0;
+	VkDeviceSize preferredBlockSize = 0;
+
+	std::vector<std::unique_ptr<Block>> blocks;	// 解放済みのスロットは nullptr
+	uint32_t liveDeviceAllocations = 0;
+	uint32_t dedicatedCount = 0;
+	VkDeviceSize dedicatedBytes = 0;
+	uint64_t deviceAllocationCalls = 0;
+
+	// ブロックのサイズを決める（小さいヒープでは控えめにする）
+	VkDeviceSize blockSizeFor(uint32_t memoryTypeIndex) const;
+
+	// vkAllocateMemory を呼び、必要ならマップする
+	VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryTypeIndex, void** mapped);
+
+	// ブロックから範囲を切り出す。空きがなければ false
+	bool allocateFromBlock(Block& block, uint32_t blockIndex, const VkMemoryRequirements& requirements, Allocation& allocation);
+
+	void accumulateStats(Stats& stats, uint32_t memoryTypeIndex, bool allTypes) const;
+};
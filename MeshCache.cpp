@@ -0,0 +1,207 @@
+﻿#include "MeshCache.h"
+
+#include "FlatHashMap.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// キャッシュを開く
+bool MeshCache::open(const std::string& path, const SourceInfo& source, const Layout& layout)
+{
+	close();
+
+	FileView mapped;
+	try {
+		mapped = FileView::open(path);
+	}
+	catch (const std::runtime_error&) {
+		return false;
+	}
+
+	// ヘッダーを検証する
+	Header header;
+	if (mapped.size() < sizeof(header)) {
+		return false;
+	}
+	std::memcpy(&header, mapped.data(), sizeof(header));
+
+	if (header.magic != MAGIC || header.version != VERSION
+		|| header.sourceHash != source.hash || header.sourceSize != source.size
+		|| header.vertexStride != layout.stride
+		|| header.attributeCount != layout.attributes.size()
+		|| (header.indexSize != 2 && header.indexSize != 4)
+		|| header.lodCount == 0 || header.lodCount > MAX_LODS) {
+		return false;
+	}
+
+	// 頂点レイアウトを検証する
+	uint64_t attributesEnd = sizeof(Header) + sizeof(VertexAttribute) * static_cast<uint64_t>(header.attributeCount);
+	if (mapped.size() < attributesEnd) {
+		return false;
+	}
+	for (uint32_t i = 0; i < header.attributeCount; i++) {
+		VertexAttribute attribute;
+		std::memcpy(&attribute, mapped.data() + sizeof(Header) + sizeof(VertexAttribute) * i, sizeof(attribute));
+
+		const VkVertexInputAttributeDescription& expected = layout.attributes[i];
+		if (attribute.location != expected.location || attribute.binding != expected.binding
+			|| attribute.format != static_cast<uint32_t>(expected.format) || attribute.offset != expected.offset) {
+			return false;
+		}
+	}
+
+	// LOD の範囲がインデックスデータに収まっているか
+	uint64_t lodsEnd = attributesEnd + sizeof(LodEntry) * static_cast<uint64_t>(header.lodCount);
+	if (mapped.size() < lodsEnd) {
+		return false;
+	}
+	std::vector<Lod> loadedLods(header.lodCount);
+	for (uint32_t i = 0; i < header.lodCount; i++) {
+		LodEntry entry;
+		std::memcpy(&entry, mapped.data() + attributesEnd + sizeof(LodEntry) * i, sizeof(entry));
+		if (static_cast<uint64_t>(entry.firstIndex) + entry.indexCount > header.indexCount || entry.indexCount % 3 != 0) {
+			return false;
+		}
+		loadedLods[i].firstIndex = entry.firstIndex;
+		loadedLods[i].indexCount = entry.indexCount;
+		loadedLods[i].error = entry.error;
+	}
+
+	// データ領域がファイルに収まっているか
+	uint64_t vertexDataSize = header.vertexCount * header.vertexStride;
+	uint64_t indexDataSize = header.indexCount * header.indexSize;
+	if (header.vertexDataOffset < lodsEnd
+		|| header.vertexDataOffset % DATA_ALIGNMENT != 0 || header.indexDataOffset % DATA_ALIGNMENT != 0
+		|| header.vertexDataOffset + vertexDataSize > header.indexDataOffset
+		|| header.indexDataOffset + indexDataSize > mapped.size()) {
+		return false;
+	}
+
+	file = std::move(mapped);
+	stride = header.vertexStride;
+	indexSize = header.indexSize;
+	vertexCount = header.vertexCount;
+	indexCount = header.indexCount;
+	vertexDataOffset = header.vertexDataOffset;
+	indexDataOffset = header.indexDataOffset;
+	lods = std::move(loadedLods);
+	dequantization = header.dequantization;
+	return true;
+}
+
+// マップを解除する
+void MeshCache::close()
+{
+	file.reset();
+	stride = 0;
+	indexSize = 0;
+	vertexCount = 0;
+	indexCount = 0;
+	vertexDataOffset = 0;
+	indexDataOffset = 0;
+	lods.clear();
+	dequantization = VertexDequantization();
+}
+
+// キャッシュを書き出す
+bool MeshCache::write(
+	const std::string& path,
+	const SourceInfo& source,
+	const Layout& layout,
+	const void* vertices,
+	uint64_t vertexCount,
+	const VertexDequantization& dequantization,
+	const uint32_t* indices,
+	uint64_t indexCount,
+	uint32_t indexSize,
+	const std::vector<Lod>& lods)
+{
+	if (indexSize != 2 && indexSize != 4) {
+		throw std::invalid_argument("mesh cache index size must be 2 or 4!");
+	}
+	if (lods.empty() || lods.size() > MAX_LODS) {
+		throw std::invalid_argument("mesh cache LOD count must be 1 to MAX_LODS!");
+	}
+
+	Header header = {};
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.sourceHash = source.hash;
+	header.sourceSize = source.size;
+	header.vertexStride = layout.stride;
+	header.attributeCount = static_cast<uint32_t>(layout.attributes.size());
+	header.indexSize = indexSize;
+	header.lodCount = static_cast<uint32_t>(lods.size());
+	header.vertexCount = vertexCount;
+	header.indexCount = indexCount;
+	header.vertexDataOffset = alignUp(
+		sizeof(Header) + sizeof(VertexAttribute) * layout.attributes.size() + sizeof(LodEntry) * lods.size(),
+		DATA_ALIGNMENT);
+	header.indexDataOffset = alignUp(header.vertexDataOffset + vertexCount * layout.stride, DATA_ALIGNMENT);
+	header.dequantization = dequantization;
+
+	return writeFileAtomically(path, [&](std::ostream& out) {
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		for (const auto& description : layout.attributes) {
+			VertexAttribute attribute = { description.location, description.binding, static_cast<uint32_t>(description.format), description.offset };
+			out.write(reinterpret_cast<const char*>(&attribute), sizeof(attribute));
+		}
+		for (const auto& lod : lods) {
+			LodEntry entry = { lod.firstIndex, lod.indexCount, lod.error, 0 };
+			out.write(reinterpret_cast<const char*>(&entry), sizeof(entry));
+		}
+
+		static const char padding[DATA_ALIGNMENT] = {};
+		auto pad = [&](uint64_t offset) {
+			out.write(padding, static_cast<std::streamsize>(offset - static_cast<uint64_t>(out.tellp())));
+		};
+
+		pad(header.vertexDataOffset);
+		out.write(static_cast<const char*>(vertices), static_cast<std::streamsize>(vertexCount * layout.stride));
+
+		pad(header.indexDataOffset);
+		if (indexSize == 4) {
+			out.write(reinterpret_cast<const char*>(indices), static_cast<std::streamsize>(indexCount * 4));
+		}
+		else {
+			std::vector<uint16_t> narrow(static_cast<size_t>(indexCount));
+			std::transform(indices, indices + indexCount, narrow.begin(), [](uint32_t index) { return static_cast<uint16_t>(index); });
+			out.write(reinterpret_cast<const char*>(narrow.data()), static_cast<std::streamsize>(indexCount * 2));
+		}
+	});
+}
+
+// 元ファイルの内容からハッシュを計算する
+MeshCache::SourceInfo MeshCache::hashSource(const FileView& source, ThreadPool& pool)
+{
+	const size_t blockSize = 1024 * 1024;
+	const size_t blockCount = (source.size() + blockSize - 1) / blockSize;
+	std::vector<uint64_t> blockHashes(blockCount);
+
+	pool.parallelFor(blockCount, [&](size_t block) {
+		const char* data = source.data() + block * blockSize;
+		size_t size = std::min(blockSize, source.size() - block * blockSize);
+
+		// 8バイトずつ読み、乗算と回転で混ぜる
+		uint64_t h = 0x9e3779b97f4a7c15ULL ^ size;
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8) {
+			uint64_t word;
+			std::memcpy(&word, data + i, sizeof(word));
+			h ^= word * 0x87c37b91114253d5ULL;
+			h = ((h << 31) | (h >> 33)) * 0x4cf5ad432745937fULL;
+		}
+		uint64_t tail = 0;
+		std::memcpy(&tail, data + i, size - i);
+		blockHashes[block] = mixHash(h ^ tail);
+	});
+
+	SourceInfo info;
+	info.size = source.size();
+	info.hash = info.size;
+	for (uint64_t blockHash : blockHashes) {
+		info.hash = hashCombine(info.hash, blockHash);
+	}
+	return info;
+}
@@ -0,0 +1,128 @@
+﻿#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "VertexFormat.h"
+
+// 重複除去済みの頂点・インデックスと LOD の表、量子化した頂点を戻す変換を保存するバイナリキャッシュ
+// 読み込み時はファイルをマップし、頂点・インデックスの領域をそのままステージングへコピーできる
+//
+// ファイル構成: Header | VertexAttribute * attributeCount | LodEntry * lodCount | 頂点データ | インデックスデータ
+// 頂点・インデックスデータの先頭は DATA_ALIGNMENT に揃える
+class MeshCache {
+public:
+	static const uint32_t MAGIC = 0x4843534d;	// "MSCH"
+	static const uint32_t VERSION = 4;
+	static const uint64_t DATA_ALIGNMENT = 16;
+	static const uint32_t MAX_LODS = 4;
+
+	// LOD 1段分のインデックスの範囲（すべての LOD が同じ頂点データを参照する）
+	struct Lod {
+		uint32_t firstIndex = 0;
+		uint32_t indexCount = 0;
+		float error = 0.0f;	// 元のメッシュからのずれ（メッシュ空間での距離）
+	};
+
+	// 頂点レイアウト（キャッシュ作成時と読み込み時で一致しなければ無効）
+	struct Layout {
+		uint32_t stride = 0;
+		std::vector<VkVertexInputAttributeDescription> attributes;
+	};
+
+	// 元ファイルの識別情報（内容のハッシュとサイズ）
+	struct SourceInfo {
+		uint64_t hash = 0;
+		uint64_t size = 0;
+	};
+
+	// キャッシュを開き、元ファイル・レイアウトと一致すれば true
+	bool open(const std::string& path, const SourceInfo& source, const Layout& layout);
+
+	// マップを解除する
+	void close();
+
+	bool isOpen() const { return !file.empty(); }
+
+	const void* getVertexData() const { return file.data() + vertexDataOffset; }
+	uint64_t getVertexCount() const { return vertexCount; }
+	uint64_t getVertexDataSize() const { return vertexCount * stride; }
+
+	const void* getIndexData() const { return file.data() + indexDataOffset; }
+	uint64_t getIndexCount() const { return indexCount; }
+	uint32_t getIndexSize() const { return indexSize; }
+	uint64_t getIndexDataSize() const { return indexCount * indexSize; }
+
+	const std::vector<Lod>& getLods() const { return lods; }
+
+	const VertexDequantization& getDequantization() const { return dequantization; }
+
+	// キャッシュを書き出す（一時ファイルに書いてから置き換える）
+	// indexSize は 2 または 4。indices は uint32_t の配列で、indexSize が 2 なら切り詰めて保存する
+	// lods は indices の中の範囲で、1 ～ MAX_LODS 段
+	// dequantization は vertices を量子化したときの変換で、そのまま保存する
+	// 書き出せなければ false
+	static bool write(
+		const std::string& path,
+		const SourceInfo& source,
+		const Layout& layout,
+		const void* vertices,
+		uint64_t vertexCount,
+		const VertexDequantization& dequantization,
+		const uint32_t* indices,
+		uint64_t indexCount,
+		uint32_t indexSize,
+		const std::vector<Lod>& lods);
+
+	// 元ファイルの内容からハッシュを計算する（ブロックごとに並列に計算して連結する）
+	static SourceInfo hashSource(const FileView& source, ThreadPool& pool);
+
+private:
+	// ファイル先頭のヘッダー
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint64_t sourceSize;
+		uint32_t vertexStride;
+		uint32_t attributeCount;
+		uint32_t indexSize;
+		uint32_t lodCount;
+		uint64_t vertexCount;
+		uint64_t indexCount;
+		uint64_t vertexDataOffset;
+		uint64_t indexDataOffset;
+		VertexDequantization dequantization;
+	};
+
+	// 頂点属性1つ分
+	struct VertexAttribute {
+		uint32_t location;
+		uint32_t binding;
+		uint32_t format;
+		uint32_t offset;
+	};
+
+	// LOD 1段分
+	struct LodEntry {
+		uint32_t firstIndex;
+		uint32_t indexCount;
+		float error;
+		uint32_t reserved;
+	};
+
+	FileView file;
+	uint32_t stride = 0;
+	uint32_t indexSize = 0;
+	uint64_t vertexCount = 0;
+	uint64_t indexCount = 0;
+	uint64_t vertexDataOffset = 0;
+	uint64_t indexDataOffset = 0;
+	std::vector<Lod> lods;
+	VertexDequantization dequantization;
+};
@@ -0,0 +1,308 @@
+﻿#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+namespace {
+	const uint32_t INVALID_INDEX = std::numeric_limits<uint32_t>::max();
+
+	// FIFO の頂点キャッシュ
+	// 頂点ごとにキャッシュへ入った時刻を持ち、その後 size 回以上の読み込みがあれば追い出されたとみなす
+	class VertexCache {
+	public:
+		VertexCache(size_t vertexCount, uint32_t size)
+			: timestamps(vertexCount, 0), timestamp(size + 1), size(size)
+		{
+		}
+
+		// 頂点 v が今キャッシュにあるか
+		bool contains(uint32_t v) const { return timestamp - timestamps[v] <= size; }
+
+		// キャッシュに入ってから何回読み込みがあったか
+		uint32_t getAge(uint32_t v) const { return timestamp - timestamps[v]; }
+
+		// 頂点 v を読み込み、キャッシュになければ入れて 1 を返す
+		uint32_t access(uint32_t v)
+		{
+			if (contains(v)) {
+				return 0;
+			}
+			timestamps[v] = timestamp++;
+			return 1;
+		}
+
+		// 三角形 triangle を読み込み、キャッシュになかった頂点の数を返す
+		uint32_t accessTriangle(const uint32_t* triangle)
+		{
+			return access(triangle[0]) + access(triangle[1]) + access(triangle[2]);
+		}
+
+		// すべての頂点を追い出す
+		void clear() { timestamp += size + 1; }
+
+	private:
+		std::vector<uint32_t> timestamps;
+		uint32_t timestamp;
+		uint32_t size;
+	};
+}
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+	VertexCacheStats stats;
+	if (indexCount < 3) {
+		return stats;
+	}
+
+	VertexCache cache(vertexCount, cacheSize);
+	std::vector<uint8_t> referenced(vertexCount, 0);
+	size_t misses = 0;
+	size_t uniqueCount = 0;
+
+	for (size_t i = 0; i < indexCount; i++) {
+		uint32_t v = indices[i];
+		misses += cache.access(v);
+		if (!referenced[v]) {
+			referenced[v] = 1;
+			uniqueCount++;
+		}
+	}
+
+	stats.acmr = static_cast<float>(misses) / static_cast<float>(indexCount / 3);
+	stats.atvr = static_cast<float>(misses) / static_cast<float>(uniqueCount);
+	return stats;
+}
+
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize)
+{
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0) {
+		return;
+	}
+
+	// 頂点ごとの、まだ出していない三角形の数と、その頂点を含む三角形の一覧
+	std::vector<uint32_t> liveCounts(vertexCount, 0);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		liveCounts[indices[i]]++;
+	}
+
+	std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; v++) {
+		adjacencyOffsets[v + 1] = adjacencyOffsets[v] + liveCounts[v];
+	}
+
+	std::vector<uint32_t> adjacency(triangleCount * 3);
+	std::vector<uint32_t> cursors(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		adjacency[cursors[indices[i]]++] = static_cast<uint32_t>(i / 3);
+	}
+
+	VertexCache cache(vertexCount, cacheSize);
+	std::vector<uint8_t> emitted(triangleCount, 0);
+	std::vector<uint32_t> deadEnds;		// 出した頂点の履歴（行き詰まったときに新しい順に再開先を探す）
+	std::vector<uint32_t> candidates;	// 直前の扇で出した頂点（次の扇の中心の候補）
+	std::vector<uint32_t> result;
+	deadEnds.reserve(triangleCount * 3);
+	result.reserve(triangleCount * 3);
+
+	size_t triangleCursor = 0;	// 行き詰まりの履歴も尽きたときに、入力順で次に探し始める三角形
+	uint32_t fanVertex = indices[0];
+
+	while (fanVertex != INVALID_INDEX) {
+		// fanVertex の周りのまだ出していない三角形をすべて出す
+		candidates.clear();
+		for (uint32_t k = adjacencyOffsets[fanVertex]; k < adjacencyOffsets[fanVertex + 1]; k++) {
+			uint32_t triangle = adjacency[k];
+			if (emitted[triangle]) {
+				continue;
+			}
+			emitted[triangle] = 1;
+
+			for (uint32_t j = 0; j < 3; j++) {
+				uint32_t v = indices[triangle * 3 + j];
+				result.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				liveCounts[v]--;
+				cache.access(v);
+			}
+		}
+
+		// 次の中心は、残りの三角形を出し切るまでキャッシュに残っている候補のうち、最も古く入ったもの
+		// （すぐ追い出される頂点を先に使い切る）。どれも残らないなら、残りの三角形がある候補を使う
+		fanVertex = INVALID_INDEX;
+		int64_t bestPriority = -1;
+		for (uint32_t v : candidates) {
+			if (liveCounts[v] == 0) {
+				continue;
+			}
+
+			int64_t priority = 0;
+			uint32_t age = cache.getAge(v);
+			if (age + 2 * liveCounts[v] <= cacheSize) {
+				priority = age;
+			}
+			if (priority > bestPriority) {
+				bestPriority = priority;
+				fanVertex = v;
+			}
+		}
+
+		// 行き詰まったら、最近出した頂点のうち三角形が残っているものから再開する
+		while (fanVertex == INVALID_INDEX && !deadEnds.empty()) {
+			uint32_t v = deadEnds.back();
+			deadEnds.pop_back();
+			if (liveCounts[v] > 0) {
+				fanVertex = v;
+			}
+		}
+
+		// それもなければ、入力順でまだ出していない三角形から再開する
+		while (fanVertex == INVALID_INDEX && triangleCursor < triangleCount) {
+			if (!emitted[triangleCursor]) {
+				fanVertex = indices[triangleCursor * 3];
+			}
+			triangleCursor++;
+		}
+	}
+
+	std::memcpy(indices, result.data(), result.size() * sizeof(uint32_t));
+}
+
+void optimizeOverdraw(
+	uint32_t* indices,
+	size_t indexCount,
+	const void* positions,
+	size_t vertexCount,
+	size_t stride,
+	float threshold)
+{
+	const size_t triangleCount = indexCount / 3;
+	if (triangleCount < 2) {
+		return;
+	}
+
+	// 3頂点ともキャッシュになかった三角形で区切る（optimizeVertexCache が行き詰まって飛んだところ）
+	VertexCache cache(vertexCount, VERTEX_CACHE_SIZE);
+	std::vector<uint32_t> triangleMisses(triangleCount);
+	std::vector<size_t> hardBoundaries;
+	for (size_t t = 0; t < triangleCount; t++) {
+		triangleMisses[t] = cache.accessTriangle(indices + t * 3);
+		if (t == 0 || triangleMisses[t] == 3) {
+			hardBoundaries.push_back(t);
+		}
+	}
+	hardBoundaries.push_back(triangleCount);
+
+	// 区切りの中を、キャッシュを空にして始め直しても ACMR が threshold 倍に収まるところでさらに区切る
+	std::vector<size_t> clusters;
+	for (size_t h = 0; h + 1 < hardBoundaries.size(); h++) {
+		size_t start = hardBoundaries[h];
+		size_t end = hardBoundaries[h + 1];
+
+		size_t hardMisses = 0;
+		for (size_t t = start; t < end; t++) {
+			hardMisses += triangleMisses[t];
+		}
+		float maxAcmr = threshold * static_cast<float>(hardMisses) / static_cast<float>(end - start);
+
+		cache.clear();
+		clusters.push_back(start);
+		size_t clusterStart = start;
+		size_t clusterMisses = 0;
+		for (size_t t = start; t < end; t++) {
+			clusterMisses += cache.accessTriangle(indices + t * 3);
+
+			if (t + 1 < end && static_cast<float>(clusterMisses) <= maxAcmr * static_cast<float>(t + 1 - clusterStart)) {
+				cache.clear();
+				clusters.push_back(t + 1);
+				clusterStart = t + 1;
+				clusterMisses = 0;
+			}
+		}
+	}
+	clusters.push_back(triangleCount);
+
+	auto getPosition = [&](uint32_t v) {
+		glm::vec3 p;
+		std::memcpy(&p, static_cast<const char*>(positions) + v * stride, sizeof(p));
+		return p;
+	};
+
+	glm::vec3 meshCentroid(0.0f);
+	for (size_t i = 0; i < triangleCount * 3; i++) {
+		meshCentroid += getPosition(indices[i]);
+	}
+	meshCentroid /= static_cast<float>(triangleCount * 3);
+
+	// 面積で重み付けしたクラスタの重心と法線から、メッシュの中心に対してどれだけ外を向いているかを求める
+	// 外を向いたクラスタほど手前に来やすいので先に描き、その陰になる面を深度テストで落とす
+	const size_t clusterCount = clusters.size() - 1;
+	std::vector<float> sortKeys(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++) {
+		glm::vec3 centroid(0.0f);
+		glm::vec3 normal(0.0f);
+		float area = 0.0f;
+
+		for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+			glm::vec3 p0 = getPosition(indices[t * 3 + 0]);
+			glm::vec3 p1 = getPosition(indices[t * 3 + 1]);
+			glm::vec3 p2 = getPosition(indices[t * 3 + 2]);
+
+			glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+			float a = glm::length(n);
+			centroid += (p0 + p1 + p2) * (a / 3.0f);
+			normal += n;
+			area += a;
+		}
+
+		float normalLength = glm::length(normal);
+		if (area <= 0.0f || normalLength <= 0.0f) {
+			sortKeys[c] = 0.0f;
+			continue;
+		}
+		sortKeys[c] = glm::dot(centroid / area - meshCentroid, normal / normalLength);
+	}
+
+	std::vector<uint32_t> order(clusterCount);
+	for (size_t c = 0; c < clusterCount; c++) {
+		order[c] = static_cast<uint32_t>(c);
+	}
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKeys[a] > sortKeys[b]; });
+
+	std::vector<uint32_t> result;
+	result.reserve(triangleCount * 3);
+	for (uint32_t c : order) {
+		result.insert(result.end(), indices + clusters[c] * 3, indices + clusters[c + 1] * 3);
+	}
+	std::memcpy(indices, result.data(), result.size() * sizeof(uint32_t));
+}
+
+void optimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexSize, uint32_t* indices, size_t indexCount)
+{
+	// 古い番号から新しい番号への対応
+	std::vector<uint32_t> remap(vertexCount, INVALID_INDEX);
+	uint32_t nextIndex = 0;
+
+	for (size_t i = 0; i < indexCount; i++) {
+		uint32_t& index = remap[indices[i]];
+		if (index == INVALID_INDEX) {
+			index = nextIndex++;
+		}
+		indices[i] = index;
+	}
+	for (size_t v = 0; v < vertexCount; v++) {
+		if (remap[v] == INVALID_INDEX) {
+			remap[v] = nextIndex++;
+		}
+	}
+
+	std::vector<char> source(static_cast<const char*>(vertices), static_cast<const char*>(vertices) + vertexCount * vertexSize);
+	for (size_t v = 0; v < vertexCount; v++) {
+		std::memcpy(static_cast<char*>(vertices) + remap[v] * vertexSize, source.data() + v * vertexSize, vertexSize);
+	}
+}
@@ -0,0 +1,35 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// 頂点キャッシュのシミュレーション結果
+struct VertexCacheStats {
+	float acmr = 0.0f;	// 三角形あたりの頂点シェーダー実行数（Average Cache Miss Ratio。理想は 0.5 前後、最悪は 3）
+	float atvr = 0.0f;	// 参照される頂点あたりの実行数（Average Transformed Vertex Ratio。理想は 1）
+};
+
+// 描画順の最適化で想定する変換後頂点キャッシュの大きさ（FIFO のエントリ数）
+const uint32_t VERTEX_CACHE_SIZE = 16;
+
+// cacheSize エントリの FIFO キャッシュで indices を描いたときの ACMR / ATVR を求める
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// 変換後頂点キャッシュに当たりやすいよう三角形を並べ替える（Tipsify）
+// キャッシュに残っている頂点の周りの三角形を扇状に続けて出し、行き詰まったら最近出した頂点から再開する
+void optimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount, uint32_t cacheSize = VERTEX_CACHE_SIZE);
+
+// optimizeVertexCache で並べた三角形をクラスタに区切り、外を向いたクラスタから先に描くよう並べ替えて重ね描きを減らす
+// クラスタの区切りはキャッシュの当たりを ACMR で threshold 倍まで悪化させてよい範囲で細かくする
+// 位置（float3）は stride バイトおきに並ぶ
+void optimizeOverdraw(
+	uint32_t* indices,
+	size_t indexCount,
+	const void* positions,
+	size_t vertexCount,
+	size_t stride,
+	float threshold = 1.05f);
+
+// 頂点を indices で初めて参照される順に並べ替え、indices を新しい番号に付け替える
+// vertices は vertexSize バイトの頂点が vertexCount 個並んだ配列で、その場で並べ替える（参照されない頂点は末尾に残す）
+void optimizeVertexFetch(void* vertices, size_t vertexCount, size_t vertexSize, uint32_t* indices, size_t indexCount);
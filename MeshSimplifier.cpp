@@ -0,0 +1,532 @@
+﻿#include "MeshSimplifier.h"
+
+#include "FlatHashMap.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+
+namespace {
+	// 境界・継ぎ目の辺に沿った拘束平面の重み（面の平面に対する倍率）
+	const double BOUNDARY_WEIGHT = 10.0;
+
+	// 平面までの距離の二乗の重み付き和を表す二次形式
+	struct Quadric {
+		double a00 = 0.0, a01 = 0.0, a02 = 0.0, a11 = 0.0, a12 = 0.0, a22 = 0.0;
+		double b0 = 0.0, b1 = 0.0, b2 = 0.0;
+		double c = 0.0;
+		double weight = 0.0;
+
+		// 単位法線 normal・原点からの距離 distance の平面を重み w で加える
+		void addPlane(const glm::vec3& normal, float distance, double w)
+		{
+			double x = normal.x, y = normal.y, z = normal.z, d = distance;
+			a00 += w * x * x; a01 += w * x * y; a02 += w * x * z;
+			a11 += w * y * y; a12 += w * y * z; a22 += w * z * z;
+			b0 += w * x * d; b1 += w * y * d; b2 += w * z * d;
+			c += w * d * d;
+			weight += w;
+		}
+
+		void add(const Quadric& other)
+		{
+			a00 += other.a00; a01 += other.a01; a02 += other.a02;
+			a11 += other.a11; a12 += other.a12; a22 += other.a22;
+			b0 += other.b0; b1 += other.b1; b2 += other.b2;
+			c += other.c;
+			weight += other.weight;
+		}
+
+		// 点 p での平面までの距離の二乗の重み付き平均
+		double evaluate(const glm::vec3& p) const
+		{
+			double x = p.x, y = p.y, z = p.z;
+			double error = a00 * x * x + a11 * y * y + a22 * z * z
+				+ 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+				+ 2.0 * (b0 * x + b1 * y + b2 * z)
+				+ c;
+			return weight > 0.0 ? std::max(error, 0.0) / weight : 0.0;
+		}
+	};
+
+	// 頂点（位置）の種類。Manifold はどの辺にも、Border・Seam は同じ種類の辺に沿ってだけ縮約できる
+	enum class VertexKind : uint8_t {
+		Manifold,
+		Border,		// 開いた境界上（境界の辺がちょうど2本）
+		Seam,		// UV の継ぎ目上（同じ位置の頂点がちょうど2つで、継ぎ目の辺がちょうど2本）
+		Locked,		// それ以外（角・非多様体など）。動かさない
+	};
+
+	// 位置辺1本分の情報
+	struct EdgeInfo {
+		uint32_t positionA;
+		uint32_t positionB;
+		uint32_t wedgeA;	// 最初に見つけた三角形での positionA 側の頂点
+		uint32_t wedgeB;
+		uint32_t triangle;	// 最初に見つけた三角形
+		uint32_t count;
+		bool seam;
+	};
+
+	// 縮約の候補（コストの小さい順に取り出す）
+	struct Collapse {
+		double cost;
+		uint32_t from;
+		uint32_t to;
+		uint32_t version;	// 積んだときの from のバージョン
+
+		bool operator>(const Collapse& other) const { return cost > other.cost; }
+	};
+
+	// 縮約で寄せる頂点の対応（継ぎ目なら両側の2組）
+	struct WedgeMap {
+		uint32_t from[2];
+		uint32_t to[2];
+		uint32_t count;
+
+		// from の頂点 wedge の移り先（なければ UINT32_MAX）
+		uint32_t find(uint32_t wedge) const
+		{
+			for (uint32_t i = 0; i < count; i++) {
+				if (from[i] == wedge) {
+					return to[i];
+				}
+			}
+			return UINT32_MAX;
+		}
+	};
+
+	struct PositionHash {
+		size_t operator()(const glm::vec3& p) const
+		{
+			return static_cast<size_t>(hashCombine(hashCombine(floatHashBits(p.x), floatHashBits(p.y)), floatHashBits(p.z)));
+		}
+	};
+}
+
+// 位置を読み込み、同じ位置の頂点をまとめる
+MeshSimplifier::MeshSimplifier(const void* data, size_t vertexCount, size_t stride)
+	: positions(vertexCount), positionIds(vertexCount)
+{
+	const char* bytes = static_cast<const char*>(data);
+	FlatHashMap<glm::vec3, uint32_t, PositionHash> firstVertices;
+	firstVertices.reserve(vertexCount);
+
+	for (size_t i = 0; i < vertexCount; i++) {
+		std::memcpy(&positions[i], bytes + i * stride, sizeof(glm::vec3));
+		positionIds[i] = *firstVertices.insert(positions[i], static_cast<uint32_t>(i)).first;
+	}
+}
+
+// 三角形を縮約する
+std::vector<uint32_t> MeshSimplifier::simplify(
+	const uint32_t* indices,
+	size_t indexCount,
+	size_t targetIndexCount,
+	float maxError,
+	float* error) const
+{
+	if (indexCount % 3 != 0) {
+		throw std::invalid_argument("index count must be a multiple of 3!");
+	}
+
+	const size_t vertexCount = positions.size();
+
+	// 位置の重なった（面積のない）三角形は最初から除く
+	std::vector<uint32_t> triangles;
+	triangles.reserve(indexCount);
+	for (size_t i = 0; i < indexCount; i += 3) {
+		if (indices[i] >= vertexCount || indices[i + 1] >= vertexCount || indices[i + 2] >= vertexCount) {
+			throw std::out_of_range("mesh index out of range!");
+		}
+		uint32_t a = positionIds[indices[i]], b = positionIds[indices[i + 1]], c = positionIds[indices[i + 2]];
+		if (a != b && b != c && a != c) {
+			triangles.insert(triangles.end(), indices + i, indices + i + 3);
+		}
+	}
+	const uint32_t triangleCount = static_cast<uint32_t>(triangles.size() / 3);
+	std::vector<uint8_t> triangleAlive(triangleCount, 1);
+
+	// 位置ごとの隣接三角形（縮約で消えた三角形は後でまとめて取り除く）
+	std::vector<std::vector<uint32_t>> adjacency(vertexCount);
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		for (int k = 0; k < 3; k++) {
+			adjacency[positionIds[triangles[t * 3 + k]]].push_back(t);
+		}
+	}
+
+	// 位置単位の辺を数え、開いた境界（三角形が1つ）と継ぎ目（両側で頂点が違う）を見つける
+	FlatHashMap<uint64_t, uint32_t> edgeIndices;
+	edgeIndices.reserve(triangles.size());
+	std::vector<EdgeInfo> edges;
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		for (int k = 0; k < 3; k++) {
+			uint32_t wa = triangles[t * 3 + k], wb = triangles[t * 3 + (k + 1) % 3];
+			uint32_t pa = positionIds[wa], pb = positionIds[wb];
+			if (pa > pb) {
+				std::swap(pa, pb);
+				std::swap(wa, wb);
+			}
+
+			uint64_t key = (static_cast<uint64_t>(pa) << 32) | pb;
+			auto result = edgeIndices.insert(key, static_cast<uint32_t>(edges.size()));
+			if (result.second) {
+				edges.push_back({ pa, pb, wa, wb, t, 1, false });
+			}
+			else {
+				EdgeInfo& edge = edges[*result.first];
+				edge.count++;
+				edge.seam = edge.seam || edge.wedgeA != wa || edge.wedgeB != wb;
+			}
+		}
+	}
+
+	// 頂点の種類を決める
+	std::vector<uint32_t> borderEdgeCounts(vertexCount, 0);
+	std::vector<uint32_t> seamEdgeCounts(vertexCount, 0);
+	std::vector<uint8_t> nonManifold(vertexCount, 0);
+	for (const auto& edge : edges) {
+		if (edge.count == 1) {
+			borderEdgeCounts[edge.positionA]++;
+			borderEdgeCounts[edge.positionB]++;
+		}
+		else if (edge.count > 2) {
+			nonManifold[edge.positionA] = 1;
+			nonManifold[edge.positionB] = 1;
+		}
+		else if (edge.seam) {
+			seamEdgeCounts[edge.positionA]++;
+			seamEdgeCounts[edge.positionB]++;
+		}
+	}
+
+	std::vector<uint32_t> wedgeCounts(vertexCount, 0);
+	std::vector<uint8_t> wedgeSeen(vertexCount, 0);
+	for (uint32_t wedge : triangles) {
+		if (!wedgeSeen[wedge]) {
+			wedgeSeen[wedge] = 1;
+			wedgeCounts[positionIds[wedge]]++;
+		}
+	}
+
+	std::vector<VertexKind> kinds(vertexCount, VertexKind::Locked);
+	for (size_t v = 0; v < vertexCount; v++) {
+		if (nonManifold[v]) {
+			continue;
+		}
+		if (borderEdgeCounts[v] == 0 && seamEdgeCounts[v] == 0 && wedgeCounts[v] == 1) {
+			kinds[v] = VertexKind::Manifold;
+		}
+		else if (borderEdgeCounts[v] == 2 && seamEdgeCounts[v] == 0 && wedgeCounts[v] == 1) {
+			kinds[v] = VertexKind::Border;
+		}
+		else if (borderEdgeCounts[v] == 0 && seamEdgeCounts[v] == 2 && wedgeCounts[v] == 2) {
+			kinds[v] = VertexKind::Seam;
+		}
+	}
+
+	// 面の平面を面積で重み付けして集める
+	auto triangleNormal = [&](uint32_t t) {
+		const glm::vec3& p0 = positions[triangles[t * 3 + 0]];
+		const glm::vec3& p1 = positions[triangles[t * 3 + 1]];
+		const glm::vec3& p2 = positions[triangles[t * 3 + 2]];
+		return glm::cross(p1 - p0, p2 - p0);
+	};
+
+	std::vector<Quadric> quadrics(vertexCount);
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		glm::vec3 normal = triangleNormal(t);
+		float length = glm::length(normal);
+		if (length == 0.0f) {
+			continue;
+		}
+		normal /= length;
+
+		const glm::vec3& p0 = positions[triangles[t * 3]];
+		for (int k = 0; k < 3; k++) {
+			quadrics[positionIds[triangles[t * 3 + k]]].addPlane(normal, -glm::dot(normal, p0), length * 0.5);
+		}
+	}
+
+	// 境界・継ぎ目の辺には、面に垂直で辺を含む平面を加えて輪郭が縮まないようにする
+	for (const auto& edge : edges) {
+		if (edge.count != 1 && !edge.seam) {
+			continue;
+		}
+
+		glm::vec3 normal = triangleNormal(edge.triangle);
+		glm::vec3 direction = positions[edge.positionB] - positions[edge.positionA];
+		glm::vec3 planeNormal = glm::cross(direction, normal);
+		float length = glm::length(planeNormal);
+		if (length == 0.0f) {
+			continue;
+		}
+		planeNormal /= length;
+
+		float distance = -glm::dot(planeNormal, positions[edge.positionA]);
+		double weight = glm::dot(direction, direction) * BOUNDARY_WEIGHT;
+		quadrics[edge.positionA].addPlane(planeNormal, distance, weight);
+		quadrics[edge.positionB].addPlane(planeNormal, distance, weight);
+	}
+
+	// from を to へ寄せられるか調べ、寄せる頂点の対応を求める
+	std::vector<uint32_t> neighborStamps(vertexCount, 0);
+	uint32_t stamp = 0;
+	auto checkCollapse = [&](uint32_t from, uint32_t to, WedgeMap& map) {
+		VertexKind kind = kinds[from];
+		if (kind == VertexKind::Locked) {
+			return false;
+		}
+
+		map.count = 0;
+		uint32_t fromWedges[2];
+		uint32_t fromWedgeCount = 0;
+		uint32_t edgeTriangles = 0;
+
+		// from の隣の位置に印を付けておき、to の隣と共通するものを数える（リンク条件）
+		stamp++;
+		for (uint32_t t : adjacency[from]) {
+			if (!triangleAlive[t]) {
+				continue;
+			}
+			const uint32_t* triangle = &triangles[t * 3];
+			int toCorner = -1;
+			uint32_t fromWedge = 0;
+			for (int k = 0; k < 3; k++) {
+				uint32_t position = positionIds[triangle[k]];
+				if (position == from) {
+					fromWedge = triangle[k];
+				}
+				else {
+					neighborStamps[position] = stamp;
+					if (position == to) {
+						toCorner = k;
+					}
+				}
+			}
+
+			if (std::find(fromWedges, fromWedges + fromWedgeCount, fromWedge) == fromWedges + fromWedgeCount) {
+				if (fromWedgeCount == 2) {
+					return false;
+				}
+				fromWedges[fromWedgeCount++] = fromWedge;
+			}
+
+			if (toCorner < 0) {
+				continue;
+			}
+			edgeTriangles++;
+
+			// 辺の両側の三角形で、from の同じ頂点が to の別々の頂点に寄ることはできない
+			uint32_t toWedge = triangle[toCorner];
+			uint32_t mapped = map.find(fromWedge);
+			if (mapped == UINT32_MAX) {
+				if (map.count == 2) {
+					return false;
+				}
+				map.from[map.count] = fromWedge;
+				map.to[map.count] = toWedge;
+				map.count++;
+			}
+			else if (mapped != toWedge) {
+				return false;
+			}
+		}
+
+		// 境界・継ぎ目の頂点は、同じ種類の辺に沿ってだけ動かす
+		VertexKind toKind = kinds[to];
+		if (kind == VertexKind::Manifold && edgeTriangles != 2) {
+			return false;
+		}
+		if (kind == VertexKind::Border && (edgeTriangles != 1 || (toKind != VertexKind::Border && toKind != VertexKind::Locked))) {
+			return false;
+		}
+		if (kind == VertexKind::Seam && (edgeTriangles != 2 || (toKind != VertexKind::Seam && toKind != VertexKind::Locked))) {
+			return false;
+		}
+		if (map.count != fromWedgeCount) {
+			return false;
+		}
+
+		// 共通の隣が辺の両側の三角形の頂点以外にあると、縮約で面が重なる
+		uint32_t sharedNeighbors = 0;
+		for (uint32_t t : adjacency[to]) {
+			if (!triangleAlive[t]) {
+				continue;
+			}
+			for (int k = 0; k < 3; k++) {
+				uint32_t position = positionIds[triangles[t * 3 + k]];
+				if (position != to && position != from && neighborStamps[position] == stamp) {
+					neighborStamps[position] = 0;
+					sharedNeighbors++;
+				}
+			}
+		}
+		if (sharedNeighbors != edgeTriangles) {
+			return false;
+		}
+
+		// 残る三角形が裏返らないか
+		const glm::vec3& target = positions[to];
+		for (uint32_t t : adjacency[from]) {
+			if (!triangleAlive[t]) {
+				continue;
+			}
+			glm::vec3 corners[3];
+			int fromCorner = -1;
+			bool hasTo = false;
+			for (int k = 0; k < 3; k++) {
+				uint32_t position = positionIds[triangles[t * 3 + k]];
+				corners[k] = positions[position];
+				if (position == from) {
+					fromCorner = k;
+				}
+				hasTo = hasTo || position == to;
+			}
+			if (hasTo) {
+				continue;
+			}
+
+			glm::vec3 before = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+			corners[fromCorner] = target;
+			glm::vec3 after = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+			if (glm::dot(before, after) <= 0.0f) {
+				return false;
+			}
+		}
+		return true;
+	};
+
+	// from の縮約のうち、できるものでコストが最も小さいものを候補に積む
+	// 判定はコストの計算より重いので、コストの小さい順に判定して最初にできたものを選ぶ
+	std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> candidates;
+	std::vector<uint32_t> versions(vertexCount, 0);
+	std::vector<std::pair<double, uint32_t>> targets;
+	auto pushBestCollapse = [&](uint32_t from) {
+		if (kinds[from] == VertexKind::Locked) {
+			return;
+		}
+
+		targets.clear();
+		for (uint32_t t : adjacency[from]) {
+			if (!triangleAlive[t]) {
+				continue;
+			}
+			for (int k = 0; k < 3; k++) {
+				uint32_t to = positionIds[triangles[t * 3 + k]];
+				if (to == from) {
+					continue;
+				}
+
+				Quadric quadric = quadrics[from];
+				quadric.add(quadrics[to]);
+				targets.push_back({ quadric.evaluate(positions[to]), to });
+			}
+		}
+		std::sort(targets.begin(), targets.end());
+		targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+
+		for (const auto& target : targets) {
+			WedgeMap map;
+			if (checkCollapse(from, target.second, map)) {
+				candidates.push({ target.first, from, target.second, versions[from] });
+				return;
+			}
+		}
+	};
+
+	for (uint32_t v = 0; v < vertexCount; v++) {
+		if (positionIds[v] == v && !adjacency[v].empty()) {
+			pushBestCollapse(v);
+		}
+	}
+
+	// コストの小さい順に縮約する
+	const double maxCost = static_cast<double>(maxError) * maxError;
+	double appliedCost = 0.0;
+	size_t liveTriangles = triangleCount;
+	std::vector<uint32_t> neighbors;
+	while (!candidates.empty() && liveTriangles * 3 > targetIndexCount) {
+		Collapse collapse = candidates.top();
+		candidates.pop();
+		if (collapse.version != versions[collapse.from] || kinds[collapse.from] == VertexKind::Locked) {
+			continue;
+		}
+		if (collapse.cost > maxCost) {
+			break;
+		}
+
+		const uint32_t from = collapse.from;
+		const uint32_t to = collapse.to;
+		WedgeMap map;
+		if (!checkCollapse(from, to, map)) {
+			versions[from]++;
+			pushBestCollapse(from);
+			continue;
+		}
+
+		// 辺を含む三角形は消え、残りは from の頂点を to の頂点に置き換えて to の隣接に移す
+		for (uint32_t t : adjacency[from]) {
+			if (!triangleAlive[t]) {
+				continue;
+			}
+			uint32_t* triangle = &triangles[t * 3];
+			bool hasTo = false;
+			for (int k = 0; k < 3; k++) {
+				hasTo = hasTo || positionIds[triangle[k]] == to;
+			}
+			if (hasTo) {
+				triangleAlive[t] = 0;
+				liveTriangles--;
+				continue;
+			}
+
+			for (int k = 0; k < 3; k++) {
+				if (positionIds[triangle[k]] == from) {
+					triangle[k] = map.find(triangle[k]);
+				}
+			}
+			adjacency[to].push_back(t);
+		}
+		std::vector<uint32_t>().swap(adjacency[from]);
+		kinds[from] = VertexKind::Locked;
+		quadrics[to].add(quadrics[from]);
+		appliedCost = std::max(appliedCost, collapse.cost);
+
+		auto& toTriangles = adjacency[to];
+		toTriangles.erase(
+			std::remove_if(toTriangles.begin(), toTriangles.end(), [&](uint32_t t) { return !triangleAlive[t]; }),
+			toTriangles.end());
+
+		// to とその隣の候補を求め直す
+		neighbors.clear();
+		for (uint32_t t : toTriangles) {
+			for (int k = 0; k < 3; k++) {
+				neighbors.push_back(positionIds[triangles[t * 3 + k]]);
+			}
+		}
+		std::sort(neighbors.begin(), neighbors.end());
+		neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+		for (uint32_t neighbor : neighbors) {
+			versions[neighbor]++;
+			pushBestCollapse(neighbor);
+		}
+	}
+
+	std::vector<uint32_t> result;
+	result.reserve(liveTriangles * 3);
+	for (uint32_t t = 0; t < triangleCount; t++) {
+		if (triangleAlive[t]) {
+			result.insert(result.end(), &triangles[t * 3], &triangles[t * 3] + 3);
+		}
+	}
+
+	if (error) {
+		*error = static_cast<float>(std::sqrt(appliedCost));
+	}
+	return result;
+}
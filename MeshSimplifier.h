@@ -0,0 +1,30 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// 二次誤差（QEM）による辺の縮約でメッシュを簡略化する
+// 頂点は隣の頂点へ寄せるだけで新しい頂点は作らないので、簡略化したインデックスは元の頂点バッファをそのまま参照できる
+// 同じ位置にある頂点（UV の継ぎ目）と開いた境界は、その辺に沿ってだけ縮約して輪郭と継ぎ目を保つ
+class MeshSimplifier {
+public:
+	// 位置（float3）が stride バイトおきに並んだ頂点配列から作る
+	MeshSimplifier(const void* positions, size_t vertexCount, size_t stride);
+
+	// indices の三角形を縮約し、インデックス数が targetIndexCount 以下になるか、
+	// 誤差が maxError（メッシュ空間での距離）を超えるまで続ける
+	// error には行った縮約の誤差の最大値を返す
+	std::vector<uint32_t> simplify(
+		const uint32_t* indices,
+		size_t indexCount,
+		size_t targetIndexCount,
+		float maxError,
+		float* error) const;
+
+private:
+	std::vector<glm::vec3> positions;
+	std::vector<uint32_t> positionIds;	// 頂点ごとの、同じ位置にある頂点の代表の番号
+};
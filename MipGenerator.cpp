@@ -0,0 +1,397 @@
+﻿#include "MipGenerator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define MIP_KERNEL_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_KERNEL_SSE2
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define MIP_KERNEL_NEON
+#endif
+
+namespace {
+	const double PI = 3.14159265358979323846;
+	const double KAISER_RADIUS = 3.0;	// 出力画素単位
+	const double KAISER_ALPHA = 4.0;
+
+	// 線形の値を sRGB に戻す表の分解能
+	const uint32_t ENCODE_TABLE_SIZE = 4096;
+
+	// 1軸分の縮小フィルター
+	// 出力画素 i は入力画素 indices[i * tapCount + t] に weights[i * tapCount + t] をかけた和（端の外は端の画素を使う）
+	struct FilterTaps {
+		uint32_t tapCount = 0;
+		std::vector<uint32_t> indices;
+		std::vector<float> weights;
+	};
+
+	// 第1種変形ベッセル関数 I0（級数展開）
+	double besselI0(double x)
+	{
+		double sum = 1.0;
+		double term = 1.0;
+		for (int k = 1; k < 64 && term > sum * 1e-12; k++) {
+			double factor = x / (2.0 * k);
+			term *= factor * factor;
+			sum += term;
+		}
+		return sum;
+	}
+
+	double sinc(double x)
+	{
+		return x == 0.0 ? 1.0 : std::sin(PI * x) / (PI * x);
+	}
+
+	// 入力画素 [first, first + 1) の重み（center は出力画素の中心の入力座標、scale は出力1画素あたりの入力画素数）
+	double filterWeight(MipFilter filter, double first, double scale, double center)
+	{
+		if (filter == MipFilter::Box) {
+			// 出力画素が覆う範囲と入力画素が重なる長さ
+			double low = std::max(first, center - scale * 0.5);
+			double high = std::min(first + 1.0, center + scale * 0.5);
+			return std::max(high - low, 0.0);
+		}
+		double distance = (first + 0.5 - center) / scale;
+		if (std::abs(distance) >= KAISER_RADIUS) {
+			return 0.0;
+		}
+		double window = distance / KAISER_RADIUS;
+		return sinc(distance) * besselI0(KAISER_ALPHA * std::sqrt(1.0 - window * window)) / besselI0(KAISER_ALPHA);
+	}
+
+	// sourceSize 画素を destinationSize 画素に縮めるフィルターを作る
+	FilterTaps buildFilterTaps(uint32_t sourceSize, uint32_t destinationSize, MipFilter filter)
+	{
+		FilterTaps taps;
+		if (sourceSize == destinationSize) {
+			taps.tapCount = 1;
+			taps.indices.resize(destinationSize);
+			taps.weights.assign(destinationSize, 1.0f);
+			for (uint32_t i = 0; i < destinationSize; i++) {
+				taps.indices[i] = i;
+			}
+			return taps;
+		}
+
+		const double scale = static_cast<double>(sourceSize) / destinationSize;
+		const double radius = filter == MipFilter::Box ? scale * 0.5 : KAISER_RADIUS * scale;
+
+		// 重みが 0 でない入力画素の範囲から、全出力画素に共通のタップ数を決める
+		std::vector<int64_t> firsts(destinationSize);
+		uint32_t tapCount = 1;
+		for (uint32_t i = 0; i < destinationSize; i++) {
+			double center = (i + 0.5) * scale;
+			int64_t first = static_cast<int64_t>(std::floor(center - radius));
+			int64_t last = static_cast<int64_t>(std::ceil(center + radius)) - 1;
+			while (first < last && filterWeight(filter, static_cast<double>(first), scale, center) == 0.0) {
+				first++;
+			}
+			while (last > first && filterWeight(filter, static_cast<double>(last), scale, center) == 0.0) {
+				last--;
+			}
+			firsts[i] = first;
+			tapCount = std::max(tapCount, static_cast<uint32_t>(last - first + 1));
+		}
+
+		taps.tapCount = tapCount;
+		taps.indices.resize(static_cast<size_t>(destinationSize) * tapCount);
+		taps.weights.resize(static_cast<size_t>(destinationSize) * tapCount);
+		std::vector<double> weights(tapCount);
+		for (uint32_t i = 0; i < destinationSize; i++) {
+			double center = (i + 0.5) * scale;
+			double sum = 0.0;
+			for (uint32_t t = 0; t < tapCount; t++) {
+				weights[t] = filterWeight(filter, static_cast<double>(firsts[i] + t), scale, center);
+				sum += weights[t];
+			}
+			for (uint32_t t = 0; t < tapCount; t++) {
+				int64_t index = std::min(std::max(firsts[i] + static_cast<int64_t>(t), int64_t(0)), static_cast<int64_t>(sourceSize) - 1);
+				taps.indices[static_cast<size_t>(i) * tapCount + t] = static_cast<uint32_t>(index);
+				taps.weights[static_cast<size_t>(i) * tapCount + t] = static_cast<float>(weights[t] / sum);
+			}
+		}
+		return taps;
+	}
+
+	// 8bit の値を線形の float にする表（0～255 は RGB、256～511 はアルファ）と、線形の値を sRGB の 8bit に戻す表
+	struct ColorTables {
+		float decode[512];
+		uint8_t encode[ENCODE_TABLE_SIZE];
+		bool srgb = false;
+
+		explicit ColorTables(bool srgb) : srgb(srgb)
+		{
+			for (int i = 0; i < 256; i++) {
+				double value = i / 255.0;
+				if (srgb) {
+					value = value <= 0.04045 ? value / 12.92 : std::pow((value + 0.055) / 1.055, 2.4);
+				}
+				decode[i] = static_cast<float>(value);
+				decode[256 + i] = static_cast<float>(i / 255.0);
+			}
+			for (uint32_t i = 0; i < ENCODE_TABLE_SIZE; i++) {
+				double value = static_cast<double>(i) / (ENCODE_TABLE_SIZE - 1);
+				value = value <= 0.0031308 ? value * 12.92 : 1.055 * std::pow(value, 1.0 / 2.4) - 0.055;
+				encode[i] = static_cast<uint8_t>(std::min(std::max(value * 255.0 + 0.5, 0.0), 255.0));
+			}
+		}
+	};
+
+	// 出力画素1つ分の量子化済みの値（srgb なら RGB は encode の番号）を 8bit にする
+	inline void storePixel(const int32_t* quantized, const ColorTables& tables, uint8_t* out)
+	{
+		for (int c = 0; c < 3; c++) {
+			out[c] = tables.srgb ? tables.encode[quantized[c]] : static_cast<uint8_t>(quantized[c]);
+		}
+		out[3] = static_cast<uint8_t>(quantized[3]);
+	}
+
+	// 量子化するときの倍率（srgb なら RGB は encode の番号にする）
+	inline float quantizeScale(const ColorTables& tables)
+	{
+		return tables.srgb ? static_cast<float>(ENCODE_TABLE_SIZE - 1) : 255.0f;
+	}
+
+#if defined(MIP_KERNEL_AVX2)
+	// row（RGBA8 を count バイト。count は 4 の倍数）を線形の値に戻し、weight をかけて sums に足す
+	void accumulateRow(const uint8_t* row, uint32_t count, float weight, const ColorTables& tables, float* sums)
+	{
+		const __m256i alphaOffset = _mm256_setr_epi32(0, 0, 0, 256, 0, 0, 0, 256);
+		const __m256 w = _mm256_set1_ps(weight);
+		uint32_t i = 0;
+		for (; i + 8 <= count; i += 8) {
+			__m256i index = _mm256_add_epi32(
+				_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + i))), alphaOffset);
+			__m256 value = _mm256_i32gather_ps(tables.decode, index, 4);
+			_mm256_storeu_ps(sums + i, _mm256_add_ps(_mm256_loadu_ps(sums + i), _mm256_mul_ps(value, w)));
+		}
+		for (; i < count; i += 4) {
+			__m128 value = _mm_setr_ps(tables.decode[row[i]], tables.decode[row[i + 1]], tables.decode[row[i + 2]], tables.decode[256 + row[i + 3]]);
+			_mm_storeu_ps(sums + i, _mm_add_ps(_mm_loadu_ps(sums + i), _mm_mul_ps(value, _mm_set1_ps(weight))));
+		}
+	}
+
+	// sums（線形の RGBA を width 画素）を横方向に縮小し、8bit に戻して out に書く
+	// 2 画素ずつ 256bit のレジスターの上下に並べて処理する
+	void filterRow(const float* sums, const FilterTaps& taps, uint32_t width, const ColorTables& tables, uint8_t* out)
+	{
+		const float scale = quantizeScale(tables);
+		const __m256 quantize = _mm256_setr_ps(scale, scale, scale, 255.0f, scale, scale, scale, 255.0f);
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256 half = _mm256_set1_ps(0.5f);
+		alignas(32) int32_t quantized[8];
+
+		uint32_t x = 0;
+		for (; x + 2 <= width; x += 2) {
+			const uint32_t* indices = taps.indices.data() + static_cast<size_t>(x) * taps.tapCount;
+			const float* weights = taps.weights.data() + static_cast<size_t>(x) * taps.tapCount;
+			__m256 sum = _mm256_setzero_ps();
+			for (uint32_t t = 0; t < taps.tapCount; t++) {
+				__m256 pixels = _mm256_insertf128_ps(
+					_mm256_castps128_ps256(_mm_loadu_ps(sums + indices[t] * 4)),
+					_mm_loadu_ps(sums + indices[taps.tapCount + t] * 4), 1);
+				__m256 w = _mm256_insertf128_ps(
+					_mm256_castps128_ps256(_mm_set1_ps(weights[t])),
+					_mm_set1_ps(weights[taps.tapCount + t]), 1);
+				sum = _mm256_add_ps(sum, _mm256_mul_ps(pixels, w));
+			}
+			sum = _mm256_min_ps(_mm256_max_ps(sum, _mm256_setzero_ps()), one);
+			_mm256_store_si256(reinterpret_cast<__m256i*>(quantized), _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(sum, quantize), half)));
+			storePixel(quantized, tables, out + x * 4);
+			storePixel(quantized + 4, tables, out + x * 4 + 4);
+		}
+		for (; x < width; x++) {
+			const uint32_t* indices = taps.indices.data() + static_cast<size_t>(x) * taps.tapCount;
+			const float* weights = taps.weights.data() + static_cast<size_t>(x) * taps.tapCount;
+			__m128 sum = _mm_setzero_ps();
+			for (uint32_t t = 0; t < taps.tapCount; t++) {
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(sums + indices[t] * 4), _mm_set1_ps(weights[t])));
+			}
+			sum = _mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+			__m128 scaled = _mm_add_ps(_mm_mul_ps(sum, _mm256_castps256_ps128(quantize)), _mm_set1_ps(0.5f));
+			_mm_store_si128(reinterpret_cast<__m128i*>(quantized), _mm_cvttps_epi32(scaled));
+			storePixel(quantized, tables, out + x * 4);
+		}
+	}
+
+	const char* const KERNEL_NAME = "AVX2";
+
+#elif defined(MIP_KERNEL_SSE2)
+	void accumulateRow(const uint8_t* row, uint32_t count, float weight, const ColorTables& tables, float* sums)
+	{
+		const __m128 w = _mm_set1_ps(weight);
+		for (uint32_t i = 0; i < count; i += 4) {
+			__m128 value = _mm_setr_ps(tables.decode[row[i]], tables.decode[row[i + 1]], tables.decode[row[i + 2]], tables.decode[256 + row[i + 3]]);
+			_mm_storeu_ps(sums + i, _mm_add_ps(_mm_loadu_ps(sums + i), _mm_mul_ps(value, w)));
+		}
+	}
+
+	// 1 画素の RGBA を 128bit のレジスター1本で処理する
+	void filterRow(const float* sums, const FilterTaps& taps, uint32_t width, const ColorTables& tables, uint8_t* out)
+	{
+		const float scale = quantizeScale(tables);
+		const __m128 quantize = _mm_setr_ps(scale, scale, scale, 255.0f);
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 half = _mm_set1_ps(0.5f);
+		alignas(16) int32_t quantized[4];
+
+		for (uint32_t x = 0; x < width; x++) {
+			const uint32_t* indices = taps.indices.data() + static_cast<size_t>(x) * taps.tapCount;
+			const float* weights = taps.weights.data() + static_cast<size_t>(x) * taps.tapCount;
+			__m128 sum = _mm_setzero_ps();
+			for (uint32_t t = 0; t < taps.tapCount; t++) {
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(sums + indices[t] * 4), _mm_set1_ps(weights[t])));
+			}
+			sum = _mm_min_ps(_mm_max_ps(sum, _mm_setzero_ps()), one);
+			_mm_store_si128(reinterpret_cast<__m128i*>(quantized), _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(sum, quantize), half)));
+			storePixel(quantized, tables, out + x * 4);
+		}
+	}
+
+	const char* const KERNEL_NAME = "SSE2";
+
+#elif defined(MIP_KERNEL_NEON)
+	void accumulateRow(const uint8_t* row, uint32_t count, float weight, const ColorTables& tables, float* sums)
+	{
+		for (uint32_t i = 0; i < count; i += 4) {
+			const float values[4] = { tables.decode[row[i]], tables.decode[row[i + 1]], tables.decode[row[i + 2]], tables.decode[256 + row[i + 3]] };
+			vst1q_f32(sums + i, vmlaq_n_f32(vld1q_f32(sums + i), vld1q_f32(values), weight));
+		}
+	}
+
+	void filterRow(const float* sums, const FilterTaps& taps, uint32_t width, const ColorTables& tables, uint8_t* out)
+	{
+		const float scale = quantizeScale(tables);
+		const float quantizeValues[4] = { scale, scale, scale, 255.0f };
+		const float32x4_t quantize = vld1q_f32(quantizeValues);
+		int32_t quantized[4];
+
+		for (uint32_t x = 0; x < width; x++) {
+			const uint32_t* indices = taps.indices.data() + static_cast<size_t>(x) * taps.tapCount;
+			const float* weights = taps.weights.data() + static_cast<size_t>(x) * taps.tapCount;
+			float32x4_t sum = vdupq_n_f32(0.0f);
+			for (uint32_t t = 0; t < taps.tapCount; t++) {
+				sum = vmlaq_n_f32(sum, vld1q_f32(sums + indices[t] * 4), weights[t]);
+			}
+			sum = vminq_f32(vmaxq_f32(sum, vdupq_n_f32(0.0f)), vdupq_n_f32(1.0f));
+			vst1q_s32(quantized, vcvtq_s32_f32(vmlaq_f32(vdupq_n_f32(0.5f), sum, quantize)));
+			storePixel(quantized, tables, out + x * 4);
+		}
+	}
+
+	const char* const KERNEL_NAME = "NEON";
+
+#else
+	void accumulateRow(const uint8_t* row, uint32_t count, float weight, const ColorTables& tables, float* sums)
+	{
+		for (uint32_t i = 0; i < count; i++) {
+			sums[i] += tables.decode[row[i] + ((i & 3) == 3 ? 256 : 0)] * weight;
+		}
+	}
+
+	void filterRow(const float* sums, const FilterTaps& taps, uint32_t width, const ColorTables& tables, uint8_t* out)
+	{
+		const float scale = quantizeScale(tables);
+		for (uint32_t x = 0; x < width; x++) {
+			const uint32_t* indices = taps.indices.data() + static_cast<size_t>(x) * taps.tapCount;
+			const float* weights = taps.weights.data() + static_cast<size_t>(x) * taps.tapCount;
+			float sum[4] = {};
+			for (uint32_t t = 0; t < taps.tapCount; t++) {
+				for (int c = 0; c < 4; c++) {
+					sum[c] += sums[indices[t] * 4 + c] * weights[t];
+				}
+			}
+			int32_t quantized[4];
+			for (int c = 0; c < 4; c++) {
+				float value = std::min(std::max(sum[c], 0.0f), 1.0f);
+				quantized[c] = static_cast<int32_t>(value * (c == 3 ? 255.0f : scale) + 0.5f);
+			}
+			storePixel(quantized, tables, out + x * 4);
+		}
+	}
+
+	const char* const KERNEL_NAME = "scalar";
+
+#endif
+
+	// source を縦横のフィルターで縮小して destination に書く
+	// 出力の行ごとに、まず縦方向に入力行を線形の値で足し合わせ、その1行を横方向に縮める
+	void downsample(
+		const MipLevel& source,
+		MipLevel& destination,
+		MipFilter filter,
+		const ColorTables& tables,
+		ThreadPool& pool)
+	{
+		const FilterTaps horizontal = buildFilterTaps(source.width, destination.width, filter);
+		const FilterTaps vertical = buildFilterTaps(source.height, destination.height, filter);
+		const uint32_t rowBytes = source.width * 4;
+
+		// 作業用の行バッファを使い回すため、出力の行を帯にまとめて並列に処理する
+		const uint32_t bandCount = std::min(destination.height, static_cast<uint32_t>(pool.size() * 8));
+		pool.parallelFor(bandCount, [&](size_t band) {
+			const uint32_t firstRow = static_cast<uint32_t>(static_cast<uint64_t>(destination.height) * band / bandCount);
+			const uint32_t lastRow = static_cast<uint32_t>(static_cast<uint64_t>(destination.height) * (band + 1) / bandCount);
+			std::vector<float> sums(rowBytes);
+			for (uint32_t y = firstRow; y < lastRow; y++) {
+				std::fill(sums.begin(), sums.end(), 0.0f);
+				for (uint32_t t = 0; t < vertical.tapCount; t++) {
+					const size_t tap = static_cast<size_t>(y) * vertical.tapCount + t;
+					accumulateRow(
+						source.rgba.data() + static_cast<size_t>(vertical.indices[tap]) * rowBytes,
+						rowBytes,
+						vertical.weights[tap],
+						tables,
+						sums.data());
+				}
+				filterRow(sums.data(), horizontal, destination.width, tables, destination.rgba.data() + static_cast<size_t>(y) * destination.width * 4);
+			}
+		});
+	}
+}
+
+std::vector<MipLevel> generateMipChain(
+	std::vector<uint8_t> base,
+	uint32_t width,
+	uint32_t height,
+	uint32_t maxLevels,
+	MipFilter filter,
+	bool srgb,
+	ThreadPool& pool)
+{
+	const uint32_t levelCount = std::min(
+		static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1,
+		std::max(maxLevels, 1u));
+	const ColorTables tables(srgb);
+
+	std::vector<MipLevel> levels(levelCount);
+	levels[0].width = width;
+	levels[0].height = height;
+	levels[0].rgba = std::move(base);
+	for (uint32_t level = 1; level < levelCount; level++) {
+		const MipLevel& source = levels[level - 1];
+		MipLevel& destination = levels[level];
+		destination.width = std::max(source.width / 2, 1u);
+		destination.height = std::max(source.height / 2, 1u);
+		destination.rgba.resize(static_cast<size_t>(destination.width) * destination.height * 4);
+		downsample(source, destination, filter, tables, pool);
+	}
+	return levels;
+}
+
+const char* getMipFilterName(MipFilter filter)
+{
+	return filter == MipFilter::Box ? "box" : "Kaiser";
+}
+
+const char* getMipGeneratorKernelName()
+{
+	return KERNEL_NAME;
+}
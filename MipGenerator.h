@@ -0,0 +1,42 @@
+﻿#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// RGBA8 の画像から CPU でミップチェーンを作る
+// GPU のブリットと違って形式を選ばないので、圧縮テクスチャや KTX2 への事前変換、
+// リニアフィルターでブリットできない形式のフォールバックに使う
+
+// 縮小フィルター
+enum class MipFilter {
+	Box,	// 出力画素が覆う範囲の平均（2 分の 1 なら 2x2 画素の平均）
+	Kaiser	// カイザー窓（半径 3 画素・alpha 4）をかけた sinc。ぼけにくいが少し遅い
+};
+
+// ミップレベル1つ分
+struct MipLevel {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> rgba;
+};
+
+// base（width x height の RGBA8）をレベル0 として、1x1 までのミップチェーン（最大 maxLevels 段）を作る
+// 各レベルは1つ前のレベルを縦横それぞれ半分（端数は切り捨て、最小 1）に縮め、行の帯ごとに pool で並列に処理する
+// srgb なら RGB を線形の値に戻してから縮小し、sRGB に符号化し直す（アルファは常に線形として扱う）
+std::vector<MipLevel> generateMipChain(
+	std::vector<uint8_t> base,
+	uint32_t width,
+	uint32_t height,
+	uint32_t maxLevels,
+	MipFilter filter,
+	bool srgb,
+	ThreadPool& pool);
+
+// フィルターの名前（ログ用）
+const char* getMipFilterName(MipFilter filter);
+
+// フィルター処理に使う命令セットの名前
+const char* getMipGeneratorKernelName();
@@ -0,0 +1,196 @@
+﻿#include "PageCache.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// スロットを割り当て、最も粗いレベルのページを常駐させる
+std::vector<PageCache::Load> PageCache::init(const VirtualTextureLayout& newLayout, uint32_t newSlotsPerSide)
+{
+	const VirtualTextureLayout::Level& top = newLayout.levels.back();
+	const uint32_t slotCount = newSlotsPerSide * newSlotsPerSide;
+	if (newSlotsPerSide == 0 || newSlotsPerSide > MAX_SLOTS_PER_SIDE || slotCount <= top.pagesX * top.pagesY) {
+		throw std::invalid_argument("page atlas must have more slots than the coarsest level has pages!");
+	}
+
+	layout = newLayout;
+	slotsPerSide = newSlotsPerSide;
+	residentCount = 0;
+	version++;
+	stats = Stats();
+
+	pageSlots.assign(layout.pageCount, NO_SLOT);
+	slotPages.assign(slotCount, NO_SLOT);
+	slotLastUsed.assign(slotCount, 0);
+	lruPrev.assign(slotCount, NO_SLOT);
+	lruNext.assign(slotCount, NO_SLOT);
+	lruHead = NO_SLOT;
+	lruTail = NO_SLOT;
+	requested.clear();
+	requestedFrame.assign(layout.pageCount, 0);
+
+	// 小さい番号のスロットから使う
+	freeSlots.clear();
+	for (uint32_t slot = slotCount; slot > 0; slot--) {
+		freeSlots.push_back(slot - 1);
+	}
+
+	// 最も粗いレベルは LRU に入れず、追い出さない
+	std::vector<Load> loads;
+	for (uint32_t page = top.firstPage; page < layout.pageCount; page++) {
+		Load load;
+		load.page = page;
+		load.slot = freeSlots.back();
+		freeSlots.pop_back();
+		pageSlots[page] = load.slot;
+		slotPages[load.slot] = page;
+		residentCount++;
+		loads.push_back(load);
+	}
+	stats.loads += loads.size();
+	return loads;
+}
+
+// 要求されたページを記録する
+void PageCache::request(uint32_t page, uint64_t frame)
+{
+	if (page >= layout.pageCount) {
+		return;
+	}
+	stats.requests++;
+
+	if (pageSlots[page] != NO_SLOT) {
+		stats.hits++;
+		touch(pageSlots[page], frame);
+		return;
+	}
+
+	if (requestedFrame[page] != frame + 1) {
+		requestedFrame[page] = frame + 1;
+		requested.push_back(page);
+	}
+
+	// 読み込むまでは常駐している祖先で描くので、その祖先を追い出さない
+	for (uint32_t ancestor = layout.getParentPage(page); ; ancestor = layout.getParentPage(ancestor)) {
+		if (pageSlots[ancestor] != NO_SLOT) {
+			touch(pageSlots[ancestor], frame);
+			break;
+		}
+	}
+}
+
+// 読み込むページを選んでスロットを割り当てる
+std::vector<PageCache::Load> PageCache::schedule(uint32_t maxLoads, uint64_t frame)
+{
+	// ページ番号は細かいレベルほど小さいので、大きい番号（粗いレベル）から読み込むと代わりに描くページが早く細かくなる
+	std::sort(requested.begin(), requested.end(), std::greater<uint32_t>());
+
+	std::vector<Load> loads;
+	for (size_t i = 0; i < requested.size(); i++) {
+		const uint32_t page = requested[i];
+		if (loads.size() == maxLoads) {
+			stats.deferred += requested.size() - i;
+			break;
+		}
+
+		uint32_t slot;
+		if (!freeSlots.empty()) {
+			slot = freeSlots.back();
+			freeSlots.pop_back();
+		}
+		else {
+			// このフレームに要求されたページは追い出さない（アトラスが足りなければ残りは後回し）
+			if (lruTail == NO_SLOT || slotLastUsed[lruTail] >= frame) {
+				stats.deferred += requested.size() - i;
+				break;
+			}
+			slot = lruTail;
+			unlink(slot);
+			pageSlots[slotPages[slot]] = NO_SLOT;
+			residentCount--;
+			stats.evictions++;
+		}
+
+		pageSlots[page] = slot;
+		slotPages[slot] = page;
+		residentCount++;
+		touch(slot, frame);
+
+		Load load;
+		load.page = page;
+		load.slot = slot;
+		loads.push_back(load);
+	}
+
+	requested.clear();
+	if (!loads.empty()) {
+		stats.loads += loads.size();
+		version++;
+	}
+	return loads;
+}
+
+// 全ページのエントリーを書く
+void PageCache::writePageTable(uint32_t* entries) const
+{
+	// 粗いレベルから順に、常駐していないページには1つ粗いページのエントリーを入れる
+	for (uint32_t level = layout.getLevelCount(); level > 0; level--) {
+		const VirtualTextureLayout::Level& entry = layout.levels[level - 1];
+		const uint32_t endPage = entry.firstPage + entry.pagesX * entry.pagesY;
+		for (uint32_t page = entry.firstPage; page < endPage; page++) {
+			const uint32_t slot = pageSlots[page];
+			if (slot != NO_SLOT) {
+				entries[page] = (slot % slotsPerSide) | ((slot / slotsPerSide) << 8) | ((level - 1) << 16);
+			}
+			else {
+				entries[page] = entries[layout.getParentPage(page)];
+			}
+		}
+	}
+}
+
+// スロットを LRU リストから外す
+void PageCache::unlink(uint32_t slot)
+{
+	if (lruPrev[slot] != NO_SLOT) {
+		lruNext[lruPrev[slot]] = lruNext[slot];
+	}
+	else if (lruHead == slot) {
+		lruHead = lruNext[slot];
+	}
+	else {
+		return;	// リストに入っていない
+	}
+	if (lruNext[slot] != NO_SLOT) {
+		lruPrev[lruNext[slot]] = lruPrev[slot];
+	}
+	else {
+		lruTail = lruPrev[slot];
+	}
+	lruPrev[slot] = NO_SLOT;
+	lruNext[slot] = NO_SLOT;
+}
+
+// スロットを LRU リストの先頭に入れる
+void PageCache::pushFront(uint32_t slot)
+{
+	lruPrev[slot] = NO_SLOT;
+	lruNext[slot] = lruHead;
+	if (lruHead != NO_SLOT) {
+		lruPrev[lruHead] = slot;
+	}
+	lruHead = slot;
+	if (lruTail == NO_SLOT) {
+		lruTail = slot;
+	}
+}
+
+// スロットのページが frame に使われたことを記録する
+void PageCache::touch(uint32_t slot, uint64_t frame)
+{
+	slotLastUsed[slot] = std::max(slotLastUsed[slot], frame);
+	if (slotPages[slot] >= layout.levels.back().firstPage) {
+		return;	// 最も粗いレベルは追い出さない
+	}
+	unlink(slot);
+	pushFront(slot);
+}
@@ -0,0 +1,81 @@
+﻿#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "VirtualTexture.h"
+
+// 仮想テクスチャの物理ページ（アトラスのスロット）の割り当て
+// GPU のフィードバックで要求されたページを粗いレベルから順に読み込むページとして選び、
+// 空きスロットがなければ最も長く要求されていないページを追い出す（LRU）
+// 最も粗いレベルのページは常駐させ、常駐していないページは常駐している最も近い祖先で代わりに描く
+class PageCache {
+public:
+	// ページテーブルのエントリー: アトラス上のスロットの x | y << 8 | 描くページのレベル << 16
+	static const uint32_t MAX_SLOTS_PER_SIDE = 256;
+
+	// 読み込むページとその転送先
+	struct Load {
+		uint32_t page = 0;
+		uint32_t slot = 0;
+	};
+
+	// 統計
+	struct Stats {
+		uint64_t requests = 0;		// フィードバックで要求されたページ数（フレームごとの延べ数）
+		uint64_t hits = 0;			// そのうち常駐していたページ数
+		uint64_t loads = 0;
+		uint64_t evictions = 0;
+		uint64_t deferred = 0;		// 1フレームの読み込み数の上限やスロット不足で後回しにした要求
+	};
+
+	// layout のページを slotsPerSide x slotsPerSide のアトラスに割り当てる
+	// 最も粗いレベルのページを読み込むものとして返す。スロットが足りなければ std::invalid_argument
+	std::vector<Load> init(const VirtualTextureLayout& layout, uint32_t slotsPerSide);
+
+	// frame でフィードバックに現れたページを記録する
+	void request(uint32_t page, uint64_t frame);
+
+	// 要求されたページのうち常駐していないものを、粗いレベルから最大 maxLoads 個選んでスロットを割り当てる
+	// 要求の記録は消える（まだ必要なページは次のフィードバックで再び要求される）
+	std::vector<Load> schedule(uint32_t maxLoads, uint64_t frame);
+
+	// 全ページのエントリーを entries に書く
+	void writePageTable(uint32_t* entries) const;
+
+	// スロットの割り当てが変わるたびに増える
+	uint64_t getVersion() const { return version; }
+
+	bool isResident(uint32_t page) const { return pageSlots[page] != NO_SLOT; }
+	uint32_t getResidentCount() const { return residentCount; }
+	uint32_t getSlotCount() const { return static_cast<uint32_t>(slotPages.size()); }
+	uint32_t getSlotsPerSide() const { return slotsPerSide; }
+	const Stats& getStats() const { return stats; }
+
+private:
+	static constexpr uint32_t NO_SLOT = UINT32_MAX;
+
+	VirtualTextureLayout layout;
+	uint32_t slotsPerSide = 0;
+	uint32_t residentCount = 0;
+	uint64_t version = 0;
+	Stats stats;
+
+	std::vector<uint32_t> pageSlots;		// ページ → スロット（NO_SLOT なら常駐していない）
+	std::vector<uint32_t> slotPages;		// スロット → ページ（NO_SLOT なら空き）
+	std::vector<uint64_t> slotLastUsed;		// スロットのページが最後に要求されたフレーム
+	std::vector<uint32_t> freeSlots;
+
+	// 追い出せるスロットの LRU リスト（先頭が最も新しい。常駐させるページのスロットは入れない）
+	std::vector<uint32_t> lruPrev;
+	std::vector<uint32_t> lruNext;
+	uint32_t lruHead = NO_SLOT;
+	uint32_t lruTail = NO_SLOT;
+
+	std::vector<uint32_t> requested;		// このフレームに要求された常駐していないページ
+	std::vector<uint64_t> requestedFrame;	// ページを requested に入れたフレーム + 1（重複を除く）
+
+	void unlink(uint32_t slot);
+	void pushFront(uint32_t slot);
+	void touch(uint32_t slot, uint64_t frame);
+};
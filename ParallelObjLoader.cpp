@@ -0,0 +1,790 @@
+﻿#include "ParallelObjLoader.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+using tinyobj::real_t;
+
+namespace {
+
+	// 面の頂点が直前の面の smoothing group を引き継ぐことを表す（チャンク先頭の状態は後で解決する）
+	const uint32_t INHERIT_SMOOTHING = UINT32_MAX;
+
+	// 解析中の行の範囲
+	// end の位置の文字は必ず読み取り可能で、改行文字または '\0' である
+	struct Line {
+		const char* begin;
+		const char* end;
+	};
+
+	// オブジェクト・グループの切り替え
+	struct Marker {
+		bool object;			// true: 'o', false: 'g'
+		size_t triangle;		// このマーカーより前にあるチャンク内の三角形数
+		size_t faceRecords;		// このマーカーより前にあるチャンク内の面の行数（頂点数3未満も含む）
+		size_t line;			// チャンク内の行番号
+		bool emptyName;			// 'g' に名前がない
+		std::string name;
+	};
+
+	// 1チャンクの解析結果
+	struct Chunk {
+		const char* begin = nullptr;
+		const char* end = nullptr;
+
+		std::vector<real_t> vertices;
+		std::vector<real_t> colors;
+		std::vector<real_t> normals;
+		std::vector<real_t> texcoords;
+
+		// 三角形ごとの頂点インデックスと smoothing group
+		std::vector<tinyobj::index_t> indices;
+		std::vector<uint32_t> smoothing;
+		size_t faceRecords = 0;
+
+		// 相対インデックス（負の値）で参照していた要素の位置（indices 内の位置 * 3 + 成分）
+		// チャンク内の要素数からの相対位置で格納してあり、前のチャンクの要素数を足して確定する
+		std::vector<size_t> relativeIndices;
+
+		std::vector<Marker> markers;
+
+		// チャンク末尾での smoothing group（INHERIT_SMOOTHING ならチャンク内で変更なし）
+		uint32_t smoothingState = INHERIT_SMOOTHING;
+
+		size_t lineCount = 0;
+		bool unsupported = false;
+		bool failed = false;
+		size_t errorLine = 0;
+	};
+
+	bool isSpace(char c)
+	{
+		return c == ' ' || c == '\t';
+	}
+
+	bool isDigit(char c)
+	{
+		return static_cast<unsigned int>(c - '0') < 10u;
+	}
+
+	// " \t" を読み飛ばす
+	const char* skipSpace(const char* p, const char* end)
+	{
+		while (p < end && isSpace(*p)) {
+			p++;
+		}
+		return p;
+	}
+
+	// " \t\r" のいずれかが現れる位置を返す
+	const char* findSpace(const char* p, const char* end)
+	{
+		while (p < end && !isSpace(*p) && *p != '\r') {
+			p++;
+		}
+		return p;
+	}
+
+	// "/ \t\r" のいずれかが現れる位置を返す
+	const char* findSlashOrSpace(const char* p, const char* end)
+	{
+		while (p < end && *p != '/' && !isSpace(*p) && *p != '\r') {
+			p++;
+		}
+		return p;
+	}
+
+	// atoi と同じ規則で整数を読む（ポインタは進めない）
+	int parseAtoi(const char* p, const char* end)
+	{
+		while (p < end && (isSpace(*p) || *p == '\v' || *p == '\f')) {
+			p++;
+		}
+
+		bool negative = false;
+		if (p < end && (*p == '+' || *p == '-')) {
+			negative = *p == '-';
+			p++;
+		}
+
+		long long value = 0;
+		while (p < end && isDigit(*p)) {
+			value = value * 10 + (*p - '0');
+			p++;
+		}
+		return static_cast<int>(negative ? -value : value);
+	}
+
+	// tinyobj の tryParseDouble と同じ手順で数値を読む（同じ値になるように丸め方も合わせる）
+	bool tryParseDouble(const char* s, const char* sEnd, double* result)
+	{
+		if (s >= sEnd) {
+			return false;
+		}
+
+		double mantissa = 0.0;
+		int exponent = 0;
+		char sign = '+';
+		char expSign = '+';
+		const char* curr = s;
+		int read = 0;
+		bool endNotReached = false;
+		bool leadingDecimalDots = false;
+
+		if (*curr == '+' || *curr == '-') {
+			sign = *curr;
+			curr++;
+			if ((curr != sEnd) && (*curr == '.')) {
+				leadingDecimalDots = true;
+			}
+		}
+		else if (isDigit(*curr)) {
+		}
+		else if (*curr == '.') {
+			leadingDecimalDots = true;
+		}
+		else {
+			return false;
+		}
+
+		// 整数部
+		endNotReached = (curr != sEnd);
+		if (!leadingDecimalDots) {
+			while (endNotReached && isDigit(*curr)) {
+				mantissa *= 10;
+				mantissa += static_cast<int>(*curr - 0x30);
+				curr++;
+				read++;
+				endNotReached = (curr != sEnd);
+			}
+			if (read == 0) {
+				return false;
+			}
+		}
+
+		if (endNotReached) {
+			// 小数部
+			bool readExponent = true;
+			if (*curr == '.') {
+				curr++;
+				read = 1;
+				endNotReached = (curr != sEnd);
+				while (endNotReached && isDigit(*curr)) {
+					static const double powLut[] = {
+						1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001,
+					};
+					const int lutEntries = sizeof powLut / sizeof powLut[0];
+
+					mantissa += static_cast<int>(*curr - 0x30) *
+						(read < lutEntries ? powLut[read] : std::pow(10.0, -read));
+					read++;
+					curr++;
+					endNotReached = (curr != sEnd);
+				}
+			}
+			else if (*curr != 'e' && *curr != 'E') {
+				readExponent = false;
+			}
+
+			// 指数部
+			if (readExponent && endNotReached && (*curr == 'e' || *curr == 'E')) {
+				curr++;
+				endNotReached = (curr != sEnd);
+				if (endNotReached && (*curr == '+' || *curr == '-')) {
+					expSign = *curr;
+					curr++;
+				}
+				else if (isDigit(*curr)) {
+				}
+				else {
+					return false;
+				}
+
+				read = 0;
+				endNotReached = (curr != sEnd);
+				while (endNotReached && isDigit(*curr)) {
+					exponent *= 10;
+					exponent += static_cast<int>(*curr - 0x30);
+					curr++;
+					read++;
+					endNotReached = (curr != sEnd);
+				}
+				exponent *= (expSign == '+' ? 1 : -1);
+				if (read == 0) {
+					return false;
+				}
+			}
+		}
+
+		*result = (sign == '+' ? 1 : -1) *
+			(exponent ? std::ldexp(mantissa * std::pow(5.0, exponent), exponent) : mantissa);
+		return true;
+	}
+
+	// 空白区切りの数値を1つ読む
+	bool parseReal(const char*& token, const char* end, real_t* out)
+	{
+		token = skipSpace(token, end);
+		const char* tokenEnd = findSpace(token, end);
+		double value;
+		bool ret = tryParseDouble(token, tokenEnd, &value);
+		if (ret) {
+			*out = static_cast<real_t>(value);
+		}
+		token = tokenEnd;
+		return ret;
+	}
+
+	// 空白区切りの数値を1つ読む（読めなければ defaultValue）
+	real_t parseReal(const char*& token, const char* end, double defaultValue)
+	{
+		token = skipSpace(token, end);
+		const char* tokenEnd = findSpace(token, end);
+		double value = defaultValue;
+		tryParseDouble(token, tokenEnd, &value);
+		token = tokenEnd;
+		return static_cast<real_t>(value);
+	}
+
+	// 空白区切りの文字列を1つ読む
+	std::string parseString(const char*& token, const char* end)
+	{
+		token = skipSpace(token, end);
+		const char* tokenEnd = findSpace(token, end);
+		std::string s(token, tokenEnd);
+		token = tokenEnd;
+		return s;
+	}
+
+	// 面の頂点インデックス1つ分（v, v/vt, v//vn, v/vt/vn）
+	struct FaceVertex {
+		int index[3] = { -1, -1, -1 };	// v, vt, vn
+		bool relative[3] = { false, false, false };
+	};
+
+	// 1から始まるインデックス・負の相対インデックスを0始まりに直す
+	// 相対インデックスはチャンク内の要素数 count からの位置になる
+	bool fixIndex(int idx, size_t count, int& out, bool& relative)
+	{
+		if (idx > 0) {
+			out = idx - 1;
+			relative = false;
+			return true;
+		}
+		if (idx == 0) {
+			return false;
+		}
+		out = static_cast<int>(count) + idx;
+		relative = true;
+		return true;
+	}
+
+	// 面の頂点インデックスを1つ読む
+	bool parseTriple(const char*& token, const char* end, const Chunk& chunk, FaceVertex& vertex)
+	{
+		const size_t counts[3] = { chunk.vertices.size() / 3, chunk.texcoords.size() / 2, chunk.normals.size() / 3 };
+
+		if (!fixIndex(parseAtoi(token, end), counts[0], vertex.index[0], vertex.relative[0])) {
+			return false;
+		}
+
+		token = findSlashOrSpace(token, end);
+		if (token >= end || *token != '/') {
+			return true;
+		}
+		token++;
+
+		// v//vn
+		if (token < end && *token == '/') {
+			token++;
+			if (!fixIndex(parseAtoi(token, end), counts[2], vertex.index[2], vertex.relative[2])) {
+				return false;
+			}
+			token = findSlashOrSpace(token, end);
+			return true;
+		}
+
+		// v/vt/vn または v/vt
+		if (!fixIndex(parseAtoi(token, end), counts[1], vertex.index[1], vertex.relative[1])) {
+			return false;
+		}
+
+		token = findSlashOrSpace(token, end);
+		if (token >= end || *token != '/') {
+			return true;
+		}
+		token++;
+
+		if (!fixIndex(parseAtoi(token, end), counts[2], vertex.index[2], vertex.relative[2])) {
+			return false;
+		}
+		token = findSlashOrSpace(token, end);
+		return true;
+	}
+
+	// 1行を解析する。続行できなければ false
+	bool parseLine(Chunk& chunk, const char* token, const char* end)
+	{
+		token = skipSpace(token, end);
+		if (token >= end || *token == '\0' || *token == '#') {
+			return true;
+		}
+
+		// 頂点（x y z [r g b]）
+		if (token[0] == 'v' && isSpace(token[1])) {
+			token += 2;
+			real_t x = parseReal(token, end, 0.0);
+			real_t y = parseReal(token, end, 0.0);
+			real_t z = parseReal(token, end, 0.0);
+
+			real_t r, g, b;
+			bool foundColor = parseReal(token, end, &r) && parseReal(token, end, &g) && parseReal(token, end, &b);
+			if (!foundColor) {
+				r = g = b = 1.0;
+			}
+
+			chunk.vertices.insert(chunk.vertices.end(), { x, y, z });
+			chunk.colors.insert(chunk.colors.end(), { r, g, b });
+			return true;
+		}
+
+		// 法線
+		if (token[0] == 'v' && token[1] == 'n' && isSpace(token[2])) {
+			token += 3;
+			real_t x = parseReal(token, end, 0.0);
+			real_t y = parseReal(token, end, 0.0);
+			real_t z = parseReal(token, end, 0.0);
+			chunk.normals.insert(chunk.normals.end(), { x, y, z });
+			return true;
+		}
+
+		// テクスチャ座標
+		if (token[0] == 'v' && token[1] == 't' && isSpace(token[2])) {
+			token += 3;
+			real_t x = parseReal(token, end, 0.0);
+			real_t y = parseReal(token, end, 0.0);
+			chunk.texcoords.insert(chunk.texcoords.end(), { x, y });
+			return true;
+		}
+
+		// 面
+		if (token[0] == 'f' && isSpace(token[1])) {
+			token += 2;
+			token = skipSpace(token, end);
+
+			FaceVertex face[3];
+			size_t count = 0;
+			while (token < end) {
+				FaceVertex vertex;
+				if (!parseTriple(token, end, chunk, vertex)) {
+					chunk.failed = true;
+					chunk.errorLine = chunk.lineCount;
+					return false;
+				}
+
+				// 4頂点以上の多角形は tinyobj の耳切り法に任せる
+				if (count == 3) {
+					chunk.unsupported = true;
+					return false;
+				}
+				face[count++] = vertex;
+
+				while (token < end && (isSpace(*token) || *token == '\r')) {
+					token++;
+				}
+			}
+
+			chunk.faceRecords++;
+
+			// 頂点数3未満の面は出力しない
+			if (count < 3) {
+				return true;
+			}
+
+			for (size_t k = 0; k < 3; k++) {
+				size_t position = chunk.indices.size();
+
+				tinyobj::index_t index;
+				index.vertex_index = face[k].index[0];
+				index.texcoord_index = face[k].index[1];
+				index.normal_index = face[k].index[2];
+				chunk.indices.push_back(index);
+
+				for (size_t c = 0; c < 3; c++) {
+					if (face[k].relative[c]) {
+						chunk.relativeIndices.push_back(position * 3 + c);
+					}
+				}
+			}
+			chunk.smoothing.push_back(chunk.smoothingState);
+			return true;
+		}
+
+		// 線・点・タグ・マテリアルは扱わない
+		if (((token[0] == 'l' || token[0] == 'p' || token[0] == 't') && isSpace(token[1]))
+			|| (end - token >= 7 && (std::memcmp(token, "usemtl", 6) == 0 || std::memcmp(token, "mtllib", 6) == 0) && isSpace(token[6]))) {
+			chunk.unsupported = true;
+			return false;
+		}
+
+		// グループ
+		if (token[0] == 'g' && isSpace(token[1])) {
+			std::vector<std::string> names;
+			while (token < end) {
+				names.push_back(parseString(token, end));
+				while (token < end && (isSpace(*token) || *token == '\r')) {
+					token++;
+				}
+			}
+
+			Marker marker;
+			marker.object = false;
+			marker.triangle = chunk.smoothing.size();
+			marker.faceRecords = chunk.faceRecords;
+			marker.line = chunk.lineCount;
+			marker.emptyName = names.size() < 2;
+
+			// 複数のグループ名は空白でつなげて1つの名前にする
+			if (!marker.emptyName) {
+				std::string name = names[1];
+				for (size_t i = 2; i < names.size(); i++) {
+					name += " " + names[i];
+				}
+				marker.name = name;
+			}
+
+			chunk.markers.push_back(std::move(marker));
+			return true;
+		}
+
+		// オブジェクト
+		if (token[0] == 'o' && isSpace(token[1])) {
+			Marker marker;
+			marker.object = true;
+			marker.triangle = chunk.smoothing.size();
+			marker.faceRecords = chunk.faceRecords;
+			marker.line = chunk.lineCount;
+			marker.emptyName = false;
+			marker.name = std::string(token + 2, end);
+			chunk.markers.push_back(std::move(marker));
+			return true;
+		}
+
+		// smoothing group（"off" または数値。3文字以上の数値は tinyobj と同様に無視する）
+		if (token[0] == 's' && isSpace(token[1])) {
+			token += 2;
+			token = skipSpace(token, end);
+			if (token >= end) {
+				return true;
+			}
+
+			if (end - token >= 3) {
+				if (token[0] == 'o' && token[1] == 'f' && token[2] == 'f') {
+					chunk.smoothingState = 0;
+				}
+			}
+			else {
+				token = skipSpace(token, end);
+				int id = parseAtoi(token, end);
+				chunk.smoothingState = id < 0 ? 0 : static_cast<uint32_t>(id);
+			}
+			return true;
+		}
+
+		// その他のコマンドは無視する
+		return true;
+	}
+
+	// チャンクを1行ずつ解析する
+	void parseChunk(Chunk& chunk, const char* fileEnd)
+	{
+		const char* p = chunk.begin;
+		std::string lastLine;
+
+		while (p < chunk.end) {
+			const char* lineEnd = p;
+			while (lineEnd < chunk.end && *lineEnd != '\n' && *lineEnd != '\r') {
+				lineEnd++;
+			}
+
+			chunk.lineCount++;
+
+			// 改行で終わらない最終行は、終端を読めるようにコピーしてから解析する
+			bool ok;
+			if (lineEnd == fileEnd) {
+				lastLine.assign(p, lineEnd);
+				ok = parseLine(chunk, lastLine.c_str(), lastLine.c_str() + lastLine.size());
+			}
+			else {
+				ok = parseLine(chunk, p, lineEnd);
+			}
+			if (!ok) {
+				return;
+			}
+
+			// 改行は "\n", "\r", "\r\n" のいずれか
+			p = lineEnd;
+			if (p < chunk.end) {
+				if (*p == '\r' && p + 1 < chunk.end && p[1] == '\n') {
+					p += 2;
+				}
+				else {
+					p++;
+				}
+			}
+		}
+	}
+
+	// target 以降で最初の行頭を返す
+	const char* nextLineStart(const char* target, const char* end)
+	{
+		const char* p = target;
+		while (p < end && *p != '\n' && *p != '\r') {
+			p++;
+		}
+		if (p < end) {
+			if (*p == '\r' && p + 1 < end && p[1] == '\n') {
+				p += 2;
+			}
+			else {
+				p++;
+			}
+		}
+		return p;
+	}
+
+	// 出力する shape と、その面がどのチャンクのどの範囲にあるか
+	struct ShapePiece {
+		size_t chunk;
+		size_t triangleBegin;
+		size_t triangleEnd;
+		size_t shape;
+		size_t dstTriangle;		// shape 内での書き込み先
+	};
+}
+
+// filename を読み込む
+bool ParallelObjLoader::load(
+	const std::string& filename,
+	tinyobj::attrib_t* attrib,
+	std::vector<tinyobj::shape_t>* shapes,
+	std::string* warn)
+{
+	return load(FileView::open(filename), attrib, shapes, warn);
+}
+
+// 開いてあるファイルの内容を解析する
+bool ParallelObjLoader::load(
+	const FileView& file,
+	tinyobj::attrib_t* attrib,
+	std::vector<tinyobj::shape_t>* shapes,
+	std::string* warn)
+{
+	const char* fileBegin = file.data();
+	const char* fileEnd = fileBegin + file.size();
+
+	// 行の途中で切らないようにチャンクへ分割する
+	size_t chunkCount = std::max<size_t>(1, std::min(pool.size() * 4, file.size() / MIN_CHUNK_SIZE));
+	std::vector<Chunk> chunks;
+	chunks.reserve(chunkCount);
+	const char* chunkBegin = fileBegin;
+	for (size_t i = 1; i <= chunkCount && chunkBegin < fileEnd; i++) {
+		const char* chunkEnd = fileEnd;
+		if (i < chunkCount) {
+			chunkEnd = std::max(chunkBegin, nextLineStart(fileBegin + file.size() * i / chunkCount, fileEnd));
+		}
+		if (chunkEnd == chunkBegin) {
+			continue;
+		}
+
+		Chunk chunk;
+		chunk.begin = chunkBegin;
+		chunk.end = chunkEnd;
+		chunks.push_back(std::move(chunk));
+		chunkBegin = chunkEnd;
+	}
+
+	pool.parallelFor(chunks.size(), [&](size_t i) {
+		parseChunk(chunks[i], fileEnd);
+	});
+
+	for (const auto& chunk : chunks) {
+		if (chunk.unsupported) {
+			return false;
+		}
+	}
+
+	// 前のチャンクまでの要素数・行数
+	struct Base {
+		size_t vertices = 0, normals = 0, texcoords = 0, lines = 0;
+		uint32_t smoothing = 0;
+	};
+	std::vector<Base> bases(chunks.size() + 1);
+	for (size_t i = 0; i < chunks.size(); i++) {
+		const Chunk& chunk = chunks[i];
+		bases[i + 1].vertices = bases[i].vertices + chunk.vertices.size() / 3;
+		bases[i + 1].normals = bases[i].normals + chunk.normals.size() / 3;
+		bases[i + 1].texcoords = bases[i].texcoords + chunk.texcoords.size() / 2;
+		bases[i + 1].lines = bases[i].lines + chunk.lineCount;
+		bases[i + 1].smoothing = chunk.smoothingState == INHERIT_SMOOTHING ? bases[i].smoothing : chunk.smoothingState;
+
+		if (chunk.failed) {
+			std::stringstream ss;
+			ss << "Failed parse `f' line(e.g. zero value for face index. line "
+				<< bases[i].lines + chunk.errorLine << ".)\n";
+			throw std::runtime_error(ss.str());
+		}
+	}
+	const Base& total = bases.back();
+
+	// 頂点属性を連結し、相対インデックスを確定する
+	attrib->vertices.resize(total.vertices * 3);
+	attrib->colors.resize(total.vertices * 3);
+	attrib->normals.resize(total.normals * 3);
+	attrib->texcoords.resize(total.texcoords * 2);
+	attrib->vertex_weights.clear();
+	attrib->texcoord_ws.clear();
+
+	pool.parallelFor(chunks.size(), [&](size_t i) {
+		Chunk& chunk = chunks[i];
+		const Base& base = bases[i];
+		std::copy(chunk.vertices.begin(), chunk.vertices.end(), attrib->vertices.begin() + base.vertices * 3);
+		std::copy(chunk.colors.begin(), chunk.colors.end(), attrib->colors.begin() + base.vertices * 3);
+		std::copy(chunk.normals.begin(), chunk.normals.end(), attrib->normals.begin() + base.normals * 3);
+		std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), attrib->texcoords.begin() + base.texcoords * 2);
+
+		for (size_t position : chunk.relativeIndices) {
+			tinyobj::index_t& index = chunk.indices[position / 3];
+			switch (position % 3) {
+			case 0: index.vertex_index += static_cast<int>(base.vertices); break;
+			case 1: index.texcoord_index += static_cast<int>(base.texcoords); break;
+			case 2: index.normal_index += static_cast<int>(base.normals); break;
+			}
+		}
+
+		// チャンク先頭の smoothing group を前のチャンクから引き継ぐ
+		uint32_t inherited = base.smoothing;
+		for (auto& id : chunk.smoothing) {
+			if (id == INHERIT_SMOOTHING) {
+				id = inherited;
+			}
+			else {
+				break;
+			}
+		}
+	});
+
+	// o / g の位置で shape を区切る（tinyobj と同じ条件で出力するかを決める）
+	shapes->clear();
+	std::vector<ShapePiece> pieces;
+	std::vector<ShapePiece> pendingPieces;
+	std::vector<size_t> shapeTriangles;
+	size_t segmentTriangles = 0;
+	size_t segmentFaces = 0;
+	std::string name;
+
+	auto flush = [&](bool emit) {
+		if (emit) {
+			size_t shapeIndex = shapes->size();
+			shapes->emplace_back();
+			shapes->back().name = name;
+
+			size_t dst = 0;
+			for (auto& piece : pendingPieces) {
+				piece.shape = shapeIndex;
+				piece.dstTriangle = dst;
+				dst += piece.triangleEnd - piece.triangleBegin;
+				pieces.push_back(piece);
+			}
+			shapeTriangles.push_back(dst);
+		}
+		pendingPieces.clear();
+		segmentTriangles = 0;
+		segmentFaces = 0;
+	};
+
+	for (size_t i = 0; i < chunks.size(); i++) {
+		const Chunk& chunk = chunks[i];
+		size_t triangle = 0;
+		size_t faceRecords = 0;
+
+		for (const auto& marker : chunk.markers) {
+			if (marker.triangle > triangle) {
+				pendingPieces.push_back({ i, triangle, marker.triangle, 0, 0 });
+			}
+			segmentTriangles += marker.triangle - triangle;
+			segmentFaces += marker.faceRecords - faceRecords;
+			triangle = marker.triangle;
+			faceRecords = marker.faceRecords;
+
+			// 'o' は面があれば、'g' は三角形があれば直前の shape を出力する
+			flush(marker.object ? segmentFaces > 0 : segmentTriangles > 0);
+
+			name = marker.name;
+			if (marker.emptyName && warn) {
+				std::stringstream ss;
+				ss << "Empty group name. line: " << bases[i].lines + marker.line << "\n";
+				*warn += ss.str();
+			}
+		}
+
+		size_t triangleCount = chunk.smoothing.size();
+		if (triangleCount > triangle) {
+			pendingPieces.push_back({ i, triangle, triangleCount, 0, 0 });
+		}
+		segmentTriangles += triangleCount - triangle;
+		segmentFaces += chunk.faceRecords - faceRecords;
+	}
+	flush(segmentFaces > 0 || segmentTriangles > 0);
+
+	for (size_t s = 0; s < shapes->size(); s++) {
+		tinyobj::mesh_t& mesh = (*shapes)[s].mesh;
+		mesh.indices.resize(shapeTriangles[s] * 3);
+		mesh.num_face_vertices.assign(shapeTriangles[s], 3);
+		mesh.material_ids.assign(shapeTriangles[s], -1);
+		mesh.smoothing_group_ids.resize(shapeTriangles[s]);
+	}
+
+	pool.parallelFor(pieces.size(), [&](size_t p) {
+		const ShapePiece& piece = pieces[p];
+		const Chunk& chunk = chunks[piece.chunk];
+		tinyobj::mesh_t& mesh = (*shapes)[piece.shape].mesh;
+
+		std::copy(
+			chunk.indices.begin() + piece.triangleBegin * 3,
+			chunk.indices.begin() + piece.triangleEnd * 3,
+			mesh.indices.begin() + piece.dstTriangle * 3);
+		std::copy(
+			chunk.smoothing.begin() + piece.triangleBegin,
+			chunk.smoothing.begin() + piece.triangleEnd,
+			mesh.smoothing_group_ids.begin() + piece.dstTriangle);
+	});
+
+	// 範囲外のインデックスを警告する
+	if (warn) {
+		int greatest[3] = { -1, -1, -1 };
+		for (const auto& shape : *shapes) {
+			for (const auto& index : shape.mesh.indices) {
+				greatest[0] = std::max(greatest[0], index.vertex_index);
+				greatest[1] = std::max(greatest[1], index.normal_index);
+				greatest[2] = std::max(greatest[2], index.texcoord_index);
+			}
+		}
+
+		const char* labels[3] = { "Vertex", "Vertex normal", "Vertex texcoord" };
+		const size_t counts[3] = { total.vertices, total.normals, total.texcoords };
+		for (size_t c = 0; c < 3; c++) {
+			if (greatest[c] >= static_cast<int>(counts[c])) {
+				std::stringstream ss;
+				ss << labels[c] << " indices out of bounds (line " << total.lines << ".)\n" << std::endl;
+				*warn += ss.str();
+			}
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,37 @@
+﻿#pragma once
+
+#include <string>
+#include <vector>
+
+#include "tiny_obj_loader.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+
+// OBJ ファイルをメモリマップし、行単位に分割したチャンクをスレッドプールで並列に解析する
+// 結果は tinyobj::LoadObj（三角形分割・頂点カラー補完あり）と同じ attrib_t / shape_t になる
+class ParallelObjLoader {
+public:
+	explicit ParallelObjLoader(ThreadPool& pool) : pool(pool) {}
+
+	// filename を読み込む。解析エラーは std::runtime_error
+	// マテリアル・線・点・タグ・4頂点以上の面を含むファイルは扱わず false を返すので、
+	// その場合は tinyobj::LoadObj で読み直すこと
+	bool load(
+		const std::string& filename,
+		tinyobj::attrib_t* attrib,
+		std::vector<tinyobj::shape_t>* shapes,
+		std::string* warn);
+
+	// 開いてあるファイルの内容を解析する
+	bool load(
+		const FileView& file,
+		tinyobj::attrib_t* attrib,
+		std::vector<tinyobj::shape_t>* shapes,
+		std::string* warn);
+
+	// 1チャンクの最小サイズ（小さなファイルは分割しない）
+	static const size_t MIN_CHUNK_SIZE = 1024 * 1024;
+
+private:
+	ThreadPool& pool;
+};
@@ -0,0 +1,166 @@
+﻿#include "PipelineCache.h"
+
+#include "FlatHashMap.h"
+#include "MappedFile.h"
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+	// キャッシュ内容の破損を検出するためのハッシュ
+	uint64_t hashData(const char* data, size_t size)
+	{
+		uint64_t h = size;
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8) {
+			uint64_t word;
+			std::memcpy(&word, data + i, sizeof(word));
+			h = hashCombine(h, word);
+		}
+		uint64_t tail = 0;
+		std::memcpy(&tail, data + i, size - i);
+		return hashCombine(h, tail);
+	}
+}
+
+// path から読み込んでキャッシュを作る
+void PipelineCache::init(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path)
+{
+	this->device = device;
+	this->path = path;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	// ファイルが無い・壊れている・別のデバイスやドライバーで作られた場合は空から始める
+	FileView file;
+	const char* initialData = nullptr;
+	size_t initialSize = 0;
+	try {
+		file = FileView::open(path);
+	}
+	catch (const std::runtime_error&) {
+	}
+
+	Header expected = makeHeader();
+	Header header;
+	if (file.size() >= sizeof(header)) {
+		std::memcpy(&header, file.data(), sizeof(header));
+
+		// Vulkan 側のヘッダー（VkPipelineCacheHeaderVersionOne）もドライバーに渡す前に確認する
+		const char* data = file.data() + sizeof(header);
+		uint32_t cacheHeader[4] = {};
+		bool valid = header.magic == expected.magic
+			&& header.version == expected.version
+			&& header.vendorID == expected.vendorID
+			&& header.deviceID == expected.deviceID
+			&& header.driverVersion == expected.driverVersion
+			&& std::memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) == 0
+			&& header.dataSize == file.size() - sizeof(header)
+			&& header.dataSize >= sizeof(cacheHeader) + VK_UUID_SIZE;
+		if (valid) {
+			std::memcpy(cacheHeader, data, sizeof(cacheHeader));
+			valid = cacheHeader[0] >= sizeof(cacheHeader) + VK_UUID_SIZE
+				&& cacheHeader[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+				&& cacheHeader[2] == properties.vendorID
+				&& cacheHeader[3] == properties.deviceID
+				&& std::memcmp(data + sizeof(cacheHeader), properties.pipelineCacheUUID, VK_UUID_SIZE) == 0
+				&& hashData(data, static_cast<size_t>(header.dataSize)) == header.dataHash;
+		}
+		if (valid) {
+			initialData = data;
+			initialSize = static_cast<size_t>(header.dataSize);
+		}
+	}
+
+	VkPipelineCacheCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = initialSize;
+	createInfo.pInitialData = initialData;
+
+	if (vkCreatePipelineCache(device, &createInfo, nullptr, &cache) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create pipeline cache!");
+	}
+	loadedBytes = initialSize;
+}
+
+// キャッシュを破棄する
+void PipelineCache::destroy()
+{
+	if (cache != VK_NULL_HANDLE) {
+		vkDestroyPipelineCache(device, cache, nullptr);
+		cache = VK_NULL_HANDLE;
+	}
+}
+
+// 内容をファイルへ書き戻す
+bool PipelineCache::save()
+{
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(device, cache, &dataSize, nullptr) != VK_SUCCESS) {
+		return false;
+	}
+	std::vector<char> data(dataSize);
+	if (vkGetPipelineCacheData(device, cache, &dataSize, data.data()) != VK_SUCCESS) {
+		return false;
+	}
+	data.resize(dataSize);
+
+	Header header = makeHeader();
+	header.dataSize = dataSize;
+	header.dataHash = hashData(data.data(), data.size());
+
+	bool written = writeFileAtomically(path, [&](std::ostream& out) {
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(data.data(), static_cast<std::streamsize>(data.size()));
+	});
+	if (!written) {
+		return false;
+	}
+	savedBytes = dataSize;
+	return true;
+}
+
+// パイプライン作成1回分を記録する
+void PipelineCache::recordCreation(const VkPipelineCreationFeedbackEXT* feedback, double createMs)
+{
+	stats.createMs += createMs;
+
+	if (feedback == nullptr || (feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT) == 0) {
+		stats.unknownCount++;
+	}
+	else if (feedback->flags & VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) {
+		stats.hitCount++;
+	}
+	else {
+		stats.missCount++;
+	}
+}
+
+void PipelineCache::printStats(std::ostream& out) const
+{
+	uint32_t known = stats.hitCount + stats.missCount;
+
+	out << "pipeline cache: " << (isWarm() ? "loaded " + std::to_string(loadedBytes) + " bytes" : std::string("cold"))
+		<< ", saved " << savedBytes << " bytes, "
+		<< stats.hitCount << " hits / " << stats.missCount << " misses";
+	if (known > 0) {
+		out << " (" << 100.0 * stats.hitCount / known << "% hit)";
+	}
+	if (stats.unknownCount > 0) {
+		out << ", " << stats.unknownCount << " without feedback";
+	}
+	out << ", " << stats.createMs << " ms creating pipelines" << std::endl;
+}
+
+// ヘッダーを現在のデバイスの内容で埋める
+PipelineCache::Header PipelineCache::makeHeader() const
+{
+	Header header = {};
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.vendorID = properties.vendorID;
+	header.deviceID = properties.deviceID;
+	header.driverVersion = properties.driverVersion;
+	std::memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	return header;
+}
@@ -0,0 +1,71 @@
+﻿#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// ディスクに保存する VkPipelineCache
+// 起動時にファイルから読み込み、終了時に書き戻すことで、2回目以降の起動やリサイズ時のパイプライン作成を速くする
+//
+// ファイル構成: Header | vkGetPipelineCacheData の内容
+// ヘッダーのデバイス・ドライバー情報が現在のデバイスと一致しなければ読み込まずに空のキャッシュから始める
+class PipelineCache {
+public:
+	static const uint32_t MAGIC = 0x48434c50;	// "PLCH"
+	static const uint32_t VERSION = 1;
+
+	// 作成したパイプラインの統計
+	struct Stats {
+		uint32_t hitCount = 0;			// キャッシュから作成できた数
+		uint32_t missCount = 0;			// コンパイルが必要だった数
+		uint32_t unknownCount = 0;		// 作成フィードバックが得られなかった数
+		double createMs = 0.0;			// 作成にかかった時間の合計
+	};
+
+	// path から読み込んでキャッシュを作る（論理デバイス作成後に呼ぶ）
+	void init(VkPhysicalDevice physicalDevice, VkDevice device, const std::string& path);
+
+	// キャッシュを破棄する（論理デバイス破棄前に呼ぶ）
+	void destroy();
+
+	// 内容をファイルへ書き戻す（一時ファイルに書いてから置き換える）。書き出せなければ false
+	bool save();
+
+	VkPipelineCache get() const { return cache; }
+
+	// 起動時にファイルの内容を読み込めたか
+	bool isWarm() const { return loadedBytes > 0; }
+
+	// パイプライン作成1回分を記録する（feedback が nullptr ならヒット・ミスは不明として数える）
+	void recordCreation(const VkPipelineCreationFeedbackEXT* feedback, double createMs);
+
+	const Stats& getStats() const { return stats; }
+	void printStats(std::ostream& out) const;
+
+private:
+	// ファイル先頭のヘッダー
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint32_t reserved;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
+		uint64_t dataHash;
+	};
+
+	// ヘッダーを現在のデバイスの内容で埋める
+	Header makeHeader() const;
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkPipelineCache cache = VK_NULL_HANDLE;
+	VkPhysicalDeviceProperties properties = {};
+	std::string path;
+	size_t loadedBytes = 0;
+	size_t savedBytes = 0;
+	Stats stats;
+};
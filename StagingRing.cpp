@@ -0,0 +1,118 @@
+﻿#include "StagingRing.h"
+
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// 初期化
+void StagingRing::init(VkBuffer buffer, void* mapped, VkDeviceSize capacity)
+{
+	this->buffer = buffer;
+	this->mapped = static_cast<char*>(mapped);
+	this->capacity = capacity;
+	head = 0;
+	spans.clear();
+}
+
+// size バイトを確保する
+StagingRing::Region StagingRing::allocate(VkDeviceSize size, VkDeviceSize alignment, UploadQueue& queue)
+{
+	if (size == 0 || size > capacity) {
+		throw std::invalid_argument("staging allocation does not fit in the ring!");
+	}
+	alignment = std::max<VkDeviceSize>(alignment, 1);
+
+	VkDeviceSize offset = 0;
+	while (!tryPlace(size, alignment, offset)) {
+		// 最も古い範囲を使うバッチをサブミットして完了を待つ
+		UploadQueue* oldest = spans.front().queue;
+		oldest->submit();
+		oldest->waitIdle();
+		releaseCompleted();
+		stallCount++;
+	}
+
+	uint64_t id = nextId++;
+	spans.push_back({ id, offset, offset + size, &queue, false });
+	head = offset + size;
+
+	// バッチの完了時に返却済みとして印を付ける（キューをまたぐと完了順は前後しうる）
+	queue.onComplete([this, id]() {
+		for (auto& span : spans) {
+			if (span.id == id) {
+				span.completed = true;
+				break;
+			}
+		}
+		releaseCompleted();
+	});
+
+	Region region;
+	region.buffer = buffer;
+	region.offset = offset;
+	region.data = mapped + offset;
+	region.size = size;
+	return region;
+}
+
+// 使用中のバイト数
+VkDeviceSize StagingRing::getUsedBytes() const
+{
+	if (spans.empty()) {
+		return 0;
+	}
+
+	VkDeviceSize tail = spans.front().begin;
+	return head > tail ? head - tail : capacity - tail + head;
+}
+
+// 先頭から完了済みの範囲を返却する
+void StagingRing::releaseCompleted()
+{
+	while (!spans.empty() && spans.front().completed) {
+		spans.pop_front();
+	}
+
+	// すべて返却されたら先頭から使い直す
+	if (spans.empty()) {
+		head = 0;
+	}
+}
+
+// 空きがあれば確保位置を返す
+bool StagingRing::tryPlace(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) const
+{
+	if (spans.empty()) {
+		offset = 0;
+		return size <= capacity;
+	}
+
+	VkDeviceSize tail = spans.front().begin;
+	VkDeviceSize start = alignUp(head, alignment);
+
+	// 折り返した書き込み位置が先頭の使用中範囲に追いついた：満杯
+	if (head == tail) {
+		return false;
+	}
+
+	if (head > tail) {
+		// [tail, head) が使用中。末尾に収まらなければ先頭へ折り返す
+		if (start + size <= capacity) {
+			offset = start;
+			return true;
+		}
+		if (size <= tail) {
+			offset = 0;
+			return true;
+		}
+		return false;
+	}
+
+	// 折り返し済み：[head, tail) が空き
+	if (start + size <= tail) {
+		offset = start;
+		return true;
+	}
+	return false;
+}
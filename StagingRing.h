@@ -0,0 +1,59 @@
+﻿#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <deque>
+
+#include "UploadQueue.h"
+
+// 永続的にマップされたホスト可視バッファをリングバッファとして使うステージング領域
+// 確保した範囲はそれを使う UploadQueue のバッチ完了時に返却され、再利用される
+class StagingRing {
+public:
+	// 確保した範囲
+	struct Region {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;	// buffer 内のオフセット
+		void* data = nullptr;		// 書き込み先（offset の位置を指す）
+		VkDeviceSize size = 0;
+	};
+
+	// 初期化（buffer は mapped にマップ済みのホスト可視バッファ）
+	void init(VkBuffer buffer, void* mapped, VkDeviceSize capacity);
+
+	// size バイトを確保し、queue に記録中のバッチが完了したら返却されるようにする
+	// 空きがなければ最も古い確保の完了を待つ（capacity を超えるサイズは分割して呼ぶこと）
+	Region allocate(VkDeviceSize size, VkDeviceSize alignment, UploadQueue& queue);
+
+	VkDeviceSize getCapacity() const { return capacity; }
+
+	// 使用中のバイト数
+	VkDeviceSize getUsedBytes() const;
+
+	// 空きを待った回数（リングが小さすぎないかの目安）
+	uint64_t getStallCount() const { return stallCount; }
+
+private:
+	// リング内の使用中範囲（確保順）
+	struct Span {
+		uint64_t id;
+		VkDeviceSize begin;
+		VkDeviceSize end;
+		UploadQueue* queue;
+		bool completed;
+	};
+
+	VkBuffer buffer = VK_NULL_HANDLE;
+	char* mapped = nullptr;
+	VkDeviceSize capacity = 0;
+	VkDeviceSize head = 0;	// 次に書き込む位置
+	std::deque<Span> spans;
+	uint64_t nextId = 0;
+	uint64_t stallCount = 0;
+
+	// 先頭から完了済みの範囲を返却する
+	void releaseCompleted();
+
+	// 空きがあれば確保位置を返す
+	bool tryPlace(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset) const;
+};
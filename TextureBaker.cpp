@@ -0,0 +1,228 @@
+﻿#include "TextureBaker.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <limits>
+#include <stdexcept>
+
+#include "stb_image.h"
+
+#include "BlockCompressor.h"
+#include "JpegDecoder.h"
+#include "Ktx2File.h"
+#include "MappedFile.h"
+
+// format が bakeTexture で作れる形式か
+bool isBakeableFormat(VkFormat format)
+{
+	return format == VK_FORMAT_R8G8B8A8_SRGB
+		|| format == VK_FORMAT_BC1_RGB_SRGB_BLOCK
+		|| format == VK_FORMAT_BC3_SRGB_BLOCK
+		|| format == VK_FORMAT_BC7_SRGB_BLOCK;
+}
+
+// format の色をサンプラーが sRGB として線形に戻すか
+bool isSrgbFormat(VkFormat format)
+{
+	switch (format) {
+	case VK_FORMAT_R8G8B8A8_SRGB:
+	case VK_FORMAT_B8G8R8A8_SRGB:
+	case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+	case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+	case VK_FORMAT_BC3_SRGB_BLOCK:
+	case VK_FORMAT_BC7_SRGB_BLOCK:
+		return true;
+	default:
+		return false;
+	}
+}
+
+// stb_image でデコードする（扱えなければ false）
+static bool decodeWithStb(const void* encoded, size_t size, DecodedImage& image)
+{
+	if (size > static_cast<size_t>(std::numeric_limits<int>::max())) {
+		return false;
+	}
+	int texWidth, texHeight, texChannels;
+	stbi_uc* pixels = stbi_load_from_memory(
+		static_cast<const stbi_uc*>(encoded),
+		static_cast<int>(size),
+		&texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+	if (!pixels) {
+		return false;
+	}
+	image.width = static_cast<uint32_t>(texWidth);
+	image.height = static_cast<uint32_t>(texHeight);
+	image.rgba.assign(pixels, pixels + static_cast<size_t>(image.width) * image.height * 4);
+	stbi_image_free(pixels);
+	return true;
+}
+
+// ベースライン JPEG は並列デコーダーで、それ以外は stb_image でデコードする
+DecodedImage decodeImage(const void* encoded, size_t size, ThreadPool& pool)
+{
+	DecodedImage image;
+	JpegImage jpeg;
+	if (decodeJpeg(encoded, size, pool, jpeg)) {
+		image.width = jpeg.width;
+		image.height = jpeg.height;
+		image.rgba = std::move(jpeg.rgba);
+		image.decoder = std::string("JPEG ") + getJpegDecoderKernelName() + ", "
+			+ (jpeg.restartSegments != 0 ? std::to_string(jpeg.restartSegments) + " restart segments" : "pipelined")
+			+ ", " + std::to_string(pool.size()) + " threads";
+		return image;
+	}
+	if (!decodeWithStb(encoded, size, image)) {
+		throw std::runtime_error("failed to load texture image!");
+	}
+	image.decoder = "stb_image";
+	return image;
+}
+
+// ヘッダーだけを読んで大きさを返す
+bool readImageInfo(const void* encoded, size_t size, uint32_t& width, uint32_t& height)
+{
+	if (size > static_cast<size_t>(std::numeric_limits<int>::max())) {
+		return false;
+	}
+	int texWidth, texHeight, texChannels;
+	if (!stbi_info_from_memory(static_cast<const stbi_uc*>(encoded), static_cast<int>(size), &texWidth, &texHeight, &texChannels)) {
+		return false;
+	}
+	width = static_cast<uint32_t>(texWidth);
+	height = static_cast<uint32_t>(texHeight);
+	return true;
+}
+
+// 並列デコーダーと stb_image の速度と結果を比べる
+void benchmarkJpegDecode(const std::string& path, uint32_t iterations, ThreadPool& pool, std::ostream& log)
+{
+	FileView file = FileView::open(path);
+	iterations = std::max(iterations, 1u);
+
+	auto median = [](std::vector<double>& samples) {
+		std::sort(samples.begin(), samples.end());
+		return samples[samples.size() / 2];
+	};
+
+	// stb_image（基準）
+	std::vector<double> stbTimes;
+	DecodedImage reference;
+	for (uint32_t i = 0; i < iterations; i++) {
+		reference = DecodedImage();
+		auto start = std::chrono::high_resolution_clock::now();
+		if (!decodeWithStb(file.data(), file.size(), reference)) {
+			throw std::runtime_error("failed to decode " + path + " with stb_image!");
+		}
+		stbTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+	}
+
+	// 並列デコーダー
+	std::vector<double> jpegTimes;
+	JpegImage image;
+	for (uint32_t i = 0; i < iterations; i++) {
+		image = JpegImage();
+		auto start = std::chrono::high_resolution_clock::now();
+		if (!decodeJpeg(file.data(), file.size(), pool, image)) {
+			throw std::runtime_error(path + " is not a baseline JPEG the parallel decoder supports!");
+		}
+		jpegTimes.push_back(std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count());
+	}
+
+	if (image.width != reference.width || image.height != reference.height) {
+		throw std::runtime_error("decoded size of " + path + " differs from stb_image!");
+	}
+	int maxDifference = 0;
+	size_t differentBytes = 0;
+	for (size_t i = 0; i < image.rgba.size(); i++) {
+		int difference = std::abs(static_cast<int>(image.rgba[i]) - static_cast<int>(reference.rgba[i]));
+		maxDifference = std::max(maxDifference, difference);
+		differentBytes += difference != 0 ? 1 : 0;
+	}
+
+	const double stbMs = median(stbTimes);
+	const double jpegMs = median(jpegTimes);
+	log << path << ": " << image.width << "x" << image.height << ", "
+		<< (image.restartSegments != 0 ? std::to_string(image.restartSegments) + " restart segments" : std::string("pipelined"))
+		<< ", " << getJpegDecoderKernelName() << ", " << pool.size() << " threads, median of " << iterations << std::endl;
+	log << "  stb_image: " << stbMs << " ms, parallel: " << jpegMs << " ms (" << stbMs / jpegMs << "x)" << std::endl;
+	log << "  max difference " << maxDifference << ", " << differentBytes << " of " << image.rgba.size() << " bytes differ" << std::endl;
+}
+
+// 画像をデコードしてミップチェーンを作り、format で符号化する
+std::vector<BakedLevel> bakeTexture(const void* encoded, size_t size, VkFormat format, uint32_t maxLevels, MipFilter mipFilter, ThreadPool& pool)
+{
+	if (!isBakeableFormat(format)) {
+		throw std::invalid_argument("unsupported texture format!");
+	}
+
+	DecodedImage image = decodeImage(encoded, size, pool);
+	std::vector<MipLevel> mipChain = generateMipChain(
+		std::move(image.rgba), image.width, image.height, maxLevels, mipFilter, isSrgbFormat(format), pool);
+
+	const BlockFormat blockFormat =
+		format == VK_FORMAT_BC1_RGB_SRGB_BLOCK ? BlockFormat::Bc1 :
+		format == VK_FORMAT_BC3_SRGB_BLOCK ? BlockFormat::Bc3 : BlockFormat::Bc7;
+
+	std::vector<BakedLevel> levels(mipChain.size());
+	for (size_t level = 0; level < mipChain.size(); level++) {
+		MipLevel& mip = mipChain[level];
+		levels[level].width = mip.width;
+		levels[level].height = mip.height;
+		if (format == VK_FORMAT_R8G8B8A8_SRGB) {
+			levels[level].data = std::move(mip.rgba);
+		}
+		else {
+			levels[level].data.resize(getCompressedSize(blockFormat, mip.width, mip.height));
+			compressImage(blockFormat, mip.rgba.data(), mip.width, mip.height, levels[level].data.data(), pool);
+			mip.rgba = std::vector<uint8_t>();
+		}
+	}
+	return levels;
+}
+
+// directory 内の .jpg をすべて .ktx2 に変換する
+size_t bakeTextureDirectory(const std::string& directory, VkFormat format, MipFilter mipFilter, ThreadPool& pool, std::ostream& log)
+{
+	size_t bakedCount = 0;
+	for (const auto& entry : std::filesystem::directory_iterator(directory)) {
+		if (!entry.is_regular_file() || entry.path().extension() != ".jpg") {
+			continue;
+		}
+
+		auto bakeStart = std::chrono::high_resolution_clock::now();
+		const std::string sourcePath = entry.path().string();
+		const std::string outputPath = std::filesystem::path(entry.path()).replace_extension(".ktx2").string();
+
+		std::vector<BakedLevel> baked;
+		uint64_t sourceSize;
+		{
+			FileView source = FileView::open(sourcePath);
+			sourceSize = source.size();
+			baked = bakeTexture(source.data(), source.size(), format, Ktx2File::MAX_LEVELS, mipFilter, pool);
+		}
+
+		std::vector<Ktx2File::Level> levels(baked.size());
+		uint64_t outputSize = 0;
+		for (size_t i = 0; i < baked.size(); i++) {
+			levels[i].width = baked[i].width;
+			levels[i].height = baked[i].height;
+			levels[i].data = baked[i].data.data();
+			levels[i].size = baked[i].data.size();
+			outputSize += levels[i].size;
+		}
+
+		if (!Ktx2File::write(outputPath, format, levels)) {
+			throw std::runtime_error("failed to write " + outputPath + "!");
+		}
+		bakedCount++;
+
+		log << sourcePath << " -> " << outputPath << ": " << levels[0].width << "x" << levels[0].height
+			<< ", " << levels.size() << " levels, " << (sourceSize >> 10) << " KiB -> " << (outputSize >> 10) << " KiB, "
+			<< std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - bakeStart).count()
+			<< " ms" << std::endl;
+	}
+	return bakedCount;
+}
@@ -0,0 +1,57 @@
+﻿#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "MipGenerator.h"
+#include "ThreadPool.h"
+
+// 画像ファイルからミップチェーンを作り、GPU へそのまま転送できる形式に符号化する
+// 起動時の圧縮テクスチャキャッシュと、オフラインの KTX2 変換（--bake-textures）で共有する
+
+// 符号化したミップレベル1つ分
+struct BakedLevel {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> data;
+};
+
+// RGBA8 にデコードした画像
+struct DecodedImage {
+	uint32_t width = 0;
+	uint32_t height = 0;
+	std::vector<uint8_t> rgba;
+	std::string decoder;	// 使ったデコーダーの説明（ログ用）
+};
+
+// 画像を RGBA8 にデコードする
+// ベースライン JPEG は decodeJpeg で並列に、それ以外は stb_image で読む。デコードできなければ std::runtime_error
+DecodedImage decodeImage(const void* encoded, size_t size, ThreadPool& pool);
+
+// 画像をデコードせずに大きさだけを読む（読めない形式なら false）
+bool readImageInfo(const void* encoded, size_t size, uint32_t& width, uint32_t& height);
+
+// JPEG ファイルを decodeJpeg と stb_image でそれぞれ iterations 回デコードし、
+// 時間の中央値と画素の最大差を log に出力する。読めなければ std::runtime_error
+void benchmarkJpegDecode(const std::string& path, uint32_t iterations, ThreadPool& pool, std::ostream& log);
+
+// format が bakeTexture で作れる形式か
+// （VK_FORMAT_R8G8B8A8_SRGB と BC1_RGB / BC3 / BC7 の SRGB）
+bool isBakeableFormat(VkFormat format);
+
+// format の色をサンプラーが sRGB として線形に戻すか（_SRGB の形式なら true）
+// CPU でミップチェーンを作るときは、これが true のときだけ色を線形に戻して縮小する
+bool isSrgbFormat(VkFormat format);
+
+// decodeImage で読める形式（JPEG など）の画像をデコードし、1x1 までのミップチェーン（最大 maxLevels 段）を
+// mipFilter で作って format で符号化する。縮小は isSrgbFormat(format) に従う。デコードできなければ std::runtime_error
+std::vector<BakedLevel> bakeTexture(const void* encoded, size_t size, VkFormat format, uint32_t maxLevels, MipFilter mipFilter, ThreadPool& pool);
+
+// directory 内の .jpg をすべて同じ名前の .ktx2 に変換し、変換した数を返す
+// 1枚ごとの結果を log に出力する。書き出せなければ std::runtime_error
+size_t bakeTextureDirectory(const std::string& directory, VkFormat format, MipFilter mipFilter, ThreadPool& pool, std::ostream& log);
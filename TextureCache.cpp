@@ -0,0 +1,122 @@
+﻿#include "TextureCache.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "Ktx2File.h"
+
+// キャッシュを開く
+bool TextureCache::open(const std::string& path, const MeshCache::SourceInfo& source, VkFormat expectedFormat, MipFilter mipFilter)
+{
+	close();
+
+	FileView mapped;
+	try {
+		mapped = FileView::open(path);
+	}
+	catch (const std::runtime_error&) {
+		return false;
+	}
+
+	// ヘッダーを検証する
+	Header header;
+	if (mapped.size() < sizeof(header)) {
+		return false;
+	}
+	std::memcpy(&header, mapped.data(), sizeof(header));
+
+	if (header.magic != MAGIC || header.version != VERSION
+		|| header.sourceHash != source.hash || header.sourceSize != source.size
+		|| header.format != static_cast<uint32_t>(expectedFormat)
+		|| header.mipFilter != static_cast<uint32_t>(mipFilter)
+		|| header.levelCount == 0 || header.levelCount > MAX_LEVELS) {
+		return false;
+	}
+
+	uint32_t blockBytes, blockExtent;
+	if (!Ktx2File::getBlockInfo(expectedFormat, blockBytes, blockExtent)) {
+		return false;
+	}
+
+	// 各レベルがレベル0 から縦横半分ずつのチェーンになっていて、形式どおりの大きさの領域がファイルに収まっているか
+	uint64_t levelsEnd = sizeof(Header) + sizeof(LevelEntry) * static_cast<uint64_t>(header.levelCount);
+	if (mapped.size() < levelsEnd) {
+		return false;
+	}
+	std::vector<Level> loadedLevels(header.levelCount);
+	for (uint32_t i = 0; i < header.levelCount; i++) {
+		LevelEntry entry;
+		std::memcpy(&entry, mapped.data() + sizeof(Header) + sizeof(LevelEntry) * i, sizeof(entry));
+		if (entry.width == 0 || entry.height == 0
+			|| (i > 0 && (entry.width != std::max(loadedLevels[0].width >> i, 1u)
+				|| entry.height != std::max(loadedLevels[0].height >> i, 1u)))
+			|| entry.size != (static_cast<uint64_t>(entry.width) + blockExtent - 1) / blockExtent
+				* ((static_cast<uint64_t>(entry.height) + blockExtent - 1) / blockExtent) * blockBytes
+			|| entry.offset < levelsEnd || entry.offset % DATA_ALIGNMENT != 0
+			|| entry.offset > mapped.size() || entry.size > mapped.size() - entry.offset) {
+			return false;
+		}
+		loadedLevels[i].width = entry.width;
+		loadedLevels[i].height = entry.height;
+		loadedLevels[i].data = mapped.data() + entry.offset;
+		loadedLevels[i].size = entry.size;
+	}
+
+	file = std::move(mapped);
+	format = expectedFormat;
+	levels = std::move(loadedLevels);
+	return true;
+}
+
+// マップを解除する
+void TextureCache::close()
+{
+	file.reset();
+	format = VK_FORMAT_UNDEFINED;
+	levels.clear();
+}
+
+// キャッシュを書き出す
+bool TextureCache::write(
+	const std::string& path,
+	const MeshCache::SourceInfo& source,
+	VkFormat format,
+	MipFilter mipFilter,
+	const std::vector<Level>& levels)
+{
+	if (levels.empty() || levels.size() > MAX_LEVELS) {
+		throw std::invalid_argument("texture cache level count must be 1 to MAX_LEVELS!");
+	}
+
+	Header header = {};
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.sourceHash = source.hash;
+	header.sourceSize = source.size;
+	header.format = static_cast<uint32_t>(format);
+	header.levelCount = static_cast<uint32_t>(levels.size());
+	header.mipFilter = static_cast<uint32_t>(mipFilter);
+
+	std::vector<LevelEntry> entries(levels.size());
+	uint64_t offset = sizeof(Header) + sizeof(LevelEntry) * levels.size();
+	for (size_t i = 0; i < levels.size(); i++) {
+		offset = alignUp(offset, DATA_ALIGNMENT);
+		entries[i].width = levels[i].width;
+		entries[i].height = levels[i].height;
+		entries[i].offset = offset;
+		entries[i].size = levels[i].size;
+		offset += levels[i].size;
+	}
+
+	return writeFileAtomically(path, [&](std::ostream& out) {
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(reinterpret_cast<const char*>(entries.data()), static_cast<std::streamsize>(sizeof(LevelEntry) * entries.size()));
+
+		static const char padding[DATA_ALIGNMENT] = {};
+		for (size_t i = 0; i < levels.size(); i++) {
+			out.write(padding, static_cast<std::streamsize>(entries[i].offset - static_cast<uint64_t>(out.tellp())));
+			out.write(static_cast<const char*>(levels[i].data), static_cast<std::streamsize>(levels[i].size));
+		}
+	});
+}
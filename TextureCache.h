@@ -0,0 +1,82 @@
+﻿#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+#include "MeshCache.h"
+#include "MipGenerator.h"
+
+// 圧縮済みのミップチェーンを保存するバイナリキャッシュ
+// 読み込み時はファイルをマップし、各レベルの領域をそのままステージングへコピーできる
+// 元ファイルの識別情報は MeshCache と同じもの（MeshCache::hashSource）を使う
+// ミップチェーンを作ったフィルターも記録し、違えば作り直す
+//
+// ファイル構成: Header | LevelEntry * levelCount | レベル0 のデータ | レベル1 のデータ | ...
+// 各レベルのデータの先頭は DATA_ALIGNMENT に揃える
+class TextureCache {
+public:
+	static const uint32_t MAGIC = 0x48435854;	// "TXCH"
+	static const uint32_t VERSION = 3;
+	static const uint64_t DATA_ALIGNMENT = 16;
+	static const uint32_t MAX_LEVELS = 16;
+
+	// ミップレベル1つ分
+	struct Level {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		const void* data = nullptr;
+		uint64_t size = 0;
+	};
+
+	// キャッシュを開き、元ファイル・形式・フィルターと一致すれば true
+	bool open(const std::string& path, const MeshCache::SourceInfo& source, VkFormat format, MipFilter mipFilter);
+
+	// マップを解除する
+	void close();
+
+	bool isOpen() const { return !file.empty(); }
+
+	VkFormat getFormat() const { return format; }
+
+	// レベル0 から順に並ぶ（data はマップしたファイルを指す）
+	const std::vector<Level>& getLevels() const { return levels; }
+
+	// キャッシュを書き出す（一時ファイルに書いてから置き換える）
+	// levels は 1 ～ MAX_LEVELS 個で、data は書き出し中だけ参照する
+	// 書き出せなければ false
+	static bool write(
+		const std::string& path,
+		const MeshCache::SourceInfo& source,
+		VkFormat format,
+		MipFilter mipFilter,
+		const std::vector<Level>& levels);
+
+private:
+	// ファイル先頭のヘッダー
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint64_t sourceSize;
+		uint32_t format;
+		uint32_t levelCount;
+		uint32_t mipFilter;
+		uint32_t reserved;
+	};
+
+	// レベル1つ分
+	struct LevelEntry {
+		uint32_t width;
+		uint32_t height;
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	FileView file;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	std::vector<Level> levels;
+};
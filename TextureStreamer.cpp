@@ -0,0 +1,127 @@
+﻿#include "TextureStreamer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+TextureStreamer::~TextureStreamer()
+{
+	finish();
+}
+
+// バックグラウンドスレッドで読み込んでから転送する
+void TextureStreamer::start(const Layout& newLayout, uint32_t pendingLevels, Loader loader)
+{
+	reset(newLayout, pendingLevels);
+	if (!active) {
+		return;
+	}
+
+	// 描画スレッドのプールは毎フレームのコマンド記録に使うので、読み込みには別のプールを使う
+	loaderThread = std::thread([this, loader]() {
+		try {
+			ThreadPool pool;
+			Source loadedSource = loader(pool);
+			std::lock_guard<std::mutex> lock(mutex);
+			source = std::move(loadedSource);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(mutex);
+			loadError = std::current_exception();
+		}
+		loaded = true;
+	});
+}
+
+// 読み込み済みのデータを転送する
+void TextureStreamer::start(const Layout& newLayout, uint32_t pendingLevels, Source loadedSource)
+{
+	reset(newLayout, pendingLevels);
+	source = std::move(loadedSource);
+	loaded = true;
+	validateSource();
+}
+
+// 次に転送する範囲を返す
+bool TextureStreamer::nextBand(uint64_t budget, Band& band)
+{
+	if (!active || !loaded) {
+		return false;
+	}
+	if (loaderThread.joinable()) {
+		loaderThread.join();
+		if (loadError) {
+			active = false;
+			std::rethrow_exception(loadError);
+		}
+		validateSource();
+	}
+	if (currentLevel == 0) {
+		return false;
+	}
+
+	const uint32_t level = currentLevel - 1;
+	const Level& data = source.levels[level];
+	const uint32_t blockRows = (data.height + layout.blockExtent - 1) / layout.blockExtent;
+	const uint64_t rowPitch = static_cast<uint64_t>((data.width + layout.blockExtent - 1) / layout.blockExtent) * layout.blockBytes;
+
+	band.level = level;
+	band.width = data.width;
+	band.height = data.height;
+	band.firstRow = currentRow;
+	band.rowCount = static_cast<uint32_t>(std::min<uint64_t>(std::max<uint64_t>(budget / rowPitch, 1), blockRows - currentRow));
+	band.data = data.data;
+	band.size = rowPitch * band.rowCount;
+	band.completesLevel = currentRow + band.rowCount == blockRows;
+
+	currentRow += band.rowCount;
+	streamedBytes += band.size;
+	if (band.completesLevel) {
+		currentLevel--;
+		currentRow = 0;
+		active = currentLevel > 0;
+	}
+	return true;
+}
+
+// 読み込みスレッドを止めてデータを解放する
+void TextureStreamer::finish()
+{
+	if (loaderThread.joinable()) {
+		loaderThread.join();
+	}
+	std::lock_guard<std::mutex> lock(mutex);
+	source = Source();
+	loadError = nullptr;
+	loaded = false;
+	active = false;
+}
+
+// 転送の進み具合を最初に戻す
+void TextureStreamer::reset(const Layout& newLayout, uint32_t pendingLevels)
+{
+	finish();
+	layout = newLayout;
+	currentLevel = std::min(pendingLevels, layout.levelCount);
+	currentRow = 0;
+	streamedBytes = 0;
+	active = currentLevel > 0;
+}
+
+// 各レベルがイメージのレベルと同じ大きさで、データがブロック行の分だけあるか
+void TextureStreamer::validateSource() const
+{
+	if (source.levels.size() < layout.levelCount) {
+		throw std::runtime_error("streamed texture has fewer levels than the image!");
+	}
+	for (uint32_t level = 0; level < layout.levelCount; level++) {
+		const Level& data = source.levels[level];
+		const uint64_t blocksX = (data.width + layout.blockExtent - 1) / layout.blockExtent;
+		const uint64_t blocksY = (data.height + layout.blockExtent - 1) / layout.blockExtent;
+		if (data.width != std::max(layout.width >> level, 1u) || data.height != std::max(layout.height >> level, 1u)) {
+			throw std::runtime_error("streamed texture level size does not match the image!");
+		}
+		if (data.data == nullptr || data.size < blocksX * blocksY * layout.blockBytes) {
+			throw std::runtime_error("streamed texture level is truncated!");
+		}
+	}
+}
@@ -0,0 +1,103 @@
+﻿#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "ThreadPool.h"
+
+// テクスチャのミップレベルを粗い方から少しずつ転送するための CPU 側の管理
+// 全レベルのデータはバックグラウンドスレッドで用意し（デコード・ミップチェーン生成・圧縮など）、
+// 描画スレッドは毎フレーム nextBand で予算内のブロック行を受け取ってイメージへ転送する
+class TextureStreamer {
+public:
+	// レベル1つ分のデータ（blockExtent x blockExtent 画素のブロックを行ごとに並べたもの）
+	struct Level {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		const uint8_t* data = nullptr;
+		uint64_t size = 0;
+	};
+
+	// 全レベルのデータ（レベル0 から順）
+	struct Source {
+		std::vector<Level> levels;
+		std::shared_ptr<const void> owner;	// levels が指すデータの持ち主（マップしたファイルなど）
+	};
+
+	// 1回に転送する範囲（level の firstRow からの rowCount ブロック行）
+	struct Band {
+		uint32_t level = 0;
+		uint32_t width = 0;				// レベルの画素数
+		uint32_t height = 0;
+		uint32_t firstRow = 0;
+		uint32_t rowCount = 0;
+		const uint8_t* data = nullptr;	// レベルの先頭
+		uint64_t size = 0;				// 範囲のバイト数
+		bool completesLevel = false;	// この範囲でレベルの転送が終わる
+	};
+
+	// 転送先のイメージの大きさと形式
+	struct Layout {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t levelCount = 0;
+		uint32_t blockBytes = 4;	// 圧縮していなければ1画素のバイト数
+		uint32_t blockExtent = 1;	// 圧縮していなければ 1
+	};
+
+	// Source を作る関数（バックグラウンドスレッドで、描画と共有しないスレッドプールを渡して実行する）
+	using Loader = std::function<Source(ThreadPool& pool)>;
+
+	TextureStreamer() = default;
+	~TextureStreamer();
+
+	TextureStreamer(const TextureStreamer&) = delete;
+	TextureStreamer& operator=(const TextureStreamer&) = delete;
+
+	// layout のイメージのうち、レベル [0, pendingLevels) の転送を始める（それより粗いレベルは転送済み）
+	// source が読み込み済みならそのまま使い、なければ loader をバックグラウンドスレッドで実行する
+	// データの大きさが layout と合わなければ std::runtime_error（loader の場合は nextBand で投げる）
+	void start(const Layout& layout, uint32_t pendingLevels, Loader loader);
+	void start(const Layout& layout, uint32_t pendingLevels, Source source);
+
+	// 転送が残っているか
+	bool isActive() const { return active; }
+
+	// 予算 budget バイトまで（少なくとも1ブロック行）の次の範囲を返す
+	// データの準備ができていないか、すべて転送し終えていれば false。loader が例外を投げていれば投げ直す
+	bool nextBand(uint64_t budget, Band& band);
+
+	// バックグラウンドスレッドの終了を待ち、データを解放する
+	void finish();
+
+	// 転送したバイト数
+	uint64_t getStreamedBytes() const { return streamedBytes; }
+
+private:
+	Layout layout;
+	bool active = false;
+
+	// バックグラウンドの読み込み
+	std::thread loaderThread;
+	std::mutex mutex;
+	std::atomic<bool> loaded{ false };
+	Source source;
+	std::exception_ptr loadError;
+
+	// 転送の進み具合（粗いレベルから順に進める）
+	uint32_t currentLevel = 0;	// 転送中のレベル + 1（0 なら終わり）
+	uint32_t currentRow = 0;
+	uint64_t streamedBytes = 0;
+
+	// 転送の進み具合を最初に戻す
+	void reset(const Layout& layout, uint32_t pendingLevels);
+
+	// 読み込んだ source の各レベルの大きさが layout と合うか確かめる
+	void validateSource() const;
+};
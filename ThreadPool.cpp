@@ -0,0 +1,118 @@
+﻿#include "ThreadPool.h"
+
+#include <algorithm>
+
+// ワーカーを起動する
+ThreadPool::ThreadPool(size_t workerCount)
+{
+	workers.reserve(workerCount);
+	for (size_t i = 0; i < workerCount; i++) {
+		workers.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+// ワーカーを停止する
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wakeCondition.notify_all();
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+// ハードウェアスレッド数から呼び出しスレッドの分を引いた数
+size_t ThreadPool::defaultWorkerCount()
+{
+	unsigned int hardwareThreads = std::thread::hardware_concurrency();
+	return hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+}
+
+// func(0) ～ func(count - 1) を並列に実行する
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& func)
+{
+	if (count == 0) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> jobLock(jobMutex);
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &func;
+		jobCount = count;
+		nextIndex = 0;
+		firstError = nullptr;
+		generation++;
+	}
+	if (count > 1) {
+		wakeCondition.notify_all();
+	}
+
+	runJob();
+
+	// ワーカーが処理中のインデックスを終えるまで待つ
+	std::exception_ptr error;
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		doneCondition.wait(lock, [this]() { return activeWorkers == 0; });
+		job = nullptr;
+		error = firstError;
+		firstError = nullptr;
+	}
+
+	if (error) {
+		std::rethrow_exception(error);
+	}
+}
+
+// ワーカーのメインループ
+void ThreadPool::workerLoop()
+{
+	uint64_t seenGeneration = 0;
+
+	for (;;) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wakeCondition.wait(lock, [&]() { return stopping || (job != nullptr && generation != seenGeneration); });
+			if (stopping) {
+				return;
+			}
+			seenGeneration = generation;
+			activeWorkers++;
+		}
+
+		runJob();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			activeWorkers--;
+		}
+		doneCondition.notify_one();
+	}
+}
+
+// ジョブのインデックスを取り出せる限り実行する
+void ThreadPool::runJob()
+{
+	for (;;) {
+		size_t index = nextIndex.fetch_add(1);
+		if (index >= jobCount) {
+			return;
+		}
+
+		try {
+			(*job)(index);
+		}
+		catch (...) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!firstError) {
+				firstError = std::current_exception();
+			}
+		}
+	}
+}
@@ -0,0 +1,54 @@
+﻿#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// 固定数のワーカースレッドで parallelFor を実行するスレッドプール
+// ジョブは一度に1つだけ実行し、呼び出しスレッドも処理に加わる
+class ThreadPool {
+public:
+	// workerCount 個のワーカーを起動する（0 なら呼び出しスレッドだけで実行する）
+	explicit ThreadPool(size_t workerCount = defaultWorkerCount());
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// 呼び出しスレッドを含めた並列数
+	size_t size() const { return workers.size() + 1; }
+
+	// func(0) ～ func(count - 1) を並列に実行し、すべて終わるまで待つ
+	// func が例外を投げた場合は、残りの処理を終えてから最初の例外を投げ直す
+	void parallelFor(size_t count, const std::function<void(size_t)>& func);
+
+	// ハードウェアスレッド数から呼び出しスレッドの分を引いた数
+	static size_t defaultWorkerCount();
+
+private:
+	std::vector<std::thread> workers;
+
+	std::mutex jobMutex;		// parallelFor の同時呼び出しを直列化する
+	std::mutex mutex;
+	std::condition_variable wakeCondition;
+	std::condition_variable doneCondition;
+	bool stopping = false;
+	uint64_t generation = 0;	// ジョブごとに増える
+
+	// 実行中のジョブ
+	const std::function<void(size_t)>* job = nullptr;
+	size_t jobCount = 0;
+	std::atomic<size_t> nextIndex{ 0 };
+	size_t activeWorkers = 0;	// ジョブを処理中のワーカー数
+	std::exception_ptr firstError;
+
+	void workerLoop();
+
+	// ジョブのインデックスを取り出せる限り実行する
+	void runJob();
+};
@@ -0,0 +1,180 @@
+﻿#include "UploadQueue.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+// 初期化
+void UploadQueue::init(VkDevice device, VkQueue queue, uint32_t queueFamilyIndex)
+{
+	this->device = device;
+	this->queue = queue;
+	this->queueFamilyIndex = queueFamilyIndex;
+
+	VkCommandPoolCreateInfo poolInfo = {};
+	poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex = queueFamilyIndex;
+	poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+		throw std::runtime_error("failed to create upload command pool!");
+	}
+}
+
+// 破棄
+void UploadQueue::destroy()
+{
+	submit();
+	waitIdle();
+
+	for (auto& batch : freeBatches) {
+		vkDestroyFence(device, batch.fence, nullptr);
+		vkFreeCommandBuffers(device, commandPool, 1, &batch.commandBuffer);
+	}
+	freeBatches.clear();
+
+	vkDestroyCommandPool(device, commandPool, nullptr);
+}
+
+// 記録中のコマンドバッファを返す
+VkCommandBuffer UploadQueue::getCommandBuffer()
+{
+	if (recording.commandBuffer != VK_NULL_HANDLE) {
+		return recording.commandBuffer;
+	}
+
+	if (!freeBatches.empty()) {
+		// 完了済みのバッチのコマンドバッファとフェンスを再利用する
+		recording.commandBuffer = freeBatches.back().commandBuffer;
+		recording.fence = freeBatches.back().fence;
+		freeBatches.pop_back();
+
+		vkResetCommandBuffer(recording.commandBuffer, 0);
+		vkResetFences(device, 1, &recording.fence);
+	}
+	else {
+		VkCommandBufferAllocateInfo allocInfo = {};
+		allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool = commandPool;
+		allocInfo.commandBufferCount = 1;
+
+		if (vkAllocateCommandBuffers(device, &allocInfo, &recording.commandBuffer) != VK_SUCCESS) {
+			throw std::runtime_error("failed to allocate upload command buffer!");
+		}
+
+		VkFenceCreateInfo fenceInfo = {};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		if (vkCreateFence(device, &fenceInfo, nullptr, &recording.fence) != VK_SUCCESS) {
+			throw std::runtime_error("failed to create upload fence!");
+		}
+	}
+
+	VkCommandBufferBeginInfo beginInfo = {};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (vkBeginCommandBuffer(recording.commandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("failed to begin recording upload command buffer!");
+	}
+
+	return recording.commandBuffer;
+}
+
+// 記録中のバッチの完了後に実行する処理を登録する
+void UploadQueue::onComplete(std::function<void()> callback)
+{
+	getCommandBuffer();
+	recording.callbacks.push_back(std::move(callback));
+}
+
+// 記録済みのコマンドをサブミットする
+UploadQueue::Ticket UploadQueue::submit()
+{
+	if (recording.commandBuffer == VK_NULL_HANDLE) {
+		return lastSubmitted;
+	}
+
+	if (vkEndCommandBuffer(recording.commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("failed to record upload command buffer!");
+	}
+
+	VkSubmitInfo submitInfo = {};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &recording.commandBuffer;
+
+	if (vkQueueSubmit(queue, 1, &submitInfo, recording.fence) != VK_SUCCESS) {
+		throw std::runtime_error("failed to submit upload command buffer!");
+	}
+
+	recording.ticket = ++lastSubmitted;
+	inFlight.push_back(std::move(recording));
+	recording = Batch();
+
+	return lastSubmitted;
+}
+
+// チケットのバッチが完了しているか
+bool UploadQueue::isComplete(Ticket ticket)
+{
+	collectCompleted();
+
+	if (ticket > lastSubmitted) {
+		return false;
+	}
+	return std::none_of(inFlight.begin(), inFlight.end(),
+		[ticket](const Batch& batch) { return batch.ticket == ticket; });
+}
+
+// チケットのバッチが完了するまで待つ
+void UploadQueue::wait(Ticket ticket)
+{
+	if (ticket > lastSubmitted) {
+		throw std::logic_error("waiting for an upload that has not been submitted!");
+	}
+
+	for (auto& batch : inFlight) {
+		if (batch.ticket == ticket) {
+			vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+			break;
+		}
+	}
+
+	collectCompleted();
+}
+
+// サブミット済みのすべてのバッチの完了を待つ
+void UploadQueue::waitIdle()
+{
+	for (auto& batch : inFlight) {
+		vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+	}
+
+	collectCompleted();
+}
+
+// 完了したバッチの後処理を行う
+void UploadQueue::collectCompleted()
+{
+	for (size_t i = 0; i < inFlight.size();) {
+		if (vkGetFenceStatus(device, inFlight[i].fence) == VK_SUCCESS) {
+			retire(inFlight[i]);
+			inFlight.erase(inFlight.begin() + i);
+		}
+		else {
+			i++;
+		}
+	}
+}
+
+// バッチの後処理を行い、再利用リストへ移す
+void UploadQueue::retire(Batch& batch)
+{
+	for (auto& callback : batch.callbacks) {
+		callback();
+	}
+	batch.callbacks.clear();
+
+	freeBatches.push_back(std::move(batch));
+}
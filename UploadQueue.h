@@ -0,0 +1,68 @@
+﻿#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <vector>
+#include <functional>
+
+// 転送コマンドを1つのコマンドバッファにまとめて記録し、フェンス付きで非同期にサブミットする
+// サブミットごとにチケットを返し、呼び出し側はポーリングまたは待機で完了を確認する
+class UploadQueue {
+public:
+	// サブミットしたバッチを識別する番号（0 は常に完了済み扱い）
+	using Ticket = uint64_t;
+
+	// 初期化（論理デバイス・キュー取得後に呼ぶ）
+	void init(VkDevice device, VkQueue queue, uint32_t queueFamilyIndex);
+
+	// 未サブミットのバッチもサブミットし、完了を待ってから破棄する
+	void destroy();
+
+	// 記録中のコマンドバッファを返す（なければ記録を開始する）
+	VkCommandBuffer getCommandBuffer();
+
+	// 記録中のバッチが完了した後に実行する処理を登録する（ステージングバッファの解放など）
+	void onComplete(std::function<void()> callback);
+
+	// 記録済みのコマンドをサブミットし、チケットを返す
+	// 何も記録されていなければ直前にサブミットしたチケットを返す
+	Ticket submit();
+
+	// チケットのバッチが完了しているか
+	bool isComplete(Ticket ticket);
+
+	// チケットのバッチが完了するまで待つ
+	void wait(Ticket ticket);
+
+	// サブミット済みのすべてのバッチの完了を待つ
+	void waitIdle();
+
+	// 完了したバッチの後処理を行い、コマンドバッファとフェンスを再利用に回す
+	void collectCompleted();
+
+	// サブミット済みで未完了のバッチ数
+	size_t pendingCount() const { return inFlight.size(); }
+
+	uint32_t getQueueFamilyIndex() const { return queueFamilyIndex; }
+
+private:
+	struct Batch {
+		VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+		VkFence fence = VK_NULL_HANDLE;
+		Ticket ticket = 0;
+		std::vector<std::function<void()>> callbacks;
+	};
+
+	VkDevice device = VK_NULL_HANDLE;
+	VkQueue queue = VK_NULL_HANDLE;
+	uint32_t queueFamilyIndex = 0;
+	VkCommandPool commandPool = VK_NULL_HANDLE;
+
+	Batch recording;				// 記録中のバッチ
+	std::vector<Batch> inFlight;	// サブミット済みで未完了のバッチ
+	std::vector<Batch> freeBatches;	// 再利用できるコマンドバッファとフェンス
+	Ticket lastSubmitted = 0;
+
+	// バッチの後処理を行い、再利用リストへ移す
+	void retire(Batch& batch);
+};
@@ -0,0 +1,223 @@
+﻿#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// 量子化して保存した頂点属性を元の値に戻す変換（元の値 = 保存した値 * scale + offset）
+// 頂点シェーダーがユニフォームで受け取って戻す。量子化しない属性は scale = 1, offset = 0 のまま
+struct VertexDequantization {
+	glm::vec3 positionScale = glm::vec3(1.0f);
+	glm::vec3 positionOffset = glm::vec3(0.0f);
+	glm::vec2 texCoordScale = glm::vec2(1.0f);
+	glm::vec2 texCoordOffset = glm::vec2(0.0f);
+};
+
+// 半精度浮動小数点数との変換（最近接偶数への丸め）
+uint16_t packHalf(float value);
+float unpackHalf(uint16_t value);
+
+// 位置の形式
+// QUANTIZED な形式は、メッシュの AABB を [-1, 1] に縮めた値を保存する
+// 3成分の 16bit 形式は頂点入力に使えない GPU が多いので、16bit の形式は4成分にして w を詰め物にする
+struct PositionFloat32 {
+	static const VkFormat FORMAT = VK_FORMAT_R32G32B32_SFLOAT;
+	static const bool QUANTIZED = false;
+
+	float value[3];
+
+	void encode(const glm::vec3& p) { value[0] = p.x; value[1] = p.y; value[2] = p.z; }
+	glm::vec3 decode() const { return glm::vec3(value[0], value[1], value[2]); }
+};
+
+struct PositionFloat16 {
+	static const VkFormat FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+	static const bool QUANTIZED = true;
+
+	uint16_t value[4];
+
+	void encode(const glm::vec3& p) { value[0] = packHalf(p.x); value[1] = packHalf(p.y); value[2] = packHalf(p.z); value[3] = 0; }
+	glm::vec3 decode() const { return glm::vec3(unpackHalf(value[0]), unpackHalf(value[1]), unpackHalf(value[2])); }
+};
+
+struct PositionSnorm16 {
+	static const VkFormat FORMAT = VK_FORMAT_R16G16B16A16_SNORM;
+	static const bool QUANTIZED = true;
+
+	int16_t value[4];
+
+	void encode(const glm::vec3& p) { value[0] = toSnorm(p.x); value[1] = toSnorm(p.y); value[2] = toSnorm(p.z); value[3] = 0; }
+	glm::vec3 decode() const { return glm::vec3(fromSnorm(value[0]), fromSnorm(value[1]), fromSnorm(value[2])); }
+
+	static int16_t toSnorm(float x) { return static_cast<int16_t>(std::lround(std::min(std::max(x, -1.0f), 1.0f) * 32767.0f)); }
+	static float fromSnorm(int16_t x) { return std::max(static_cast<float>(x) / 32767.0f, -1.0f); }
+};
+
+// テクスチャ座標の形式
+// QUANTIZED な形式は [0, 1] の値を保存する（範囲外の座標を含むメッシュは座標の範囲を [0, 1] に縮める）
+struct TexCoordFloat32 {
+	static const VkFormat FORMAT = VK_FORMAT_R32G32_SFLOAT;
+	static const bool QUANTIZED = false;
+
+	float value[2];
+
+	void encode(const glm::vec2& uv) { value[0] = uv.x; value[1] = uv.y; }
+};
+
+struct TexCoordUnorm16 {
+	static const VkFormat FORMAT = VK_FORMAT_R16G16_UNORM;
+	static const bool QUANTIZED = true;
+
+	uint16_t value[2];
+
+	void encode(const glm::vec2& uv) { value[0] = toUnorm(uv.x); value[1] = toUnorm(uv.y); }
+
+	static uint16_t toUnorm(float x) { return static_cast<uint16_t>(std::lround(std::min(std::max(x, 0.0f), 1.0f) * 65535.0f)); }
+};
+
+// 頂点カラーの形式
+struct ColorFloat32 {
+	static const VkFormat FORMAT = VK_FORMAT_R32G32B32_SFLOAT;
+
+	float value[3];
+
+	void encode(const glm::vec3& c) { value[0] = c.r; value[1] = c.g; value[2] = c.b; }
+};
+
+struct ColorUnorm8 {
+	static const VkFormat FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
+
+	uint8_t value[4];
+
+	void encode(const glm::vec3& c) { value[0] = toUnorm(c.r); value[1] = toUnorm(c.g); value[2] = toUnorm(c.b); value[3] = 255; }
+
+	static uint8_t toUnorm(float x) { return static_cast<uint8_t>(std::lround(std::min(std::max(x, 0.0f), 1.0f) * 255.0f)); }
+};
+
+// 頂点カラーを持たない（頂点シェーダーは白として扱う。shaders/shader.vert を VERTEX_COLOR なしでコンパイルしたものを使う）
+struct NoColor {
+};
+
+// 属性を並べた頂点の中身（NoColor のときはカラーの領域を持たない）
+template<typename Position, typename TexCoord, typename Color>
+struct PackedVertexData {
+	Position pos;
+	TexCoord texCoord;
+	Color color;
+};
+
+template<typename Position, typename TexCoord>
+struct PackedVertexData<Position, TexCoord, NoColor> {
+	Position pos;
+	TexCoord texCoord;
+};
+
+// GPU に送る頂点の形式。属性ごとの形式を組み合わせ、頂点入力の記述と符号化をまとめて生成する
+// 位置はロケーション0、カラーは1、テクスチャ座標は2に割り当てる
+template<typename Position, typename TexCoord, typename Color>
+struct PackedVertex : PackedVertexData<Position, TexCoord, Color> {
+	using Data = PackedVertexData<Position, TexCoord, Color>;
+
+	static const bool HAS_COLOR = !std::is_same<Color, NoColor>::value;
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription = {};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(PackedVertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+		return bindingDescription;
+	}
+
+	static std::vector<VkVertexInputAttributeDescription> getAttributeDescriptions() {
+		std::vector<VkVertexInputAttributeDescription> attributeDescriptions;
+
+		VkVertexInputAttributeDescription attribute = {};
+		attribute.binding = 0;
+
+		attribute.location = 0;
+		attribute.format = Position::FORMAT;
+		attribute.offset = offsetof(Data, pos);
+		attributeDescriptions.push_back(attribute);
+
+		if constexpr (HAS_COLOR) {
+			attribute.location = 1;
+			attribute.format = Color::FORMAT;
+			attribute.offset = offsetof(Data, color);
+			attributeDescriptions.push_back(attribute);
+		}
+
+		attribute.location = 2;
+		attribute.format = TexCoord::FORMAT;
+		attribute.offset = offsetof(Data, texCoord);
+		attributeDescriptions.push_back(attribute);
+
+		return attributeDescriptions;
+	}
+
+	// 属性の範囲から、量子化する属性をその形式の範囲に収める変換を求める
+	static VertexDequantization getDequantization(
+		const glm::vec3& positionMin,
+		const glm::vec3& positionMax,
+		const glm::vec2& texCoordMin,
+		const glm::vec2& texCoordMax) {
+		VertexDequantization dequantization;
+
+		if constexpr (Position::QUANTIZED) {
+			// 一番長い軸に合わせて3軸とも同じスケールにする（軸ごとに変えると法線の向きの精度が偏る）
+			glm::vec3 extent = (positionMax - positionMin) * 0.5f;
+			float scale = std::max(std::max(extent.x, extent.y), extent.z);
+			dequantization.positionScale = glm::vec3(scale > 0.0f ? scale : 1.0f);
+			dequantization.positionOffset = (positionMin + positionMax) * 0.5f;
+		}
+
+		if constexpr (TexCoord::QUANTIZED) {
+			for (int i = 0; i < 2; i++) {
+				if (texCoordMin[i] < 0.0f || texCoordMax[i] > 1.0f) {
+					float extent = texCoordMax[i] - texCoordMin[i];
+					dequantization.texCoordScale[i] = extent > 0.0f ? extent : 1.0f;
+					dequantization.texCoordOffset[i] = texCoordMin[i];
+				}
+			}
+		}
+
+		return dequantization;
+	}
+
+	static PackedVertex encode(
+		const glm::vec3& pos,
+		const glm::vec3& color,
+		const glm::vec2& texCoord,
+		const VertexDequantization& dequantization) {
+		PackedVertex vertex = {};
+		vertex.pos.encode((pos - dequantization.positionOffset) / dequantization.positionScale);
+		vertex.texCoord.encode((texCoord - dequantization.texCoordOffset) / dequantization.texCoordScale);
+		if constexpr (HAS_COLOR) {
+			vertex.color.encode(color);
+		}
+		return vertex;
+	}
+
+	// メッシュ空間の位置に戻す
+	glm::vec3 decodePosition(const VertexDequantization& dequantization) const {
+		return this->pos.decode() * dequantization.positionScale + dequantization.positionOffset;
+	}
+};
+
+// 元の形式（32 バイト）
+using FloatVertex = PackedVertex<PositionFloat32, TexCoordFloat32, ColorFloat32>;
+
+// 半精度の位置と 16bit のテクスチャ座標（12 バイト）
+using HalfVertex = PackedVertex<PositionFloat16, TexCoordUnorm16, NoColor>;
+
+// 16bit に量子化した位置とテクスチャ座標（12 バイト）
+using CompactVertex = PackedVertex<PositionSnorm16, TexCoordUnorm16, NoColor>;
+
+// CompactVertex に 8bit の頂点カラーを加えたもの（16 バイト）
+using CompactColorVertex = PackedVertex<PositionSnorm16, TexCoordUnorm16, ColorUnorm8>;
@@ -0,0 +1,263 @@
+﻿#include "VirtualTexture.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "BlockCompressor.h"
+#include "Ktx2File.h"
+#include "TextureBaker.h"
+
+// 各レベルのページ数を数える
+VirtualTextureLayout VirtualTextureLayout::create(uint32_t width, uint32_t height, uint32_t pageSize, uint32_t border)
+{
+	if (width == 0 || height == 0 || pageSize == 0 || pageSize % 4 != 0 || border % 4 != 0) {
+		throw std::invalid_argument("virtual texture page size and border must be multiples of 4!");
+	}
+
+	VirtualTextureLayout layout;
+	layout.width = width;
+	layout.height = height;
+	layout.pageSize = pageSize;
+	layout.border = border;
+	for (uint32_t level = 0; ; level++) {
+		Level entry;
+		entry.width = std::max(width >> level, 1u);
+		entry.height = std::max(height >> level, 1u);
+		entry.pagesX = (entry.width + pageSize - 1) / pageSize;
+		entry.pagesY = (entry.height + pageSize - 1) / pageSize;
+		entry.firstPage = layout.pageCount;
+		layout.pageCount += entry.pagesX * entry.pagesY;
+		layout.levels.push_back(entry);
+
+		if (entry.pagesX * entry.pagesY == 1) {
+			break;
+		}
+		if (layout.levels.size() == MAX_LEVELS) {
+			throw std::invalid_argument("virtual texture needs too many levels for its page size!");
+		}
+	}
+	return layout;
+}
+
+// レベル level の (x, y) 番目のページの番号
+uint32_t VirtualTextureLayout::getPageIndex(uint32_t level, uint32_t x, uint32_t y) const
+{
+	const Level& entry = levels[level];
+	return entry.firstPage + y * entry.pagesX + x;
+}
+
+// page のレベルと位置
+void VirtualTextureLayout::getPageCoord(uint32_t page, uint32_t& level, uint32_t& x, uint32_t& y) const
+{
+	level = 0;
+	while (level + 1 < levels.size() && page >= levels[level + 1].firstPage) {
+		level++;
+	}
+	const uint32_t index = page - levels[level].firstPage;
+	x = index % levels[level].pagesX;
+	y = index / levels[level].pagesX;
+}
+
+// 1つ粗いレベルで同じ場所を覆うページ
+uint32_t VirtualTextureLayout::getParentPage(uint32_t page) const
+{
+	uint32_t level, x, y;
+	getPageCoord(page, level, x, y);
+	if (level + 1 == levels.size()) {
+		return page;
+	}
+	const Level& parent = levels[level + 1];
+	return getPageIndex(level + 1, std::min(x / 2, parent.pagesX - 1), std::min(y / 2, parent.pagesY - 1));
+}
+
+// タイル1枚のバイト数
+uint64_t VirtualTextureFile::getTileBytes(VkFormat format, uint32_t tileSize)
+{
+	uint32_t blockBytes, blockExtent;
+	if (!Ktx2File::getBlockInfo(format, blockBytes, blockExtent) || tileSize % blockExtent != 0) {
+		return 0;
+	}
+	const uint64_t blocks = tileSize / blockExtent;
+	return blocks * blocks * blockBytes;
+}
+
+// ファイルを開く
+bool VirtualTextureFile::open(
+	const std::string& path,
+	const MeshCache::SourceInfo& source,
+	VkFormat expectedFormat,
+	uint32_t pageSize,
+	uint32_t border,
+	MipFilter mipFilter)
+{
+	close();
+
+	FileView mapped;
+	try {
+		mapped = FileView::open(path);
+	}
+	catch (const std::runtime_error&) {
+		return false;
+	}
+
+	// ヘッダーを検証する
+	Header header;
+	if (mapped.size() < sizeof(header)) {
+		return false;
+	}
+	std::memcpy(&header, mapped.data(), sizeof(header));
+
+	if (header.magic != MAGIC || header.version != VERSION
+		|| header.sourceHash != source.hash || header.sourceSize != source.size
+		|| header.format != static_cast<uint32_t>(expectedFormat)
+		|| header.pageSize != pageSize || header.border != border
+		|| header.mipFilter != static_cast<uint32_t>(mipFilter)
+		|| header.width == 0 || header.height == 0) {
+		return false;
+	}
+
+	VirtualTextureLayout loadedLayout;
+	try {
+		loadedLayout = VirtualTextureLayout::create(header.width, header.height, header.pageSize, header.border);
+	}
+	catch (const std::invalid_argument&) {
+		return false;
+	}
+
+	// 全タイルがファイルに収まっているか
+	const uint64_t loadedTileBytes = getTileBytes(expectedFormat, loadedLayout.getTileSize());
+	const uint64_t loadedDataOffset = alignUp(sizeof(Header), DATA_ALIGNMENT);
+	if (loadedTileBytes == 0 || mapped.size() < loadedDataOffset
+		|| (mapped.size() - loadedDataOffset) / loadedTileBytes < loadedLayout.pageCount) {
+		return false;
+	}
+
+	file = std::move(mapped);
+	format = expectedFormat;
+	layout = std::move(loadedLayout);
+	tileBytes = loadedTileBytes;
+	dataOffset = loadedDataOffset;
+	return true;
+}
+
+// マップを解除する
+void VirtualTextureFile::close()
+{
+	file.reset();
+	format = VK_FORMAT_UNDEFINED;
+	layout = VirtualTextureLayout();
+	tileBytes = 0;
+	dataOffset = 0;
+}
+
+// page のタイル
+const void* VirtualTextureFile::getTile(uint32_t page) const
+{
+	return file.data() + dataOffset + tileBytes * page;
+}
+
+// ファイルを書き出す
+bool VirtualTextureFile::write(
+	const std::string& path,
+	const MeshCache::SourceInfo& source,
+	VkFormat format,
+	MipFilter mipFilter,
+	const VirtualTextureLayout& layout,
+	const std::vector<uint8_t>& tiles)
+{
+	if (tiles.size() != getTileBytes(format, layout.getTileSize()) * layout.pageCount) {
+		throw std::invalid_argument("virtual texture tiles do not match the layout!");
+	}
+
+	Header header = {};
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.sourceHash = source.hash;
+	header.sourceSize = source.size;
+	header.format = static_cast<uint32_t>(format);
+	header.width = layout.width;
+	header.height = layout.height;
+	header.pageSize = layout.pageSize;
+	header.border = layout.border;
+	header.mipFilter = static_cast<uint32_t>(mipFilter);
+
+	return writeFileAtomically(path, [&](std::ostream& out) {
+		static const char padding[DATA_ALIGNMENT] = {};
+		out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		out.write(padding, static_cast<std::streamsize>(alignUp(sizeof(Header), DATA_ALIGNMENT) - sizeof(Header)));
+		out.write(reinterpret_cast<const char*>(tiles.data()), static_cast<std::streamsize>(tiles.size()));
+	});
+}
+
+// 画像をデコードしてミップチェーンを作り、タイルに切り分ける
+std::vector<uint8_t> bakeVirtualTexture(
+	const void* encoded,
+	size_t size,
+	VkFormat format,
+	uint32_t pageSize,
+	uint32_t border,
+	MipFilter mipFilter,
+	ThreadPool& pool,
+	VirtualTextureLayout& layout)
+{
+	if (!isBakeableFormat(format)) {
+		throw std::invalid_argument("unsupported virtual texture format!");
+	}
+
+	DecodedImage image = decodeImage(encoded, size, pool);
+	layout = VirtualTextureLayout::create(image.width, image.height, pageSize, border);
+	std::vector<MipLevel> mipChain = generateMipChain(
+		std::move(image.rgba), image.width, image.height, layout.getLevelCount(), mipFilter, isSrgbFormat(format), pool);
+
+	const uint32_t tileSize = layout.getTileSize();
+	const uint64_t tileBytes = VirtualTextureFile::getTileBytes(format, tileSize);
+	std::vector<uint8_t> tiles(static_cast<size_t>(tileBytes * layout.pageCount));
+
+	pool.parallelFor(layout.pageCount, [&](size_t page) {
+		uint32_t level, pageX, pageY;
+		layout.getPageCoord(static_cast<uint32_t>(page), level, pageX, pageY);
+		const MipLevel& mip = mipChain[level];
+
+		// 境界も含めて画素を集める（テクスチャの外は REPEAT と同じく反対側の画素）
+		std::vector<uint8_t> rgba(static_cast<size_t>(tileSize) * tileSize * 4);
+		const int64_t originX = static_cast<int64_t>(pageX) * pageSize - border;
+		const int64_t originY = static_cast<int64_t>(pageY) * pageSize - border;
+		for (uint32_t y = 0; y < tileSize; y++) {
+			const int64_t srcY = ((originY + y) % mip.height + mip.height) % mip.height;
+			const uint8_t* srcRow = mip.rgba.data() + static_cast<size_t>(srcY) * mip.width * 4;
+			for (uint32_t x = 0; x < tileSize; x++) {
+				const int64_t srcX = ((originX + x) % mip.width + mip.width) % mip.width;
+				std::memcpy(&rgba[(static_cast<size_t>(y) * tileSize + x) * 4], srcRow + srcX * 4, 4);
+			}
+		}
+
+		uint8_t* output = tiles.data() + tileBytes * page;
+		if (format == VK_FORMAT_R8G8B8A8_SRGB) {
+			std::memcpy(output, rgba.data(), rgba.size());
+			return;
+		}
+
+		// ブロック圧縮する（ページごとに並列に処理しているので、ブロックは1スレッドで順に圧縮する）
+		const uint32_t blockBytes = static_cast<uint32_t>(tileBytes / ((tileSize / 4) * (tileSize / 4)));
+		uint8_t pixels[4 * 4 * 4];
+		for (uint32_t blockY = 0; blockY < tileSize / 4; blockY++) {
+			for (uint32_t blockX = 0; blockX < tileSize / 4; blockX++) {
+				for (uint32_t row = 0; row < 4; row++) {
+					std::memcpy(pixels + row * 16, &rgba[((static_cast<size_t>(blockY) * 4 + row) * tileSize + blockX * 4) * 4], 16);
+				}
+				uint8_t* block = output + (static_cast<size_t>(blockY) * (tileSize / 4) + blockX) * blockBytes;
+				if (format == VK_FORMAT_BC1_RGB_SRGB_BLOCK) {
+					compressBlockBc1(pixels, block);
+				}
+				else if (format == VK_FORMAT_BC3_SRGB_BLOCK) {
+					compressBlockBc3(pixels, block);
+				}
+				else {
+					compressBlockBc7(pixels, block);
+				}
+			}
+		}
+	});
+	return tiles;
+}
@@ -0,0 +1,134 @@
+﻿#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "MappedFile.h"
+#include "MeshCache.h"
+#include "MipGenerator.h"
+#include "ThreadPool.h"
+
+// 仮想テクスチャのページの並び
+// 各レベルを pageSize 画素角のページに分け、レベル0 の左上から行ごとに、続けて粗いレベルのページを番号順に並べる
+// ページは周囲に border 画素の境界（テクスチャの端では反対側の画素）を付けた tileSize 画素角のタイルとして保存・転送する
+struct VirtualTextureLayout {
+	static const uint32_t MAX_LEVELS = 16;	// shaders/shader.frag の PageTable.levels と同じ
+
+	struct Level {
+		uint32_t width = 0;
+		uint32_t height = 0;
+		uint32_t pagesX = 0;
+		uint32_t pagesY = 0;
+		uint32_t firstPage = 0;
+	};
+
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t pageSize = 0;
+	uint32_t border = 0;
+	uint32_t pageCount = 0;
+	std::vector<Level> levels;
+
+	// width x height のテクスチャを分ける（最も粗いレベルが1ページに収まるまでレベルを作る）
+	// pageSize と border がブロック圧縮できる 4 の倍数でなければ std::invalid_argument
+	static VirtualTextureLayout create(uint32_t width, uint32_t height, uint32_t pageSize, uint32_t border);
+
+	uint32_t getLevelCount() const { return static_cast<uint32_t>(levels.size()); }
+	uint32_t getTileSize() const { return pageSize + border * 2; }
+
+	// レベル level の (x, y) 番目のページの番号
+	uint32_t getPageIndex(uint32_t level, uint32_t x, uint32_t y) const;
+
+	// page のレベルと位置
+	void getPageCoord(uint32_t page, uint32_t& level, uint32_t& x, uint32_t& y) const;
+
+	// page を覆う1つ粗いレベルのページ（最も粗いレベルなら page）
+	uint32_t getParentPage(uint32_t page) const;
+};
+
+// 仮想テクスチャの全ページを保存するファイル
+// 読み込み時はファイルをマップし、要求されたページだけをそのままステージングへコピーする（OS も触れたページだけを読む）
+// 元ファイルの識別情報は MeshCache と同じもの（MeshCache::hashSource）を使い、形式・ページの大きさ・フィルターが違えば作り直す
+//
+// ファイル構成: Header | ページ0 のタイル | ページ1 のタイル | ...
+// タイルはすべて同じバイト数で、先頭を DATA_ALIGNMENT に揃える
+class VirtualTextureFile {
+public:
+	static const uint32_t MAGIC = 0x47505456;	// "VTPG"
+	static const uint32_t VERSION = 2;
+	static const uint64_t DATA_ALIGNMENT = 16;
+
+	// ファイルを開き、元ファイル・形式・ページの大きさ・フィルターと一致すれば true
+	bool open(
+		const std::string& path,
+		const MeshCache::SourceInfo& source,
+		VkFormat format,
+		uint32_t pageSize,
+		uint32_t border,
+		MipFilter mipFilter);
+
+	// マップを解除する
+	void close();
+
+	bool isOpen() const { return !file.empty(); }
+
+	VkFormat getFormat() const { return format; }
+	const VirtualTextureLayout& getLayout() const { return layout; }
+
+	// タイル1枚のバイト数
+	uint64_t getTileBytes() const { return tileBytes; }
+
+	// page のタイル（マップしたファイルを指す）
+	const void* getTile(uint32_t page) const;
+
+	// format で tileSize 画素角のタイル1枚を符号化したバイト数（扱えない形式なら 0）
+	static uint64_t getTileBytes(VkFormat format, uint32_t tileSize);
+
+	// ファイルを書き出す（一時ファイルに書いてから置き換える）
+	// tiles は layout.pageCount 枚のタイルを番号順に並べたもの。書き出せなければ false
+	static bool write(
+		const std::string& path,
+		const MeshCache::SourceInfo& source,
+		VkFormat format,
+		MipFilter mipFilter,
+		const VirtualTextureLayout& layout,
+		const std::vector<uint8_t>& tiles);
+
+private:
+	// ファイル先頭のヘッダー
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+		uint64_t sourceHash;
+		uint64_t sourceSize;
+		uint32_t format;
+		uint32_t width;
+		uint32_t height;
+		uint32_t pageSize;
+		uint32_t border;
+		uint32_t mipFilter;
+	};
+
+	FileView file;
+	VkFormat format = VK_FORMAT_UNDEFINED;
+	VirtualTextureLayout layout;
+	uint64_t tileBytes = 0;
+	uint64_t dataOffset = 0;
+};
+
+// decodeImage で読める画像をデコードしてミップチェーンを mipFilter で作り（縮小は isSrgbFormat(format) に従う）、
+// 境界付きのタイルに切り分けて format（VK_FORMAT_R8G8B8A8_SRGB と BC1_RGB / BC3 / BC7 の SRGB）で符号化する
+// タイルはページごとに pool で並列に作る。layout にページの並びを返す
+std::vector<uint8_t> bakeVirtualTexture(
+	const void* encoded,
+	size_t size,
+	VkFormat format,
+	uint32_t pageSize,
+	uint32_t border,
+	MipFilter mipFilter,
+	ThreadPool& pool,
+	VirtualTextureLayout& layout);
@@ -1,10 +1,137 @@
 ﻿#include "HelloTriangleApp.h"
 #include <cstdlib>
+#include <string>
 
-int main() {
-	HelloTriangleApplication app;
+// コマンドライン引数から起動オプションを読み取る
+static HelloTriangleApplication::Options parseOptions(int argc, char** argv) {
+	HelloTriangleApplication::Options options;
 
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+
+		if (arg == "--frames-in-flight" && i + 1 < argc) {
+			options.maxFramesInFlight = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--headless") {
+			options.headless = true;
+		}
+		else if (arg == "--frames" && i + 1 < argc) {
+			options.benchmarkFrames = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--duration" && i + 1 < argc) {
+			options.benchmarkSeconds = std::stod(argv[++i]);
+		}
+		else if (arg == "--objects" && i + 1 < argc) {
+			options.objectCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--instances" && i + 1 < argc) {
+			options.instanceCount = static_cast<uint32_t>(std::stoul(argv[++i]));
+		}
+		else if (arg == "--culling" && i + 1 < argc) {
+			std::string mode = argv[++i];
+			if (mode == "none") {
+				options.culling = HelloTriangleApplication::CullingMode::None;
+			}
+			else if (mode == "cpu") {
+				options.culling = HelloTriangleApplication::CullingMode::Cpu;
+			}
+			else if (mode == "gpu") {
+				options.culling = HelloTriangleApplication::CullingMode::Gpu;
+			}
+			else {
+				throw std::invalid_argument("unknown culling mode: " + mode);
+			}
+		}
+		else if (arg == "--verify-culling") {
+			options.verifyCulling = true;
+		}
+		else if (arg == "--lod-threshold" && i + 1 < argc) {
+			options.lodThreshold = std::stof(argv[++i]);
+		}
+		else if (arg == "--mip-filter" && i + 1 < argc) {
+			std::string mode = argv[++i];
+			if (mode == "box") {
+				options.mipFilter = MipFilter::Box;
+			}
+			else if (mode == "kaiser") {
+				options.mipFilter = MipFilter::Kaiser;
+			}
+			else {
+				throw std::invalid_argument("unknown mip filter: " + mode);
+			}
+		}
+		else if (arg == "--cpu-mipmaps") {
+			options.cpuMipmaps = true;
+		}
+		else if (arg == "--stream-texture") {
+			options.streamTexture = true;
+		}
+		else if (arg == "--texture-stream-budget" && i + 1 < argc) {
+			options.textureStreamBudgetKiB = std::max(static_cast<uint32_t>(std::stoul(argv[++i])), 1u);
+		}
+		else if (arg == "--virtual-texture") {
+			options.virtualTexture = true;
+		}
+		else if (arg == "--vt-atlas-pages" && i + 1 < argc) {
+			options.virtualTextureAtlasPages = std::max(static_cast<uint32_t>(std::stoul(argv[++i])), 1u);
+		}
+		else if (arg == "--vt-uploads-per-frame" && i + 1 < argc) {
+			options.virtualTextureUploadsPerFrame = std::max(static_cast<uint32_t>(std::stoul(argv[++i])), 1u);
+		}
+		else if (arg == "--bake-textures") {
+			options.bakeTextures = true;
+		}
+		else if (arg == "--benchmark-jpeg" && i + 1 < argc) {
+			options.benchmarkJpegPath = argv[++i];
+		}
+		else if (arg == "--texture-compression" && i + 1 < argc) {
+			std::string mode = argv[++i];
+			if (mode == "none") {
+				options.textureCompression = HelloTriangleApplication::TextureCompression::None;
+			}
+			else if (mode == "bc1") {
+				options.textureCompression = HelloTriangleApplication::TextureCompression::Bc1;
+			}
+			else if (mode == "bc3") {
+				options.textureCompression = HelloTriangleApplication::TextureCompression::Bc3;
+			}
+			else if (mode == "bc7") {
+				options.textureCompression = HelloTriangleApplication::TextureCompression::Bc7;
+			}
+			else {
+				throw std::invalid_argument("unknown texture compression: " + mode);
+			}
+		}
+		else {
+			throw std::invalid_argument("unknown argument: " + arg);
+		}
+	}
+
+	return options;
+}
+
+int main(int argc, char** argv) {
 	try {
+		HelloTriangleApplication::Options options = parseOptions(argc, argv);
+
+		// テクスチャの変換だけを行い、ウィンドウもデバイスも作らずに終了する
+		if (options.bakeTextures) {
+			ThreadPool pool;
+			VkFormat format = HelloTriangleApplication::getCompressedTextureFormat(options.textureCompression);
+			if (bakeTextureDirectory("textures", format, options.mipFilter, pool, std::cout) == 0) {
+				throw std::runtime_error("no textures to bake in textures/");
+			}
+			return EXIT_SUCCESS;
+		}
+
+		// JPEG のデコード速度だけを測って終了する
+		if (!options.benchmarkJpegPath.empty()) {
+			ThreadPool pool;
+			benchmarkJpegDecode(options.benchmarkJpegPath, 10, pool, std::cout);
+			return EXIT_SUCCESS;
+		}
+
+		HelloTriangleApplication app(options);
 		app.run();
 	}
 	catch (const std::exception& e) {
@@ -14,4 +141,3 @@ int main() {
 
 	return EXIT_SUCCESS;
 }
-
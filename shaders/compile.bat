@@ -3,5 +3,10 @@ chcp 65001
 chcp
 
 %VK_SDK_PATH%\Bin32\glslc.exe shader.vert -o vert.spv
+%VK_SDK_PATH%\Bin32\glslc.exe -DVERTEX_COLOR shader.vert -o vert_color.spv
+%VK_SDK_PATH%\Bin32\glslc.exe -DINDIRECT_DRAW shader.vert -o vert_indirect.spv
+%VK_SDK_PATH%\Bin32\glslc.exe -DVERTEX_COLOR -DINDIRECT_DRAW shader.vert -o vert_color_indirect.spv
 %VK_SDK_PATH%\Bin32\glslc.exe shader.frag -o frag.spv
+%VK_SDK_PATH%\Bin32\glslc.exe -DVIRTUAL_TEXTURE shader.frag -o frag_virtual.spv
+%VK_SDK_PATH%\Bin32\glslc.exe cull.comp -o cull.spv
 pause
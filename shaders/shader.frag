@@ -4,10 +4,70 @@
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
 
+#ifdef VIRTUAL_TEXTURE
+// 仮想テクスチャ: 描画に使うページをページテーブルで物理ページのアトラス上のタイルに引き、
+// そのページの番号にフレーム番号を書いて CPU に要求する（フィードバック）
+// 隠れた面のページを要求しないよう、深度テストを先に行う
+layout(early_fragment_tests) in;
+
+layout(binding = 1) uniform sampler2D pageAtlas;
+
+// HelloTriangleApplication::PageTableHeader と同じ並び
+layout(std430, binding = 3) readonly buffer PageTable {
+	uvec4 info;			// 幅, 高さ, レベル数, フレーム番号
+	uvec4 atlas;		// ページの大きさ, 境界の幅, タイルの大きさ, アトラスの大きさ
+	uvec4 levels[16];	// 横のページ数, 縦のページ数, 先頭のページ番号, 0
+	uint entries[];		// スロットの x | y << 8 | 描くページのレベル << 16
+} pageTable;
+
+layout(std430, binding = 4) writeonly buffer Feedback {
+	uint requests[];
+} feedback;
+
+vec3 sampleVirtualTexture(vec2 texCoord) {
+	uvec2 size = pageTable.info.xy;
+	uint pageSize = pageTable.atlas.x;
+
+	// 画面の1画素が覆うレベル0 のテクセル数からレベルを選ぶ
+	vec2 dx = dFdx(texCoord) * vec2(size);
+	vec2 dy = dFdy(texCoord) * vec2(size);
+	float lod = 0.5 * log2(max(max(dot(dx, dx), dot(dy, dy)), 1.0));
+	uint level = min(uint(lod + 0.5), pageTable.info.z - 1u);
+
+	// REPEAT と同じく繰り返す
+	vec2 uv = fract(texCoord);
+	uvec4 levelInfo = pageTable.levels[level];
+	uvec2 pageCoord = min(uvec2(uv * vec2(max(size >> level, uvec2(1u)))) / pageSize, levelInfo.xy - 1u);
+	uint page = levelInfo.z + pageCoord.y * levelInfo.x + pageCoord.x;
+
+	// 2x2 画素のうちフレームごとに替わる1画素だけが書く（同じページへの書き込みを減らす）
+	uvec2 pixel = uvec2(gl_FragCoord.xy) & 1u;
+	uint frame = pageTable.info.w;
+	if (pixel.x + pixel.y * 2u == (frame & 3u)) {
+		feedback.requests[page] = frame;
+	}
+
+	// 常駐していなければページテーブルには常駐している祖先が入っているので、そのレベルでの位置を求める
+	uint entry = pageTable.entries[page];
+	uvec2 slot = uvec2(entry & 0xffu, (entry >> 8) & 0xffu);
+	uint residentLevel = entry >> 16;
+	vec2 texel = uv * vec2(max(size >> residentLevel, uvec2(1u)));
+	vec2 local = texel - vec2(min(uvec2(texel) / pageSize, pageTable.levels[residentLevel].xy - 1u) * pageSize);
+
+	// タイルの境界の内側をバイリニアで読む
+	vec2 atlasTexel = vec2(slot * pageTable.atlas.z + pageTable.atlas.y) + local;
+	return textureLod(pageAtlas, atlasTexel / float(pageTable.atlas.w), 0.0).rgb;
+}
+#else
 layout(binding = 1) uniform sampler2D texSampler;
+#endif
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
+#ifdef VIRTUAL_TEXTURE
+    outColor = vec4(sampleVirtualTexture(fragTexCoord) * fragColor, 1.0);
+#else
     outColor = vec4(texture(texSampler, fragTexCoord).rgb * fragColor, 1.0);
+#endif
 }
\ No newline at end of file
@@ -1,21 +1,53 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#ifdef INDIRECT_DRAW
+#extension GL_ARB_shader_draw_parameters : require
+#endif
 
 layout(binding = 0) uniform UniformBufferObject {
     mat4 model;
 	mat4 view;
 	mat4 proj;
+	vec4 positionScale;		// 量子化した位置を戻す変換（xyz）
+	vec4 positionOffset;
+	vec4 texCoordTransform;	// 量子化したテクスチャ座標を戻す変換（xy: スケール、zw: オフセット）
 } ubo;
 
+// カリングして間接描画するときは INDIRECT_DRAW を定義してコンパイルする（vert_indirect.spv / vert_color_indirect.spv）
+// 全オブジェクトを1回で描くので、オブジェクトの model 行列は ubo.model ではなく描画コマンドごとの表から読む
+#ifdef INDIRECT_DRAW
+layout(std430, binding = 2) readonly buffer DrawModels {
+	mat4 drawModels[];
+};
+#endif
+
+// 頂点の形式は HelloTriangleApplication::GpuVertex に合わせる
+// 頂点カラーを持つ形式用には VERTEX_COLOR を定義してコンパイルする（vert_color.spv）
 layout(location = 0) in vec3 inPosition;
+#ifdef VERTEX_COLOR
 layout(location = 1) in vec3 inColor;
+#endif
 layout(location = 2) in vec2 inTexCoord;
 
+// インスタンス単位の頂点属性（mat4 はロケーション3～6を使う）
+// オブジェクト空間での配置で、ubo.model より先にかける
+layout(location = 3) in mat4 inInstanceModel;
+
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 
 void main() {
-    gl_Position = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+    vec3 position = inPosition * ubo.positionScale.xyz + ubo.positionOffset.xyz;
+#ifdef INDIRECT_DRAW
+	mat4 model = drawModels[gl_DrawIDARB];
+#else
+	mat4 model = ubo.model;
+#endif
+    gl_Position = ubo.proj * ubo.view * model * inInstanceModel * vec4(position, 1.0);
+#ifdef VERTEX_COLOR
     fragColor = inColor;
-	fragTexCoord = inTexCoord;
+#else
+    fragColor = vec3(1.0);
+#endif
+	fragTexCoord = inTexCoord * ubo.texCoordTransform.xy + ubo.texCoordTransform.zw;
 }
\ No newline at end of file